@@ -0,0 +1,234 @@
+#!/usr/bin/python
+#
+# bpfstacks - off-CPU, off-wake and context switch stacks of a container,
+#             filtered in kernel context.
+#
+# USAGE: bpfstacks.py [-c cgroupids] [-p pids] {offcpu,offwake,csw} seconds
+#
+# These are the bcc tools offcputime, offwaketime and stackcount (of the
+# sched:sched_switch tracepoint), with a filter that the bcc tools lack:
+# events are counted only for tasks in the given cgroups, by their unified
+# (v2) cgroup IDs (bpf_get_current_cgroup_id(), Linux 4.18+), or failing
+# that, in the given processes. The filter is checked before anything is
+# stored, so on a host of many containers, the events of the others cost
+# little more than the probe itself.
+#
+#	offcpu	time blocked, by the blocked task's stack, in microseconds
+#	offwake	the same, by the blocked and the waker stacks
+#	csw	context switches, by the stack of the task switched out
+#
+# Output is folded, as offcputime -df and offwaketime -f write it:
+#
+#	comm;user frames;-;kernel frames value
+#	comm;user;-;kernel;--;waker kernel;-;waker user;waker comm value
+#
+# Symbols are resolved as the tool exits, so JIT symbol maps must be in place
+# beforehand.
+#
+# The cgroup IDs are those of the container's cgroup and of all below it,
+# when the trace starts (see vectorhelper container), and the PIDs those of
+# its processes then.
+#
+# Copyright 2017 Netflix, Inc.
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+from __future__ import print_function
+from bcc import BPF
+from time import sleep
+import argparse
+import ctypes as ct
+import signal
+
+STACK_STORAGE = 16384
+
+parser = argparse.ArgumentParser(
+    description="Stacks of a container, filtered in kernel context")
+parser.add_argument("-c", "--cgroupids",
+    help="unified cgroup IDs to trace, comma separated")
+parser.add_argument("-p", "--pids",
+    help="process IDs to trace, comma separated")
+parser.add_argument("mode", choices=["offcpu", "offwake", "csw"])
+parser.add_argument("duration", type=int)
+args = parser.parse_args()
+
+bpf_text = """
+#include <uapi/linux/ptrace.h>
+#include <linux/sched.h>
+
+struct key_t {
+    u32 tgid;
+    int user_stack_id;
+    int kernel_stack_id;
+    char name[TASK_COMM_LEN];
+    u32 w_tgid;
+    int w_user_stack_id;
+    int w_kernel_stack_id;
+    char waker[TASK_COMM_LEN];
+};
+
+struct wokeby_t {
+    u32 tgid;
+    int user_stack_id;
+    int kernel_stack_id;
+    char name[TASK_COMM_LEN];
+};
+
+BPF_HASH(counts, struct key_t);
+BPF_HASH(start, u32);
+BPF_HASH(wokeby, u32, struct wokeby_t);
+BPF_HASH(cgroups, u64, u8);
+BPF_HASH(tgids, u32, u8);
+BPF_STACK_TRACE(stack_traces, STACK_STORAGE);
+
+/* is the current task in the container? */
+static inline int traced(void)
+{
+#ifdef FILTER_CGROUP
+    u64 id = bpf_get_current_cgroup_id();
+    if (cgroups.lookup(&id) == NULL)
+        return 0;
+#endif
+#ifdef FILTER_TGID
+    u32 tgid = bpf_get_current_pid_tgid() >> 32;
+    if (tgids.lookup(&tgid) == NULL)
+        return 0;
+#endif
+    return 1;
+}
+
+static inline void current_stacks(struct pt_regs *ctx, struct key_t *key)
+{
+    key->tgid = bpf_get_current_pid_tgid() >> 32;
+    key->user_stack_id = stack_traces.get_stackid(ctx, BPF_F_USER_STACK);
+    key->kernel_stack_id = stack_traces.get_stackid(ctx, 0);
+    bpf_get_current_comm(&key->name, sizeof (key->name));
+}
+
+/* the current task is switching out */
+int offcpu(struct pt_regs *ctx)
+{
+    u32 pid = bpf_get_current_pid_tgid();
+    u64 ts;
+
+    if (pid == 0 || !traced())
+        return 0;
+#ifdef MODE_CSW
+    struct key_t key = {};
+    current_stacks(ctx, &key);
+    counts.increment(key);
+#else
+    ts = bpf_ktime_get_ns();
+    start.update(&pid, &ts);
+#endif
+    return 0;
+}
+
+#ifdef MODE_OFFWAKE
+/* the current task wakes p, which is traced if it was blocked in it */
+int waker(struct pt_regs *ctx, struct task_struct *p)
+{
+    u32 pid = p->pid;
+    struct wokeby_t woke = {};
+
+    if (start.lookup(&pid) == NULL)
+        return 0;
+    woke.tgid = bpf_get_current_pid_tgid() >> 32;
+    woke.user_stack_id = stack_traces.get_stackid(ctx, BPF_F_USER_STACK);
+    woke.kernel_stack_id = stack_traces.get_stackid(ctx, 0);
+    bpf_get_current_comm(&woke.name, sizeof (woke.name));
+    wokeby.update(&pid, &woke);
+    return 0;
+}
+#endif
+
+/* the current task is back on-CPU */
+int oncpu(struct pt_regs *ctx)
+{
+    u32 pid = bpf_get_current_pid_tgid();
+    struct key_t key = {};
+    u64 *tsp, delta;
+
+    if ((tsp = start.lookup(&pid)) == NULL)
+        return 0;
+    delta = (bpf_ktime_get_ns() - *tsp) / 1000;
+    start.delete(&pid);
+    if (delta == 0)
+        return 0;
+    current_stacks(ctx, &key);
+#ifdef MODE_OFFWAKE
+    struct wokeby_t *woke = wokeby.lookup(&pid);
+    if (woke != NULL) {
+        key.w_tgid = woke->tgid;
+        key.w_user_stack_id = woke->user_stack_id;
+        key.w_kernel_stack_id = woke->kernel_stack_id;
+        __builtin_memcpy(&key.waker, woke->name, TASK_COMM_LEN);
+        wokeby.delete(&pid);
+    }
+#endif
+    counts.increment(key, delta);
+    return 0;
+}
+"""
+
+bpf_text = bpf_text.replace("STACK_STORAGE", str(STACK_STORAGE))
+defines = ["MODE_" + args.mode.upper()]
+if args.cgroupids:
+    defines.append("FILTER_CGROUP")
+if args.pids:
+    defines.append("FILTER_TGID")
+bpf_text = "".join("#define %s\n" % d for d in defines) + bpf_text
+
+b = BPF(text=bpf_text)
+if args.cgroupids:
+    for id in args.cgroupids.split(","):
+        b["cgroups"][ct.c_ulonglong(int(id))] = ct.c_ubyte(1)
+if args.pids:
+    for pid in args.pids.split(","):
+        b["tgids"][ct.c_uint(int(pid))] = ct.c_ubyte(1)
+
+# the current task is the one switching out at the tracepoint, and the one
+# switching in after the switch
+b.attach_tracepoint(tp="sched:sched_switch", fn_name="offcpu")
+if args.mode != "csw":
+    b.attach_kprobe(event_re=r"^finish_task_switch$|^finish_task_switch\.isra\.\d$",
+        fn_name="oncpu")
+if args.mode == "offwake":
+    b.attach_kprobe(event="try_to_wake_up", fn_name="waker")
+
+# as the bcc tools do, print what was traced on SIGINT (timeout -s 2)
+try:
+    sleep(args.duration)
+except KeyboardInterrupt:
+    signal.signal(signal.SIGINT, signal.SIG_IGN)
+
+stack_traces = b["stack_traces"]
+
+def frames(stack_id, tgid, user):
+    if stack_id < 0:
+        return []
+    if user:
+        return [b.sym(addr, tgid).decode("utf-8", "replace")
+            for addr in stack_traces.walk(stack_id)]
+    return [b.ksym(addr).decode("utf-8", "replace")
+        for addr in stack_traces.walk(stack_id)]
+
+for k, v in sorted(b["counts"].items(), key=lambda kv: kv[1].value):
+    # root to leaf: comm, user frames, kernel frames
+    line = [k.name.decode("utf-8", "replace")]
+    user = frames(k.user_stack_id, k.tgid, True)
+    kernel = frames(k.kernel_stack_id, k.tgid, False)
+    line.extend(reversed(user))
+    if user and kernel:
+        line.append("-")
+    line.extend(reversed(kernel))
+    if args.mode == "offwake":
+        # then leaf to root, for the waker
+        wuser = frames(k.w_user_stack_id, k.w_tgid, True)
+        wkernel = frames(k.w_kernel_stack_id, k.w_tgid, False)
+        line.append("--")
+        line.extend(wkernel)
+        if wuser and wkernel:
+            line.append("-")
+        line.extend(wuser)
+        line.append(k.waker.decode("utf-8", "replace") or "[unknown]")
+    print("%s %d" % (";".join(line), v.value))
@@ -0,0 +1,510 @@
+/*
+ * containers.c - resolution of a container name to its cgroup and PIDs.
+ *
+ * See containers.h. The Docker state files are JSON, of which only a few
+ * keys are needed, so they are found by a string search rather than parsed:
+ * "Name" and "ID" at the top level, and "Pid" within "State".
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "containers.h"
+#include "procs.h"
+#include "vfile.h"
+
+#define DOCKER_CONTAINERS	"/var/lib/docker/containers"
+#define DOCKER_CONFIG		"config.v2.json"
+#define CT_MINIDLEN		12	/* shortest container ID prefix */
+#define CT_MAXCONFIG		(16 << 20)
+
+/* where the perf_event (v1) and unified (v2) hierarchies are mounted */
+static void
+cgroup_mounts(char *v1, char *v2, size_t size)
+{
+	char line[4096], dir[1024], type[64], opts[1024], *o;
+	FILE *fp;
+
+	v1[0] = v2[0] = '\0';
+	if ((fp = fopen("/proc/self/mounts", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "%*s %1023s %63s %1023s", dir, type,
+		    opts) != 3)
+			continue;
+		if (strcmp(type, "cgroup2") == 0 && v2[0] == '\0') {
+			snprintf(v2, size, "%s", dir);
+		} else if (strcmp(type, "cgroup") == 0 && v1[0] == '\0') {
+			for (o = strtok(opts, ","); o != NULL;
+			    o = strtok(NULL, ",")) {
+				if (strcmp(o, "perf_event") == 0)
+					snprintf(v1, size, "%s", dir);
+			}
+		}
+	}
+	fclose(fp);
+}
+
+/* read a whole file into b; returns -1 if it can't be read */
+static int
+readfile(const char *path, vbuf_t *b)
+{
+	char buf[65536];
+	size_t n;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	while ((n = fread(buf, 1, sizeof (buf), fp)) > 0 &&
+	    b->len + n <= CT_MAXCONFIG)
+		vbuf_put(b, buf, n);
+	fclose(fp);
+	vbuf_put(b, "", 1);
+	return 0;
+}
+
+/* the string value of "key": in a JSON text, or NULL */
+static char *
+json_str(const char *text, const char *key, char *out, size_t size)
+{
+	const char *p = strstr(text, key);
+	size_t len = 0;
+
+	if (p == NULL)
+		return NULL;
+	for (p += strlen(key); isspace((unsigned char)*p); p++)
+		;
+	if (*p++ != '"')
+		return NULL;
+	while (*p != '\0' && *p != '"' && len < size - 1)
+		out[len++] = *p++;
+	out[len] = '\0';
+	return out;
+}
+
+/* find a Docker container by name or ID prefix */
+static int
+docker_find(const char *name, container_t *c, char *config, size_t size)
+{
+	char path[CT_PATHLEN], cname[256], *state, *pid;
+	struct dirent *de;
+	vbuf_t b;
+	DIR *dir;
+	int found = 0;
+
+	if ((dir = opendir(DOCKER_CONTAINERS)) == NULL)
+		return -1;
+	while (!found && (de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof (path), "%s/%s/%s", DOCKER_CONTAINERS,
+		    de->d_name, DOCKER_CONFIG);
+		memset(&b, 0, sizeof (b));
+		if (readfile(path, &b) != 0)
+			continue;
+		/* the name is "/name" */
+		if (json_str((char *)b.buf, "\"Name\":", cname,
+		    sizeof (cname)) != NULL &&
+		    strcmp(cname[0] == '/' ? cname + 1 : cname, name) == 0)
+			found = 1;
+		else if (strlen(name) >= CT_MINIDLEN &&
+		    strncmp(de->d_name, name, strlen(name)) == 0)
+			found = 1;
+		if (found) {
+			snprintf(c->id, sizeof (c->id), "%.64s", de->d_name);
+			snprintf(config, size, "%s", path);
+			state = strstr((char *)b.buf, "\"State\":");
+			if (state != NULL &&
+			    (pid = strstr(state, "\"Pid\":")) != NULL)
+				c->pid = atoi(pid + 6);
+		}
+		vbuf_free(&b);
+	}
+	closedir(dir);
+	return found ? 0 : -1;
+}
+
+/*
+ * The name of the container that a cgroup path is of, for a flame graph: its
+ * Docker name, or else its short ID. A container's cgroup is named with its
+ * 64 digit ID, by Docker (/docker/ID, or docker-ID.scope under systemd),
+ * containerd, CRI-O and Kubernetes alike, as are any cgroups below it.
+ * Returns -1 if the path is of no container.
+ */
+int
+container_name(const char *cgroup, char *name, size_t size)
+{
+	char path[CT_PATHLEN], cname[256];
+	const char *id;
+	size_t len;
+	vbuf_t b;
+
+	for (id = cgroup; *id != '\0'; id += len ? len : 1) {
+		for (len = 0; isxdigit((unsigned char)id[len]); len++)
+			;
+		if (len == 64)
+			break;
+	}
+	if (*id == '\0')
+		return -1;
+	snprintf(name, size, "%.*s", CT_MINIDLEN, id);
+	snprintf(path, sizeof (path), "%s/%.64s/%s", DOCKER_CONTAINERS, id,
+	    DOCKER_CONFIG);
+	memset(&b, 0, sizeof (b));
+	if (readfile(path, &b) != 0)
+		return 0;
+	/* the name is "/name" */
+	if (json_str((char *)b.buf, "\"Name\":", cname,
+	    sizeof (cname)) != NULL && cname[0] != '\0')
+		snprintf(name, size, "%s", cname[0] == '/' ? cname + 1 : cname);
+	vbuf_free(&b);
+	return 0;
+}
+
+/*
+ * find a container by ID in the processes' cgroups, as containerd and CRI-O
+ * name them (eg, cri-containerd-ID.scope): its init process is taken to be
+ * the lowest PID in the highest cgroup named with the ID.
+ */
+static int
+cgroup_find(const char *name, container_t *c)
+{
+	const procinfo_t *p, *best = NULL;
+	proctab_t t;
+	const char *id;
+	uint32_t i;
+	size_t len = strlen(name);
+
+	if (len < CT_MINIDLEN)
+		return -1;
+	for (i = 0; i < len; i++) {
+		if (!isxdigit((unsigned char)name[i]))
+			return -1;
+	}
+	proctab_init(&t);
+	proctab_scan(&t);
+	for (i = 0; i < t.count; i++) {
+		p = &t.procs[i];
+		if (p->cgroup == NULL || strstr(p->cgroup, name) == NULL)
+			continue;
+		if (best == NULL || strlen(p->cgroup) < strlen(best->cgroup))
+			best = p;
+	}
+	if (best != NULL) {
+		c->pid = best->pid;
+		/* the full ID, from the cgroup name */
+		id = strstr(best->cgroup, name);
+		for (i = 0; i < sizeof (c->id) - 1 &&
+		    isxdigit((unsigned char)id[i]); i++)
+			c->id[i] = id[i];
+		c->id[i] = '\0';
+	}
+	proctab_free(&t);
+	return best != NULL ? 0 : -1;
+}
+
+/* the cgroups of a container, from those of its init process */
+static int
+container_cgroups(container_t *c)
+{
+	char v1mnt[CT_PATHLEN], v2mnt[CT_PATHLEN], path[CT_PATHLEN];
+	char *v1 = NULL, *v2 = NULL;
+	struct stat st;
+
+	cgroup_mounts(v1mnt, v2mnt, sizeof (v1mnt));
+	if (proc_cgroups(c->pid, &v1, &v2) != 0) {
+		vh_warn("container process %d not found", c->pid);
+		return -1;
+	}
+	c->version = 0;
+	c->cgroupid = 0;
+	c->unified[0] = '\0';
+	if (v1 != NULL && v1mnt[0] != '\0') {
+		c->version = 1;
+		snprintf(c->cgroup, sizeof (c->cgroup), "%s", v1);
+		snprintf(c->dir, sizeof (c->dir), "%s%s", v1mnt, v1);
+	} else if (v2 != NULL && v2mnt[0] != '\0') {
+		c->version = 2;
+		snprintf(c->cgroup, sizeof (c->cgroup), "%s", v2);
+		snprintf(c->dir, sizeof (c->dir), "%s%s", v2mnt, v2);
+	}
+	/*
+	 * also on hybrid hosts, where v1 has the perf_event controller, but
+	 * not if the container is at the root of v2, as all of the host is
+	 */
+	if (v2 != NULL && v2mnt[0] != '\0' && strcmp(v2, "/") != 0) {
+		snprintf(path, sizeof (path), "%s%s", v2mnt, v2);
+		if (stat(path, &st) == 0) {
+			c->cgroupid = st.st_ino;
+			snprintf(c->unified, sizeof (c->unified), "%s", path);
+		}
+	}
+	free(v1);
+	free(v2);
+	if (c->version == 0 || stat(c->dir, &st) != 0 ||
+	    !S_ISDIR(st.st_mode)) {
+		vh_warn("container cgroup not found");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+cache_path(const char *name, char *path, size_t size)
+{
+	const char *dir = getenv("VECTOR_SYMCACHE");
+
+	if (dir == NULL || *dir == '\0' || strchr(name, '/') != NULL)
+		return -1;
+	snprintf(path, size, "%s/container-%s", dir, name);
+	return 0;
+}
+
+/* the mtime of a file, as text, or "-" */
+static void
+mtime(const char *path, char *buf, size_t size)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0) {
+		snprintf(buf, size, "-");
+		return;
+	}
+	snprintf(buf, size, "%jd.%09ld", (intmax_t)st.st_mtim.tv_sec,
+	    (long)st.st_mtim.tv_nsec);
+}
+
+/* read a cached container, if it is current */
+static int
+cache_read(const char *path, container_t *c)
+{
+	char buf[CT_PATHLEN], config[CT_PATHLEN], now[64];
+	uint64_t start;
+	vfile_t f;
+	int ok = 0;
+
+	if (access(path, R_OK) != 0 ||
+	    vf_open(&f, path, VF_KIND_CONTAINER) != 0)
+		return -1;
+	memset(c, 0, sizeof (*c));
+	if (vf_meta(&f, "config", config, sizeof (config)) == NULL) {
+		vf_close(&f);
+		return -1;
+	}
+	mtime(config, now, sizeof (now));
+	if (vf_meta(&f, "mtime", buf, sizeof (buf)) != NULL &&
+	    strcmp(buf, now) == 0 &&
+	    vf_meta(&f, "pid", buf, sizeof (buf)) != NULL &&
+	    (c->pid = atoi(buf)) > 0 &&
+	    vf_meta(&f, "start", buf, sizeof (buf)) != NULL &&
+	    proc_starttime(c->pid, &start) == 0 &&
+	    strtoull(buf, NULL, 10) == start &&
+	    vf_meta(&f, "id", c->id, sizeof (c->id)) != NULL &&
+	    vf_meta(&f, "version", buf, sizeof (buf)) != NULL &&
+	    (c->version = atoi(buf)) > 0 &&
+	    vf_meta(&f, "cgroup", c->cgroup, sizeof (c->cgroup)) != NULL &&
+	    vf_meta(&f, "dir", c->dir, sizeof (c->dir)) != NULL &&
+	    vf_meta(&f, "unified", c->unified, sizeof (c->unified)) != NULL &&
+	    vf_meta(&f, "cgroupid", buf, sizeof (buf)) != NULL) {
+		c->cgroupid = strtoull(buf, NULL, 10);
+		ok = 1;
+	}
+	vf_close(&f);
+	return ok ? 0 : -1;
+}
+
+static void
+cache_write(const char *path, const char *name, const char *config,
+    const container_t *c)
+{
+	char meta[5 * CT_PATHLEN + 512], now[64];
+	vfwriter_t vw;
+	uint64_t start;
+
+	if (proc_starttime(c->pid, &start) != 0)
+		return;
+	mtime(config, now, sizeof (now));
+	snprintf(meta, sizeof (meta), "name=%s\nid=%s\nconfig=%s\nmtime=%s\n"
+	    "pid=%d\nstart=%" PRIu64 "\nversion=%d\ncgroup=%s\ndir=%s\n"
+	    "unified=%s\ncgroupid=%" PRIu64 "\n", name, c->id, config, now,
+	    c->pid, start, c->version, c->cgroup, c->dir, c->unified,
+	    c->cgroupid);
+	vfw_init(&vw, VF_KIND_CONTAINER);
+	vbuf_put(vfw_section(&vw, VF_META, 0), meta, strlen(meta));
+	if (mkdir(getenv("VECTOR_SYMCACHE"), 0755) == 0 || errno == EEXIST)
+		vfw_write(&vw, path);
+	vfw_free(&vw);
+}
+
+/* resolve a container name, or ID; returns 0, or -1 with a warning */
+int
+container_resolve(container_t *c, const char *name)
+{
+	char path[CT_PATHLEN], config[CT_PATHLEN] = "-";
+	int cached;
+
+	cached = cache_path(name, path, sizeof (path)) == 0;
+	if (cached && cache_read(path, c) == 0)
+		return 0;
+
+	memset(c, 0, sizeof (*c));
+	if (docker_find(name, c, config, sizeof (config)) != 0 &&
+	    cgroup_find(name, c) != 0) {
+		vh_warn("container not found: %s", name);
+		return -1;
+	}
+	if (c->pid <= 0) {
+		vh_warn("container not running: %s", name);
+		return -1;
+	}
+	if (container_cgroups(c) != 0)
+		return -1;
+	if (cached)
+		cache_write(path, name, config, c);
+	return 0;
+}
+
+static void
+addpids(const char *dir, int **pids, uint32_t *count, uint32_t *alloc)
+{
+	char path[CT_PATHLEN], line[64];
+	struct dirent *de;
+	FILE *fp;
+	DIR *d;
+
+	snprintf(path, sizeof (path), "%s/cgroup.procs", dir);
+	if ((fp = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof (line), fp) != NULL) {
+			if (*count == *alloc) {
+				*alloc = *alloc ? *alloc * 2 : 256;
+				*pids = vh_realloc(*pids,
+				    *alloc * sizeof (int));
+			}
+			(*pids)[(*count)++] = atoi(line);
+		}
+		fclose(fp);
+	}
+	/* and the cgroups below */
+	if ((d = opendir(dir)) == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_type != DT_DIR || de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof (path), "%s/%s", dir, de->d_name);
+		addpids(path, pids, count, alloc);
+	}
+	closedir(d);
+}
+
+static int
+intcmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* the PIDs in a container's cgroups, sorted; the caller frees *pids */
+int
+container_pids(const container_t *c, int **pids, uint32_t *count)
+{
+	uint32_t alloc = 0;
+
+	*pids = NULL;
+	*count = 0;
+	addpids(c->dir, pids, count, &alloc);
+	qsort(*pids, *count, sizeof (int), intcmp);
+	return 0;
+}
+
+static void
+addids(const char *dir, uint64_t **ids, uint32_t *count, uint32_t *alloc)
+{
+	char path[CT_PATHLEN];
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+
+	if (stat(dir, &st) != 0)
+		return;
+	if (*count == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 64;
+		*ids = vh_realloc(*ids, *alloc * sizeof (uint64_t));
+	}
+	(*ids)[(*count)++] = st.st_ino;
+	if ((d = opendir(dir)) == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_type != DT_DIR || de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof (path), "%s/%s", dir, de->d_name);
+		addids(path, ids, count, alloc);
+	}
+	closedir(d);
+}
+
+/*
+ * The unified cgroup IDs of a container's cgroup and all below it, as
+ * bpf_get_current_cgroup_id() returns them for its tasks, which may be in
+ * any of them; none without a unified hierarchy. The caller frees *ids.
+ */
+int
+container_cgroupids(const container_t *c, uint64_t **ids, uint32_t *count)
+{
+	uint32_t alloc = 0;
+
+	*ids = NULL;
+	*count = 0;
+	if (c->unified[0] != '\0')
+		addids(c->unified, ids, count, &alloc);
+	return 0;
+}
+
+/*
+ * container name: resolve a container by name, or ID, and print its
+ * details as "key value" lines:
+ *
+ *	id ID
+ *	pid PID			init process
+ *	version 1|2		cgroup version
+ *	cgroup PATH		for perf record --cgroup
+ *	cgroupid ID		unified cgroup ID, for BPF, or 0
+ *	cgroupids ID ...	it and those below it, if any
+ *	pids PID ...		processes in the container
+ */
+int
+cmd_container(int argc, char **argv)
+{
+	container_t c;
+	uint32_t count, i;
+	uint64_t *ids;
+	int *pids;
+
+	if (argc != 2)
+		return 2;
+	if (container_resolve(&c, argv[1]) != 0)
+		return 1;
+	printf("id %s\npid %d\nversion %d\ncgroup %s\ncgroupid %" PRIu64
+	    "\ncgroupids", c.id, c.pid, c.version, c.cgroup, c.cgroupid);
+	container_cgroupids(&c, &ids, &count);
+	for (i = 0; i < count; i++)
+		printf(" %" PRIu64, ids[i]);
+	free(ids);
+	printf("\npids");
+	container_pids(&c, &pids, &count);
+	for (i = 0; i < count; i++)
+		printf(" %d", pids[i]);
+	putchar('\n');
+	free(pids);
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * containers.h - resolution of a container name to its cgroup and PIDs.
+ *
+ * Tasks are asked to profile a container by name ($PCP_CONTAINER_NAME). A
+ * container is resolved from the runtime's state files, without its CLI:
+ * for Docker, each /var/lib/docker/containers/ID/config.v2.json has the
+ * container's name and the PID of its init process, whose cgroups are read
+ * from /proc. A name that is no Docker container's, but is a hex container
+ * ID (or a prefix of at least 12 digits), as containerd and CRI-O name
+ * their cgroups, is found by a scan of the processes' cgroups instead.
+ *
+ * Both cgroup versions are supported. With cgroup v1, the container's
+ * cgroup is its perf_event cgroup, as perf record --cgroup takes; with v2,
+ * it is its unified cgroup, which perf also takes. Either way, cgroupid is
+ * the inode of its unified cgroup directory, if there is one: the cgroup
+ * ID that BPF programs see (bpf_get_current_cgroup_id()). The container's
+ * PIDs are read from cgroup.procs in its cgroup and all below it, and its
+ * cgroup IDs for BPF are those of its unified cgroup and all below it.
+ *
+ * The other way around, container_name() names the container that a cgroup
+ * is of, from the container ID in its path, for splitting a host profile.
+ *
+ * A resolved container is cached in the symbol cache (see symbols.h), as
+ * the entry "container-<name>" of kind VF_KIND_CONTAINER, with only a
+ * VF_META section:
+ *
+ *	name, id, config, mtime, pid, start, version, cgroup, dir, unified,
+ *	cgroupid
+ *
+ * It is used while the config file is unchanged (mtime, which Docker
+ * rewrites on each start) and its init process is the same (start time),
+ * and resolved again otherwise. The PIDs and the cgroup IDs below the
+ * container's own are never cached.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef CONTAINERS_H
+#define CONTAINERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CT_PATHLEN	1024
+
+typedef struct container {
+	char		id[65];
+	int		pid;		/* init process */
+	int		version;	/* cgroup version, 1 or 2 */
+	char		cgroup[CT_PATHLEN];	/* for perf --cgroup */
+	char		dir[CT_PATHLEN];	/* in the cgroup fs */
+	char		unified[CT_PATHLEN];	/* v2 dir, or "" */
+	uint64_t	cgroupid;	/* unified (v2) cgroup ID, or 0 */
+} container_t;
+
+int	container_resolve(container_t *, const char *name);
+int	container_pids(const container_t *, int **pids, uint32_t *count);
+int	container_name(const char *cgroup, char *name, size_t size);
+int	container_cgroupids(const container_t *, uint64_t **ids,
+	    uint32_t *count);
+
+#endif /* CONTAINERS_H */
@@ -2,7 +2,57 @@
 #
 # cpuflamegraph - a Vector pcp pmda for generating a CPU flame graph
 #
-# USAGE: cpuflamegraph [seconds]
+# USAGE: cpuflamegraph [seconds] [mode=perf|bpf] [hz=frequency] [last=minutes]
+#	 [stream] [lines [top=N]] [containers] [compare=PID|last]
+#	 cpuflamegraph range=t0-t1 [cpu=N] [pid=N] [tid=N] [cgroup=path]
+#
+# mode=perf (default) samples with perf record, and post-processes every
+# sample with perf script. mode=bpf uses the bcc profile tool, which counts
+# stacks in kernel context and only copies the aggregated counts to user
+# space at the end, so that high frequencies (eg, hz=997) can be used on
+# large systems without losing samples.
+#
+# In perf mode, stream decodes and folds the capture while it runs, rather
+# than writing perf.data and reading it back afterwards, so the flame graph
+# is ready seconds after profiling ends.
+#
+# lines attributes samples to source lines: each native leaf frame gets a
+# "file:line" frame below it, from the DWARF line table of its binary (or
+# its debuginfo package), so the hot loop of a large function can be seen.
+# The top N lines (default 50) are also written as a table, next to the SVG
+# as cpuflamegraph.<context>.lines.txt. It needs perf.data to be decoded
+# natively: perf mode, without stream.
+#
+# containers splits one host-wide profile by container: each container also
+# gets its own flame graph, cpuflamegraph.<context>.container.<name>.svg by
+# its Docker name or short ID, and the host's has each container's stacks
+# below a [name] frame. All cover the same seconds, from one capture rather
+# than one per container. perf record --all-cgroups (Linux 5.7) tags each
+# sample with its cgroup; before that, samples are placed by the cgroup of
+# their process when the profile is decoded, so processes that exited during
+# it are counted as the host's. It needs perf mode, without stream.
+#
+# In perf mode, the capture is shared with uninlinedcpuflamegraph and
+# pnamecpuflamegraph: a run that starts while one of theirs (or another of
+# this task's) samples the same way, for at least as long, uses that capture
+# rather than sampling again, and one decode writes all of their views (see
+# shared_capture in vectorlib.sh). Runs with stream, lines or containers,
+# which need their own capture or decode, do not share.
+#
+# last=N renders the last N minutes of the always-on continuous profile
+# immediately, without profiling (see vectord.sh; it must be enabled).
+#
+# Each run keeps its profile as perf.profile.<PID> in the working directory.
+# compare=PID renders this run as a differential flame graph against that
+# earlier run, or compare=last against the most recent: widths are this run,
+# red frames grew and blue shrank, with the earlier counts normalized to this
+# run's total.
+#
+# In perf mode, every sample is also kept in a sample store. range=t0-t1
+# renders a flame graph from the most recent store for that window only,
+# without profiling again: t0 and t1 are seconds from the start of the
+# capture (eg, range=20.5-25.5 for the 5 seconds around a latency spike), or
+# epoch seconds. The cpu=, pid=, tid= and cgroup= options filter further.
 #
 # The $PCP_CONTAINER_NAME environment variable will be read, and if it is
 # not NULL, a CPU flame graph will be generated for the container name it
@@ -33,11 +83,17 @@ PMDA_DIR=${0%/*}
 WEBSITE_DIR=/usr/share/pcp/webapps/$METRIC
 WORKING_DIR=/var/log/pcp/vector/$METRIC
 FG_DIR=/var/lib/pcp/pmdas/vector/BINFlameGraph
+BCC_DIR=/usr/share/bcc/tools
 OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
 OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
 OUT_FOLDED=$WORKING_DIR/perf.folded.$$
+OUT_SAMPLES=$WORKING_DIR/perf.samples.$$
 PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
-CGROUPFS=/sys/fs/cgroup
+OUT_LINES=$WORKING_DIR/perf.lines.$$
+OUT_TABLE=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.lines.txt
+OUT_SPLIT=$WORKING_DIR/perf.containers.$$
+SPLIT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.container	# .<name>.svg
+CONT_DIR=/var/log/pcp/vector/continuous
 
 # libraries
 . $PMDA_DIR/vectorlib.sh
@@ -47,8 +103,13 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-60}		# default to 60 seconds if not sepcified
-HERTZ=49
+parseargs "$@"
+SECS=${ARG_SECS:-60}		# default to 60 seconds if not sepcified
+HERTZ=${OPT_hz:-49}
+MODE=${OPT_mode:-perf}
+TOP=${OPT_top:-50}		# lines option: rows of the hot lines table
+STACK_STORAGE=65536	# bpf mode: unique stack limit, sized for many CPUs
+PERF_SCRIPT_OPTS="-F comm,pid,tid,cpu,time,event,ip,sym,dso"
 
 #
 # Ensure output directories exist
@@ -56,12 +117,87 @@ HERTZ=49
 [ ! -d "$WORKING_DIR" ] && mkdir -p $WORKING_DIR
 [ ! -d "$WEBSITE_DIR" ] && mkdir -p $WEBSITE_DIR
 [ -d "$WEBSITE_DIR" -a -e "$OUT_SVG" ] && rm $OUT_SVG
+[ -e "$OUT_TABLE" ] && rm $OUT_TABLE
+rm -f $SPLIT_SVG.*.svg
 [ -d "$FG_DIR" ] || errorexit "Flame graph software missing"
+[[ "$HERTZ" =~ ^[0-9]+$ ]] || errorexit "Bad hz option: $HERTZ"
+[[ "$MODE" == perf || "$MODE" == bpf ]] || errorexit "Unknown mode: $MODE"
+[[ "$TOP" =~ ^[0-9]+$ ]] || errorexit "Bad top option: $TOP"
+if (( OPT_lines )); then
+	# line tables are read by vectorhelper decode, from perf.data
+	[[ "$MODE" == perf ]] && (( ! OPT_stream && NATIVE_DECODE )) ||
+	    errorexit "Source lines need native decoding (mode=perf, no stream)"
+fi
+if (( OPT_containers )); then
+	# containers are split by vectorhelper decode, from perf.data
+	[[ "$MODE" == perf ]] && (( ! OPT_stream && NATIVE_DECODE )) ||
+	    errorexit "Container split needs native decoding (mode=perf, no stream)"
+	[[ "$PCP_CONTAINER_NAME" == "" ]] ||
+	    errorexit "Container split is of the whole host, not one container"
+fi
 
 # terminator for new log group:
 echo >&2
 
+if [[ "$MODE" == bpf ]]; then
+	if ! $VECTOR_HELPER ksym bpf_get_stackid 2>/dev/null; then
+		# check for the capability rather than the kernel version,
+		# because it may have been backported.
+		errorexit "BPF stacks not available on this kernel version (see help)"
+	fi
+	if [ ! -e $BCC_DIR/profile ]; then
+		errorexit "bcc/BPF tool profile not installed ($BCC_DIR)"
+	fi
+fi
+
 debugtime "$0 start, container=$PCP_CONTAINER_NAME"
+
+#
+# Continuous profile: render the last N minutes, which are already captured
+#
+if [[ "$OPT_last" != "" ]]; then
+	[[ "$OPT_last" =~ ^[0-9]+$ ]] || errorexit "Bad last option: $OPT_last"
+	[[ "$PCP_CONTAINER_NAME" != "" ]] && errorexit "Continuous profiles are host-wide only"
+	minutes=$(ls -1 $CONT_DIR/*.profile 2>/dev/null | sort | tail -n $OPT_last)
+	[[ "$minutes" == "" ]] && errorexit "No continuous profiles (enable in vectord.sh)"
+	first=${minutes%%.profile*}
+	first=$(date -d @${first##*/} +%T)
+	statusmsg "Merging continuous profiles"
+	$VECTOR_HELPER merge $minutes | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED
+	if have_procs node; then
+		color=js
+	else
+		color=java
+	fi
+	fgtitle="CPU Flame Graph (no idle): $HOSTNAME, $OPT_last minutes from $first"
+	statusmsg "Flame Graph generation"
+	$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" < $OUT_FOLDED > $OUT_SVG
+	keep_profile
+	statusmsg "DONE"
+	exit 0
+fi
+
+#
+# Range query: render a window of the last capture, from its sample store
+#
+if [[ "$OPT_range" != "" ]]; then
+	statusmsg "Querying samples"
+	range_query > $OUT_FOLDED.range
+	egrep -v 'cpu_idle|cpuidle_enter' $OUT_FOLDED.range > $OUT_FOLDED
+	rm $OUT_FOLDED.range
+	if have_procs node; then
+		color=js
+	else
+		color=java
+	fi
+	fgtitle="CPU Flame Graph (no idle): $HOSTNAME, range $OPT_range"
+	statusmsg "Flame Graph generation"
+	$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" < $OUT_FOLDED > $OUT_SVG
+	keep_profile
+	statusmsg "DONE"
+	exit 0
+fi
+
 statusmsg "Profiling for $SECS seconds"
 
 #
@@ -71,48 +207,100 @@ if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
 	#
 	# Set $cgroupfilter for perf record, and $tasklist of container PIDs.
 	#
-	# The code below assumes that $PCP_CONTAINER_NAME is a Docker container
-	# name, and so uses the docker command and cgroup v1 paths in
-	# /sys/fs/cgroup. This code will need modifications for different
-	# container software, and for cgroup v2.
+	# $PCP_CONTAINER_NAME is a Docker container name, or a container ID,
+	# resolved by vectorhelper under cgroup v1 or v2 (see vectorlib.sh).
 	#
-	UUID=$(docker inspect --format='{{ .Id }}' $PCP_CONTAINER_NAME)
-	[[ "$UUID" == "" ]] && errorexit "Container not found"
-	pid=$(docker inspect --format='{{ .State.Pid }}' $UUID)
-	cgroup=$(awk -F: '$2 == "perf_event" { print $3; exit }' /proc/$pid/cgroup)
-	[ ! -e $CGROUPFS/perf_event/$cgroup ] && errorexit "Container cgroup not found"
+	container_resolve $PCP_CONTAINER_NAME
 	cgroupfilter="-e cpu-clock --cgroup=$cgroup"
-	tasklist=$(cat $CGROUPFS/perf_event/$cgroup/tasks)
 	fgtitle="CPU Flame Graph (no idle): $PCP_CONTAINER_NAME, $TS"
+	if [[ "$MODE" == bpf ]]; then
+		# profile can only filter cgroups via a pinned BPF map
+		debugtime "bpf mode not container aware, using perf mode"
+		MODE=perf
+	fi
 else
 	cgroupfilter=""
 	tasklist=""
 	fgtitle="CPU Flame Graph (no idle): $HOSTNAME, $TS"
 fi
+if (( OPT_containers )); then
+	# tag samples with their cgroup, where perf can (Linux 5.7)
+	perf record -h 2>&1 | grep -q -- --all-cgroups &&
+	    cgroupfilter="--all-cgroups"
+	fgtitle="${fgtitle/CPU Flame Graph/CPU Flame Graph by container}"
+fi
+shared=0
+if [[ "$MODE" == perf ]] && (( SHARED_CAPTURE && NATIVE_DECODE )) &&
+    (( ! OPT_stream && ! OPT_lines && ! OPT_containers )); then
+	shared=1
+fi
+
+# perf mode: fold as stackcollapse-perf.pl --all does, and keep the samples
+# for range queries. perf_capture times them with CLOCK_MONOTONIC.
+function foldstacks {
+	$VECTOR_HELPER collapse -a -k mono -s $OUT_SAMPLES | \
+	    egrep -v 'cpu_idle|cpuidle_enter'
+}
+function decodestacks {
+	local lineopts="" splitopts=""
+	(( OPT_lines )) && lineopts="-i -L $OUT_LINES"
+	(( OPT_containers )) && splitopts="-c $OUT_SPLIT"
+	$VECTOR_HELPER decode -a $lineopts $splitopts -s $OUT_SAMPLES $PERF_DATA | \
+	    egrep -v 'cpu_idle|cpuidle_enter'
+}
 
 #
 # Profile
 #
-perf record -o $PERF_DATA -F $HERTZ -a $cgroupfilter -g sleep $SECS >/dev/null &
+if [[ "$MODE" == bpf ]] || (( OPT_stream )); then
+	# profile translates symbols as it exits, and streamed perf script as
+	# samples arrive, so JIT symbol maps must be in place beforehand.
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+	statusmsg "Profiling for $SECS seconds"
+fi
+if [[ "$MODE" == bpf ]]; then
+	${BCC_DIR}/profile -af -F $HERTZ --stack-storage-size=$STACK_STORAGE \
+	    $SECS > $OUT_FOLDED.bpf &
+	bgpid=$!
+elif (( shared )); then
+	shared_capture cpu -F $HERTZ -a $cgroupfilter -g
+else
+	perf_capture -F $HERTZ -a $cgroupfilter -g
+fi
 s=0
 # update status message
 while (( s < SECS )); do
-	sleep 5
+	# give perf or bcc a chance to error before doing a kill -0 check:
+	sleep 1
+	kill -0 $bgpid > /dev/null 2>&1 || break
+	sleep 4
 	(( s += 5 ))
 	statusmsg "Profiling for $SECS seconds ($s/$SECS)" 2>/dev/null
 done
-wait
+if (( shared )); then
+	shared_wait
+else
+	wait -n
+	status=$?
+fi
+if [[ "$MODE" == bpf ]]; then
+	(( status == 0 )) || errorexit "BPF instrumentation failed. Old kernel version? (See help.)"
+fi
 
 # lower our priority before flame graph generation, to reduce CPU contention:
 renice -n 19 -p $$ &>/dev/null
 
 # prepare symbol maps
-statusmsg "Collecting symbol maps"
-dump_java_maps $tasklist
-fix_node_maps $tasklist
+if [[ "$MODE" == perf ]] && (( ! OPT_stream && ! shared )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+fi
 
 # decide upon a palette
-if pgrep -x node >/dev/null; then
+if have_procs node; then
 	color=js
 else
 	color=java
@@ -120,17 +308,55 @@ fi
 
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Processing profile"
-timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED
+if [[ "$MODE" == bpf ]]; then
+	# already folded, with kernel frames annotated like stackcollapse-perf.pl --all
+	egrep -v 'cpu_idle|cpuidle_enter' $OUT_FOLDED.bpf > $OUT_FOLDED
+	rm $OUT_FOLDED.bpf
+elif (( shared )); then
+	# maps are collected for, and stacks decoded with, the other views
+	shared_fold cpu $OUT_FOLDED.shared $OUT_SAMPLES
+	egrep -v 'cpu_idle|cpuidle_enter' $OUT_FOLDED.shared > $OUT_FOLDED
+	rm $OUT_FOLDED.shared
+	ln -sf ${OUT_SAMPLES##*/} $WORKING_DIR/${METRIC}.${PCP_CONTEXT}.samples
+else
+	perf_fold
+	[ -e $OUT_SAMPLES ] && ln -sf ${OUT_SAMPLES##*/} $WORKING_DIR/${METRIC}.${PCP_CONTEXT}.samples
+	if [ -e $OUT_LINES ]; then
+		head -n $(( TOP + 1 )) $OUT_LINES > $OUT_TABLE
+		rm $OUT_LINES
+		fgtitle="${fgtitle/CPU Flame Graph/CPU Flame Graph by source line}"
+	fi
+fi
 statusmsg "Flame Graph generation"
-$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" < $OUT_FOLDED > $OUT_SVG
+if [[ "$OPT_compare" != "" ]]; then
+	# differential: widths are this run, red == more than before
+	before=$(compare_profile) || exit 1
+	$VECTOR_HELPER diff -n $before $OUT_FOLDED > $OUT_FOLDED.diff
+	$FG_DIR/flamegraph.pl --minwidth=0.5 --hash --title="Differential $fgtitle" --subtitle="compared with ${before##*/}; red == more, blue == less" < $OUT_FOLDED.diff > $OUT_SVG
+	rm $OUT_FOLDED.diff
+else
+	$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" < $OUT_FOLDED > $OUT_SVG
+fi
+if [ -d "$OUT_SPLIT" ]; then
+	# one flame graph per container, of the same capture
+	for folded in $OUT_SPLIT/*; do
+		[ -e "$folded" ] || continue
+		name=${folded##*/}
+		egrep -v 'cpu_idle|cpuidle_enter' $folded | $FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="CPU Flame Graph (no idle): $name on $HOSTNAME, $TS" > $SPLIT_SVG.$name.svg
+	done
+	rm -r $OUT_SPLIT
+fi
+
+# keep the profile in the compact binary format
+keep_profile
 
 # send to s3
 # statusmsg "s3 archive"
 # s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
-# s3cp $OUT_FOLDED $S3BUCKET/${METRIC}-$TS.folded >/dev/null &
+# s3cp ${OUT_FOLDED/perf.folded/perf.profile} $S3BUCKET/${METRIC}-$TS.profile >/dev/null &
 
 statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
-# $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# $PERF_DATA file left behind for debug or custom reports, unless streamed
+# (retention in vectord.sh compresses it, and removes old output)
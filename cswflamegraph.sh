@@ -38,6 +38,7 @@ BCC_DIR=/usr/share/bcc/tools
 OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
 OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
 OUT_STACKS=$WORKING_DIR/bcc.stacks.$$
+OUT_FOLDED=$WORKING_DIR/perf.folded.$$
 CGROUPFS=/sys/fs/cgroup
 
 # libraries
@@ -48,7 +49,8 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-10}		# default to 10 seconds if not sepcified
+parseargs "$@"
+SECS=${ARG_SECS:-10}		# default to 10 seconds if not sepcified
 
 #
 # Ensure output directories exist
@@ -61,7 +63,7 @@ SECS=${1:-10}		# default to 10 seconds if not sepcified
 # terminator for new log group:
 echo >&2
 
-if ! grep -w bpf_get_stackid /proc/kallsyms > /dev/null 2>&1; then
+if ! $VECTOR_HELPER ksym bpf_get_stackid 2>/dev/null; then
 	# check for the capability rather than the kernel version, because it
 	# may have been backported.
 	errorexit "BPF stacks not available on this kernel version (see help)"
@@ -71,18 +73,39 @@ if [ ! -e $BCC_DIR/stackcount ]; then
 fi
 
 debugtime "$0 start, container=$PCP_CONTAINER_NAME"
-statusmsg "Tracing for $SECS seconds"
 
-# XXX make container aware when bcc tool supports it
-cgroupfilter=""
-tasklist=""
-fgtitle="Context Switch Flame Graph (no idle): $HOSTNAME, $TS"
+if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
+	#
+	# stackcount traces the whole host. bpfstacks.py traces the same
+	# event, but counts only the container's tasks, filtered in kernel
+	# context by cgroup ID or PID (see container_bpffilter), and writes
+	# folded stacks.
+	#
+	container_resolve $PCP_CONTAINER_NAME
+	container_bpffilter
+	tracer="$PMDA_DIR/bpfstacks.py $cgroupfilter csw $SECS"
+	collapse=cat
+	fgtitle="Context Switch Flame Graph (no idle): $PCP_CONTAINER_NAME, $TS"
+else
+	cgroupfilter=""
+	tasklist=""
+	# XXX support older version of stackcount that lacks -d and -f:
+	tracer="timeout -s 2 $SECS ${BCC_DIR}/stackcount t:sched:sched_switch"
+	collapse=$FG_DIR/stackcollapse.pl
+	fgtitle="Context Switch Flame Graph (no idle): $HOSTNAME, $TS"
+fi
+
+# symbols are translated as the tracer exits, so JIT symbol maps must be in
+# place beforehand.
+statusmsg "Collecting symbol maps"
+dump_java_maps $tasklist
+fix_node_maps $tasklist
 
 #
 # Trace
 #
-# XXX support older version of stackcount that lacks -d and -f:
-timeout -s 2 $SECS ${BCC_DIR}/stackcount t:sched:sched_switch > $OUT_STACKS &
+statusmsg "Tracing for $SECS seconds"
+$tracer > $OUT_STACKS &
 bgpid=$!
 s=0
 # update status message
@@ -101,13 +124,8 @@ status=$?
 # lower our priority before flame graph generation, to reduce CPU contention:
 renice -n 19 -p $$ &>/dev/null
 
-# prepare symbol maps
-statusmsg "Collecting symbol maps"
-dump_java_maps $tasklist
-fix_node_maps $tasklist
-
 # decide upon a palette
-if pgrep -x node >/dev/null; then
+if have_procs node; then
 	color=js
 else
 	color=java
@@ -115,16 +133,20 @@ fi
 
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Flame Graph generation"
-$FG_DIR/stackcollapse.pl < $OUT_STACKS | egrep -v 'cpu_idle|cpuidle_enter' | \
-    $FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" --countname=events > $OUT_SVG
+$collapse < $OUT_STACKS | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED
+$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" --countname=events < $OUT_FOLDED > $OUT_SVG
+rm $OUT_STACKS
+
+# keep the profile in the compact binary format
+keep_profile events
 
 # send to s3
 # statusmsg "s3 archive"
 # s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
-# s3cp $OUT_STACKS $S3BUCKET/${METRIC}-$TS.stacks >/dev/null &
+# s3cp ${OUT_FOLDED/perf.folded/perf.profile} $S3BUCKET/${METRIC}-$TS.profile >/dev/null &
 
 statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
 # $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# (retention in vectord.sh compresses it, and removes old output)
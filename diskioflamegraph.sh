@@ -3,7 +3,22 @@
 # diskioflamegraph - a Vector pcp pmda for generating a disk I/O flame
 #		     graph, for the analysis of disk I/O code paths.
 #
-# USAGE: diskioflamegraph [seconds]
+# USAGE: diskioflamegraph [seconds] [stream]
+#
+# stream decodes the capture while it runs, rather than writing perf.data and
+# reading it back afterwards, so the flame graph is ready sooner.
+#
+# Unless streamed, I/O is traced as it is issued to the device, with stacks,
+# and to its completion, and the one trace renders three SVGs:
+#
+#	diskioflamegraph.<context>.svg		stacks by I/O count
+#	diskioflamegraph.<context>.latency.svg	stacks by total I/O time
+#	diskioflamegraph.<context>.heatmap.svg	latency heat map
+#
+# The latency flame graph shows the code paths of the slow I/O. A
+# disklatencyheatmap run at the same time shares the trace (see
+# blkio_capture in vectorlib.sh). When streamed, I/O is traced as it is
+# queued (block_rq_insert), for the I/O count flame graph only.
 #
 # The $PCP_CONTAINER_NAME environment variable will be read, and if it is
 # not NULL, a CPU flame graph will be generated for the container name it
@@ -34,11 +49,15 @@ PMDA_DIR=${0%/*}
 WEBSITE_DIR=/usr/share/pcp/webapps/$METRIC
 WORKING_DIR=/var/log/pcp/vector/$METRIC
 FG_DIR=/var/lib/pcp/pmdas/vector/BINFlameGraph
+HM_DIR=/var/lib/pcp/pmdas/vector/BINHeatMap
 OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
+LAT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.latency.svg
+HEAT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.heatmap.svg
 OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
 OUT_FOLDED=$WORKING_DIR/perf.folded.$$
+OUT_TIME=$WORKING_DIR/perf.time.$$
+OUT_LAT=$WORKING_DIR/perf.lat.$$
 PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
-CGROUPFS=/sys/fs/cgroup
 
 # libraries
 . $PMDA_DIR/vectorlib.sh
@@ -48,7 +67,8 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-60}		# default to 60 seconds if not sepcified
+parseargs "$@"
+SECS=${ARG_SECS:-60}		# default to 60 seconds if not sepcified
 HERTZ=49
 
 #
@@ -57,7 +77,10 @@ HERTZ=49
 [ ! -d "$WORKING_DIR" ] && mkdir -p $WORKING_DIR
 [ ! -d "$WEBSITE_DIR" ] && mkdir -p $WEBSITE_DIR
 [ -d "$WEBSITE_DIR" -a -e "$OUT_SVG" ] && rm $OUT_SVG
+rm -f $LAT_SVG $HEAT_SVG
 [ -d "$FG_DIR" ] || errorexit "Flame graph software missing"
+# issues are timed to their completions by vectorhelper decode, from perf.data
+(( NATIVE_DECODE && ! OPT_stream )) && fused=1 || fused=0
 
 # terminator for new log group:
 echo >&2
@@ -72,48 +95,72 @@ if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
 	#
 	# Set $cgroupfilter for perf record, and $tasklist of container PIDs.
 	#
-	# The code below assumes that $PCP_CONTAINER_NAME is a Docker container
-	# name, and so uses the docker command and cgroup v1 paths in
-	# /sys/fs/cgroup. This code will need modifications for different
-	# container software, and for cgroup v2.
+	# $PCP_CONTAINER_NAME is a Docker container name, or a container ID,
+	# resolved by vectorhelper under cgroup v1 or v2 (see vectorlib.sh).
 	#
-	UUID=$(docker inspect --format='{{ .Id }}' $PCP_CONTAINER_NAME)
-	[[ "$UUID" == "" ]] && errorexit "Container not found"
-	pid=$(docker inspect --format='{{ .State.Pid }}' $UUID)
-	cgroup=$(awk -F: '$2 == "perf_event" { print $3; exit }' /proc/$pid/cgroup)
-	[ ! -e $CGROUPFS/perf_event/$cgroup ] && errorexit "Container cgroup not found"
+	container_resolve $PCP_CONTAINER_NAME
 	cgroupfilter="--cgroup=$cgroup"
-	tasklist=$(cat $CGROUPFS/perf_event/$cgroup/tasks)
 	fgtitle="Disk I/O Flame Graph: $PCP_CONTAINER_NAME, $TS"
+	hmtitle="Disk I/O Latency Heat Map: $PCP_CONTAINER_NAME, $TS"
 else
 	cgroupfilter=""
 	tasklist=""
 	fgtitle="Disk I/O Flame Graph: $HOSTNAME, $TS"
+	hmtitle="Disk I/O Latency Heat Map: $HOSTNAME, $TS"
+fi
+
+# fold perf script output, for perf_capture and perf_fold
+function foldstacks {
+	$FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter'
+}
+
+# fold $PERF_DATA natively, for perf_fold
+function decodestacks {
+	$VECTOR_HELPER decode -a -m $DECODE_MINPCT $PERF_DATA | egrep -v 'cpu_idle|cpuidle_enter'
+}
+
+# when streaming, samples are symbolized as they arrive, so collect maps first
+if (( OPT_stream )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+	statusmsg "Tracing for $SECS seconds"
 fi
 
 #
 # Profile
 #
-perf record -o $PERF_DATA -e block:block_rq_insert -a $cgroupfilter -g sleep $SECS >/dev/null &
+if (( fused )); then
+	blkio_capture diskio $cgroup
+else
+	perf_capture -e block:block_rq_insert -a $cgroupfilter -g
+fi
 s=0
 # update status message
 while (( s < SECS )); do
 	sleep 5
+	kill -0 $bgpid > /dev/null 2>&1 || break
 	(( s += 5 ))
 	statusmsg "Tracing for $SECS seconds ($s/$SECS)" 2>/dev/null
 done
-wait
+if (( fused )); then
+	shared_wait
+else
+	wait
+fi
 
 # lower our priority before flame graph generation, to reduce CPU contention:
 renice -n 19 -p $$ &>/dev/null
 
 # prepare symbol maps
-statusmsg "Collecting symbol maps"
-dump_java_maps $tasklist
-fix_node_maps $tasklist
+if (( ! OPT_stream && ! fused )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+fi
 
 # decide upon a palette
-if pgrep -x node >/dev/null; then
+if have_procs node; then
 	color=js
 else
 	color=java
@@ -121,17 +168,31 @@ fi
 
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Processing profile"
-timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED
+if (( fused )); then
+	blkio_fold $OUT_FOLDED $OUT_TIME $OUT_LAT
+else
+	perf_fold
+fi
 statusmsg "Flame Graph generation"
 $FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" --countname="I/O" < $OUT_FOLDED > $OUT_SVG
+if (( fused )); then
+	# the same stacks by I/O time, and the latency of every I/O
+	$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="${fgtitle/Flame Graph/Latency Flame Graph}" --countname=us < $OUT_TIME > $LAT_SVG
+	statusmsg "Heat Map generation"
+	[ -s $OUT_LAT ] && $HM_DIR/trace2heatmap.pl --unitstime=us --unitslat=us --grid --maxlat=100000 --title="$hmtitle" $OUT_LAT > $HEAT_SVG
+	rm -f $OUT_TIME $OUT_LAT
+fi
+
+# keep the profile in the compact binary format
+keep_profile
 
 # send to s3
 # statusmsg "s3 archive"
 # s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
-# s3cp $OUT_FOLDED $S3BUCKET/${METRIC}-$TS.folded >/dev/null &
+# s3cp ${OUT_FOLDED/perf.folded/perf.profile} $S3BUCKET/${METRIC}-$TS.profile >/dev/null &
 
 statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
-# $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# $PERF_DATA file left behind for debug or custom reports, unless streamed
+# (retention in vectord.sh compresses it, and removes old output)
@@ -0,0 +1,1458 @@
+/*
+ * dwarf.c - inlined function calls and source lines, from DWARF debug
+ * information.
+ *
+ * See dwarf.h. Only what inline chains need is read from .debug_info: the
+ * address ranges of DW_TAG_inlined_subroutine entries, and the names of the
+ * functions they refer to (DW_AT_abstract_origin), which are demangled as
+ * symbol names are. Line tables are read by running the line number
+ * programs of .debug_line, which do not depend on .debug_info. DWARF
+ * versions 2 to 5 are read, in the 32-bit and 64-bit formats. Compressed
+ * sections, split DWARF (.dwo) and type units are not, and an object with
+ * only those has empty tables.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vectorhelper.h"
+#include "dwarf.h"
+
+/* tags, attributes and forms that are read; see the DWARF 5 standard */
+#define DW_TAG_inlined_subroutine	0x1d
+#define DW_TAG_compile_unit		0x11
+#define DW_TAG_partial_unit		0x3c
+
+#define DW_AT_name			0x03
+#define DW_AT_low_pc			0x11
+#define DW_AT_high_pc			0x12
+#define DW_AT_abstract_origin		0x31
+#define DW_AT_specification		0x47
+#define DW_AT_ranges			0x55
+#define DW_AT_linkage_name		0x6e
+#define DW_AT_str_offsets_base		0x72
+#define DW_AT_addr_base			0x73
+#define DW_AT_rnglists_base		0x74
+#define DW_AT_MIPS_linkage_name		0x2007
+
+#define DW_FORM_addr			0x01
+#define DW_FORM_block2			0x03
+#define DW_FORM_block4			0x04
+#define DW_FORM_data2			0x05
+#define DW_FORM_data4			0x06
+#define DW_FORM_data8			0x07
+#define DW_FORM_string			0x08
+#define DW_FORM_block			0x09
+#define DW_FORM_block1			0x0a
+#define DW_FORM_data1			0x0b
+#define DW_FORM_flag			0x0c
+#define DW_FORM_sdata			0x0d
+#define DW_FORM_strp			0x0e
+#define DW_FORM_udata			0x0f
+#define DW_FORM_ref_addr		0x10
+#define DW_FORM_ref1			0x11
+#define DW_FORM_ref2			0x12
+#define DW_FORM_ref4			0x13
+#define DW_FORM_ref8			0x14
+#define DW_FORM_ref_udata		0x15
+#define DW_FORM_indirect		0x16
+#define DW_FORM_sec_offset		0x17
+#define DW_FORM_exprloc			0x18
+#define DW_FORM_flag_present		0x19
+#define DW_FORM_strx			0x1a
+#define DW_FORM_addrx			0x1b
+#define DW_FORM_ref_sup4		0x1c
+#define DW_FORM_strp_sup		0x1d
+#define DW_FORM_data16			0x1e
+#define DW_FORM_line_strp		0x1f
+#define DW_FORM_ref_sig8		0x20
+#define DW_FORM_implicit_const		0x21
+#define DW_FORM_loclistx		0x22
+#define DW_FORM_rnglistx		0x23
+#define DW_FORM_ref_sup8		0x24
+#define DW_FORM_strx1			0x25
+#define DW_FORM_strx2			0x26
+#define DW_FORM_strx3			0x27
+#define DW_FORM_strx4			0x28
+#define DW_FORM_addrx1			0x29
+#define DW_FORM_addrx2			0x2a
+#define DW_FORM_addrx3			0x2b
+#define DW_FORM_addrx4			0x2c
+#define DW_FORM_GNU_addr_index		0x1f01
+#define DW_FORM_GNU_str_index		0x1f02
+#define DW_FORM_GNU_ref_alt		0x1f20
+#define DW_FORM_GNU_strp_alt		0x1f21
+
+#define DW_UT_compile			0x01
+#define DW_UT_partial			0x03
+
+#define DW_RLE_end_of_list		0x00
+#define DW_RLE_base_addressx		0x01
+#define DW_RLE_startx_endx		0x02
+#define DW_RLE_startx_length		0x03
+#define DW_RLE_offset_pair		0x04
+#define DW_RLE_base_address		0x05
+#define DW_RLE_start_end		0x06
+#define DW_RLE_start_length		0x07
+
+#define DW_LNS_copy			0x01
+#define DW_LNS_advance_pc		0x02
+#define DW_LNS_advance_line		0x03
+#define DW_LNS_set_file			0x04
+#define DW_LNS_const_add_pc		0x08
+#define DW_LNS_fixed_advance_pc		0x09
+
+#define DW_LNE_end_sequence		0x01
+#define DW_LNE_set_address		0x02
+
+#define DW_LNCT_path			0x01
+
+/* from libstdc++, as for symbol names */
+extern char *__cxa_demangle(const char *, char *, size_t *, int *);
+
+#define MAXNEST		256		/* DIE tree depth that is followed */
+#define MAXORIGIN	8		/* abstract_origin links followed */
+
+/*
+ * Inline tables
+ */
+
+void
+inltab_init(inltab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+	strtab_init(&t->names);
+}
+
+void
+inltab_free(inltab_t *t)
+{
+	if (t->mapped)
+		vf_close(&t->f);
+	else
+		free(t->inls);
+	strtab_free(&t->names);
+	memset(t, 0, sizeof (*t));
+}
+
+/* until the table is finished, parent is the inline depth of the range */
+static void
+inltab_add(inltab_t *t, uint64_t lo, uint64_t hi, uint32_t name,
+    uint32_t depth)
+{
+	if (lo >= hi)
+		return;
+	if (t->count == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 1024;
+		t->inls = vh_realloc(t->inls, t->alloc * sizeof (inl_t));
+	}
+	t->inls[t->count].lo = lo;
+	t->inls[t->count].hi = hi;
+	t->inls[t->count].name = name;
+	t->inls[t->count++].parent = depth;
+}
+
+/* by start, then outermost first */
+static int
+inlcmp(const void *a, const void *b)
+{
+	const inl_t *x = a, *y = b;
+
+	if (x->lo != y->lo)
+		return x->lo < y->lo ? -1 : 1;
+	if (x->hi != y->hi)
+		return x->hi > y->hi ? -1 : 1;
+	return x->parent < y->parent ? -1 : x->parent > y->parent;
+}
+
+/*
+ * Sort, and link each range to the innermost range that encloses it. Ranges
+ * of one function nest; the ranges of a stack that no longer enclose the
+ * next range are popped.
+ */
+void
+inltab_finish(inltab_t *t)
+{
+	uint32_t *stack, depth = 0, i;
+
+	if (t->count > 1)
+		qsort(t->inls, t->count, sizeof (inl_t), inlcmp);
+	stack = vh_malloc(t->count * sizeof (uint32_t) + 1);
+	for (i = 0; i < t->count; i++) {
+		while (depth > 0 && t->inls[stack[depth - 1]].hi <
+		    t->inls[i].hi)
+			depth--;
+		t->inls[i].parent = depth > 0 ? stack[depth - 1] : ST_NONE;
+		stack[depth++] = i;
+	}
+	free(stack);
+}
+
+/* the innermost inlined call at addr, or ST_NONE */
+uint32_t
+inltab_lookup(const inltab_t *t, uint64_t addr)
+{
+	uint32_t lo = 0, hi = t->count, mid, i;
+
+	/* the last range starting at or before addr, or one enclosing it */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->inls[mid].lo <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return ST_NONE;
+	for (i = lo - 1; i != ST_NONE && addr >= t->inls[i].hi;
+	    i = t->inls[i].parent)
+		;
+	return i;
+}
+
+/* the names of the inline chain ending at inl, outermost first */
+int
+inltab_chain(const inltab_t *t, uint32_t inl, const char **names, int max)
+{
+	const char *tmp;
+	int n = 0, i;
+
+	for (; inl != ST_NONE && n < max; inl = t->inls[inl].parent)
+		names[n++] = inl_name(t, &t->inls[inl]);
+	for (i = 0; i < n / 2; i++) {
+		tmp = names[i];
+		names[i] = names[n - 1 - i];
+		names[n - 1 - i] = tmp;
+	}
+	return n;
+}
+
+/*
+ * Line tables
+ */
+
+void
+linetab_init(linetab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+	strtab_init(&t->files);
+}
+
+void
+linetab_free(linetab_t *t)
+{
+	if (t->mapped)
+		vf_close(&t->f);
+	else
+		free(t->rows);
+	strtab_free(&t->files);
+	memset(t, 0, sizeof (*t));
+}
+
+static void
+linetab_add(linetab_t *t, uint64_t addr, uint32_t file, uint32_t line)
+{
+	if (t->count == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 4096;
+		t->rows = vh_realloc(t->rows, t->alloc * sizeof (line_t));
+	}
+	t->rows[t->count].addr = addr;
+	t->rows[t->count].file = file;
+	t->rows[t->count++].line = line;
+}
+
+/* the row of the line at addr, or ST_NONE */
+uint32_t
+linetab_lookup(const linetab_t *t, uint64_t addr)
+{
+	uint32_t lo = 0, hi = t->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->rows[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || t->rows[lo - 1].line == 0)
+		return ST_NONE;
+	return lo - 1;
+}
+
+/*
+ * DWARF
+ */
+
+typedef struct dwsec {
+	const unsigned char *p;
+	size_t		size;
+} dwsec_t;
+
+/* a bounds checked reader; err is set on overrun */
+typedef struct cursor {
+	const unsigned char *p;
+	const unsigned char *end;
+	int		err;
+} cursor_t;
+
+typedef struct abbrevattr {
+	uint32_t	name;
+	uint32_t	form;
+	int64_t		implicit;	/* DW_FORM_implicit_const value */
+} abbrevattr_t;
+
+typedef struct abbrev {
+	uint64_t	code;
+	uint32_t	tag;
+	int		children;
+	uint32_t	attr;		/* first, in attrs */
+	uint32_t	nattrs;
+} abbrev_t;
+
+typedef struct unit {
+	uint64_t	off;		/* of the unit header */
+	uint64_t	end;
+	uint64_t	die;		/* the unit DIE */
+	uint64_t	abbrevoff;
+	int		version;
+	int		addrsz;
+	int		offsz;
+	int		loaded;		/* abbrevs and bases are read */
+	abbrev_t	*abbrevs;
+	uint32_t	nabbrevs;
+	abbrevattr_t	*attrs;
+	uint64_t	base;		/* DW_AT_low_pc, for ranges */
+	uint64_t	stroffbase;
+	uint64_t	addrbase;
+	uint64_t	rngbase;
+} unit_t;
+
+typedef struct dwarf {
+	dwsec_t		info;
+	dwsec_t		abbrev;
+	dwsec_t		str;
+	dwsec_t		linestr;
+	dwsec_t		stroff;
+	dwsec_t		addr;
+	dwsec_t		ranges;
+	dwsec_t		rnglists;
+	dwsec_t		line;
+	unit_t		*units;
+	uint32_t	nunits;
+	inltab_t	*t;
+
+	/* DIE offset -> name string ID, for abstract origins */
+	uint64_t	*namekey;
+	uint32_t	*nameval;
+	uint32_t	namesize;
+	uint32_t	namecount;
+} dwarf_t;
+
+/* a DIE: its tag, and the attributes that are used */
+typedef struct die {
+	uint64_t	code;		/* 0: the end of a list of children */
+	uint32_t	tag;
+	int		children;
+	uint64_t	next;		/* offset of the next DIE */
+	const char	*name;
+	const char	*linkage;
+	uint64_t	origin;		/* DIE offset, or 0 */
+	uint64_t	lowpc;
+	uint64_t	highpc;
+	int		haslow;
+	int		hashigh;
+	int		highoff;	/* highpc is an offset from lowpc */
+	uint64_t	ranges;
+	int		hasranges;
+	int		rangesx;	/* ranges is a DW_FORM_rnglistx index */
+} die_t;
+
+static uint64_t
+rd(cursor_t *c, int n)
+{
+	uint64_t v = 0;
+
+	if (c->err || c->end - c->p < n) {
+		c->err = 1;
+		return 0;
+	}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(&v, c->p, n);
+#else
+	memcpy((unsigned char *)&v + sizeof (v) - n, c->p, n);
+#endif
+	c->p += n;
+	return v;
+}
+
+static uint64_t
+rd_uleb(cursor_t *c)
+{
+	uint64_t v = 0;
+	int shift = 0;
+
+	while (!c->err) {
+		if (c->p >= c->end) {
+			c->err = 1;
+			break;
+		}
+		if (shift < 64)
+			v |= (uint64_t)(*c->p & 0x7f) << shift;
+		shift += 7;
+		if ((*c->p++ & 0x80) == 0)
+			break;
+	}
+	return v;
+}
+
+static int64_t
+rd_sleb(cursor_t *c)
+{
+	uint64_t v = 0;
+	int shift = 0;
+	unsigned char b = 0;
+
+	while (!c->err) {
+		if (c->p >= c->end) {
+			c->err = 1;
+			return 0;
+		}
+		b = *c->p++;
+		if (shift < 64)
+			v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+		if ((b & 0x80) == 0)
+			break;
+	}
+	if (shift < 64 && (b & 0x40))
+		v |= ~(uint64_t)0 << shift;
+	return (int64_t)v;
+}
+
+static void
+skip(cursor_t *c, uint64_t n)
+{
+	if (c->err || (uint64_t)(c->end - c->p) < n)
+		c->err = 1;
+	else
+		c->p += n;
+}
+
+static const char *
+rd_cstr(cursor_t *c)
+{
+	const unsigned char *s = c->p;
+
+	while (c->p < c->end && *c->p != '\0')
+		c->p++;
+	if (c->p >= c->end) {
+		c->err = 1;
+		return NULL;
+	}
+	c->p++;
+	return (const char *)s;
+}
+
+/* a NUL terminated string at off in a string section, or NULL */
+static const char *
+secstr(const dwsec_t *s, uint64_t off)
+{
+	if (s->p == NULL || off >= s->size ||
+	    memchr(s->p + off, '\0', s->size - off) == NULL)
+		return NULL;
+	return (const char *)s->p + off;
+}
+
+static const char *
+strx(const dwarf_t *dw, const unit_t *u, uint64_t index)
+{
+	cursor_t c;
+	uint64_t off = u->stroffbase + index * u->offsz;
+
+	if (dw->stroff.p == NULL || off > dw->stroff.size)
+		return NULL;
+	c.p = dw->stroff.p + off;
+	c.end = dw->stroff.p + dw->stroff.size;
+	c.err = 0;
+	off = rd(&c, u->offsz);
+	return c.err ? NULL : secstr(&dw->str, off);
+}
+
+static uint64_t
+addrx(const dwarf_t *dw, const unit_t *u, uint64_t index)
+{
+	cursor_t c;
+	uint64_t off = u->addrbase + index * u->addrsz;
+
+	if (dw->addr.p == NULL || off > dw->addr.size)
+		return 0;
+	c.p = dw->addr.p + off;
+	c.end = dw->addr.p + dw->addr.size;
+	c.err = 0;
+	return rd(&c, u->addrsz);
+}
+
+/* read the abbreviation table of a unit */
+static void
+unit_abbrevs(dwarf_t *dw, unit_t *u)
+{
+	cursor_t c;
+	uint32_t aalloc = 0, nattrs = 0, alloc = 0;
+	abbrev_t *a;
+	uint64_t code, name, form;
+
+	if (u->abbrevoff >= dw->abbrev.size)
+		return;
+	c.p = dw->abbrev.p + u->abbrevoff;
+	c.end = dw->abbrev.p + dw->abbrev.size;
+	c.err = 0;
+	while ((code = rd_uleb(&c)) != 0 && !c.err) {
+		if (u->nabbrevs == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			u->abbrevs = vh_realloc(u->abbrevs,
+			    alloc * sizeof (abbrev_t));
+		}
+		a = &u->abbrevs[u->nabbrevs++];
+		a->code = code;
+		a->tag = rd_uleb(&c);
+		a->children = rd(&c, 1);
+		a->attr = nattrs;
+		a->nattrs = 0;
+		for (;;) {
+			name = rd_uleb(&c);
+			form = rd_uleb(&c);
+			if (c.err || (name == 0 && form == 0))
+				break;
+			if (nattrs == aalloc) {
+				aalloc = aalloc ? aalloc * 2 : 256;
+				u->attrs = vh_realloc(u->attrs,
+				    aalloc * sizeof (abbrevattr_t));
+			}
+			u->attrs[nattrs].name = name;
+			u->attrs[nattrs].form = form;
+			u->attrs[nattrs].implicit =
+			    form == DW_FORM_implicit_const ? rd_sleb(&c) : 0;
+			nattrs++;
+			a->nattrs++;
+		}
+	}
+}
+
+static const abbrev_t *
+unit_abbrev(const unit_t *u, uint64_t code)
+{
+	uint32_t i;
+
+	/* codes are usually numbered from one, in order */
+	if (code - 1 < u->nabbrevs && u->abbrevs[code - 1].code == code)
+		return &u->abbrevs[code - 1];
+	for (i = 0; i < u->nabbrevs; i++) {
+		if (u->abbrevs[i].code == code)
+			return &u->abbrevs[i];
+	}
+	return NULL;
+}
+
+/* values of the forms that are used; the rest are skipped */
+enum { V_NONE, V_CONST, V_ADDR, V_ADDRX, V_REF, V_STR, V_STRX };
+
+static int
+rd_form(const dwarf_t *dw, const unit_t *u, cursor_t *c, uint64_t form,
+    int64_t implicit, uint64_t *vp, const char **sp)
+{
+	uint64_t off;
+
+	switch (form) {
+	case DW_FORM_addr:
+		*vp = rd(c, u->addrsz);
+		return V_ADDR;
+	case DW_FORM_data1:
+	case DW_FORM_flag:
+		*vp = rd(c, 1);
+		return V_CONST;
+	case DW_FORM_data2:
+		*vp = rd(c, 2);
+		return V_CONST;
+	case DW_FORM_data4:
+		*vp = rd(c, 4);
+		return V_CONST;
+	case DW_FORM_data8:
+		*vp = rd(c, 8);
+		return V_CONST;
+	case DW_FORM_sdata:
+		*vp = rd_sleb(c);
+		return V_CONST;
+	case DW_FORM_udata:
+		*vp = rd_uleb(c);
+		return V_CONST;
+	case DW_FORM_implicit_const:
+		*vp = implicit;
+		return V_CONST;
+	case DW_FORM_sec_offset:
+		*vp = rd(c, u->offsz);
+		return V_CONST;
+	case DW_FORM_rnglistx:
+	case DW_FORM_loclistx:
+		*vp = rd_uleb(c);
+		return V_CONST;
+	case DW_FORM_string:
+		*sp = rd_cstr(c);
+		return V_STR;
+	case DW_FORM_strp:
+		off = rd(c, u->offsz);
+		*sp = secstr(&dw->str, off);
+		return V_STR;
+	case DW_FORM_line_strp:
+		off = rd(c, u->offsz);
+		*sp = secstr(&dw->linestr, off);
+		return V_STR;
+	case DW_FORM_strx:
+	case DW_FORM_GNU_str_index:
+		*vp = rd_uleb(c);
+		return V_STRX;
+	case DW_FORM_strx1:
+	case DW_FORM_strx2:
+	case DW_FORM_strx3:
+	case DW_FORM_strx4:
+		*vp = rd(c, form - DW_FORM_strx1 + 1);
+		return V_STRX;
+	case DW_FORM_addrx:
+	case DW_FORM_GNU_addr_index:
+		*vp = rd_uleb(c);
+		return V_ADDRX;
+	case DW_FORM_addrx1:
+	case DW_FORM_addrx2:
+	case DW_FORM_addrx3:
+	case DW_FORM_addrx4:
+		*vp = rd(c, form - DW_FORM_addrx1 + 1);
+		return V_ADDRX;
+	case DW_FORM_ref1:
+		*vp = u->off + rd(c, 1);
+		return V_REF;
+	case DW_FORM_ref2:
+		*vp = u->off + rd(c, 2);
+		return V_REF;
+	case DW_FORM_ref4:
+		*vp = u->off + rd(c, 4);
+		return V_REF;
+	case DW_FORM_ref8:
+		*vp = u->off + rd(c, 8);
+		return V_REF;
+	case DW_FORM_ref_udata:
+		*vp = u->off + rd_uleb(c);
+		return V_REF;
+	case DW_FORM_ref_addr:
+		*vp = rd(c, u->version <= 2 ? u->addrsz : u->offsz);
+		return V_REF;
+	case DW_FORM_strp_sup:
+	case DW_FORM_GNU_ref_alt:
+	case DW_FORM_GNU_strp_alt:
+		skip(c, u->offsz);
+		return V_NONE;
+	case DW_FORM_ref_sup4:
+		skip(c, 4);
+		return V_NONE;
+	case DW_FORM_ref_sig8:
+	case DW_FORM_ref_sup8:
+		skip(c, 8);
+		return V_NONE;
+	case DW_FORM_data16:
+		skip(c, 16);
+		return V_NONE;
+	case DW_FORM_flag_present:
+		*vp = 1;
+		return V_CONST;
+	case DW_FORM_block1:
+		skip(c, rd(c, 1));
+		return V_NONE;
+	case DW_FORM_block2:
+		skip(c, rd(c, 2));
+		return V_NONE;
+	case DW_FORM_block4:
+		skip(c, rd(c, 4));
+		return V_NONE;
+	case DW_FORM_block:
+	case DW_FORM_exprloc:
+		skip(c, rd_uleb(c));
+		return V_NONE;
+	case DW_FORM_indirect:
+		form = rd_uleb(c);
+		if (form == DW_FORM_indirect || c->err) {
+			c->err = 1;
+			return V_NONE;
+		}
+		return rd_form(dw, u, c, form, 0, vp, sp);
+	default:
+		/* an unknown form has an unknown size */
+		c->err = 1;
+		return V_NONE;
+	}
+}
+
+/* read the DIE at off of unit u */
+static int
+die_read(const dwarf_t *dw, const unit_t *u, uint64_t off, die_t *d)
+{
+	const abbrev_t *a;
+	const abbrevattr_t *at;
+	const char *s;
+	cursor_t c;
+	uint64_t v;
+	uint32_t i;
+	int cls;
+
+	memset(d, 0, sizeof (*d));
+	if (off >= u->end)
+		return -1;
+	c.p = dw->info.p + off;
+	c.end = dw->info.p + u->end;
+	c.err = 0;
+	if ((d->code = rd_uleb(&c)) == 0) {
+		d->next = c.err ? u->end : (uint64_t)(c.p - dw->info.p);
+		return c.err ? -1 : 0;
+	}
+	if ((a = unit_abbrev(u, d->code)) == NULL)
+		return -1;
+	d->tag = a->tag;
+	d->children = a->children;
+	for (i = 0; i < a->nattrs && !c.err; i++) {
+		at = &u->attrs[a->attr + i];
+		v = 0;
+		s = NULL;
+		cls = rd_form(dw, u, &c, at->form, at->implicit, &v, &s);
+		if (cls == V_ADDRX)
+			v = addrx(dw, u, v);
+		switch (at->name) {
+		case DW_AT_name:
+			d->name = cls == V_STRX ? strx(dw, u, v) : s;
+			break;
+		case DW_AT_linkage_name:
+		case DW_AT_MIPS_linkage_name:
+			d->linkage = cls == V_STRX ? strx(dw, u, v) : s;
+			break;
+		case DW_AT_abstract_origin:
+		case DW_AT_specification:
+			if (cls == V_REF)
+				d->origin = v;
+			break;
+		case DW_AT_low_pc:
+			d->lowpc = v;
+			d->haslow = 1;
+			break;
+		case DW_AT_high_pc:
+			d->highpc = v;
+			d->hashigh = 1;
+			d->highoff = cls == V_CONST;
+			break;
+		case DW_AT_ranges:
+			d->ranges = v;
+			d->hasranges = 1;
+			d->rangesx = at->form == DW_FORM_rnglistx;
+			break;
+		}
+	}
+	if (c.err)
+		return -1;
+	d->next = c.p - dw->info.p;
+	return 0;
+}
+
+/*
+ * Read the abbreviations of a unit, and the bases of its unit DIE. The
+ * bases are read before the DIE's other attributes are used, as strx and
+ * addrx forms depend on them.
+ */
+static void
+unit_load(dwarf_t *dw, unit_t *u)
+{
+	const abbrev_t *a;
+	const abbrevattr_t *at;
+	const char *s;
+	cursor_t c;
+	uint64_t v;
+	uint32_t i;
+	die_t d;
+	int cls;
+
+	if (u->loaded)
+		return;
+	u->loaded = 1;
+	unit_abbrevs(dw, u);
+	c.p = dw->info.p + u->die;
+	c.end = dw->info.p + u->end;
+	c.err = 0;
+	if ((a = unit_abbrev(u, rd_uleb(&c))) == NULL)
+		return;
+	for (i = 0; i < a->nattrs && !c.err; i++) {
+		at = &u->attrs[a->attr + i];
+		cls = rd_form(dw, u, &c, at->form, at->implicit, &v, &s);
+		if (cls != V_CONST && cls != V_ADDR)
+			continue;
+		if (at->name == DW_AT_str_offsets_base)
+			u->stroffbase = v;
+		else if (at->name == DW_AT_addr_base)
+			u->addrbase = v;
+		else if (at->name == DW_AT_rnglists_base)
+			u->rngbase = v;
+		else if (at->name == DW_AT_low_pc && cls == V_ADDR)
+			u->base = v;
+	}
+	/* a DW_FORM_addrx low_pc needs addr_base, which may follow it */
+	if (die_read(dw, u, u->die, &d) == 0 && d.haslow)
+		u->base = d.lowpc;
+}
+
+static unit_t *
+unit_of(dwarf_t *dw, uint64_t off)
+{
+	uint32_t lo = 0, hi = dw->nunits, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dw->units[mid].off <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || off >= dw->units[lo - 1].end)
+		return NULL;
+	return &dw->units[lo - 1];
+}
+
+static uint32_t
+intern_name(inltab_t *t, const char *name)
+{
+	char *dm = NULL;
+	uint32_t id;
+	int status;
+
+	if (name[0] == '_' && name[1] == 'Z')
+		dm = __cxa_demangle(name, NULL, NULL, &status);
+	if (dm != NULL) {
+		id = strtab_intern(&t->names, dm, strlen(dm));
+		free(dm);
+		return id;
+	}
+	return strtab_intern(&t->names, name, strlen(name));
+}
+
+/*
+ * The name of the function of the DIE at off, following abstract origins
+ * and specifications, or ST_NONE. Names are kept by DIE offset, as many
+ * inlined calls refer to the same function.
+ */
+static uint32_t
+die_name(dwarf_t *dw, uint64_t off, int depth)
+{
+	uint64_t *okey = dw->namekey;
+	uint32_t *oval = dw->nameval, osize = dw->namesize, mask, i, j, id;
+	unit_t *u;
+	die_t d;
+
+	if (dw->namecount * 2 >= dw->namesize) {
+		dw->namesize = osize ? osize * 2 : 4096;
+		dw->namekey = vh_calloc(dw->namesize, sizeof (uint64_t));
+		dw->nameval = vh_malloc(dw->namesize * sizeof (uint32_t));
+		mask = dw->namesize - 1;
+		for (i = 0; i < osize; i++) {
+			if (okey[i] == 0)
+				continue;
+			for (j = (okey[i] * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+			    dw->namekey[j]; j = (j + 1) & mask)
+				;
+			dw->namekey[j] = okey[i];
+			dw->nameval[j] = oval[i];
+		}
+		free(okey);
+		free(oval);
+	}
+	mask = dw->namesize - 1;
+	/* DIE offsets are never 0, the start of a unit header */
+	for (i = (off * 0x9e3779b97f4a7c15ULL) >> 32 & mask; dw->namekey[i];
+	    i = (i + 1) & mask) {
+		if (dw->namekey[i] == off)
+			return dw->nameval[i];
+	}
+
+	id = ST_NONE;
+	if ((u = unit_of(dw, off)) != NULL) {
+		unit_load(dw, u);
+		if (die_read(dw, u, off, &d) == 0) {
+			if (d.linkage != NULL)
+				id = intern_name(dw->t, d.linkage);
+			else if (d.name != NULL)
+				id = intern_name(dw->t, d.name);
+			else if (d.origin != 0 && depth < MAXORIGIN)
+				id = die_name(dw, d.origin, depth + 1);
+		}
+	}
+	/* the table may have grown */
+	mask = dw->namesize - 1;
+	for (i = (off * 0x9e3779b97f4a7c15ULL) >> 32 & mask; dw->namekey[i];
+	    i = (i + 1) & mask) {
+		if (dw->namekey[i] == off)
+			return dw->nameval[i];
+	}
+	dw->namekey[i] = off;
+	dw->nameval[i] = id;
+	dw->namecount++;
+	return id;
+}
+
+/* add the address ranges of an inlined call */
+static void
+add_ranges(dwarf_t *dw, const unit_t *u, const die_t *d, uint32_t name,
+    uint32_t depth)
+{
+	uint64_t base = u->base, off, kind, a, b;
+	cursor_t c;
+
+	if (d->haslow && d->hashigh) {
+		inltab_add(dw->t, d->lowpc, d->highoff ? d->lowpc + d->highpc :
+		    d->highpc, name, depth);
+		return;
+	}
+	if (!d->hasranges)
+		return;
+
+	if (u->version < 5) {
+		/* .debug_ranges: pairs, relative to the base address */
+		if (dw->ranges.p == NULL || d->ranges >= dw->ranges.size)
+			return;
+		c.p = dw->ranges.p + d->ranges;
+		c.end = dw->ranges.p + dw->ranges.size;
+		c.err = 0;
+		for (;;) {
+			a = rd(&c, u->addrsz);
+			b = rd(&c, u->addrsz);
+			if (c.err || (a == 0 && b == 0))
+				break;
+			if (a == (u->addrsz == 8 ? UINT64_MAX : UINT32_MAX))
+				base = b;
+			else
+				inltab_add(dw->t, base + a, base + b, name,
+				    depth);
+		}
+		return;
+	}
+
+	/* .debug_rnglists: by offset, or by index from rnglists_base */
+	if (dw->rnglists.p == NULL)
+		return;
+	off = d->ranges;
+	if (d->rangesx) {
+		off = u->rngbase + d->ranges * u->offsz;
+		if (off >= dw->rnglists.size)
+			return;
+		c.p = dw->rnglists.p + off;
+		c.end = dw->rnglists.p + dw->rnglists.size;
+		c.err = 0;
+		off = u->rngbase + rd(&c, u->offsz);
+		if (c.err)
+			return;
+	}
+	if (off >= dw->rnglists.size)
+		return;
+	c.p = dw->rnglists.p + off;
+	c.end = dw->rnglists.p + dw->rnglists.size;
+	c.err = 0;
+	while (!c.err && (kind = rd(&c, 1)) != DW_RLE_end_of_list) {
+		switch (kind) {
+		case DW_RLE_base_addressx:
+			base = addrx(dw, u, rd_uleb(&c));
+			break;
+		case DW_RLE_startx_endx:
+			a = addrx(dw, u, rd_uleb(&c));
+			b = addrx(dw, u, rd_uleb(&c));
+			inltab_add(dw->t, a, b, name, depth);
+			break;
+		case DW_RLE_startx_length:
+			a = addrx(dw, u, rd_uleb(&c));
+			b = rd_uleb(&c);
+			inltab_add(dw->t, a, a + b, name, depth);
+			break;
+		case DW_RLE_offset_pair:
+			a = rd_uleb(&c);
+			b = rd_uleb(&c);
+			inltab_add(dw->t, base + a, base + b, name, depth);
+			break;
+		case DW_RLE_base_address:
+			base = rd(&c, u->addrsz);
+			break;
+		case DW_RLE_start_end:
+			a = rd(&c, u->addrsz);
+			b = rd(&c, u->addrsz);
+			inltab_add(dw->t, a, b, name, depth);
+			break;
+		case DW_RLE_start_length:
+			a = rd(&c, u->addrsz);
+			b = rd_uleb(&c);
+			inltab_add(dw->t, a, a + b, name, depth);
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+/* add the inlined calls of a unit, with their depth in the DIE tree */
+static void
+unit_inlines(dwarf_t *dw, unit_t *u)
+{
+	uint32_t inlines[MAXNEST + 1], depth, name;
+	uint64_t off;
+	int level = 0;
+	die_t d;
+
+	unit_load(dw, u);
+	inlines[0] = 0;
+	for (off = u->die; off < u->end; off = d.next) {
+		if (die_read(dw, u, off, &d) != 0)
+			break;
+		if (d.code == 0) {
+			if (level > 0)
+				level--;
+			continue;
+		}
+		depth = inlines[level < MAXNEST ? level : MAXNEST];
+		if (d.tag == DW_TAG_inlined_subroutine && d.origin != 0 &&
+		    (name = die_name(dw, d.origin, 0)) != ST_NONE)
+			add_ranges(dw, u, &d, name, ++depth);
+		if (d.children && ++level <= MAXNEST)
+			inlines[level] = depth;
+	}
+}
+
+/* read the unit headers of .debug_info */
+static void
+read_units(dwarf_t *dw)
+{
+	uint32_t alloc = 0;
+	uint64_t off = 0, len;
+	cursor_t c;
+	unit_t u;
+	int type;
+
+	c.p = dw->info.p;
+	c.end = dw->info.p + dw->info.size;
+	c.err = 0;
+	while (off < dw->info.size) {
+		memset(&u, 0, sizeof (u));
+		u.off = off;
+		c.p = dw->info.p + off;
+		u.offsz = 4;
+		if ((len = rd(&c, 4)) == 0xffffffff) {
+			len = rd(&c, 8);
+			u.offsz = 8;
+		}
+		if (c.err || len > (uint64_t)(c.end - c.p) || len < 4)
+			break;
+		u.end = (c.p - dw->info.p) + len;
+		u.version = rd(&c, 2);
+		type = DW_UT_compile;
+		if (u.version >= 5) {
+			type = rd(&c, 1);
+			u.addrsz = rd(&c, 1);
+			u.abbrevoff = rd(&c, u.offsz);
+		} else {
+			u.abbrevoff = rd(&c, u.offsz);
+			u.addrsz = rd(&c, 1);
+		}
+		u.die = c.p - dw->info.p;
+		off = u.end;
+		if (c.err || u.version < 2 || u.version > 5 ||
+		    (u.addrsz != 4 && u.addrsz != 8) ||
+		    (type != DW_UT_compile && type != DW_UT_partial))
+			continue;
+		if (dw->nunits == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			dw->units = vh_realloc(dw->units,
+			    alloc * sizeof (unit_t));
+		}
+		dw->units[dw->nunits++] = u;
+	}
+}
+
+/* find the DWARF sections; compressed sections are left out */
+static int
+find_sections(dwarf_t *dw, const unsigned char *base, size_t size)
+{
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)base;
+	const Elf64_Shdr *sh, *strsh;
+	static const struct {
+		const char	*name;
+		size_t		off;
+	} secs[] = {
+		{ ".debug_info", offsetof(dwarf_t, info) },
+		{ ".debug_abbrev", offsetof(dwarf_t, abbrev) },
+		{ ".debug_str", offsetof(dwarf_t, str) },
+		{ ".debug_line_str", offsetof(dwarf_t, linestr) },
+		{ ".debug_str_offsets", offsetof(dwarf_t, stroff) },
+		{ ".debug_addr", offsetof(dwarf_t, addr) },
+		{ ".debug_ranges", offsetof(dwarf_t, ranges) },
+		{ ".debug_rnglists", offsetof(dwarf_t, rnglists) },
+		{ ".debug_line", offsetof(dwarf_t, line) },
+	};
+	const char *name;
+	dwsec_t *s;
+	uint32_t i, j;
+
+	if (size < sizeof (*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS64 || eh->e_shoff > size ||
+	    eh->e_shnum == 0 || eh->e_shentsize != sizeof (*sh) ||
+	    eh->e_shnum > (size - eh->e_shoff) / sizeof (*sh) ||
+	    eh->e_shstrndx >= eh->e_shnum)
+		return -1;
+	sh = (const Elf64_Shdr *)(base + eh->e_shoff);
+	strsh = &sh[eh->e_shstrndx];
+	if (strsh->sh_offset > size || strsh->sh_size > size - strsh->sh_offset)
+		return -1;
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_name >= strsh->sh_size ||
+		    sh[i].sh_type == SHT_NOBITS ||
+		    (sh[i].sh_flags & SHF_COMPRESSED) ||
+		    sh[i].sh_offset > size ||
+		    sh[i].sh_size > size - sh[i].sh_offset)
+			continue;
+		name = (const char *)base + strsh->sh_offset + sh[i].sh_name;
+		if (memchr(name, '\0', strsh->sh_size - sh[i].sh_name) == NULL)
+			continue;
+		for (j = 0; j < sizeof (secs) / sizeof (secs[0]); j++) {
+			if (strcmp(name, secs[j].name) != 0)
+				continue;
+			s = (dwsec_t *)((char *)dw + secs[j].off);
+			s->p = base + sh[i].sh_offset;
+			s->size = sh[i].sh_size;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read the inlined calls of an ELF image. Returns -1 if it has no DWARF
+ * that can be read, eg, a stripped binary; its debug file may have.
+ */
+int
+dwarf_inlines(inltab_t *t, const unsigned char *base, size_t size)
+{
+	dwarf_t dw;
+	uint32_t i;
+
+	memset(&dw, 0, sizeof (dw));
+	dw.t = t;
+	if (find_sections(&dw, base, size) != 0 || dw.info.p == NULL ||
+	    dw.abbrev.p == NULL)
+		return -1;
+	read_units(&dw);
+	for (i = 0; i < dw.nunits; i++)
+		unit_inlines(&dw, &dw.units[i]);
+	inltab_finish(t);
+
+	for (i = 0; i < dw.nunits; i++) {
+		free(dw.units[i].abbrevs);
+		free(dw.units[i].attrs);
+	}
+	free(dw.units);
+	free(dw.namekey);
+	free(dw.nameval);
+	return 0;
+}
+
+/* a file name, without its directory */
+static uint32_t
+line_intern(linetab_t *t, const char *path)
+{
+	const char *base;
+
+	if (path == NULL)
+		path = "??";
+	base = strrchr(path, '/');
+	base = base != NULL && base[1] != '\0' ? base + 1 : path;
+	return strtab_intern(&t->files, base, strlen(base));
+}
+
+/* a line program's file names, indexed by file number */
+typedef struct files {
+	uint32_t	*ids;
+	uint32_t	count;
+	uint32_t	alloc;
+} files_t;
+
+static void
+files_add(files_t *f, uint32_t id)
+{
+	if (f->count == f->alloc) {
+		f->alloc = f->alloc ? f->alloc * 2 : 64;
+		f->ids = vh_realloc(f->ids, f->alloc * sizeof (uint32_t));
+	}
+	f->ids[f->count++] = id;
+}
+
+/*
+ * Read the directory or file entries of a version 5 line program header.
+ * Each entry has the same list of (content, form) pairs; only the path of a
+ * file is kept, as file names are shown without their directories.
+ */
+static void
+line_entries(dwarf_t *dw, const unit_t *u, cursor_t *c, linetab_t *t,
+    files_t *files)
+{
+	uint64_t fmt[16][2], nfmt, count, i, j, v;
+	const char *str, *path;
+	int cls;
+
+	nfmt = rd(c, 1);
+	if (nfmt > 16) {
+		c->err = 1;
+		return;
+	}
+	for (i = 0; i < nfmt; i++) {
+		fmt[i][0] = rd_uleb(c);
+		fmt[i][1] = rd_uleb(c);
+	}
+	count = rd_uleb(c);
+	for (i = 0; i < count && !c->err; i++) {
+		path = NULL;
+		for (j = 0; j < nfmt; j++) {
+			str = NULL;
+			cls = rd_form(dw, u, c, fmt[j][1], 0, &v, &str);
+			if (fmt[j][0] == DW_LNCT_path && cls == V_STR)
+				path = str;
+		}
+		if (files != NULL && !c->err)
+			files_add(files, line_intern(t, path));
+	}
+}
+
+/* a sequence of rows of the line table, ending with a line 0 row */
+typedef struct seq {
+	uint64_t	addr;
+	uint32_t	first;
+	uint32_t	count;
+} seq_t;
+
+typedef struct seqs {
+	seq_t		*seqs;
+	uint32_t	count;
+	uint32_t	alloc;
+} seqs_t;
+
+static int
+seqcmp(const void *a, const void *b)
+{
+	const seq_t *x = a, *y = b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/*
+ * Run the line number program at off in .debug_line, adding the rows of
+ * each sequence. Sequences of discarded code (eg, by --gc-sections) are
+ * left at address 0 or -1 by the linker, and are dropped. Returns the
+ * offset of the next program, or 0 at the end.
+ */
+static uint64_t
+line_program(dwarf_t *dw, uint64_t off, linetab_t *t, seqs_t *sq)
+{
+	uint64_t len, end, hdrlen, addr = 0, tomb, n, op;
+	int64_t line = 1, linebase;
+	uint32_t file = 1, first, mininst, linerange, opbase, i;
+	uint8_t oplens[256];
+	const unsigned char *next;
+	files_t files = { NULL, 0, 0 };
+	const char *name;
+	cursor_t c;
+	unit_t u;
+
+	memset(&u, 0, sizeof (u));
+	c.p = dw->line.p + off;
+	c.end = dw->line.p + dw->line.size;
+	c.err = 0;
+	u.offsz = 4;
+	if ((len = rd(&c, 4)) == 0xffffffff) {
+		len = rd(&c, 8);
+		u.offsz = 8;
+	}
+	if (c.err || len > (uint64_t)(c.end - c.p) || len < 2)
+		return 0;
+	end = (c.p - dw->line.p) + len;
+	c.end = dw->line.p + end;
+	u.version = rd(&c, 2);
+	u.addrsz = 8;
+	if (u.version >= 5) {
+		u.addrsz = rd(&c, 1);
+		skip(&c, 1);			/* segment selector size */
+	}
+	hdrlen = rd(&c, u.offsz);
+	if (c.err || u.version < 2 || u.version > 5 ||
+	    hdrlen > (uint64_t)(c.end - c.p))
+		return end;
+	next = c.p + hdrlen;
+	mininst = rd(&c, 1);
+	if (u.version >= 4)
+		skip(&c, 1);			/* maximum operations */
+	skip(&c, 1);				/* default is_stmt */
+	linebase = (int8_t)rd(&c, 1);
+	linerange = rd(&c, 1);
+	opbase = rd(&c, 1);
+	if (c.err || linerange == 0 || opbase == 0)
+		return end;
+	memset(oplens, 0, sizeof (oplens));
+	for (i = 1; i < opbase; i++)
+		oplens[i] = rd(&c, 1);
+
+	if (u.version >= 5) {
+		/* directories, then files, numbered from 0 */
+		line_entries(dw, &u, &c, t, NULL);
+		line_entries(dw, &u, &c, t, &files);
+	} else {
+		/* numbered from 1 */
+		files_add(&files, line_intern(t, NULL));
+		while ((name = rd_cstr(&c)) != NULL && name[0] != '\0')
+			;
+		while ((name = rd_cstr(&c)) != NULL && name[0] != '\0') {
+			rd_uleb(&c);
+			rd_uleb(&c);
+			rd_uleb(&c);
+			files_add(&files, line_intern(t, name));
+		}
+	}
+	if (c.err) {
+		free(files.ids);
+		return end;
+	}
+	if (files.count == 0)
+		files_add(&files, line_intern(t, NULL));
+
+	c.p = next;
+	tomb = u.addrsz == 8 ? UINT64_MAX : UINT32_MAX;
+	first = t->count;
+	while (c.p < c.end && !c.err) {
+		op = rd(&c, 1);
+		if (op >= opbase) {
+			/* special opcode: advance both, and add a row */
+			op -= opbase;
+			addr += (op / linerange) * mininst;
+			line += linebase + (int64_t)(op % linerange);
+			linetab_add(t, addr, file < files.count ?
+			    files.ids[file] : files.ids[0], line);
+			continue;
+		}
+		switch (op) {
+		case 0:
+			n = rd_uleb(&c);
+			if (n == 0 || n > (uint64_t)(c.end - c.p)) {
+				c.err = 1;
+				break;
+			}
+			next = c.p + n;
+			op = rd(&c, 1);
+			if (op == DW_LNE_end_sequence) {
+				linetab_add(t, addr, files.ids[0], 0);
+				if (t->rows[first].addr == 0 ||
+				    t->rows[first].addr >= tomb - 1) {
+					t->count = first;
+				} else {
+					if (sq->count == sq->alloc) {
+						sq->alloc = sq->alloc ?
+						    sq->alloc * 2 : 256;
+						sq->seqs = vh_realloc(sq->seqs,
+						    sq->alloc * sizeof (seq_t));
+					}
+					sq->seqs[sq->count].addr =
+					    t->rows[first].addr;
+					sq->seqs[sq->count].first = first;
+					sq->seqs[sq->count++].count =
+					    t->count - first;
+				}
+				first = t->count;
+				addr = 0;
+				line = 1;
+				file = 1;
+			} else if (op == DW_LNE_set_address) {
+				addr = rd(&c, n - 1 < 8 ? n - 1 : 8);
+			}
+			c.p = next;
+			break;
+		case DW_LNS_copy:
+			linetab_add(t, addr, file < files.count ?
+			    files.ids[file] : files.ids[0], line);
+			break;
+		case DW_LNS_advance_pc:
+			addr += rd_uleb(&c) * mininst;
+			break;
+		case DW_LNS_advance_line:
+			line += rd_sleb(&c);
+			break;
+		case DW_LNS_set_file:
+			file = rd_uleb(&c);
+			break;
+		case DW_LNS_const_add_pc:
+			addr += ((255 - opbase) / linerange) * mininst;
+			break;
+		case DW_LNS_fixed_advance_pc:
+			addr += rd(&c, 2);
+			break;
+		default:
+			/* standard opcodes, with uleb operands */
+			for (i = 0; i < oplens[op]; i++)
+				rd_uleb(&c);
+		}
+	}
+	/* rows of a sequence that was not ended are dropped */
+	t->count = first;
+	free(files.ids);
+	return end;
+}
+
+/*
+ * Sort the sequences by address, and join their rows. Rows that cover no
+ * addresses, and rows of the same line as the row before, are left out.
+ */
+static void
+line_join(linetab_t *t, seqs_t *sq)
+{
+	line_t *rows, *r;
+	uint32_t count = 0, i, j;
+
+	qsort(sq->seqs, sq->count, sizeof (seq_t), seqcmp);
+	rows = vh_malloc(t->count * sizeof (line_t) + 1);
+	for (i = 0; i < sq->count; i++) {
+		for (j = 0; j < sq->seqs[i].count; j++) {
+			r = &t->rows[sq->seqs[i].first + j];
+			if (count > 0 && rows[count - 1].addr == r->addr)
+				count--;
+			if (count > 0 && rows[count - 1].line == r->line &&
+			    rows[count - 1].file == r->file)
+				continue;
+			rows[count++] = *r;
+		}
+	}
+	free(t->rows);
+	t->rows = rows;
+	t->count = t->alloc = count;
+}
+
+/*
+ * Read the line number table of an ELF image. Returns -1 if it has no
+ * .debug_line, eg, a stripped binary; its debug file may have.
+ */
+int
+dwarf_lines(linetab_t *t, const unsigned char *base, size_t size)
+{
+	seqs_t sq = { NULL, 0, 0 };
+	uint64_t off = 0;
+	dwarf_t dw;
+
+	memset(&dw, 0, sizeof (dw));
+	if (find_sections(&dw, base, size) != 0 || dw.line.p == NULL)
+		return -1;
+	while (off < dw.line.size && (off = line_program(&dw, off, t, &sq)) != 0)
+		;
+	line_join(t, &sq);
+	free(sq.seqs);
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * dwarf.h - inlined function calls and source lines, from DWARF debug
+ * information.
+ *
+ * An inltab is an interval index of the inlined calls of an ELF object: the
+ * address ranges of its DW_TAG_inlined_subroutine entries, sorted by start
+ * address, each with the name of the function inlined and a link to the
+ * range that encloses it. A lookup finds the innermost inlined call at an
+ * address, and its parents are the rest of the inline chain, out to the
+ * function of the symbol table.
+ *
+ * Tables are cached by build ID with the symbols (see symbols.h), as the
+ * entry "<buildid>.inlines" of kind VF_KIND_INLINES:
+ *
+ *	VF_META		buildid, inlines
+ *	VF_STRINGS	function names
+ *	VF_INLINES	inl_t per range, sorted by start address
+ *
+ * A linetab is the line number table of an object, from .debug_line: the
+ * rows of all of its sequences, sorted by address, each giving the source
+ * file and line of the addresses up to the next row. A row with line 0 ends
+ * a sequence, and the addresses that follow it have no line. It is cached
+ * as the entry "<buildid>.lines" of kind VF_KIND_LINES:
+ *
+ *	VF_META		buildid, lines
+ *	VF_STRINGS	source file names, without their directories
+ *	VF_LINES	line_t per row, sorted by address
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef DWARF_H
+#define DWARF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stacktab.h"
+#include "vfile.h"
+
+#define INL_MAXDEPTH	32		/* inline chain, per address */
+
+typedef struct inl {
+	uint64_t	lo;
+	uint64_t	hi;		/* end, exclusive */
+	uint32_t	name;		/* string ID */
+	uint32_t	parent;		/* enclosing range, or ST_NONE */
+} inl_t;
+
+typedef struct inltab {
+	inl_t		*inls;		/* sorted by lo, once finished */
+	uint32_t	count;
+	uint32_t	alloc;
+	strtab_t	names;
+
+	/* or, mapped from a symbol cache entry, read only */
+	int		mapped;
+	vfile_t		f;
+	vf_strings_t	fnames;
+} inltab_t;
+
+void	inltab_init(inltab_t *);
+void	inltab_free(inltab_t *);
+void	inltab_finish(inltab_t *);
+uint32_t inltab_lookup(const inltab_t *, uint64_t addr);
+int	inltab_chain(const inltab_t *, uint32_t inl, const char **names,
+	    int max);
+
+static inline const char *
+inl_name(const inltab_t *t, const inl_t *i)
+{
+	if (t->mapped)
+		return vf_string(&t->fnames, i->name);
+	return strtab_str(&t->names, i->name);
+}
+
+typedef struct line {
+	uint64_t	addr;
+	uint32_t	file;		/* string ID */
+	uint32_t	line;		/* 0: no line, to the next row */
+} line_t;
+
+typedef struct linetab {
+	line_t		*rows;		/* sorted by addr, once finished */
+	uint32_t	count;
+	uint32_t	alloc;
+	strtab_t	files;
+
+	/* or, mapped from a symbol cache entry, read only */
+	int		mapped;
+	vfile_t		f;
+	vf_strings_t	ffiles;
+} linetab_t;
+
+void	linetab_init(linetab_t *);
+void	linetab_free(linetab_t *);
+uint32_t linetab_lookup(const linetab_t *, uint64_t addr);
+
+static inline const char *
+line_file(const linetab_t *t, uint32_t file)
+{
+	if (t->mapped)
+		return vf_string(&t->ffiles, file);
+	return strtab_str(&t->files, file);
+}
+
+/* read the inlined calls of an ELF image of size bytes, into an empty t */
+int	dwarf_inlines(inltab_t *, const unsigned char *base, size_t size);
+
+/* read the line number table of an ELF image, into an empty t */
+int	dwarf_lines(linetab_t *, const unsigned char *base, size_t size);
+
+#endif /* DWARF_H */
@@ -1,34 +1,101 @@
 #!/bin/bash
-TS=`date +%Y%m%d-%T`
-
-#DIR
-WEBDIR=/usr/share/pcp/webapps/heatmap
-WDIR=/var/log/pcp/vector/HEATMAP
-BDIR=/var/lib/pcp/pmdas/vector/BINHeatMap
-#FILE
-SVG=$WEBDIR/heatmap.svg
-PERF=$WDIR/perf.data.$TS
-#
-if [ ! -d "$WDIR" ]
-then
-/bin/mkdir -p $WDIR
-fi
+#
+# heatmap - a Vector pcp pmda for generating a disk I/O latency heat map
+#	    as a background task (vector.task.disklatencyheatmap).
+#
+# USAGE: heatmap [seconds]
+#
+# Block I/O is traced from issue to completion, and each I/O is drawn by its
+# completion time and latency. The trace is the one diskioflamegraph records
+# for its latency flame graph, and a run of either at the same time shares
+# it (see blkio_capture in vectorlib.sh), so the heat map and the stacks of
+# its slow I/O cost one trace.
+#
+# Check and adjust the environment settings below.
+#
+# REQUIREMENTS: The libraries perfmaplib.sh and vectorlib.sh. See those
+# files for their own requirements.
+#
+# DEBUG: STDERR includes timestamped debug messages, and command errors. It
+# is redirected to the pmda vector log (/var/log/pcp/pmcd/vector.log).
+#
+# SEE ALSO: http://vectoross.io http://pcp.io
+#
+# Copyright 2017 Netflix, Inc.
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+# host
+export TZ=US/Pacific
+TS=$(date +%Y-%m-%d_%T)
+PATH=/bin:/usr/bin:$PATH
+HOSTNAME=$(uname -n)
+
+# pcp pmda paths
+METRIC=disklatencyheatmap
+PMDA_DIR=${0%/*}
+WEBSITE_DIR=/usr/share/pcp/webapps/heatmap
+WORKING_DIR=/var/log/pcp/vector/$METRIC
+HM_DIR=/var/lib/pcp/pmdas/vector/BINHeatMap
+OUT_SVG=$WEBSITE_DIR/heatmap.svg
+OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
+OUT_LAT=$WORKING_DIR/out.lat_us.$$
+PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
+
+# libraries
+. $PMDA_DIR/vectorlib.sh
+. $PMDA_DIR/perfmaplib.sh
+
+# perf settings
+parseargs "$@"
+SECS=${ARG_SECS:-120}		# default to 120 seconds if not sepcified
 
-if [ ! -d "$WEBDIR" ]
-then
-/bin/mkdir -p $WEBDIR
-fi
 #
-if [ -d "$WEBDIR" ]
-then
-/bin/rm $SVG
-fi
+# Ensure output directories exist
 #
+[ ! -d "$WORKING_DIR" ] && mkdir -p $WORKING_DIR
+[ ! -d "$WEBSITE_DIR" ] && mkdir -p $WEBSITE_DIR
+[ -d "$WEBSITE_DIR" -a -e "$OUT_SVG" ] && rm $OUT_SVG
+[ -d "$HM_DIR" ] || errorexit "Heat map software missing"
+
+# terminator for new log group:
+echo >&2
+
+debugtime "$0 start"
+statusmsg "Tracing for $SECS seconds"
+
 #
-/usr/bin/perf record -o $PERF -e block:block_rq_issue -e block:block_rq_complete -a sleep 120 &> /dev/null
-timeout 20 /usr/bin/perf script -i $PERF| awk '{ gsub(/:/, "") } $5 ~ /issue/ { ts[$6, $10] = $4 } $5 ~ /complete/ { if (l = ts[$6, $9]) { printf "%.f %.f\n", $4 * 1000000, ($4 - l) * 1000000; ts[$6, $10] = 0 } }' > $WDIR/out.lat_us
+# Trace
 #
-$BDIR/trace2heatmap.pl --unitstime=us --unitslat=us --grid --maxlat=100000 $WDIR/out.lat_us >$SVG
-#clean up
-/bin/rm $PERF
-/bin/rm $WDIR/out.lat_us
+if (( NATIVE_DECODE )); then
+	blkio_capture heatmap
+else
+	perf_capture -e block:block_rq_issue -e block:block_rq_complete -a
+fi
+s=0
+# update status message
+while (( s < SECS )); do
+	sleep 5
+	kill -0 $bgpid > /dev/null 2>&1 || break
+	(( s += 5 ))
+	statusmsg "Tracing for $SECS seconds ($s/$SECS)" 2>/dev/null
+done
+shared_wait
+
+# lower our priority before heat map generation, to reduce CPU contention:
+renice -n 19 -p $$ &>/dev/null
+
+statusmsg "Processing trace"
+if (( NATIVE_DECODE )); then
+	blkio_fold /dev/null /dev/null $OUT_LAT
+else
+	timeout 20 perf script -i $PERF_DATA | awk '{ gsub(/:/, "") } $5 ~ /issue/ { ts[$6, $10] = $4 } $5 ~ /complete/ { if (l = ts[$6, $9]) { printf "%.f %.f\n", $4 * 1000000, ($4 - l) * 1000000; ts[$6, $10] = 0 } }' > $OUT_LAT
+fi
+[ -s $OUT_LAT ] || errorexit "No disk I/O traced"
+statusmsg "Heat Map generation"
+$HM_DIR/trace2heatmap.pl --unitstime=us --unitslat=us --grid --maxlat=100000 --title="Disk I/O Latency Heat Map: $HOSTNAME, $TS" $OUT_LAT > $OUT_SVG
+rm $OUT_LAT
+
+statusmsg "Usage: $(rusage)"
+statusmsg "DONE"
+
+# $PERF_DATA file left behind for debug or custom reports
@@ -37,7 +37,6 @@ OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
 OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
 OUT_FOLDED=$WORKING_DIR/perf.folded.$$
 PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
-CGROUPFS=/sys/fs/cgroup
 
 # libraries
 . $PMDA_DIR/vectorlib.sh
@@ -47,7 +46,8 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-30}		# default to 30 seconds if not sepcified
+parseargs "$@"
+SECS=${ARG_SECS:-30}		# default to 30 seconds if not sepcified
 
 #
 # Ensure output directories exist
@@ -80,18 +80,11 @@ if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
 	#
 	# Set $cgroupfilter for perf record, and $tasklist of container PIDs.
 	#
-	# The code below assumes that $PCP_CONTAINER_NAME is a Docker container
-	# name, and so uses the docker command and cgroup v1 paths in
-	# /sys/fs/cgroup. This code will need modifications for different
-	# container software, and for cgroup v2.
+	# $PCP_CONTAINER_NAME is a Docker container name, or a container ID,
+	# resolved by vectorhelper under cgroup v1 or v2 (see vectorlib.sh).
 	#
-	UUID=$(docker inspect --format='{{ .Id }}' $PCP_CONTAINER_NAME)
-	[[ "$UUID" == "" ]] && errorexit "Container not found"
-	pid=$(docker inspect --format='{{ .State.Pid }}' $UUID)
-	cgroup=$(awk -F: '$2 == "perf_event" { print $3; exit }' /proc/$pid/cgroup)
-	[ ! -e $CGROUPFS/perf_event/$cgroup ] && errorexit "Container cgroup not found"
+	container_resolve $PCP_CONTAINER_NAME
 	cgroupfilter="--cgroup=$cgroup"
-	tasklist=$(cat $CGROUPFS/perf_event/$cgroup/tasks)
 	fgtitle="IPC Flame Graph (no idle): $PCP_CONTAINER_NAME, $TS"
 else
 	cgroupfilter=""
@@ -138,7 +131,7 @@ dump_java_maps $tasklist
 fix_node_maps $tasklist
 
 # decide upon a palette
-if pgrep -x node >/dev/null; then
+if have_procs node; then
 	color=js
 else
 	color=java
@@ -146,16 +139,35 @@ fi
 
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Processing profile"
-timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all --event-filter=$cpuevent | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED.cpu-cycles
-timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all --event-filter=$insevent | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED.instructions
-timeout 20 $FG_DIR/difffolded.pl -ns $OUT_FOLDED.instructions $OUT_FOLDED.cpu-cycles > $OUT_FOLDED.diff
-ipc=$(timeout 20 perf report --stdio | awk '
-	/^# Samples: / { if (/instructions/) { i = 1; } else { i = 0; } }
-	/^# Event count/ { if (i) { ins = $NF; } else { cyc = $NF; } }
-	END { if (cyc) { printf("%.2f\n", ins / cyc); } else { print "?" } }')
+hold_java_maps
+if (( NATIVE_DECODE )); then
+	# one pass: instruction and cycle samples are folded together, as
+	# "stack instructions cycles", with the event totals for the IPC. The
+	# idle stacks are dropped, and the columns split, before the
+	# differential is normalized to cycles, as below.
+	$VECTOR_HELPER decode -a -m $DECODE_MINPCT -t $OUT_FOLDED.totals \
+	    -e $insevent -e $cpuevent $PERF_DATA | \
+	    egrep -v 'cpu_idle|cpuidle_enter' | awk -v ins=$OUT_FOLDED.instructions \
+	    -v cyc=$OUT_FOLDED.cpu-cycles '{ n = $(NF - 1); c = $NF
+		sub(/ [0-9]+ [0-9]+$/, ""); print $0, n > ins; print $0, c > cyc }'
+	$VECTOR_HELPER diff -ns $OUT_FOLDED.instructions $OUT_FOLDED.cpu-cycles > $OUT_FOLDED.diff
+	ipc=$(awk '{ t[NR] = $NF }
+	    END { if (t[2]) { printf("%.2f\n", t[1] / t[2]); } else { print "?" } }' \
+	    $OUT_FOLDED.totals)
+	rm $OUT_FOLDED.totals $OUT_FOLDED.cpu-cycles $OUT_FOLDED.instructions
+else
+	timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all --event-filter=$cpuevent | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED.cpu-cycles
+	timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all --event-filter=$insevent | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED.instructions
+	$VECTOR_HELPER diff -ns $OUT_FOLDED.instructions $OUT_FOLDED.cpu-cycles > $OUT_FOLDED.diff
+	ipc=$(timeout 20 perf report --stdio -i $PERF_DATA | awk '
+		/^# Samples: / { if (/instructions/) { i = 1; } else { i = 0; } }
+		/^# Event count/ { if (i) { ins = $NF; } else { cyc = $NF; } }
+		END { if (cyc) { printf("%.2f\n", ins / cyc); } else { print "?" } }')
+	rm $OUT_FOLDED.cpu-cycles $OUT_FOLDED.instructions
+fi
+release_java_maps
 statusmsg "Flame Graph generation"
 $FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" --subtitle="IPC: $ipc; PEBS: $PEBS; red == instruction heavy, blue == stall heavy" --negate < $OUT_FOLDED.diff > $OUT_SVG
-rm $OUT_FOLDED.cpu-cycles $OUT_FOLDED.instructions
 
 # send to s3
 # statusmsg "s3 archive"
@@ -166,4 +178,4 @@ statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
 # $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# (retention in vectord.sh compresses it, and removes old output)
@@ -0,0 +1,273 @@
+/*
+ * jitdump.c - JIT code loads from jitdump files.
+ *
+ * See jitdump.h. The format is described in the Linux source, in
+ * tools/perf/Documentation/jitdump-specification.txt. The file is read while
+ * the runtime may still be appending to it, so a last record that is not
+ * complete is ignored. Files are read in the host byte order, as the host's
+ * runtimes write them.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "jitdump.h"
+
+#define JITHEADER_MAGIC		0x4A695444	/* "JiTD" */
+#define JITHEADER_SIZE		40
+#define JITDUMP_FLAGS_ARCH_TIMESTAMP	1
+#define JR_PREFIX_SIZE		16	/* id, total_size, timestamp */
+#define JR_CODE_LOAD_SIZE	56	/* then the name, and the code */
+#define JR_CODE_MOVE_SIZE	64
+
+/* record types */
+enum {
+	JIT_CODE_LOAD = 0,
+	JIT_CODE_MOVE,
+	JIT_CODE_DEBUG_INFO,
+	JIT_CODE_CLOSE,
+};
+
+/* a code index, and the name of its load, for moves */
+typedef struct jitindex {
+	uint64_t	index;
+	uint32_t	name;
+	uint32_t	reserved;
+} jitindex_t;
+
+typedef struct jitmove {
+	uint64_t	index;
+	uint64_t	addr;
+	uint64_t	size;
+	uint64_t	time;
+} jitmove_t;
+
+static inline uint64_t
+get64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof (v));
+	return v;
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof (v));
+	return v;
+}
+
+void
+jittab_init(jittab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+	strtab_init(&t->names);
+}
+
+void
+jittab_free(jittab_t *t)
+{
+	free(t->codes);
+	strtab_free(&t->names);
+	memset(t, 0, sizeof (*t));
+}
+
+static void
+jittab_add(jittab_t *t, uint64_t addr, uint64_t size, uint64_t time,
+    uint32_t name)
+{
+	jitcode_t *c;
+
+	if (size == 0 || addr + size < addr)
+		return;
+	if (t->count == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 1024;
+		t->codes = vh_realloc(t->codes, t->alloc * sizeof (jitcode_t));
+	}
+	c = &t->codes[t->count++];
+	c->addr = addr;
+	c->end = addr + size;
+	c->time = time;
+	c->name = name;
+	c->reserved = 0;
+	if (size > t->maxlen)
+		t->maxlen = size;
+}
+
+static int
+codecmp(const void *a, const void *b)
+{
+	const jitcode_t *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x->time < y->time ? -1 : x->time > y->time;
+}
+
+static int
+indexcmp(const void *a, const void *b)
+{
+	const jitindex_t *x = a, *y = b;
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* add the moves, named for the loads of their code indexes */
+static void
+jittab_moves(jittab_t *t, jitindex_t *loads, uint32_t nloads,
+    const jitmove_t *moves, uint32_t nmoves)
+{
+	const jitindex_t *ix;
+	jitindex_t key;
+	uint32_t i;
+
+	qsort(loads, nloads, sizeof (jitindex_t), indexcmp);
+	for (i = 0; i < nmoves; i++) {
+		key.index = moves[i].index;
+		if ((ix = bsearch(&key, loads, nloads, sizeof (jitindex_t),
+		    indexcmp)) != NULL)
+			jittab_add(t, moves[i].addr, moves[i].size,
+			    moves[i].time, ix->name);
+	}
+}
+
+/* read the loads and moves of a jitdump file into an empty t */
+int
+jitdump_load(jittab_t *t, const char *path)
+{
+	const unsigned char *base, *p, *name;
+	jitindex_t *loads = NULL;
+	jitmove_t *moves = NULL;
+	uint32_t nloads = 0, nmoves = 0, id, size;
+	uint64_t off, fsize;
+	struct stat st;
+	size_t nlen;
+	int fd, done = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size < JITHEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+	fsize = st.st_size;
+	base = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+	if (get32(base) != JITHEADER_MAGIC || get32(base + 8) < JITHEADER_SIZE ||
+	    get32(base + 8) > fsize) {
+		vh_warn("%s: not a jitdump file", path);
+		munmap((void *)base, fsize);
+		return -1;
+	}
+	t->timed = !(get64(base + 32) & JITDUMP_FLAGS_ARCH_TIMESTAMP);
+
+	for (off = get32(base + 8); !done && off + JR_PREFIX_SIZE <= fsize;
+	    off += size) {
+		p = base + off;
+		id = get32(p);
+		size = get32(p + 4);
+		if (size < JR_PREFIX_SIZE || size > fsize - off)
+			break;
+		switch (id) {
+		case JIT_CODE_LOAD:
+			if (size <= JR_CODE_LOAD_SIZE)
+				break;
+			name = p + JR_CODE_LOAD_SIZE;
+			nlen = strnlen((const char *)name,
+			    size - JR_CODE_LOAD_SIZE);
+			if (nlen == size - JR_CODE_LOAD_SIZE)
+				break;
+			if ((nloads & (nloads - 1)) == 0)
+				loads = vh_realloc(loads, (nloads ? nloads * 2 :
+				    1) * sizeof (jitindex_t));
+			loads[nloads].index = get64(p + 48);
+			loads[nloads].name = strtab_intern(&t->names,
+			    (const char *)name, nlen);
+			loads[nloads].reserved = 0;
+			jittab_add(t, get64(p + 32), get64(p + 40),
+			    get64(p + 8), loads[nloads++].name);
+			break;
+		case JIT_CODE_MOVE:
+			if (size < JR_CODE_MOVE_SIZE)
+				break;
+			if ((nmoves & (nmoves - 1)) == 0)
+				moves = vh_realloc(moves, (nmoves ? nmoves * 2 :
+				    1) * sizeof (jitmove_t));
+			moves[nmoves].index = get64(p + 56);
+			moves[nmoves].addr = get64(p + 40);
+			moves[nmoves].size = get64(p + 48);
+			moves[nmoves++].time = get64(p + 8);
+			break;
+		case JIT_CODE_CLOSE:
+			done = 1;
+			break;
+		}
+	}
+	munmap((void *)base, fsize);
+
+	if (nmoves > 0)
+		jittab_moves(t, loads, nloads, moves, nmoves);
+	free(loads);
+	free(moves);
+	qsort(t->codes, t->count, sizeof (jitcode_t), codecmp);
+	return 0;
+}
+
+/*
+ * The code at addr at time: the latest loaded there by then, or at any
+ * time, if time is 0 or the loads have no comparable times. Returns an
+ * index of t->codes, or ST_NONE.
+ */
+uint32_t
+jittab_lookup(const jittab_t *t, uint64_t addr, uint64_t time)
+{
+	const jitcode_t *c;
+	uint32_t lo = 0, hi = t->count, mid, best = ST_NONE;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->codes[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo > 0; lo--) {
+		c = &t->codes[lo - 1];
+		if (addr - c->addr >= t->maxlen)
+			break;
+		if (addr >= c->end)
+			continue;
+		if (t->timed && time != 0 && c->time > time)
+			continue;
+		if (best == ST_NONE || c->time > t->codes[best].time)
+			best = lo - 1;
+	}
+	return best;
+}
+
+int
+jitdump_path(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	p = p != NULL ? p + 1 : path;
+	if (strncmp(p, "jit-", 4) != 0 || !isdigit((unsigned char)p[4]))
+		return 0;
+	for (p += 4; isdigit((unsigned char)*p); p++)
+		;
+	return strcmp(p, ".dump") == 0;
+}
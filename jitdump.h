@@ -0,0 +1,64 @@
+/*
+ * jitdump.h - JIT code loads from jitdump files, for resolving JIT frames
+ * by time.
+ *
+ * A runtime with a jitdump agent (node --perf-prof, the JVMTI agent of
+ * Linux perf, python -X perf_jit) writes a jit-PID.dump file, with a record
+ * for each function it compiles: its address, size and name, and the time
+ * it was loaded. It also maps the file executable, so that perf record sees
+ * where it is. Unlike /tmp/perf-PID.map, which a tidy keeps only the most
+ * recent function at each address of, the dump keeps every load, so a
+ * sample is resolved with the function that was at its address at its time:
+ * the latest load there before the sample.
+ *
+ * A jittab is sorted by address, as a process's maps are, and searched the
+ * same way (see proc_map() in perfdata.c): back from the last load starting
+ * at or before an address, as far as the longest load.
+ *
+ * Load times are CLOCK_MONOTONIC, unless the agent used the CPU's timestamp
+ * counter (JITDUMP_FLAGS_ARCH_TIMESTAMP), and are comparable with sample
+ * times only if perf record used the same clock (-k mono). Otherwise, the
+ * latest load at an address is used for all samples, as in a tidied map.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef JITDUMP_H
+#define JITDUMP_H
+
+#include <stdint.h>
+#include "stacktab.h"
+
+typedef struct jitcode {
+	uint64_t	addr;
+	uint64_t	end;		/* exclusive */
+	uint64_t	time;		/* loaded, or moved here */
+	uint32_t	name;		/* string ID */
+	uint32_t	reserved;
+} jitcode_t;
+
+typedef struct jittab {
+	jitcode_t	*codes;		/* sorted by address, once loaded */
+	uint32_t	count;
+	uint32_t	alloc;
+	uint64_t	maxlen;		/* longest load */
+	int		timed;		/* times are CLOCK_MONOTONIC */
+	strtab_t	names;
+} jittab_t;
+
+void	jittab_init(jittab_t *);
+void	jittab_free(jittab_t *);
+int	jitdump_load(jittab_t *, const char *path);
+uint32_t jittab_lookup(const jittab_t *, uint64_t addr, uint64_t time);
+
+static inline const char *
+jit_name(const jittab_t *t, const jitcode_t *c)
+{
+	return strtab_str(&t->names, c->name);
+}
+
+/* return 1 if path names a jitdump file, jit-PID.dump */
+int	jitdump_path(const char *path);
+
+#endif /* JITDUMP_H */
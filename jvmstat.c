@@ -0,0 +1,203 @@
+/*
+ * jvmstat.c - JIT code state of a JVM, from its hsperfdata counters.
+ *
+ * A HotSpot JVM exports its performance counters (what jstat reads) in a
+ * memory mapped file, /tmp/hsperfdata_USER/PID, named with its PID in its
+ * own namespace. Among them are counts of the methods compiled and of the
+ * compiled methods invalidated: the code cache changes only when these do,
+ * so a perf map dumped from a JVM stays current while they are unchanged.
+ * This lets the Java map refresh (see perfmaplib.sh) skip the JVMs that
+ * have compiled nothing since their last dump, without attaching to them.
+ *
+ * The file is a prologue, then entries, each a name and a value, in the
+ * byte order given in the prologue:
+ *
+ *	prologue: magic 0xcafec0c0, byte_order, major, minor, accessible,
+ *	    used, overflow, mod_time_stamp, entry_offset, num_entries
+ *	entry: entry_length, name_offset, vector_length, data_type, flags,
+ *	    data_units, data_variability, data_offset
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "procs.h"
+
+#define HSP_MAGIC	0xcafec0c0
+#define HSP_PROLOGUE	32
+#define HSP_ENTRY	20
+#define HSP_MAXSIZE	(1 << 20)
+
+/* counters of the code cache, in the order printed */
+static const char *jit_counters[] = {
+	"sun.ci.totalCompiles",
+	"sun.ci.totalInvalidates",
+};
+#define NCOUNTERS	(sizeof (jit_counters) / sizeof (jit_counters[0]))
+
+typedef struct hsperf {
+	unsigned char	*buf;
+	size_t		size;
+	int		big;		/* big endian */
+} hsperf_t;
+
+static uint32_t
+hsp32(const hsperf_t *h, size_t off)
+{
+	const unsigned char *p = h->buf + off;
+
+	if (h->big)
+		return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	return (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+static uint64_t
+hsp64(const hsperf_t *h, size_t off)
+{
+	uint64_t hi = hsp32(h, off + (h->big ? 0 : 4));
+	uint64_t lo = hsp32(h, off + (h->big ? 4 : 0));
+
+	return hi << 32 | lo;
+}
+
+/* read a whole hsperfdata file, which the JVM is updating as it is read */
+static int
+hsperf_read(hsperf_t *h, const char *path)
+{
+	struct stat st;
+	ssize_t n;
+	size_t len = 0;
+	int fd;
+
+	memset(h, 0, sizeof (*h));
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || st.st_size < HSP_PROLOGUE ||
+	    st.st_size > HSP_MAXSIZE) {
+		close(fd);
+		return -1;
+	}
+	h->buf = vh_malloc(st.st_size);
+	while (len < (size_t)st.st_size &&
+	    (n = read(fd, h->buf + len, st.st_size - len)) > 0)
+		len += n;
+	close(fd);
+	h->size = len;
+	/* the magic is written big endian on all hosts */
+	h->big = 1;
+	if (len < HSP_PROLOGUE || hsp32(h, 0) != HSP_MAGIC) {
+		free(h->buf);
+		return -1;
+	}
+	h->big = h->buf[4] == 0;
+	return 0;
+}
+
+/* the value of a long counter, or -1 */
+static int64_t
+hsperf_counter(const hsperf_t *h, const char *name)
+{
+	size_t off, len, nlen = strlen(name) + 1;
+	uint32_t i, count, noff, doff;
+
+	off = hsp32(h, 24);
+	count = hsp32(h, 28);
+	for (i = 0; i < count && off + HSP_ENTRY <= h->size; i++, off += len) {
+		len = hsp32(h, off);
+		noff = hsp32(h, off + 4);
+		doff = hsp32(h, off + 16);
+		if (len < HSP_ENTRY || len > h->size - off)
+			break;
+		/* a scalar long: vector_length 0, data_type 'J' */
+		if (hsp32(h, off + 8) != 0 || h->buf[off + 12] != 'J' ||
+		    noff + nlen > len || doff + 8 > len)
+			continue;
+		if (memcmp(h->buf + off + noff, name, nlen) == 0)
+			return hsp64(h, off + doff);
+	}
+	return -1;
+}
+
+/* the PID of a process in its own PID namespace */
+static long
+proc_nspid(int pid)
+{
+	char path[64], line[512], *p;
+	long nspid = pid;
+	FILE *fp;
+
+	snprintf(path, sizeof (path), "/proc/%d/status", pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (strncmp(line, "NSpid:", 6) != 0)
+			continue;
+		/* the last is the PID in the innermost namespace */
+		if ((p = strrchr(line, '\t')) != NULL ||
+		    (p = strrchr(line, ' ')) != NULL)
+			nspid = strtol(p + 1, NULL, 10);
+		break;
+	}
+	fclose(fp);
+	return nspid;
+}
+
+/*
+ * jvmstamp pid: print a stamp of the JIT code state of a JVM, its start
+ * time and code cache counters, which changes when its code does. Exits 1
+ * if the JVM has no readable hsperfdata (eg, -XX:-UsePerfData).
+ */
+int
+cmd_jvmstamp(int argc, char **argv)
+{
+	uint64_t start;
+	char pattern[128];
+	hsperf_t h;
+	glob_t g;
+	int64_t values[NCOUNTERS];
+	long nspid;
+	size_t i, j;
+	int pid, found = 0;
+
+	if (argc != 2 || (pid = atoi(argv[1])) <= 0)
+		return 2;
+	if (proc_starttime(pid, &start) != 0 || (nspid = proc_nspid(pid)) < 0) {
+		vh_warn("no such process: %d", pid);
+		return 1;
+	}
+
+	/* the file is in the JVM's /tmp, in a directory per user */
+	snprintf(pattern, sizeof (pattern),
+	    "/proc/%d/root/tmp/hsperfdata_*/%ld", pid, nspid);
+	if (glob(pattern, 0, NULL, &g) != 0)
+		return 1;
+	for (i = 0; i < g.gl_pathc && !found; i++) {
+		if (hsperf_read(&h, g.gl_pathv[i]) != 0)
+			continue;
+		found = 1;
+		for (j = 0; j < NCOUNTERS; j++) {
+			values[j] = hsperf_counter(&h, jit_counters[j]);
+			if (values[j] < 0)
+				found = 0;
+		}
+		free(h.buf);
+	}
+	globfree(&g);
+	if (!found)
+		return 1;
+
+	printf("%" PRIu64, start);
+	for (i = 0; i < NCOUNTERS; i++)
+		printf(" %" PRId64, values[i]);
+	putchar('\n');
+	return 0;
+}
@@ -47,7 +47,8 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-5}		# default to 5 seconds if not sepcified
+parseargs "$@"
+SECS=${ARG_SECS:-5}		# default to 5 seconds if not sepcified
 
 #
 # Ensure output directories exist
@@ -60,7 +61,7 @@ SECS=${1:-5}		# default to 5 seconds if not sepcified
 # terminator for new log group:
 echo >&2
 
-if ! grep -w bpf_get_stackid /proc/kallsyms > /dev/null 2>&1; then
+if ! $VECTOR_HELPER ksym bpf_get_stackid 2>/dev/null; then
 	# check for the capability rather than the kernel version, because it
 	# may have been backported.
 	errorexit "BPF stacks not available on this kernel version (see help)"
@@ -68,19 +69,41 @@ fi
 if [ ! -e $BCC_DIR/offwaketime ]; then
 	errorexit "bcc/BPF tool offwaketime not installed ($BCC_DIR)"
 fi
+if [[ "$OPT_range" != "" ]]; then
+	# offwaketime sums in kernel context, so samples have no times to query
+	errorexit "range= not supported: off-CPU time is summed in kernel"
+fi
 
 debugtime "$0 start, container=$PCP_CONTAINER_NAME"
-statusmsg "Tracing for $SECS seconds"
 
-# XXX make container aware when bcc tool supports it
-cgroupfilter=""
-tasklist=""
-fgtitle="Off-Wake Time Flame Graph: $HOSTNAME, $TS"
+if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
+	#
+	# The bcc tools trace the whole host. bpfstacks.py traces the same
+	# events, but counts only those of the container's tasks, filtered in
+	# kernel context by cgroup ID or PID (see container_bpffilter).
+	#
+	container_resolve $PCP_CONTAINER_NAME
+	container_bpffilter
+	tracer="$PMDA_DIR/bpfstacks.py $cgroupfilter offwake"
+	fgtitle="Off-Wake Time Flame Graph: $PCP_CONTAINER_NAME, $TS"
+else
+	cgroupfilter=""
+	tasklist=""
+	tracer="${BCC_DIR}/offwaketime -df"
+	fgtitle="Off-Wake Time Flame Graph: $HOSTNAME, $TS"
+fi
+
+# symbols are translated as the tracer exits, so JIT symbol maps must be in
+# place beforehand.
+statusmsg "Collecting symbol maps"
+dump_java_maps $tasklist
+fix_node_maps $tasklist
 
 #
 # Trace
 #
-${BCC_DIR}/offwaketime -df $SECS > $OUT_FOLDED &
+statusmsg "Tracing for $SECS seconds"
+$tracer $SECS > $OUT_FOLDED &
 bgpid=$!
 s=0
 # update status message
@@ -99,22 +122,20 @@ status=$?
 # lower our priority before flame graph generation, to reduce CPU contention:
 renice -n 19 -p $$ &>/dev/null
 
-# prepare symbol maps
-statusmsg "Collecting symbol maps"
-dump_java_maps $tasklist
-fix_node_maps $tasklist
-
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Flame Graph generation"
 awk '{ printf("%s %.2f\n", $1, $2 / 1000); }' $OUT_FOLDED | $FG_DIR/flamegraph.pl --minwidth=0.5 --color=chain --hash --title="$fgtitle" --countname=ms > $OUT_SVG
 
+# keep the profile in the compact binary format
+keep_profile us
+
 # send to s3
 # statusmsg "s3 archive"
 # s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
-# s3cp $OUT_FOLDED $S3BUCKET/${METRIC}-$TS.folded >/dev/null &
+# s3cp ${OUT_FOLDED/perf.folded/perf.profile} $S3BUCKET/${METRIC}-$TS.profile >/dev/null &
 
 statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
 # $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# (retention in vectord.sh compresses it, and removes old output)
@@ -3,7 +3,10 @@
 # pagefaultflamegraph - a Vector pcp pmda for generating a page fault flame
 #			graph, for the analysis of RSS growth
 #
-# USAGE: pagefaultflamegraph [seconds]
+# USAGE: pagefaultflamegraph [seconds] [stream]
+#
+# stream decodes the capture while it runs, rather than writing perf.data and
+# reading it back afterwards, so the flame graph is ready sooner.
 #
 # The $PCP_CONTAINER_NAME environment variable will be read, and if it is
 # not NULL, a CPU flame graph will be generated for the container name it
@@ -38,7 +41,6 @@ OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
 OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
 OUT_FOLDED=$WORKING_DIR/perf.folded.$$
 PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
-CGROUPFS=/sys/fs/cgroup
 
 # libraries
 . $PMDA_DIR/vectorlib.sh
@@ -48,7 +50,8 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-60}		# default to 60 seconds if not sepcified
+parseargs "$@"
+SECS=${ARG_SECS:-60}		# default to 60 seconds if not sepcified
 HERTZ=49
 
 #
@@ -72,18 +75,11 @@ if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
 	#
 	# Set $cgroupfilter for perf record, and $tasklist of container PIDs.
 	#
-	# The code below assumes that $PCP_CONTAINER_NAME is a Docker container
-	# name, and so uses the docker command and cgroup v1 paths in
-	# /sys/fs/cgroup. This code will need modifications for different
-	# container software, and for cgroup v2.
+	# $PCP_CONTAINER_NAME is a Docker container name, or a container ID,
+	# resolved by vectorhelper under cgroup v1 or v2 (see vectorlib.sh).
 	#
-	UUID=$(docker inspect --format='{{ .Id }}' $PCP_CONTAINER_NAME)
-	[[ "$UUID" == "" ]] && errorexit "Container not found"
-	pid=$(docker inspect --format='{{ .State.Pid }}' $UUID)
-	cgroup=$(awk -F: '$2 == "perf_event" { print $3; exit }' /proc/$pid/cgroup)
-	[ ! -e $CGROUPFS/perf_event/$cgroup ] && errorexit "Container cgroup not found"
+	container_resolve $PCP_CONTAINER_NAME
 	cgroupfilter="--cgroup=$cgroup"
-	tasklist=$(cat $CGROUPFS/perf_event/$cgroup/tasks)
 	fgtitle="Page Fault Flame Graph: $PCP_CONTAINER_NAME, $TS"
 else
 	cgroupfilter=""
@@ -91,10 +87,28 @@ else
 	fgtitle="Page Fault Flame Graph: $HOSTNAME, $TS"
 fi
 
+# fold perf script output, for perf_capture and perf_fold
+function foldstacks {
+	$FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter'
+}
+
+# fold $PERF_DATA natively, for perf_fold
+function decodestacks {
+	$VECTOR_HELPER decode -a -m $DECODE_MINPCT $PERF_DATA | egrep -v 'cpu_idle|cpuidle_enter'
+}
+
+# when streaming, samples are symbolized as they arrive, so collect maps first
+if (( OPT_stream )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+	statusmsg "Tracing for $SECS seconds"
+fi
+
 #
 # Profile
 #
-perf record -o $PERF_DATA -e page-faults -a $cgroupfilter -g sleep $SECS >/dev/null &
+perf_capture -e page-faults -a $cgroupfilter -g
 s=0
 # update status message
 while (( s < SECS )); do
@@ -108,12 +122,14 @@ wait
 renice -n 19 -p $$ &>/dev/null
 
 # prepare symbol maps
-statusmsg "Collecting symbol maps"
-dump_java_maps $tasklist
-fix_node_maps $tasklist
+if (( ! OPT_stream )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+fi
 
 # decide upon a palette
-if pgrep -x node >/dev/null; then
+if have_procs node; then
 	color=js
 else
 	color=java
@@ -121,17 +137,20 @@ fi
 
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Processing profile"
-timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED
+perf_fold
 statusmsg "Flame Graph generation"
 $FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" --countname="pagefaults" < $OUT_FOLDED > $OUT_SVG
 
+# keep the profile in the compact binary format
+keep_profile
+
 # send to s3
 # statusmsg "s3 archive"
 # s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
-# s3cp $OUT_FOLDED $S3BUCKET/${METRIC}-$TS.folded >/dev/null &
+# s3cp ${OUT_FOLDED/perf.folded/perf.profile} $S3BUCKET/${METRIC}-$TS.profile >/dev/null &
 
 statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
-# $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# $PERF_DATA file left behind for debug or custom reports, unless streamed
+# (retention in vectord.sh compresses it, and removes old output)
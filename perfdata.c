@@ -0,0 +1,2535 @@
+/*
+ * perfdata.c - native perf.data reader, decoding samples on several threads.
+ *
+ * See perfdata.h. The file format is described in the Linux source, in
+ * tools/perf/Documentation/perf.data-file-format.txt.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "containers.h"
+#include "perfdata.h"
+#include "perfscript.h"
+#include "procs.h"
+#include "samplestore.h"
+
+#define PERF_MAGIC		0x32454c4946524550ULL	/* "PERFILE2" */
+#define HEADER_BUILD_ID		2		/* feature bits */
+#define HEADER_EVENT_DESC	12
+#define MISC_BUILD_ID_SIZE	(1 << 15)	/* build_id_event size is set */
+#define RECORD_CGROUP		19		/* Linux 5.7, with: */
+#define SAMPLE_CGROUP		(1ULL << 21)
+#define SAMPLE_PHYS_ADDR	(1ULL << 19)
+#define SAMPLE_WEIGHT_STRUCT	(1ULL << 24)
+#define MAXTHREADS		64
+#define MAXFRAMES		1024
+#define FUNCMAX			4096
+
+/* frame context, from callchain markers or the CPU mode */
+enum { CTX_USER, CTX_KERNEL, CTX_OTHER };
+
+typedef struct pd_section {
+	uint64_t	offset;
+	uint64_t	size;
+} pd_section_t;
+
+typedef struct pd_header {
+	uint64_t	magic;
+	uint64_t	size;
+	uint64_t	attr_size;
+	pd_section_t	attrs;
+	pd_section_t	data;
+	pd_section_t	event_types;
+	uint64_t	features[4];
+} pd_header_t;
+
+static inline uint64_t
+get64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof (v));
+	return v;
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof (v));
+	return v;
+}
+
+static inline uint16_t
+get16(const unsigned char *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof (v));
+	return v;
+}
+
+/*
+ * ID hashes
+ */
+
+static uint32_t *
+idmap_find(const pd_idmap_t *m, int32_t key)
+{
+	uint32_t i, mask = m->size - 1;
+
+	if (m->size == 0)
+		return NULL;
+	for (i = (uint32_t)key * 2654435761U & mask; m->val[i] != ST_NONE;
+	    i = (i + 1) & mask) {
+		if (m->key[i] == key)
+			return &m->val[i];
+	}
+	return NULL;
+}
+
+static void
+idmap_put(pd_idmap_t *m, int32_t key, uint32_t val)
+{
+	int32_t *okey = m->key;
+	uint32_t *oval = m->val, osize = m->size, i, mask;
+
+	if ((m->count + 1) * 2 > m->size) {
+		m->size = osize ? osize * 2 : 1024;
+		m->key = vh_malloc(m->size * sizeof (int32_t));
+		m->val = vh_malloc(m->size * sizeof (uint32_t));
+		memset(m->val, 0xff, m->size * sizeof (uint32_t));
+		m->count = 0;
+		for (i = 0; i < osize; i++) {
+			if (oval[i] != ST_NONE)
+				idmap_put(m, okey[i], oval[i]);
+		}
+		free(okey);
+		free(oval);
+	}
+	mask = m->size - 1;
+	for (i = (uint32_t)key * 2654435761U & mask; m->val[i] != ST_NONE;
+	    i = (i + 1) & mask) {
+		if (m->key[i] == key) {
+			m->val[i] = val;
+			return;
+		}
+	}
+	m->key[i] = key;
+	m->val[i] = val;
+	m->count++;
+}
+
+static void
+idmap_free(pd_idmap_t *m)
+{
+	free(m->key);
+	free(m->val);
+	memset(m, 0, sizeof (*m));
+}
+
+/*
+ * Header and attributes
+ */
+
+/* name events as perf does, for files without event descriptions */
+static void
+attr_name(pd_attr_t *a)
+{
+	static const char *hw[] = { "cycles", "instructions",
+	    "cache-references", "cache-misses", "branches", "branch-misses",
+	    "bus-cycles" };
+	static const char *sw[] = { "cpu-clock", "task-clock", "page-faults",
+	    "context-switches", "cpu-migrations", "minor-faults",
+	    "major-faults" };
+
+	if (a->type == PERF_TYPE_HARDWARE && a->config < 7)
+		snprintf(a->name, sizeof (a->name), "%s", hw[a->config]);
+	else if (a->type == PERF_TYPE_SOFTWARE && a->config < 7)
+		snprintf(a->name, sizeof (a->name), "%s", sw[a->config]);
+	else
+		snprintf(a->name, sizeof (a->name), "event-%u:%" PRIu64,
+		    a->type, a->config);
+}
+
+static int
+idcmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* read attributes and their sample IDs */
+static int
+read_attrs(perfdata_t *pd, const pd_header_t *h)
+{
+	const unsigned char *p;
+	pd_section_t ids;
+	pd_attr_t *a;
+	uint64_t i, j, n, *pairs;
+	uint32_t nids = 0;
+
+	if (h->attr_size < 64 + sizeof (ids) || h->attrs.offset > pd->size ||
+	    h->attrs.size > pd->size - h->attrs.offset)
+		return -1;
+	n = h->attrs.size / h->attr_size;
+	if (n == 0 || n > PD_MAXATTRS)
+		return -1;
+	pairs = NULL;
+	pd->monotonic = 1;
+	for (i = 0; i < n; i++) {
+		p = pd->base + h->attrs.offset + i * h->attr_size;
+		a = &pd->attrs[i];
+		a->type = get32(p);
+		a->config = get64(p + 8);
+		a->sample_type = get64(p + 24);
+		a->read_format = get64(p + 32);
+		a->sample_id_all = (get64(p + 40) >> 18) & 1;
+		/* use_clockid, and clockid, in attrs of 96 bytes or more */
+		if (!((get64(p + 40) >> 25) & 1) || get32(p + 4) < 96 ||
+		    (int32_t)get32(p + 92) != CLOCK_MONOTONIC)
+			pd->monotonic = 0;
+		attr_name(a);
+		memcpy(&ids, p + h->attr_size - sizeof (ids), sizeof (ids));
+		if (ids.offset > pd->size || ids.size > pd->size - ids.offset)
+			continue;
+		pairs = vh_realloc(pairs, (nids + ids.size / 8) * 2 *
+		    sizeof (uint64_t) + 1);
+		for (j = 0; j < ids.size / 8; j++, nids++) {
+			pairs[nids * 2] = get64(pd->base + ids.offset + j * 8);
+			pairs[nids * 2 + 1] = i;
+		}
+	}
+	pd->nattrs = n;
+
+	/* sorted, for a binary search per sample */
+	if (nids > 0)
+		qsort(pairs, nids, 2 * sizeof (uint64_t), idcmp);
+	pd->ids = vh_malloc(nids * sizeof (uint64_t) + 1);
+	pd->idattr = vh_malloc(nids * sizeof (int) + 1);
+	for (j = 0; j < nids; j++) {
+		pd->ids[j] = pairs[j * 2];
+		pd->idattr[j] = pairs[j * 2 + 1];
+	}
+	pd->nids = nids;
+	free(pairs);
+	return 0;
+}
+
+/* a feature section, or NULL if the feature is absent */
+static const unsigned char *
+feature(const perfdata_t *pd, const pd_header_t *h, int feat, uint64_t *size)
+{
+	pd_section_t sec;
+	uint64_t off;
+	int bit;
+
+	/* feature sections follow the data, one per feature bit set */
+	if (!(h->features[feat / 64] & (1ULL << (feat % 64))))
+		return NULL;
+	off = h->data.offset + h->data.size;
+	for (bit = 0; bit < feat; bit++) {
+		if (h->features[bit / 64] & (1ULL << (bit % 64)))
+			off += sizeof (sec);
+	}
+	if (off + sizeof (sec) > pd->size)
+		return NULL;
+	memcpy(&sec, pd->base + off, sizeof (sec));
+	if (sec.offset > pd->size || sec.size > pd->size - sec.offset)
+		return NULL;
+	*size = sec.size;
+	return pd->base + sec.offset;
+}
+
+/* use the event names from the HEADER_EVENT_DESC feature, if present */
+static void
+read_event_desc(perfdata_t *pd, const pd_header_t *h)
+{
+	const unsigned char *p, *end;
+	uint64_t size;
+	uint32_t nevents, attrsz, nids, len, i;
+
+	if ((p = feature(pd, h, HEADER_EVENT_DESC, &size)) == NULL || size < 8)
+		return;
+	end = p + size;
+	nevents = get32(p);
+	attrsz = get32(p + 4);
+	p += 8;
+	for (i = 0; i < nevents && i < (uint32_t)pd->nattrs; i++) {
+		if ((size_t)(end - p) < attrsz + 8)
+			return;
+		p += attrsz;
+		nids = get32(p);
+		len = get32(p + 4);
+		p += 8;
+		if ((size_t)(end - p) < len || len == 0)
+			return;
+		snprintf(pd->attrs[i].name, sizeof (pd->attrs[i].name), "%.*s",
+		    (int)strnlen((const char *)p, len), p);
+		p += len;
+		if ((size_t)(end - p) < (size_t)nids * 8)
+			return;
+		p += (size_t)nids * 8;
+	}
+}
+
+static int
+id_attr(const perfdata_t *pd, uint64_t id)
+{
+	uint32_t lo = 0, hi = pd->nids, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (pd->ids[mid] == id)
+			return pd->idattr[mid];
+		if (pd->ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+int
+pd_attrnum(const perfdata_t *pd, const char *event)
+{
+	int i;
+
+	for (i = 0; i < pd->nattrs; i++) {
+		if (strcmp(pd->attrs[i].name, event) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Process state
+ */
+
+static pd_proc_t *
+proc_get(perfdata_t *pd, int32_t pid, int create)
+{
+	uint32_t *ix;
+	pd_proc_t *p;
+
+	if ((ix = idmap_find(&pd->procmap, pid)) != NULL)
+		return &pd->procs[*ix];
+	if (!create)
+		return NULL;
+	if ((pd->nprocs & (pd->nprocs - 1)) == 0)
+		pd->procs = vh_realloc(pd->procs,
+		    (pd->nprocs ? pd->nprocs * 2 : 1) * sizeof (pd_proc_t));
+	p = &pd->procs[pd->nprocs];
+	memset(p, 0, sizeof (*p));
+	p->pid = pid;
+	p->ppid = -1;
+	snprintf(p->jitpath, sizeof (p->jitpath), "/tmp/perf-%d.map", pid);
+	p->jitdump = ST_NONE;
+	idmap_put(&pd->procmap, pid, pd->nprocs++);
+	return p;
+}
+
+static pd_thread_t *
+thread_get(perfdata_t *pd, int32_t tid, int create)
+{
+	uint32_t *ix;
+	pd_thread_t *t;
+
+	if ((ix = idmap_find(&pd->threadmap, tid)) != NULL)
+		return &pd->threads[*ix];
+	if (!create)
+		return NULL;
+	if ((pd->nthreads & (pd->nthreads - 1)) == 0)
+		pd->threads = vh_realloc(pd->threads, (pd->nthreads ?
+		    pd->nthreads * 2 : 1) * sizeof (pd_thread_t));
+	t = &pd->threads[pd->nthreads];
+	memset(t, 0, sizeof (*t));
+	t->tid = tid;
+	idmap_put(&pd->threadmap, tid, pd->nthreads++);
+	return t;
+}
+
+static void
+thread_comm(perfdata_t *pd, int32_t tid, uint64_t time, const char *comm)
+{
+	pd_thread_t *t = thread_get(pd, tid, 1);
+	pd_comm_t *c;
+
+	t->comms = vh_realloc(t->comms, (t->ncomms + 1) * sizeof (pd_comm_t));
+	c = &t->comms[t->ncomms++];
+	c->time = time;
+	snprintf(c->comm, sizeof (c->comm), "%s", comm);
+}
+
+/* the name of a thread at a time, or NULL if unknown */
+const char *
+pd_comm(const perfdata_t *pd, int32_t tid, uint64_t time)
+{
+	const pd_thread_t *t;
+	uint32_t *ix, i;
+
+	if ((ix = idmap_find(&pd->threadmap, tid)) == NULL) {
+		return tid == 0 ? "swapper" : NULL;
+	}
+	t = &pd->threads[*ix];
+	if (t->ncomms == 0)
+		return NULL;
+	for (i = t->ncomms; i > 1; i--) {
+		if (t->comms[i - 1].time <= time)
+			break;
+	}
+	return t->comms[i - 1].comm;
+}
+
+static uint32_t
+dso_get(perfdata_t *pd, const char *path, int32_t pid)
+{
+	uint32_t id = strtab_intern(&pd->dsonames, path, strlen(path));
+	pd_dso_t *d;
+
+	if (id < pd->ndsos)
+		return id;
+	pd->dsos = vh_realloc(pd->dsos, (id + 1) * sizeof (pd_dso_t));
+	d = &pd->dsos[pd->ndsos++];
+	memset(d, 0, sizeof (*d));
+	d->pid = pid;
+	if (strcmp(path, "[vdso]") == 0)
+		d->kind = PD_DSO_VDSO;
+	else if (jitdump_path(path))
+		d->kind = PD_DSO_JITDUMP;
+	else if (path[0] == '[' || strcmp(path, "//anon") == 0 ||
+	    strcmp(path, "/dev/zero") == 0 ||
+	    strncmp(path, "/anon_hugepage", 14) == 0 ||
+	    strncmp(path, "/memfd:", 7) == 0)
+		d->kind = PD_DSO_ANON;
+	else
+		d->kind = PD_DSO_ELF;
+	return id;
+}
+
+static void
+proc_map_add(perfdata_t *pd, int32_t pid, uint64_t start, uint64_t len,
+    uint64_t pgoff, uint64_t time, const char *path)
+{
+	pd_proc_t *p;
+	pd_map_t *m;
+	uint32_t dso;
+
+	if (pid == -1 || len == 0)
+		return;			/* kernel maps: kallsyms is used */
+	dso = dso_get(pd, path, pid);
+	p = proc_get(pd, pid, 1);
+	if (pd->dsos[dso].kind == PD_DSO_JITDUMP) {
+		/* mapped by the agent, so that its path is recorded */
+		p->jitdump = dso;
+		return;
+	}
+	if (p->nmaps == p->mapsalloc) {
+		p->mapsalloc = p->mapsalloc ? p->mapsalloc * 2 : 64;
+		p->maps = vh_realloc(p->maps, p->mapsalloc * sizeof (pd_map_t));
+	}
+	m = &p->maps[p->nmaps++];
+	m->start = start;
+	m->end = start + len;
+	m->pgoff = pgoff;
+	m->time = time;
+	m->dso = dso;
+	if (len > p->maxlen)
+		p->maxlen = len;
+}
+
+static int
+mapcmp(const void *a, const void *b)
+{
+	const pd_map_t *x = a, *y = b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/*
+ * The map of a process containing addr at time: the latest mapped by then,
+ * or of the parent process, for a child that has not called exec.
+ */
+static const pd_map_t *
+proc_map(const perfdata_t *pd, const pd_proc_t *p, uint64_t addr,
+    uint64_t time)
+{
+	const pd_map_t *m, *best, *any;
+	uint32_t lo, hi, mid, *ix;
+	int depth;
+
+	for (depth = 0; p != NULL && depth < 8; depth++) {
+		lo = 0;
+		hi = p->nmaps;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (p->maps[mid].start <= addr)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		best = any = NULL;
+		for (; lo > 0; lo--) {
+			m = &p->maps[lo - 1];
+			if (addr - m->start >= p->maxlen)
+				break;
+			if (addr >= m->end)
+				continue;
+			any = m;
+			if ((time == 0 || m->time <= time) &&
+			    (best == NULL || m->time > best->time))
+				best = m;
+		}
+		if (best != NULL || any != NULL)
+			return best ? best : any;
+		if (p->ppid == -1 || p->ppid == p->pid ||
+		    (ix = idmap_find(&pd->procmap, p->ppid)) == NULL)
+			break;
+		p = &pd->procs[*ix];
+	}
+	return NULL;
+}
+
+static int
+cgroupcmp(const void *a, const void *b)
+{
+	const pd_cgroup_t *x = a, *y = b;
+
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/* the path of a cgroup, by its ID in samples, or NULL */
+const char *
+pd_cgroup(const perfdata_t *pd, uint64_t id)
+{
+	const pd_cgroup_t *c;
+	pd_cgroup_t key;
+
+	if (pd->ncgroups == 0)
+		return NULL;
+	key.id = id;
+	c = bsearch(&key, pd->cgroups, pd->ncgroups, sizeof (pd_cgroup_t),
+	    cgroupcmp);
+	return c != NULL ? strtab_str(&pd->cgnames, c->name) : NULL;
+}
+
+/* the time of a non-sample record, from its sample_id_all fields */
+static uint64_t
+record_time(const perfdata_t *pd, const unsigned char *rec, size_t size)
+{
+	const pd_attr_t *a = &pd->attrs[0];
+	uint64_t st = a->sample_type, bits;
+	size_t trailer;
+
+	if (pd->nattrs > 1 && (st & PERF_SAMPLE_IDENTIFIER) && size >= 16)
+		a = &pd->attrs[id_attr(pd, get64(rec + size - 8))];
+	st = a->sample_type;
+	if (!a->sample_id_all || !(st & PERF_SAMPLE_TIME))
+		return 0;
+	bits = st & (PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_ID |
+	    PERF_SAMPLE_STREAM_ID | PERF_SAMPLE_CPU | PERF_SAMPLE_IDENTIFIER);
+	trailer = __builtin_popcountll(bits) * 8;
+	if (trailer + 8 > size)
+		return 0;
+	rec += size - trailer;
+	if (st & PERF_SAMPLE_TID)
+		rec += 8;
+	return get64(rec);
+}
+
+/*
+ * First pass: process state, and chunk offsets.
+ */
+static void
+pd_scan(perfdata_t *pd)
+{
+	const unsigned char *rec, *body, *end;
+	uint64_t off, start, len, pgoff, time;
+	uint32_t type, size, alloc = 0, cgalloc = 0;
+	int32_t pid, ppid, tid, ptid;
+	const char *name;
+	pd_proc_t *p;
+	size_t nlen;
+
+	for (off = pd->data; off + 8 <= pd->dataend; off += size) {
+		rec = pd->base + off;
+		type = get32(rec);
+		size = get16(rec + 6);
+		if (size < 8 || off + size > pd->dataend) {
+			vh_warn("perf.data truncated at offset %" PRIu64, off);
+			pd->dataend = off;
+			break;
+		}
+		body = rec + 8;
+		end = rec + size;
+
+		switch (type) {
+		case PERF_RECORD_SAMPLE:
+			if (pd->nsamples % PD_CHUNK == 0) {
+				if (pd->nchunks == alloc) {
+					alloc = alloc ? alloc * 2 : 256;
+					pd->chunks = vh_realloc(pd->chunks,
+					    alloc * sizeof (uint64_t));
+				}
+				pd->chunks[pd->nchunks++] = off;
+			}
+			pd->nsamples++;
+			break;
+		case PERF_RECORD_MMAP:
+		case PERF_RECORD_MMAP2:
+			/* only executable maps are of interest */
+			if (get16(rec + 4) & PERF_RECORD_MISC_MMAP_DATA)
+				break;
+			if (size < (type == PERF_RECORD_MMAP ? 40 : 72))
+				break;
+			pid = get32(body);
+			start = get64(body + 8);
+			len = get64(body + 16);
+			pgoff = get64(body + 24);
+			name = (const char *)body + 32;
+			if (type == PERF_RECORD_MMAP2) {
+				if (!(get32(body + 56) & PROT_EXEC))
+					break;
+				name = (const char *)body + 64;
+			}
+			nlen = strnlen(name, end - (const unsigned char *)name);
+			if ((const unsigned char *)name + nlen >= end)
+				break;
+			proc_map_add(pd, pid, start, len, pgoff,
+			    record_time(pd, rec, size), name);
+			break;
+		case PERF_RECORD_COMM:
+			if (size < 17)
+				break;
+			tid = get32(body + 4);
+			name = (const char *)body + 8;
+			nlen = end - (const unsigned char *)name;
+			if (strnlen(name, nlen) == nlen)
+				break;
+			thread_comm(pd, tid, record_time(pd, rec, size), name);
+			break;
+		case PERF_RECORD_FORK:
+			if (size < 32)
+				break;
+			pid = get32(body);
+			ppid = get32(body + 4);
+			tid = get32(body + 8);
+			ptid = get32(body + 12);
+			time = get64(body + 16);
+			if (thread_get(pd, tid, 0) == NULL &&
+			    (name = pd_comm(pd, ptid, time)) != NULL)
+				thread_comm(pd, tid, time, name);
+			if (pid != ppid) {
+				p = proc_get(pd, pid, 1);
+				if (p->nmaps == 0)
+					p->ppid = ppid;
+			}
+			break;
+		case RECORD_CGROUP:
+			/* id, path */
+			if (size < 17)
+				break;
+			name = (const char *)body + 8;
+			nlen = end - (const unsigned char *)name;
+			if (strnlen(name, nlen) == nlen)
+				break;
+			if (pd->ncgroups == cgalloc) {
+				cgalloc = cgalloc ? cgalloc * 2 : 64;
+				pd->cgroups = vh_realloc(pd->cgroups,
+				    cgalloc * sizeof (pd_cgroup_t));
+			}
+			pd->cgroups[pd->ncgroups].id = get64(body);
+			pd->cgroups[pd->ncgroups++].name = strtab_intern(
+			    &pd->cgnames, name, strlen(name));
+			break;
+		}
+	}
+}
+
+/*
+ * Note the build IDs that perf record saves for the objects with samples, so
+ * that symbols are loaded from the symbol cache, or from the right file.
+ */
+static void
+read_build_ids(perfdata_t *pd, const pd_header_t *h)
+{
+	const unsigned char *p, *end;
+	const char *name;
+	uint64_t size;
+	uint32_t recsz, idsz, id, i;
+
+	if ((p = feature(pd, h, HEADER_BUILD_ID, &size)) == NULL)
+		return;
+	/* records: header, pid, build ID (24 bytes), filename */
+	for (end = p + size; (size_t)(end - p) >= 8; p += recsz) {
+		recsz = get16(p + 6);
+		if (recsz < 8 + 4 + 24 + 1 || recsz > (size_t)(end - p))
+			break;
+		idsz = get16(p + 4) & MISC_BUILD_ID_SIZE ? p[8 + 4 + 20] : 20;
+		if (idsz == 0 || idsz > 20)
+			continue;
+		name = (const char *)p + 8 + 4 + 24;
+		if (strnlen(name, recsz - 36) == recsz - 36)
+			continue;
+		id = strtab_lookup(&pd->dsonames, name, strlen(name));
+		if (id == ST_NONE)
+			continue;
+		for (i = 0; i < idsz; i++)
+			sprintf(pd->dsos[id].buildid + i * 2, "%02x", p[12 + i]);
+	}
+}
+
+int
+pd_open(perfdata_t *pd, const char *path)
+{
+	pd_header_t h;
+	struct stat st;
+	void *base;
+	uint32_t i;
+	int fd;
+
+	memset(pd, 0, sizeof (*pd));
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		vh_warn("can't read %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof (h)) {
+		vh_warn("%s: not a perf.data file", path);
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		vh_warn("can't map %s: %s", path, strerror(errno));
+		return -1;
+	}
+	pd->base = base;
+	pd->size = st.st_size;
+	memcpy(&h, base, sizeof (h));
+	if (h.magic != PERF_MAGIC || h.size != sizeof (h)) {
+		vh_warn("%s: not a perf.data file, or written in pipe mode",
+		    path);
+		goto bad;
+	}
+	if (read_attrs(pd, &h) != 0) {
+		vh_warn("%s: bad event attributes", path);
+		goto bad;
+	}
+	/* data.size is only set once perf record exits cleanly */
+	if (h.data.offset > pd->size)
+		goto bad;
+	pd->data = h.data.offset;
+	pd->dataend = h.data.size && h.data.size <= pd->size - h.data.offset ?
+	    h.data.offset + h.data.size : pd->size;
+	if (h.data.size)
+		read_event_desc(pd, &h);
+
+	strtab_init(&pd->dsonames);
+	strtab_init(&pd->cgnames);
+	pd_scan(pd);
+	if (pd->ncgroups > 1)
+		qsort(pd->cgroups, pd->ncgroups, sizeof (pd_cgroup_t),
+		    cgroupcmp);
+	for (i = 0; i < pd->ndsos; i++)
+		pd->dsos[i].path = strtab_str(&pd->dsonames, i);
+	if (h.data.size)
+		read_build_ids(pd, &h);
+	for (i = 0; i < pd->nprocs; i++) {
+		if (pd->procs[i].nmaps > 1)
+			qsort(pd->procs[i].maps, pd->procs[i].nmaps,
+			    sizeof (pd_map_t), mapcmp);
+	}
+
+	symtab_init(&pd->kernel);
+	kallsyms_index(&pd->kernel);
+	elf_load_vdso(&pd->vdso);
+	pthread_mutex_init(&pd->lock, NULL);
+	return 0;
+
+bad:
+	munmap((void *)pd->base, pd->size);
+	free(pd->ids);
+	free(pd->idattr);
+	memset(pd, 0, sizeof (*pd));
+	return -1;
+}
+
+void
+pd_close(perfdata_t *pd)
+{
+	uint32_t i;
+
+	for (i = 0; i < pd->nprocs; i++) {
+		free(pd->procs[i].maps);
+		if (pd->procs[i].jitloaded) {
+			symtab_free(&pd->procs[i].jit);
+			jittab_free(&pd->procs[i].jd);
+		}
+	}
+	for (i = 0; i < pd->nthreads; i++)
+		free(pd->threads[i].comms);
+	for (i = 0; i < pd->ndsos; i++) {
+		if (pd->dsos[i].loaded)
+			elf_free(&pd->dsos[i].elf);
+		if (pd->dsos[i].inlloaded)
+			inltab_free(&pd->dsos[i].inl);
+		if (pd->dsos[i].lineloaded)
+			linetab_free(&pd->dsos[i].lines);
+	}
+	free(pd->procs);
+	free(pd->threads);
+	free(pd->dsos);
+	free(pd->chunks);
+	free(pd->ids);
+	free(pd->idattr);
+	idmap_free(&pd->procmap);
+	idmap_free(&pd->threadmap);
+	strtab_free(&pd->dsonames);
+	free(pd->cgroups);
+	strtab_free(&pd->cgnames);
+	symtab_free(&pd->kernel);
+	elf_free(&pd->vdso);
+	pthread_mutex_destroy(&pd->lock);
+	munmap((void *)pd->base, pd->size);
+	memset(pd, 0, sizeof (*pd));
+}
+
+/*
+ * Symbols: loaded by the first thread that needs them
+ */
+
+static const elfobj_t *
+dso_elf(perfdata_t *pd, pd_dso_t *d)
+{
+	char path[4096];
+
+	if (__atomic_load_n(&d->loaded, __ATOMIC_ACQUIRE))
+		return &d->elf;
+	pthread_mutex_lock(&pd->lock);
+	if (!d->loaded) {
+		if (elf_load(&d->elf, d->path, d->buildid) != 0) {
+			/* eg, in a container's mount namespace */
+			elf_free(&d->elf);
+			snprintf(path, sizeof (path), "/proc/%d/root%s", d->pid,
+			    d->path);
+			if (elf_load(&d->elf, path, d->buildid) != 0) {
+				elf_free(&d->elf);
+				symtab_init(&d->elf.syms);
+			}
+		}
+		__atomic_store_n(&d->loaded, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pd->lock);
+	return &d->elf;
+}
+
+static const inltab_t *
+dso_inl(perfdata_t *pd, pd_dso_t *d)
+{
+	char path[4096];
+
+	if (__atomic_load_n(&d->inlloaded, __ATOMIC_ACQUIRE))
+		return &d->inl;
+	pthread_mutex_lock(&pd->lock);
+	if (!d->inlloaded) {
+		if (elf_load_inlines(&d->inl, d->path, d->buildid) != 0) {
+			inltab_free(&d->inl);
+			snprintf(path, sizeof (path), "/proc/%d/root%s", d->pid,
+			    d->path);
+			if (elf_load_inlines(&d->inl, path, d->buildid) != 0) {
+				inltab_free(&d->inl);
+				inltab_init(&d->inl);
+			}
+		}
+		__atomic_store_n(&d->inlloaded, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pd->lock);
+	return &d->inl;
+}
+
+static const linetab_t *
+dso_lines(perfdata_t *pd, pd_dso_t *d)
+{
+	char path[4096];
+
+	if (__atomic_load_n(&d->lineloaded, __ATOMIC_ACQUIRE))
+		return &d->lines;
+	pthread_mutex_lock(&pd->lock);
+	if (!d->lineloaded) {
+		if (elf_load_lines(&d->lines, d->path, d->buildid) != 0) {
+			linetab_free(&d->lines);
+			snprintf(path, sizeof (path), "/proc/%d/root%s", d->pid,
+			    d->path);
+			if (elf_load_lines(&d->lines, path, d->buildid) != 0) {
+				linetab_free(&d->lines);
+				linetab_init(&d->lines);
+			}
+		}
+		__atomic_store_n(&d->lineloaded, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pd->lock);
+	return &d->lines;
+}
+
+/*
+ * Return 1 if a process is in our mount namespace, 0 if it is in another,
+ * eg, a container's, or -1 if that is unknown, as it has exited.
+ */
+static int
+proc_hostns(int32_t pid)
+{
+	char path[64];
+	struct stat st, self;
+
+	snprintf(path, sizeof (path), "/proc/%d/ns/mnt", pid);
+	if (stat(path, &st) != 0)
+		return -1;
+	if (stat("/proc/self/ns/mnt", &self) != 0)
+		return -1;
+	return st.st_dev == self.st_dev && st.st_ino == self.st_ino;
+}
+
+/*
+ * Load the JIT symbols of a process: its perf map, and any jitdump. The
+ * jitdump path was recorded as the process sees it, with its namespace PID,
+ * eg, /tmp/jit-7.dump in a container, so it is read through the process's
+ * root first. The same path on the host is only that process's if it is in
+ * our mount namespace, or, once it has exited, if the PIDs match.
+ */
+static const symtab_t *
+proc_jit(perfdata_t *pd, pd_proc_t *p)
+{
+	char path[4096], host[64];
+	const char *dump, *base;
+	int ns;
+
+	if (__atomic_load_n(&p->jitloaded, __ATOMIC_ACQUIRE))
+		return &p->jit;
+	pthread_mutex_lock(&pd->lock);
+	if (!p->jitloaded) {
+		symtab_init(&p->jit);
+		perfmap_load(&p->jit, p->jitpath);
+		jittab_init(&p->jd);
+		if (p->jitdump != ST_NONE) {
+			dump = pd->dsos[p->jitdump].path;
+			snprintf(path, sizeof (path), "/proc/%d/root%s", p->pid,
+			    dump);
+			base = strrchr(dump, '/');
+			snprintf(host, sizeof (host), "jit-%d.dump", p->pid);
+			ns = proc_hostns(p->pid);
+			if (ns < 0 && strcmp(base ? base + 1 : dump, host) == 0)
+				ns = 1;
+			if (jitdump_load(&p->jd, path) != 0 &&
+			    (ns != 1 || jitdump_load(&p->jd, dump) != 0)) {
+				jittab_free(&p->jd);
+				jittab_init(&p->jd);
+			}
+		}
+		__atomic_store_n(&p->jitloaded, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pd->lock);
+	return &p->jit;
+}
+
+/*
+ * Find the object and symbol of an address, without naming it. The source
+ * line is found for the leaf only: callers' addresses are return addresses,
+ * which may be on the line after the call.
+ */
+static void
+locate(perfdata_t *pd, pd_proc_t *p, uint64_t ip, uint64_t time, int ctx,
+    int leaf, pd_loc_t *l)
+{
+	const pd_map_t *m;
+	const elfobj_t *eo;
+	const linetab_t *lt;
+	const sym_t *s;
+	uint64_t vaddr;
+	uint32_t row, code;
+	pd_dso_t *d;
+
+	l->kind = PD_LOC_NONE;
+	l->obj = 0;
+	l->sym = ST_NONE;
+	l->inl = ST_NONE;
+	l->file = ST_NONE;
+	l->line = 0;
+	if (ctx == CTX_KERNEL) {
+		l->kind = PD_LOC_KERNEL;
+		if ((s = symtab_lookup(&pd->kernel, ip)) != NULL)
+			l->sym = s - pd->kernel.syms;
+		return;
+	}
+	if (ctx != CTX_USER || p == NULL ||
+	    (m = proc_map(pd, p, ip, time)) == NULL)
+		return;
+	d = &pd->dsos[m->dso];
+	if (d->kind == PD_DSO_ANON) {
+		l->kind = PD_LOC_JIT;
+		l->obj = p - pd->procs;
+		if ((s = symtab_lookup(proc_jit(pd, p), ip)) != NULL)
+			l->sym = s - p->jit.syms;
+		/* the code at the address at the sample's time, if dumped */
+		if ((code = jittab_lookup(&p->jd, ip,
+		    pd->monotonic ? time : 0)) != ST_NONE) {
+			l->kind = PD_LOC_JITDUMP;
+			l->sym = code;
+		}
+		return;
+	}
+	l->kind = PD_LOC_DSO;
+	l->obj = m->dso;
+	eo = d->kind == PD_DSO_VDSO ? &pd->vdso : dso_elf(pd, d);
+	vaddr = elf_vaddr(eo, ip - m->start + m->pgoff);
+	if ((s = symtab_lookup(&eo->syms, vaddr)) != NULL)
+		l->sym = s - eo->syms.syms;
+	if (pd->inlines && s != NULL && d->kind == PD_DSO_ELF)
+		l->inl = inltab_lookup(dso_inl(pd, d), vaddr);
+	if (pd->lines && leaf && s != NULL && d->kind == PD_DSO_ELF) {
+		lt = dso_lines(pd, d);
+		if ((row = linetab_lookup(lt, vaddr)) != ST_NONE) {
+			l->file = lt->rows[row].file;
+			l->line = lt->rows[row].line;
+		}
+	}
+}
+
+/* name a location; its symbols were loaded when it was located */
+void
+pd_symbolize(const perfdata_t *pd, const pd_loc_t *l, pd_frame_t *f)
+{
+	const symtab_t *t = NULL;
+	const jittab_t *jt;
+	const pd_dso_t *d;
+
+	f->func = "[unknown]";
+	f->mod = "[unknown]";
+	switch (l->kind) {
+	case PD_LOC_KERNEL:
+		t = &pd->kernel;
+		f->mod = "[kernel.kallsyms]";
+		if (l->sym != ST_NONE && sym_mod(t, &t->syms[l->sym]) != NULL)
+			f->mod = sym_mod(t, &t->syms[l->sym]);
+		break;
+	case PD_LOC_DSO:
+		d = &pd->dsos[l->obj];
+		t = d->kind == PD_DSO_VDSO ? &pd->vdso.syms : &d->elf.syms;
+		f->mod = d->path;
+		break;
+	case PD_LOC_JIT:
+		t = &pd->procs[l->obj].jit;
+		f->mod = pd->procs[l->obj].jitpath;
+		break;
+	case PD_LOC_JITDUMP:
+		/* named as from the map, so that frames are annotated _[j] */
+		jt = &pd->procs[l->obj].jd;
+		f->func = jit_name(jt, &jt->codes[l->sym]);
+		f->mod = pd->procs[l->obj].jitpath;
+		return;
+	}
+	if (t != NULL && l->sym != ST_NONE)
+		f->func = sym_name(t, &t->syms[l->sym]);
+}
+
+/* the functions inlined at a location, outermost first */
+int
+pd_inlined(const perfdata_t *pd, const pd_loc_t *l, const char **names,
+    int max)
+{
+	if (l->kind != PD_LOC_DSO || l->inl == ST_NONE)
+		return 0;
+	return inltab_chain(&pd->dsos[l->obj].inl, l->inl, names, max);
+}
+
+/* the source file of a location, without its directory, or NULL */
+const char *
+pd_srcfile(const perfdata_t *pd, const pd_loc_t *l)
+{
+	if (l->kind != PD_LOC_DSO || l->file == ST_NONE)
+		return NULL;
+	return line_file(&pd->dsos[l->obj].lines, l->file);
+}
+
+/* locate the stack of a sample, leaf first, returning the frame count */
+int
+pd_stack(perfdata_t *pd, const pd_sample_t *s, pd_loc_t *frames, int max)
+{
+	pd_proc_t *p = s->pid >= 0 ? proc_get(pd, s->pid, 0) : NULL;
+	uint64_t ip;
+	uint32_t i;
+	int ctx, n = 0;
+
+	switch (s->misc & PERF_RECORD_MISC_CPUMODE_MASK) {
+	case PERF_RECORD_MISC_KERNEL:
+		ctx = CTX_KERNEL;
+		break;
+	case PERF_RECORD_MISC_USER:
+		ctx = CTX_USER;
+		break;
+	default:
+		ctx = CTX_OTHER;
+	}
+	if (s->ips == NULL) {
+		locate(pd, p, s->ip, s->time, ctx, 1, &frames[0]);
+		return 1;
+	}
+	for (i = 0; i < s->nips && n < max; i++) {
+		ip = s->ips[i];
+		if (ip >= (uint64_t)PERF_CONTEXT_MAX) {
+			if (ip == (uint64_t)PERF_CONTEXT_KERNEL)
+				ctx = CTX_KERNEL;
+			else if (ip == (uint64_t)PERF_CONTEXT_USER)
+				ctx = CTX_USER;
+			else
+				ctx = CTX_OTHER;
+			continue;
+		}
+		locate(pd, p, ip, s->time, ctx, n == 0, &frames[n]);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Second pass: samples
+ */
+
+static int
+parse_sample(const perfdata_t *pd, const unsigned char *rec, pd_sample_t *s)
+{
+	const unsigned char *p = rec + 8, *end = rec + get16(rec + 6);
+	const pd_attr_t *a;
+	uint64_t st, rf, nr, n;
+
+	memset(s, 0, sizeof (*s));
+	s->pid = s->tid = s->cpu = -1;
+	s->misc = get16(rec + 4);
+	st = pd->attrs[0].sample_type;
+	if (pd->nattrs > 1) {
+		if (st & PERF_SAMPLE_IDENTIFIER)
+			s->attr = id_attr(pd, get64(p));
+		else if (st & PERF_SAMPLE_ID)
+			s->attr = id_attr(pd, get64(p + 8 *
+			    __builtin_popcountll(st & (PERF_SAMPLE_IP |
+			    PERF_SAMPLE_TID | PERF_SAMPLE_TIME |
+			    PERF_SAMPLE_ADDR))));
+	}
+	a = &pd->attrs[s->attr];
+	st = a->sample_type;
+
+#define	NEED(n)	do { if ((size_t)(end - p) < (size_t)(n)) return -1; } while (0)
+	if (st & PERF_SAMPLE_IDENTIFIER) {
+		NEED(8);
+		p += 8;
+	}
+	if (st & PERF_SAMPLE_IP) {
+		NEED(8);
+		s->ip = get64(p);
+		p += 8;
+	}
+	if (st & PERF_SAMPLE_TID) {
+		NEED(8);
+		s->pid = get32(p);
+		s->tid = get32(p + 4);
+		p += 8;
+	}
+	if (st & PERF_SAMPLE_TIME) {
+		NEED(8);
+		s->time = get64(p);
+		p += 8;
+	}
+	if (st & PERF_SAMPLE_ADDR)
+		p += 8;
+	if (st & PERF_SAMPLE_ID)
+		p += 8;
+	if (st & PERF_SAMPLE_STREAM_ID)
+		p += 8;
+	if (st & PERF_SAMPLE_CPU) {
+		NEED(8);
+		s->cpu = get32(p);
+		p += 8;
+	}
+	if (st & PERF_SAMPLE_PERIOD) {
+		NEED(8);
+		s->period = get64(p);
+		p += 8;
+	}
+	if (st & PERF_SAMPLE_READ) {
+		rf = a->read_format;
+		n = !!(rf & PERF_FORMAT_ID) + !!(rf & PERF_FORMAT_LOST) + 1;
+		if (rf & PERF_FORMAT_GROUP) {
+			NEED(8);
+			nr = get64(p);
+			p += 8;
+			n *= nr;
+		}
+		n += !!(rf & PERF_FORMAT_TOTAL_TIME_ENABLED) +
+		    !!(rf & PERF_FORMAT_TOTAL_TIME_RUNNING);
+		NEED(n * 8);
+		p += n * 8;
+	}
+	if (st & PERF_SAMPLE_CALLCHAIN) {
+		NEED(8);
+		nr = get64(p);
+		p += 8;
+		NEED(nr * 8);
+		s->nips = nr;
+		s->ips = (const uint64_t *)p;	/* records are 8 byte aligned */
+		p += nr * 8;
+	}
+	if (st & PERF_SAMPLE_RAW) {
+		NEED(4);
+		s->rawsize = get32(p);
+		NEED(4 + (size_t)s->rawsize);
+		s->raw = p + 4;
+		p += 4 + s->rawsize;
+	}
+	/* the cgroup, unless it follows variable fields that are not read */
+	if ((st & SAMPLE_CGROUP) && !(st & (PERF_SAMPLE_BRANCH_STACK |
+	    PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER |
+	    PERF_SAMPLE_REGS_INTR))) {
+		p += 8 * __builtin_popcountll(st & (PERF_SAMPLE_WEIGHT |
+		    SAMPLE_WEIGHT_STRUCT | PERF_SAMPLE_DATA_SRC |
+		    PERF_SAMPLE_TRANSACTION | SAMPLE_PHYS_ADDR));
+		NEED(8);
+		s->cgroup = get64(p);
+		p += 8;
+	}
+#undef	NEED
+	return p <= end ? 0 : -1;
+}
+
+typedef struct pd_worker {
+	perfdata_t	*pd;
+	void		(*func)(void *, const pd_sample_t *, uint32_t);
+	void		*arg;
+} pd_worker_t;
+
+static void *
+pd_work(void *warg)
+{
+	pd_worker_t *w = warg;
+	perfdata_t *pd = w->pd;
+	const unsigned char *rec;
+	pd_sample_t s;
+	uint64_t off, end;
+	uint32_t c, n;
+
+	while ((c = __atomic_fetch_add(&pd->next, 1, __ATOMIC_RELAXED)) <
+	    pd->nchunks) {
+		end = c + 1 < pd->nchunks ? pd->chunks[c + 1] : pd->dataend;
+		for (off = pd->chunks[c], n = 0; off < end && n < PD_CHUNK;
+		    off += get16(rec + 6)) {
+			rec = pd->base + off;
+			if (get32(rec) != PERF_RECORD_SAMPLE)
+				continue;
+			n++;
+			if (parse_sample(pd, rec, &s) == 0)
+				w->func(w->arg, &s, c);
+		}
+	}
+	return NULL;
+}
+
+void
+pd_decode(perfdata_t *pd, int nthreads,
+    void (*func)(void *, const pd_sample_t *, uint32_t), void **args)
+{
+	pd_worker_t w[MAXTHREADS];
+	pthread_t tids[MAXTHREADS];
+	int i, started;
+
+	if (nthreads > MAXTHREADS)
+		nthreads = MAXTHREADS;
+	pd->next = 0;
+	for (i = 0; i < nthreads; i++) {
+		w[i].pd = pd;
+		w[i].func = func;
+		w[i].arg = args[i];
+	}
+	for (started = 1; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, pd_work,
+		    &w[started]) != 0)
+			break;
+	}
+	pd_work(&w[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * The decode command aggregates samples by location before naming them:
+ * the frames of a decoder's stack table are pd_loc_t's (or LOC_COMM and a
+ * process name) interned as strings, so stacktab_merge() still merges the
+ * per-thread tables. Each location is then named once, after stacks are
+ * trimmed (decode_name), rather than once per sample.
+ *
+ * To split a capture by container (-c), each stack is rooted at a cgroup
+ * location (LOC_CGROUP and its path): the cgroup of the sample, if perf
+ * recorded it (--all-cgroups), or else the cgroup of its process at decode
+ * time. These are named as the container, or as no frame for host tasks, so
+ * that one pass yields the host's stacks by container, and each container's
+ * stacks are the ones below its root (decode_split).
+ */
+#define LOC_COMM	0x10		/* a process name, not a pd_loc_t */
+#define LOC_JAVA	0x20		/* flag: in a java process */
+#define LOC_CGROUP	0x40		/* a cgroup path, not a pd_loc_t */
+
+/* resolver counts, see resolver_stats() */
+enum {
+	RS_FRAMES = 0,			/* frames located */
+	RS_HITS,			/* found in a symbol table */
+	RS_INLINED,			/* in an inlined call */
+	RS_TIME,			/* microseconds decoding and naming */
+	RS_COUNT
+};
+
+/*
+ * Block I/O latency (-b): block_rq_issue samples, with stacks, are paired
+ * with the block_rq_complete of the same device and sector, and each I/O's
+ * time is added to its issue stack, as a second weight column.
+ */
+#define BLK_COMPLETE	ST_NONE		/* blkio_t stack of a completion */
+
+/* where a block tracepoint's raw data has the device and sector */
+typedef struct blkfmt {
+	int		attr;		/* -1 if not recorded */
+	uint32_t	dev;		/* offsets and sizes */
+	uint32_t	devsize;
+	uint32_t	sector;
+	uint32_t	secsize;
+} blkfmt_t;
+
+/* an issue or a completion */
+typedef struct blkio {
+	uint64_t	time;
+	uint64_t	sector;
+	uint32_t	dev;
+	uint32_t	stack;		/* location stack, or BLK_COMPLETE */
+} blkio_t;
+
+/* per-thread state of the decode command */
+typedef struct decoder {
+	perfdata_t	*pd;
+	const int	*colof;		/* attr -> weight column, or -1 */
+	stacktab_t	st;		/* stacks of locations */
+	sswriter_t	store;
+	psparser_t	ps;		/* for the cgroups of store samples */
+	int		cgroups;	/* root stacks at their cgroup */
+	pd_idmap_t	cgpid;		/* pid -> cgroup location, from /proc */
+	const blkfmt_t	*blk;		/* -b: issue and complete, or NULL */
+	blkio_t		*ios;
+	uint64_t	nios;
+	uint64_t	ioalloc;
+	pd_loc_t	locs[MAXFRAMES];
+	uint32_t	*chunk;		/* chunks of store samples, in order */
+	uint64_t	*first;
+	uint32_t	nranges;
+	uint64_t	counts[RS_COUNT];	/* for resolver_stats() */
+} decoder_t;
+
+/* the cgroup location of a sample, recorded or read from /proc */
+static uint32_t
+decode_cgroup(decoder_t *d, const pd_sample_t *s)
+{
+	char key[sizeof (uint32_t) + CT_PATHLEN], *v1 = NULL, *v2 = NULL;
+	const char *path = NULL;
+	uint32_t kind = LOC_CGROUP, *fid, id;
+	int32_t pid = s->pid > 0 ? s->pid : s->tid;
+	int len, proc = 0;
+
+	if (s->cgroup != 0)
+		path = pd_cgroup(d->pd, s->cgroup);
+	if (path == NULL) {
+		if ((fid = idmap_find(&d->cgpid, pid)) != NULL)
+			return *fid;
+		if (pid > 0)
+			proc_cgroups(pid, &v1, &v2);
+		path = v1 != NULL ? v1 : v2 != NULL ? v2 : "";
+		proc = 1;
+	}
+	memcpy(key, &kind, sizeof (kind));
+	len = snprintf(key + sizeof (kind), sizeof (key) - sizeof (kind), "%s",
+	    path);
+	if (len >= (int)(sizeof (key) - sizeof (kind)))
+		len = sizeof (key) - sizeof (kind) - 1;
+	id = strtab_intern(&d->st.frames, key, sizeof (kind) + len);
+	if (proc)
+		idmap_put(&d->cgpid, pid, id);
+	free(v1);
+	free(v2);
+	return id;
+}
+
+/* an unsigned field of a tracepoint's raw data */
+static int
+rawfield(const pd_sample_t *s, uint32_t off, uint32_t size, uint64_t *vp)
+{
+	if (s->raw == NULL || off + size > s->rawsize)
+		return -1;
+	if (size == 8)
+		*vp = get64(s->raw + off);
+	else if (size == 4)
+		*vp = get32(s->raw + off);
+	else
+		return -1;
+	return 0;
+}
+
+/* keep the device and sector of a block I/O issue or completion */
+static void
+decode_blkio(decoder_t *d, const blkfmt_t *f, const pd_sample_t *s,
+    uint32_t stack)
+{
+	uint64_t dev, sector;
+	blkio_t *io;
+
+	if (rawfield(s, f->dev, f->devsize, &dev) != 0 ||
+	    rawfield(s, f->sector, f->secsize, &sector) != 0)
+		return;
+	if (d->nios == d->ioalloc) {
+		d->ioalloc = d->ioalloc ? d->ioalloc * 2 : 4096;
+		d->ios = vh_realloc(d->ios, d->ioalloc * sizeof (blkio_t));
+	}
+	io = &d->ios[d->nios++];
+	io->time = s->time;
+	io->sector = sector;
+	io->dev = dev;
+	io->stack = stack;
+}
+
+static void
+decode_sample(void *arg, const pd_sample_t *s, uint32_t chunk)
+{
+	decoder_t *d = arg;
+	char key[sizeof (uint32_t) + PD_COMMLEN + 16];
+	const char *name, *cg;
+	uint32_t kind = LOC_COMM, java, *ids, id, root;
+	sample_t sample;
+	size_t len;
+	int col, n, i, r;
+
+	if (d->blk != NULL && s->attr == d->blk[1].attr) {
+		decode_blkio(d, &d->blk[1], s, BLK_COMPLETE);
+		return;
+	}
+	if ((col = d->colof[s->attr]) < 0)
+		return;
+	if (d->ps.store != NULL &&
+	    (d->nranges == 0 || d->chunk[d->nranges - 1] != chunk)) {
+		d->chunk = vh_realloc(d->chunk,
+		    (d->nranges + 1) * sizeof (uint32_t));
+		d->first = vh_realloc(d->first,
+		    (d->nranges + 1) * sizeof (uint64_t));
+		d->chunk[d->nranges] = chunk;
+		d->first[d->nranges++] = d->store.count;
+	}
+
+	memcpy(key, &kind, sizeof (kind));
+	if ((name = pd_comm(d->pd, s->tid, s->time)) != NULL)
+		len = snprintf(key + sizeof (kind), sizeof (key) - sizeof (kind),
+		    "%s", name);
+	else
+		len = snprintf(key + sizeof (kind), sizeof (key) - sizeof (kind),
+		    ":%d", s->tid);
+	java = strcmp(key + sizeof (kind), "java") == 0 ? LOC_JAVA : 0;
+
+	/*
+	 * root first: the cgroup, if split, the process name, then the stack
+	 * from its root
+	 */
+	r = d->cgroups;
+	root = r ? decode_cgroup(d, s) : ST_NONE;
+	n = pd_stack(d->pd, s, d->locs, MAXFRAMES);
+	ids = stacktab_scratch(&d->st, r + n + 1);
+	ids[0] = root;
+	ids[r] = strtab_intern(&d->st.frames, key, sizeof (kind) + len);
+	d->counts[RS_FRAMES] += n;
+	for (i = 0; i < n; i++) {
+		d->counts[RS_HITS] += d->locs[i].sym != ST_NONE;
+		d->counts[RS_INLINED] += d->locs[i].inl != ST_NONE;
+		d->locs[i].kind |= java;
+		ids[r + n - i] = strtab_intern(&d->st.frames,
+		    (const char *)&d->locs[i], sizeof (pd_loc_t));
+	}
+	id = stacktab_intern(&d->st, ids, r + n + 1);
+	stacktab_add(&d->st, id, col, 1);
+	if (d->blk != NULL)
+		decode_blkio(d, &d->blk[0], s, id);
+	if (d->ps.store == NULL)
+		return;
+
+	memset(&sample, 0, sizeof (sample));
+	sample.time = s->time;
+	sample.weight = 1;
+	sample.pid = s->pid;
+	sample.tid = s->tid;
+	sample.cpu = s->cpu;
+	sample.stack = id;
+	if (s->cgroup != 0 && (cg = pd_cgroup(d->pd, s->cgroup)) != NULL)
+		sample.cgroup = ssw_cgroup(&d->store, cg);
+	else
+		sample.cgroup = ps_cgroup(&d->ps, s->pid > 0 ? s->pid : s->tid);
+	ssw_add(&d->store, &sample);
+}
+
+typedef struct range {
+	uint32_t	chunk;
+	decoder_t	*d;
+	uint64_t	first;
+	uint64_t	end;
+} range_t;
+
+static int
+rangecmp(const void *a, const void *b)
+{
+	const range_t *x = a, *y = b;
+
+	return x->chunk < y->chunk ? -1 : x->chunk > y->chunk;
+}
+
+/*
+ * Merge the per-thread stacks and samples, with samples in file order. The
+ * stacks of block I/O issues are renumbered in place.
+ */
+static void
+decode_merge(decoder_t *dec, int n, stacktab_t *st, sswriter_t *store)
+{
+	range_t *ranges = NULL;
+	uint32_t nranges = 0, r, i, **stackmap, **cgmap;
+	const strtab_t *cg;
+	sample_t s;
+	uint64_t j;
+	decoder_t *d;
+	int t;
+
+	stackmap = vh_calloc(n, sizeof (uint32_t *));
+	cgmap = vh_calloc(n, sizeof (uint32_t *));
+	for (t = 0; t < n; t++) {
+		d = &dec[t];
+		stackmap[t] = vh_malloc(d->st.count * sizeof (uint32_t) + 1);
+		stacktab_merge(st, &d->st, stackmap[t]);
+		for (j = 0; j < d->nios; j++) {
+			if (d->ios[j].stack != BLK_COMPLETE)
+				d->ios[j].stack = stackmap[t][d->ios[j].stack];
+		}
+		if (store == NULL)
+			continue;
+		cg = &d->store.cgroups;
+		cgmap[t] = vh_malloc(cg->count * sizeof (uint32_t) + 1);
+		for (i = 0; i < cg->count; i++)
+			cgmap[t][i] = ssw_cgroup(store, strtab_str(cg, i));
+		ranges = vh_realloc(ranges,
+		    (nranges + d->nranges) * sizeof (range_t) + 1);
+		for (r = 0; r < d->nranges; r++, nranges++) {
+			ranges[nranges].chunk = d->chunk[r];
+			ranges[nranges].d = d;
+			ranges[nranges].first = d->first[r];
+			ranges[nranges].end = r + 1 < d->nranges ?
+			    d->first[r + 1] : d->store.count;
+		}
+	}
+
+	if (store != NULL) {
+		qsort(ranges, nranges, sizeof (range_t), rangecmp);
+		for (r = 0; r < nranges; r++) {
+			d = ranges[r].d;
+			t = d - dec;
+			for (j = ranges[r].first; j < ranges[r].end; j++) {
+				s = d->store.samples[j];
+				s.stack = stackmap[t][s.stack];
+				s.cgroup = cgmap[t][s.cgroup];
+				ssw_add(store, &s);
+			}
+		}
+	}
+	for (t = 0; t < n; t++) {
+		free(stackmap[t]);
+		free(cgmap[t]);
+	}
+	free(stackmap);
+	free(cgmap);
+	free(ranges);
+}
+
+/*
+ * The function of a location, and with inlines, its inlined calls:
+ * "func->inl->...". Without, a Java method that its symbol map names with
+ * its inlined calls (perf-map-agent unfoldall) is named alone, as a map
+ * without unfoldall names it, so that the uninlined maps dumped for one
+ * view of a capture leave the others as they were.
+ */
+static void
+decode_func(const perfdata_t *pd, const pd_loc_t *l, const char *name,
+    int java, int inlines, char *func)
+{
+	const char *inl[INL_MAXDEPTH];
+	char *p;
+	size_t len;
+	int n, i;
+
+	len = snprintf(func, FUNCMAX, "%s", name);
+	if (!inlines) {
+		if (java && (p = strstr(func, "->")) != NULL)
+			*p = '\0';
+		return;
+	}
+	n = pd_inlined(pd, l, inl, INL_MAXDEPTH);
+	for (i = 0; i < n && len < FUNCMAX; i++)
+		len += snprintf(func + len, FUNCMAX - len, "->%s", inl[i]);
+}
+
+/*
+ * Name the frames of the location stacks in raw, interning the named stacks
+ * in st, and map[] the named stack of each. A location may name several
+ * frames (inlined functions, and the source line of a leaf), and is named
+ * once: its frame IDs are kept in names[], from off[] for len[] IDs.
+ * Inlined calls are named as frames if inlines is set (see decode_func).
+ */
+static void
+decode_name(const perfdata_t *pd, const stacktab_t *raw, stacktab_t *st,
+    psparser_t *ps, int inlines, uint32_t *map)
+{
+	const strtab_t *locs = &raw->frames;
+	const uint32_t *frames, *fids;
+	uint32_t *off, *len, *names = NULL, *ids, nnames = 0, alloc = 0;
+	uint32_t depth, total, kind, id, cid, n, f, i;
+	char func[FUNCMAX], cname[256];
+	const char *key, *file;
+	pd_frame_t fr;
+	pd_loc_t l;
+	int c;
+
+	off = vh_malloc(locs->count * sizeof (uint32_t) + 1);
+	len = vh_malloc(locs->count * sizeof (uint32_t) + 1);
+	for (f = 0; f < locs->count; f++)
+		len[f] = ST_NONE;
+
+	for (id = 0; id < raw->count; id++) {
+		frames = stacktab_frames(raw, id, &depth);
+		for (total = 0, i = 0; i < depth; total += len[frames[i++]]) {
+			f = frames[i];
+			if (len[f] != ST_NONE)
+				continue;
+			key = strtab_str(locs, f);
+			memcpy(&kind, key, sizeof (kind));
+			if (kind == LOC_CGROUP) {
+				/* the container, if any, as the root frame */
+				n = 0;
+				file = NULL;
+				if (container_name(key + sizeof (kind), cname,
+				    sizeof (cname)) == 0) {
+					snprintf(func, FUNCMAX, "[%s]", cname);
+					cid = strtab_intern(&st->frames, func,
+					    strlen(func));
+					fids = &cid;
+					n = 1;
+				}
+			} else if (kind == LOC_COMM) {
+				ps_begin(ps, key + sizeof (kind),
+				    locs->len[f] - sizeof (kind));
+				fids = &ps->pname;
+				n = 1;
+				file = NULL;
+			} else {
+				memcpy(&l, key, sizeof (l));
+				l.kind &= ~LOC_JAVA;
+				pd_symbolize(pd, &l, &fr);
+				decode_func(pd, &l, fr.func, kind & LOC_JAVA,
+				    inlines, func);
+				n = ps_name(ps, func, fr.mod, kind & LOC_JAVA,
+				    &fids);
+				file = pd_srcfile(pd, &l);
+			}
+			while (nnames + n + 1 > alloc) {
+				alloc = alloc ? alloc * 2 : 4096;
+				names = vh_realloc(names,
+				    alloc * sizeof (uint32_t));
+			}
+			memcpy(names + nnames, fids, n * sizeof (uint32_t));
+			if (file != NULL) {
+				snprintf(func, FUNCMAX, "%s:%u", file, l.line);
+				ps_name(ps, func, "", 0, &fids);
+				names[nnames + n++] = fids[0];
+			}
+			off[f] = nnames;
+			len[f] = n;
+			nnames += n;
+		}
+
+		ids = stacktab_scratch(st, total);
+		for (total = 0, i = 0; i < depth; i++) {
+			f = frames[i];
+			memcpy(ids + total, names + off[f],
+			    len[f] * sizeof (uint32_t));
+			total += len[f];
+		}
+		map[id] = stacktab_intern(st, ids, total);
+		for (c = 0; c < raw->ncols; c++)
+			stacktab_add(st, map[id], c, raw->weight[c][id]);
+	}
+	free(off);
+	free(len);
+	free(names);
+}
+
+/* write folded stacks, or differential ones for two events */
+static void
+decode_write(const stacktab_t *st, FILE *fp, int normalize)
+{
+	if (st->ncols == 2)
+		stacktab_write_diff(st, fp, 0, 1, normalize);
+	else
+		stacktab_write_folded(st, fp, 0);
+}
+
+/* write the location stacks in raw to path, named with inlined calls */
+static int
+decode_uninlined(const perfdata_t *pd, const stacktab_t *raw, int annotate,
+    int normalize, const char *path)
+{
+	stacktab_t st;
+	psparser_t ps;
+	uint32_t *map;
+	FILE *fp;
+	int status = 0;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	stacktab_init(&st, raw->ncols);
+	ps_init(&ps, &st, NULL);
+	ps.annotate = annotate;
+	map = vh_malloc(raw->count * sizeof (uint32_t) + 1);
+	decode_name(pd, raw, &st, &ps, 1, map);
+	decode_write(&st, fp, normalize);
+	if (ferror(fp) | fclose(fp)) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		status = -1;
+	}
+	free(map);
+	ps_free(&ps);
+	stacktab_free(&st);
+	return status;
+}
+
+/*
+ * Write the stacks of each container in raw to dir/NAME, below their cgroup
+ * roots, each trimmed to minpct of its own total and named as the host's
+ * are; a small container is not trimmed away by the others. The stacks of
+ * host tasks are not written.
+ */
+static int
+decode_split(const perfdata_t *pd, const stacktab_t *raw, const char *dir,
+    double minpct, int annotate, int inlines, int normalize)
+{
+	const strtab_t *locs = &raw->frames;
+	const uint32_t *frames;
+	uint32_t *label, *ids, *map, depth, kind, id, sid, f, i, l;
+	char name[256], path[CT_PATHLEN];
+	const char *key;
+	stacktab_t *sub, st;
+	strtab_t names;
+	psparser_t ps;
+	FILE *fp;
+	int c, status = 0;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		vh_warn("can't create %s: %s", dir, strerror(errno));
+		return -1;
+	}
+
+	/* the container of each cgroup */
+	strtab_init(&names);
+	label = vh_malloc(locs->count * sizeof (uint32_t) + 1);
+	for (f = 0; f < locs->count; f++) {
+		key = strtab_str(locs, f);
+		memcpy(&kind, key, sizeof (kind));
+		label[f] = ST_NONE;
+		if (kind == LOC_CGROUP && container_name(key + sizeof (kind),
+		    name, sizeof (name)) == 0)
+			label[f] = strtab_intern(&names, name, strlen(name));
+	}
+
+	/* its stacks, without the cgroup; its sub-cgroups are merged */
+	sub = vh_malloc(names.count * sizeof (stacktab_t) + 1);
+	for (l = 0; l < names.count; l++)
+		stacktab_init(&sub[l], raw->ncols);
+	for (id = 0; id < raw->count; id++) {
+		frames = stacktab_frames(raw, id, &depth);
+		if (depth < 2 || (l = label[frames[0]]) == ST_NONE)
+			continue;
+		ids = stacktab_scratch(&sub[l], depth - 1);
+		for (i = 1; i < depth; i++)
+			ids[i - 1] = strtab_intern(&sub[l].frames,
+			    strtab_str(locs, frames[i]), locs->len[frames[i]]);
+		sid = stacktab_intern(&sub[l], ids, depth - 1);
+		for (c = 0; c < raw->ncols; c++)
+			stacktab_add(&sub[l], sid, c, raw->weight[c][id]);
+	}
+
+	for (l = 0; l < names.count; l++) {
+		if (minpct > 0)
+			stacktab_trim(&sub[l], minpct / 100);
+		stacktab_init(&st, raw->ncols);
+		ps_init(&ps, &st, NULL);
+		ps.annotate = annotate;
+		map = vh_malloc(sub[l].count * sizeof (uint32_t) + 1);
+		decode_name(pd, &sub[l], &st, &ps, inlines, map);
+		snprintf(path, sizeof (path), "%s/%s", dir,
+		    strtab_str(&names, l));
+		if ((fp = fopen(path, "w")) == NULL) {
+			vh_warn("can't write %s: %s", path, strerror(errno));
+			status = 1;
+		} else {
+			decode_write(&st, fp, normalize);
+			if (ferror(fp) | fclose(fp)) {
+				vh_warn("can't write %s: %s", path,
+				    strerror(errno));
+				status = 1;
+			}
+		}
+		free(map);
+		ps_free(&ps);
+		stacktab_free(&st);
+		stacktab_free(&sub[l]);
+	}
+	free(sub);
+	free(label);
+	strtab_free(&names);
+	return status;
+}
+
+#define PKG_IDLE	(ST_NONE - 1)	/* pkg[] of an idle leaf */
+
+/* idle leaf functions, which pkgsplit-perf.pl drops */
+static int
+idlefunc(const char *func)
+{
+	return strstr(func, "xen_hypercall_sched_op") != NULL ||
+	    strstr(func, "cpu_idle") != NULL ||
+	    strstr(func, "native_safe_halt") != NULL;
+}
+
+/*
+ * Write the package view of the location stacks in raw to path, as
+ * pkgsplit-perf.pl writes it from perf script output: each sample by its
+ * process name and leaf function only, the function split at each "/" of
+ * its package, with its leading "L" removed and digits as "X", eg,
+ * "java;com;google;gson;JsonObject;::add". This is before stacks are
+ * trimmed, as it is the leaves that are counted. Idle samples are dropped.
+ */
+static int
+decode_pkgsplit(const perfdata_t *pd, const stacktab_t *raw, const char *path)
+{
+	const strtab_t *locs = &raw->frames;
+	const uint32_t *frames;
+	uint32_t *pkg, *ids, depth, kind, comm, len, id, sid, f, i, n;
+	char func[FUNCMAX], buf[FUNCMAX];
+	const char *key, *p, *s;
+	stacktab_t st;
+	strtab_t pkgs;
+	pd_frame_t fr;
+	pd_loc_t l;
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	stacktab_init(&st, 1);
+	strtab_init(&pkgs);
+	pkg = vh_malloc(locs->count * sizeof (uint32_t) + 1);
+	for (f = 0; f < locs->count; f++)
+		pkg[f] = ST_NONE;
+
+	for (id = 0; id < raw->count; id++) {
+		frames = stacktab_frames(raw, id, &depth);
+		if (raw->weight[0][id] == 0 || depth < 2)
+			continue;
+
+		/* the leaf's package name, split once */
+		f = frames[depth - 1];
+		key = strtab_str(locs, f);
+		memcpy(&kind, key, sizeof (kind));
+		if (kind == LOC_COMM || kind == LOC_CGROUP)
+			continue;
+		if (pkg[f] == ST_NONE) {
+			memcpy(&l, key, sizeof (l));
+			l.kind &= ~LOC_JAVA;
+			pd_symbolize(pd, &l, &fr);
+			decode_func(pd, &l, fr.func, kind & LOC_JAVA, 0, func);
+			if (idlefunc(func)) {
+				pkg[f] = PKG_IDLE;
+				continue;
+			}
+			p = func[0] == 'L' ? func + 1 : func;
+			for (n = 0; *p != '\0'; p++)
+				buf[n++] = isdigit((unsigned char)*p) ? 'X' :
+				    *p == '/' ? ';' : *p;
+			pkg[f] = strtab_intern(&pkgs, buf, n);
+		}
+		if (pkg[f] == PKG_IDLE)
+			continue;
+
+		/* the process name, after any cgroup root */
+		i = 0;
+		key = strtab_str(locs, frames[0]);
+		memcpy(&kind, key, sizeof (kind));
+		if (kind == LOC_CGROUP)
+			key = strtab_str(locs, frames[++i]);
+		len = locs->len[frames[i]] - sizeof (kind);
+		if (len >= sizeof (buf))
+			len = sizeof (buf) - 1;
+		for (n = 0; n < len; n++)
+			buf[n] = key[sizeof (kind) + n] == ' ' ? '_' :
+			    key[sizeof (kind) + n];
+		comm = strtab_intern(&st.frames, buf, len);
+
+		/* one frame per package name */
+		s = strtab_str(&pkgs, pkg[f]);
+		for (n = 1; (p = strchr(s, ';')) != NULL; s = p + 1)
+			n++;
+		ids = stacktab_scratch(&st, n + 1);
+		ids[0] = comm;
+		s = strtab_str(&pkgs, pkg[f]);
+		for (n = 1; (p = strchr(s, ';')) != NULL; s = p + 1)
+			ids[n++] = strtab_intern(&st.frames, s, p - s);
+		ids[n++] = strtab_intern(&st.frames, s, strlen(s));
+		sid = stacktab_intern(&st, ids, n);
+		stacktab_add(&st, sid, 0, raw->weight[0][id]);
+	}
+	stacktab_write_folded(&st, fp, 0);
+
+	free(pkg);
+	strtab_free(&pkgs);
+	stacktab_free(&st);
+	if (ferror(fp) | fclose(fp)) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* a source line of the hot lines table, by its key in decode_lines() */
+typedef struct hotline {
+	uint64_t	count;
+	uint32_t	key;
+} hotline_t;
+
+static int
+hotlinecmp(const void *a, const void *b)
+{
+	const hotline_t *x = a, *y = b;
+
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/*
+ * Write the source lines of the leaves of the location stacks in raw, by
+ * samples of the first event, hottest first: "samples percent file:line
+ * function". This is before stacks are trimmed, so a line that is hot in
+ * total but spread over many narrow stacks is still counted.
+ */
+static int
+decode_lines(const perfdata_t *pd, const stacktab_t *raw, int annotate,
+    int inlines, const char *path)
+{
+	const strtab_t *locs = &raw->frames;
+	const uint32_t *frames, *fids;
+	uint64_t *hits, *counts = NULL, total = stacktab_total(raw, 0);
+	uint32_t depth, kind, alloc = 0, id, f, k, n;
+	char func[FUNCMAX], buf[FUNCMAX + 64];
+	const char *key, *file;
+	hotline_t *hot;
+	stacktab_t st;
+	psparser_t ps;
+	strtab_t keys;
+	pd_frame_t fr;
+	pd_loc_t l;
+	FILE *fp;
+	int len;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	hits = vh_calloc(locs->count + 1, sizeof (uint64_t));
+	for (id = 0; id < raw->count; id++) {
+		frames = stacktab_frames(raw, id, &depth);
+		if (depth > 0)
+			hits[frames[depth - 1]] += raw->weight[0][id];
+	}
+
+	/* name each line once, with its function as a frame of the graph */
+	stacktab_init(&st, 1);
+	ps_init(&ps, &st, NULL);
+	ps.annotate = annotate;
+	strtab_init(&keys);
+	for (f = 0; f < locs->count; f++) {
+		key = strtab_str(locs, f);
+		memcpy(&kind, key, sizeof (kind));
+		if (hits[f] == 0 || kind == LOC_COMM)
+			continue;
+		memcpy(&l, key, sizeof (l));
+		l.kind &= ~LOC_JAVA;
+		if ((file = pd_srcfile(pd, &l)) == NULL)
+			continue;
+		pd_symbolize(pd, &l, &fr);
+		decode_func(pd, &l, fr.func, kind & LOC_JAVA, inlines, func);
+		n = ps_name(&ps, func, fr.mod, kind & LOC_JAVA, &fids);
+		len = snprintf(buf, sizeof (buf), "%s:%u  %s", file, l.line,
+		    strtab_str(&st.frames, fids[n - 1]));
+		k = strtab_intern(&keys, buf, len);
+		if (k == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			counts = vh_realloc(counts, alloc * sizeof (uint64_t));
+			memset(counts + k, 0, (alloc - k) * sizeof (uint64_t));
+		}
+		counts[k] += hits[f];
+	}
+
+	hot = vh_malloc(keys.count * sizeof (hotline_t) + 1);
+	for (k = 0; k < keys.count; k++) {
+		hot[k].count = counts[k];
+		hot[k].key = k;
+	}
+	qsort(hot, keys.count, sizeof (hotline_t), hotlinecmp);
+	fprintf(fp, "%10s %7s  %s\n", "SAMPLES", "PERCENT", "LINE  FUNCTION");
+	for (k = 0; k < keys.count; k++)
+		fprintf(fp, "%10" PRIu64 " %6.2f%%  %s\n", hot[k].count,
+		    total ? 100.0 * hot[k].count / total : 0,
+		    strtab_str(&keys, hot[k].key));
+
+	free(hot);
+	free(counts);
+	free(hits);
+	strtab_free(&keys);
+	ps_free(&ps);
+	stacktab_free(&st);
+	if (ferror(fp) | fclose(fp)) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The offset and size of a field of a tracepoint's raw data, eg, "sector"
+ * of "block:block_rq_issue", from its format file in tracefs. It is read
+ * when decoding, so on the host that recorded the capture.
+ */
+static int
+tp_field(const char *event, const char *field, uint32_t *offset,
+    uint32_t *size)
+{
+	static const char *roots[] = {
+		"/sys/kernel/tracing", "/sys/kernel/debug/tracing"
+	};
+	char path[256], line[512], *name, *end, *p;
+	size_t flen = strlen(field);
+	unsigned int o, z;
+	FILE *fp = NULL;
+	int i, found = -1;
+
+	if ((p = strchr(event, ':')) == NULL)
+		return -1;
+	for (i = 0; i < 2 && fp == NULL; i++) {
+		snprintf(path, sizeof (path), "%s/events/%.*s/%s/format",
+		    roots[i], (int)(p - event), event, p + 1);
+		fp = fopen(path, "r");
+	}
+	if (fp == NULL)
+		return -1;
+	/* "field:sector_t sector;	offset:16;	size:8;	signed:0;" */
+	while (found != 0 && fgets(line, sizeof (line), fp) != NULL) {
+		if ((name = strstr(line, "field:")) == NULL ||
+		    (end = strchr(name, ';')) == NULL)
+			continue;
+		for (name = end; name > line && name[-1] != ' '; name--)
+			;
+		if ((size_t)(end - name) != flen ||
+		    memcmp(name, field, flen) != 0 ||
+		    (p = strstr(end, "offset:")) == NULL ||
+		    sscanf(p, "offset:%u; size:%u", &o, &z) != 2)
+			continue;
+		*offset = o;
+		*size = z;
+		found = 0;
+	}
+	fclose(fp);
+	return found;
+}
+
+/*
+ * Find the block I/O tracepoints in pd, and their device and sector fields,
+ * into f[0] for issues and f[1] for completions. Without their tracefs
+ * formats, the fields are where every kernel since 3.x has had them.
+ */
+static int
+blk_formats(const perfdata_t *pd, blkfmt_t *f)
+{
+	static const char *events[2] = {
+		"block:block_rq_issue", "block:block_rq_complete"
+	};
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if ((f[i].attr = pd_attrnum(pd, events[i])) < 0) {
+			vh_warn("no %s events", events[i]);
+			return -1;
+		}
+		if (tp_field(events[i], "dev", &f[i].dev, &f[i].devsize) != 0) {
+			f[i].dev = 8;
+			f[i].devsize = 4;
+		}
+		if (tp_field(events[i], "sector", &f[i].sector,
+		    &f[i].secsize) != 0) {
+			f[i].sector = 16;
+			f[i].secsize = 8;
+		}
+	}
+	return 0;
+}
+
+/* by device, sector and time, with a completion after an issue */
+static int
+blkiocmp(const void *a, const void *b)
+{
+	const blkio_t *x = a, *y = b;
+
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	if (x->sector != y->sector)
+		return x->sector < y->sector ? -1 : 1;
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	return (x->stack == BLK_COMPLETE) - (y->stack == BLK_COMPLETE);
+}
+
+/* a completed I/O of the heat map: completion time, and latency (us) */
+typedef struct blklat {
+	uint64_t	time;
+	uint64_t	lat;
+} blklat_t;
+
+static int
+blklatcmp(const void *a, const void *b)
+{
+	const blklat_t *x = a, *y = b;
+
+	return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/*
+ * Pair the block I/O issues of the decoders with their completions, by
+ * device and sector, as heatmap.sh did from perf script output: a request
+ * issued again before it completes is timed from its last issue. The time
+ * of each I/O, in microseconds, is added to its issue stack in column 1 of
+ * raw, and written to path as "time latency" lines, by completion time in
+ * microseconds, for trace2heatmap.pl.
+ */
+static int
+decode_blklat(stacktab_t *raw, decoder_t *dec, int n, const char *path)
+{
+	blkio_t *ios, *io;
+	blklat_t *lats;
+	uint64_t count = 0, nlats = 0, i;
+	FILE *fp;
+	int t, status = 0;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	for (t = 0; t < n; t++)
+		count += dec[t].nios;
+	ios = vh_malloc(count * sizeof (blkio_t) + 1);
+	for (count = 0, t = 0; t < n; t++) {
+		memcpy(ios + count, dec[t].ios, dec[t].nios * sizeof (blkio_t));
+		count += dec[t].nios;
+	}
+	qsort(ios, count, sizeof (blkio_t), blkiocmp);
+
+	lats = vh_malloc(count * sizeof (blklat_t) + 1);
+	for (i = 0; i + 1 < count; i++) {
+		io = &ios[i];
+		if (io->stack == BLK_COMPLETE || io[1].stack != BLK_COMPLETE ||
+		    io[1].dev != io->dev || io[1].sector != io->sector)
+			continue;
+		lats[nlats].time = io[1].time / 1000;
+		lats[nlats].lat = (io[1].time - io->time) / 1000;
+		stacktab_add(raw, io->stack, 1, lats[nlats++].lat);
+	}
+	qsort(lats, nlats, sizeof (blklat_t), blklatcmp);
+	for (i = 0; i < nlats; i++)
+		fprintf(fp, "%" PRIu64 " %" PRIu64 "\n", lats[i].time,
+		    lats[i].lat);
+
+	free(lats);
+	free(ios);
+	if (ferror(fp) | fclose(fp)) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		status = -1;
+	}
+	return status;
+}
+
+/* write the stacks of -b by the time of their I/O, in microseconds */
+static int
+decode_weighted(const stacktab_t *st, const char *path)
+{
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	stacktab_write_folded(st, fp, 1);
+	if (ferror(fp) | fclose(fp)) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Add the resolver counts of a decode to the stats file at path, as "name
+ * count" lines, which the pmda exports as the vector.resolver metrics.
+ * Helpers that finish together take turns, with a lock on the file.
+ */
+static void
+resolver_stats(const char *path, const uint64_t *counts)
+{
+	static const char *names[RS_COUNT] = {
+		"frames", "hits", "inlined", "time"
+	};
+	uint64_t total[RS_COUNT];
+	unsigned long long v;
+	char line[128], name[64];
+	FILE *fp;
+	int fd, i;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+		return;
+	if (flock(fd, LOCK_EX) != 0 || (fp = fdopen(fd, "r+")) == NULL) {
+		close(fd);
+		return;
+	}
+	memcpy(total, counts, sizeof (total));
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "%63s %llu", name, &v) != 2)
+			continue;
+		for (i = 0; i < RS_COUNT; i++) {
+			if (strcmp(name, names[i]) == 0)
+				total[i] += v;
+		}
+	}
+	rewind(fp);
+	if (ftruncate(fd, 0) == 0) {
+		for (i = 0; i < RS_COUNT; i++)
+			fprintf(fp, "%s %" PRIu64 "\n", names[i], total[i]);
+	}
+	fclose(fp);
+}
+
+static uint64_t
+usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * decode [-ailn] [-b latencies [-w file]] [-c dir] [-e event] [-I file]
+ * [-j threads] [-L lines] [-m pct] [-P file] [-s store] [-t totals]
+ * perf.data: fold the samples of a perf.data file, as "perf script |
+ * vectorhelper collapse" does, on several threads (default the CPU count,
+ * up to 8).
+ *
+ * -i expands the functions inlined at each frame, from the DWARF of its
+ * object, or the object's debug file, as "func->inlined" (see ps_frame).
+ * If $VECTOR_RESOLVER_STATS is set, frame and time counts are added to it.
+ * Without -i, Java methods are named without their inlined calls, even from
+ * perf-map-agent unfoldall maps.
+ *
+ * -l adds the source line of each native leaf frame, from the DWARF line
+ * table, as a "file:line" frame below it. -L also writes the hot lines
+ * table to a file, all lines by samples (see decode_lines), and implies -l.
+ *
+ * -m trims stacks to the frames of at least pct percent of the total, which
+ * is all that flamegraph.pl --minwidth draws, so that the rest are never
+ * named. It is ignored with -s, as the store keeps whole stacks.
+ *
+ * With two events (-e twice), eg, instructions and cycles, both are folded
+ * in the same pass, and written as differential lines, "stack w0 w1", with
+ * w0 normalized to the total of w1 if -n is given. -t writes the total of
+ * each event to a file, as "event total" lines.
+ *
+ * -c splits a host-wide capture by container: each container's stacks are
+ * written to dir/NAME, by its Docker name or short ID (see decode_split),
+ * and the host's stacks are rooted at a "[NAME]" frame for their container.
+ * Samples are placed by the cgroup that perf recorded with them, from
+ * perf record --all-cgroups, or else by their process's cgroup now.
+ *
+ * Other views of the same samples can be written in the same pass, from the
+ * same location stacks, rather than by decoding perf.data again: -I writes
+ * the folded stacks with inlined calls expanded, as -i would, to a file,
+ * and -P writes the package view of the first event (see decode_pkgsplit).
+ *
+ * -b decodes a block I/O trace, of block:block_rq_issue with stacks and
+ * block:block_rq_complete: the issue stacks are written by I/O count, and
+ * each issue is timed to its completion (see decode_blklat). The latencies
+ * are written to a file, as "time latency" lines in microseconds for
+ * trace2heatmap.pl, and -w writes the issue stacks by total I/O time, in
+ * microseconds, to another, so that the code paths of slow I/O stand out.
+ * Stacks are not trimmed, as -m would trim by both.
+ */
+int
+cmd_decode(int argc, char **argv)
+{
+	perfdata_t pd;
+	decoder_t *dec;
+	stacktab_t raw, st;
+	sswriter_t store;
+	psparser_t ps;
+	const char *storepath = NULL, *totalpath = NULL, *linepath = NULL;
+	const char *splitdir = NULL, *uninlpath = NULL, *pkgpath = NULL;
+	const char *latpath = NULL, *weightpath = NULL;
+	const char *events[2];
+	blkfmt_t blk[2];
+	void *args[MAXTHREADS];
+	int colof[PD_MAXATTRS], attrs[2] = { 0 };
+	int annotate = 0, inlines = 0, lines = 0, normalize = 0, nevents = 0;
+	int nthreads, ncols;
+	int c, t, i;
+	int status = 0;
+	double minpct = 0;
+	uint32_t *map;
+	uint64_t counts[RS_COUNT] = { 0 }, start, j;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	FILE *fp;
+
+	nthreads = ncpus < 1 ? 1 : ncpus > 8 ? 8 : ncpus;
+	while ((c = getopt(argc, argv, "ab:c:e:iI:j:lL:m:nP:s:t:w:")) != -1) {
+		switch (c) {
+		case 'a':
+			annotate = 1;
+			break;
+		case 'b':
+			latpath = optarg;
+			break;
+		case 'c':
+			splitdir = optarg;
+			break;
+		case 'e':
+			if (nevents == 2)
+				return 2;
+			events[nevents++] = optarg;
+			break;
+		case 'i':
+			inlines = 1;
+			break;
+		case 'I':
+			uninlpath = optarg;
+			break;
+		case 'L':
+			linepath = optarg;
+			/* FALLTHROUGH */
+		case 'l':
+			lines = 1;
+			break;
+		case 'm':
+			minpct = atof(optarg);
+			if (minpct < 0 || minpct >= 100)
+				return 2;
+			break;
+		case 'n':
+			normalize = 1;
+			break;
+		case 'P':
+			pkgpath = optarg;
+			break;
+		case 't':
+			totalpath = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			if (nthreads < 1 || nthreads > MAXTHREADS)
+				return 2;
+			break;
+		case 's':
+			storepath = optarg;
+			break;
+		case 'w':
+			weightpath = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	/* the store has one event; -b has its own, and a weight column */
+	if (optind != argc - 1 || (storepath != NULL && nevents > 1))
+		return 2;
+	if (latpath != NULL ? nevents > 0 || storepath != NULL ||
+	    splitdir != NULL || uninlpath != NULL || pkgpath != NULL :
+	    weightpath != NULL)
+		return 2;
+	if (latpath != NULL)
+		events[nevents++] = "block:block_rq_issue";
+
+	if (pd_open(&pd, argv[optind]) != 0)
+		return 1;
+	pd.inlines = inlines || uninlpath != NULL;
+	pd.lines = lines;
+	for (i = 0; i < nevents; i++) {
+		if ((attrs[i] = pd_attrnum(&pd, events[i])) < 0) {
+			vh_warn("%s: no %s events", argv[optind], events[i]);
+			pd_close(&pd);
+			return 1;
+		}
+	}
+	if (latpath != NULL && blk_formats(&pd, blk) != 0) {
+		pd_close(&pd);
+		return 1;
+	}
+	if (nevents == 0) {
+		if (pd.nattrs > 1)
+			vh_warn("Filtering for events of type: %s",
+			    pd.attrs[0].name);
+		nevents = 1;
+	}
+	for (i = 0; i < PD_MAXATTRS; i++)
+		colof[i] = -1;
+	for (i = nevents - 1; i >= 0; i--)
+		colof[attrs[i]] = i;
+	ncols = nevents + (latpath != NULL);
+
+	dec = vh_calloc(nthreads, sizeof (decoder_t));
+	for (t = 0; t < nthreads; t++) {
+		dec[t].pd = &pd;
+		dec[t].colof = colof;
+		dec[t].cgroups = splitdir != NULL;
+		dec[t].blk = latpath != NULL ? blk : NULL;
+		stacktab_init(&dec[t].st, ncols);
+		ssw_init(&dec[t].store, &dec[t].st);
+		ps_init(&dec[t].ps, &dec[t].st,
+		    storepath ? &dec[t].store : NULL);
+		args[t] = &dec[t];
+	}
+	start = usecs();
+	pd_decode(&pd, nthreads, decode_sample, args);
+
+	/* merge and trim the location stacks, then name what is left */
+	stacktab_init(&raw, ncols);
+	stacktab_init(&st, ncols);
+	ssw_init(&store, &st);
+	store.monotonic = pd.monotonic;
+	decode_merge(dec, nthreads, &raw, storepath ? &store : NULL);
+	counts[RS_TIME] = usecs() - start;
+	if (latpath != NULL && decode_blklat(&raw, dec, nthreads,
+	    latpath) != 0)
+		status = 1;
+	if (linepath != NULL && decode_lines(&pd, &raw, annotate, inlines,
+	    linepath) != 0)
+		status = 1;
+	if (pkgpath != NULL && decode_pkgsplit(&pd, &raw, pkgpath) != 0)
+		status = 1;
+	if (splitdir != NULL && decode_split(&pd, &raw, splitdir, minpct,
+	    annotate, inlines, normalize) != 0)
+		status = 1;
+	if (minpct > 0 && storepath == NULL && latpath == NULL)
+		stacktab_trim(&raw, minpct / 100);
+	map = vh_malloc(raw.count * sizeof (uint32_t) + 1);
+	ps_init(&ps, &st, NULL);
+	ps.annotate = annotate;
+	start = usecs();
+	decode_name(&pd, &raw, &st, &ps, inlines, map);
+	counts[RS_TIME] += usecs() - start;
+	if (uninlpath != NULL && decode_uninlined(&pd, &raw, annotate,
+	    normalize, uninlpath) != 0)
+		status = 1;
+	for (t = 0; t < nthreads; t++) {
+		for (i = 0; i < RS_TIME; i++)
+			counts[i] += dec[t].counts[i];
+	}
+	/* the resolver metrics describe decoders that expand inlined calls */
+	if (pd.inlines && getenv("VECTOR_RESOLVER_STATS") != NULL)
+		resolver_stats(getenv("VECTOR_RESOLVER_STATS"), counts);
+	for (j = 0; j < store.count; j++)
+		store.samples[j].stack = map[store.samples[j].stack];
+	ps_free(&ps);
+	free(map);
+	stacktab_free(&raw);
+	if (latpath != NULL) {
+		stacktab_write_folded(&st, stdout, 0);
+		if (weightpath != NULL && decode_weighted(&st, weightpath) != 0)
+			status = 1;
+	} else {
+		decode_write(&st, stdout, normalize);
+	}
+	if (storepath != NULL) {
+		snprintf(store.event, sizeof (store.event), "%s",
+		    pd.attrs[attrs[0]].name);
+		if (ssw_write(&store, storepath) != 0)
+			status = 1;
+	}
+	if (totalpath != NULL) {
+		if ((fp = fopen(totalpath, "w")) == NULL) {
+			vh_warn("can't write %s: %s", totalpath,
+			    strerror(errno));
+			status = 1;
+		} else {
+			for (i = 0; i < nevents; i++)
+				fprintf(fp, "%s %" PRIu64 "\n",
+				    pd.attrs[attrs[i]].name,
+				    stacktab_total(&st, i));
+			fclose(fp);
+		}
+	}
+
+	for (t = 0; t < nthreads; t++) {
+		ps_free(&dec[t].ps);
+		ssw_free(&dec[t].store);
+		stacktab_free(&dec[t].st);
+		idmap_free(&dec[t].cgpid);
+		free(dec[t].chunk);
+		free(dec[t].first);
+		free(dec[t].ios);
+	}
+	free(dec);
+	ssw_free(&store);
+	stacktab_free(&st);
+	pd_close(&pd);
+	return status;
+}
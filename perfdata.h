@@ -0,0 +1,217 @@
+/*
+ * perfdata.h - native perf.data reader, decoding samples on several threads.
+ *
+ * perf.data is mapped, and read in two passes. The first, on one thread,
+ * walks the record headers: it keeps the process state (names, memory maps
+ * and forks, with their times), and notes the offset of every PD_CHUNK'th
+ * sample. Chunks of samples are then decoded and located in symbol tables
+ * by a pool of threads, each with its own state, and the callers merge the
+ * per-thread results at the end. The process state is read only by then,
+ * so samples are resolved with the maps that were live at their time.
+ *
+ * Captures by "perf record --all-cgroups" (Linux 5.7) also tag each sample
+ * with the ID of its task's cgroup, which pd_cgroup() names from the cgroup
+ * records of the capture.
+ *
+ * Only files written by "perf record -o file" are read; pipe mode output
+ * ("-o -") has no index, and is read by perf script instead.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef PERFDATA_H
+#define PERFDATA_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "jitdump.h"
+#include "stacktab.h"
+#include "symbols.h"
+
+#define PD_CHUNK	4096		/* samples per unit of work */
+#define PD_MAXATTRS	64		/* events per file */
+#define PD_COMMLEN	16
+
+/* event attributes, from the file header */
+typedef struct pd_attr {
+	uint32_t	type;
+	uint64_t	config;
+	uint64_t	sample_type;
+	uint64_t	read_format;
+	int		sample_id_all;
+	char		name[64];
+} pd_attr_t;
+
+/* a mapped object: an ELF file, anonymous memory (JIT code), or the vDSO */
+typedef struct pd_dso {
+	const char	*path;
+	int		kind;
+	int32_t		pid;		/* mapped by, for /proc/PID/root */
+	int		loaded;		/* set once elf is loaded, or failed */
+	char		buildid[SYM_BUILDIDLEN];	/* hex, or "" */
+	elfobj_t	elf;
+	int		inlloaded;
+	inltab_t	inl;		/* inlined calls, if pd->inlines */
+	int		lineloaded;
+	linetab_t	lines;		/* source lines, if pd->lines */
+} pd_dso_t;
+
+enum {
+	PD_DSO_ELF = 0,
+	PD_DSO_ANON,			/* JIT code, see /tmp/perf-PID.map */
+	PD_DSO_VDSO,
+	PD_DSO_JITDUMP,			/* a jit-PID.dump, not code */
+};
+
+typedef struct pd_map {
+	uint64_t	start;
+	uint64_t	end;
+	uint64_t	pgoff;
+	uint64_t	time;		/* 0 if mapped before the capture */
+	uint32_t	dso;
+} pd_map_t;
+
+typedef struct pd_proc {
+	int32_t		pid;
+	int32_t		ppid;		/* forked from, for inherited maps */
+	pd_map_t	*maps;		/* sorted by start, once scanned */
+	uint32_t	nmaps;
+	uint32_t	mapsalloc;
+	uint64_t	maxlen;		/* longest map */
+	int		jitloaded;
+	symtab_t	jit;		/* /tmp/perf-PID.map */
+	char		jitpath[32];
+	uint32_t	jitdump;	/* dso of its jit-PID.dump, or ST_NONE */
+	jittab_t	jd;		/* and its loads, tried first */
+} pd_proc_t;
+
+typedef struct pd_comm {
+	uint64_t	time;		/* named from */
+	char		comm[PD_COMMLEN];
+} pd_comm_t;
+
+typedef struct pd_thread {
+	int32_t		tid;
+	pd_comm_t	*comms;		/* in time order */
+	uint32_t	ncomms;
+} pd_thread_t;
+
+/* a cgroup of the capture, by the ID that samples have */
+typedef struct pd_cgroup {
+	uint64_t	id;
+	uint32_t	name;		/* in cgnames */
+} pd_cgroup_t;
+
+/* an open addressed hash of process or thread IDs to array indexes */
+typedef struct pd_idmap {
+	int32_t		*key;
+	uint32_t	*val;
+	uint32_t	size;
+	uint32_t	count;
+} pd_idmap_t;
+
+typedef struct perfdata {
+	const unsigned char *base;	/* the mapped file */
+	size_t		size;
+	uint64_t	data;		/* data section */
+	uint64_t	dataend;
+	pd_attr_t	attrs[PD_MAXATTRS];
+	int		nattrs;
+	int		monotonic;	/* sample times are CLOCK_MONOTONIC */
+	uint64_t	*ids;		/* sorted sample IDs, and attrs */
+	int		*idattr;
+	uint32_t	nids;
+
+	/* process state, from the first pass */
+	pd_proc_t	*procs;
+	uint32_t	nprocs;
+	pd_idmap_t	procmap;
+	pd_thread_t	*threads;
+	uint32_t	nthreads;
+	pd_idmap_t	threadmap;
+	pd_dso_t	*dsos;
+	uint32_t	ndsos;
+	strtab_t	dsonames;
+	pd_cgroup_t	*cgroups;	/* sorted by ID */
+	uint32_t	ncgroups;
+	strtab_t	cgnames;
+
+	/* samples, and the offset of every PD_CHUNK'th */
+	uint64_t	nsamples;
+	uint64_t	*chunks;
+	uint32_t	nchunks;
+	uint32_t	next;		/* next chunk to decode */
+
+	symtab_t	kernel;		/* kallsyms */
+	elfobj_t	vdso;
+	int		inlines;	/* callers set this to locate inlines */
+	int		lines;		/* and this for the lines of leaves */
+	pthread_mutex_t	lock;		/* for loading symbols */
+} perfdata_t;
+
+typedef struct pd_sample {
+	uint64_t	time;		/* 0 if not recorded */
+	uint64_t	period;
+	uint64_t	ip;
+	int32_t		pid;		/* -1 if not recorded */
+	int32_t		tid;
+	int32_t		cpu;
+	int		attr;
+	uint16_t	misc;		/* record header misc: CPU mode */
+	uint32_t	nips;		/* callchain, leaf first */
+	const uint64_t	*ips;
+	uint32_t	rawsize;	/* tracepoint data */
+	const unsigned char *raw;
+	uint64_t	cgroup;		/* cgroup ID, 0 if not recorded */
+} pd_sample_t;
+
+/*
+ * A frame's location: its object, and the symbol in that object's table.
+ * Finding it is a lookup, so samples can be aggregated by location, and
+ * only the locations that are kept are named, with pd_symbolize(). The
+ * leaf frame of a stack also has its source line, if pd->lines is set.
+ */
+typedef struct pd_loc {
+	uint32_t	kind;		/* PD_LOC_* */
+	uint32_t	obj;		/* dso, or proc for JIT code */
+	uint32_t	sym;		/* symbol index, or ST_NONE */
+	uint32_t	inl;		/* innermost inlined call, or ST_NONE */
+	uint32_t	file;		/* source file string ID, or ST_NONE */
+	uint32_t	line;
+} pd_loc_t;
+
+enum {
+	PD_LOC_NONE = 0,		/* not mapped */
+	PD_LOC_KERNEL,
+	PD_LOC_DSO,			/* an ELF object, or the vDSO */
+	PD_LOC_JIT,
+	PD_LOC_JITDUMP,			/* sym is a code load of the proc */
+};
+
+/* a named frame; names are valid until the file is closed */
+typedef struct pd_frame {
+	const char	*func;		/* "[unknown]" if not found */
+	const char	*mod;		/* eg, "[kernel.kallsyms]" */
+} pd_frame_t;
+
+int	pd_open(perfdata_t *, const char *path);
+void	pd_close(perfdata_t *);
+int	pd_attrnum(const perfdata_t *, const char *event);
+const char *pd_comm(const perfdata_t *, int32_t tid, uint64_t time);
+const char *pd_cgroup(const perfdata_t *, uint64_t id);
+int	pd_stack(perfdata_t *, const pd_sample_t *, pd_loc_t *, int max);
+void	pd_symbolize(const perfdata_t *, const pd_loc_t *, pd_frame_t *);
+int	pd_inlined(const perfdata_t *, const pd_loc_t *, const char **names,
+	    int max);
+const char *pd_srcfile(const perfdata_t *, const pd_loc_t *);
+
+/*
+ * Decode all samples on nthreads threads. Each thread calls func with its
+ * own arg from args[], for each sample, with the number of its chunk.
+ */
+void	pd_decode(perfdata_t *, int nthreads,
+	    void (*func)(void *, const pd_sample_t *, uint32_t), void **args);
+
+#endif /* PERFDATA_H */
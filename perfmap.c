@@ -0,0 +1,553 @@
+/*
+ * perfmap.c - tidying of JIT symbol maps.
+ *
+ * See perfmap.h. Lines are parsed as perfmaptidy.pl splits them, so that
+ * odd lines (no size, no name, a "0x" prefix) tidy the same way. Maps are
+ * written to a temporary file that is renamed into place, as vfiles are, so
+ * perf never reads a partial map.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "perfmap.h"
+#include "vfile.h"
+
+/*
+ * Map tables
+ */
+
+void
+maptab_init(maptab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+}
+
+void
+maptab_free(maptab_t *t)
+{
+	uint32_t i;
+
+	for (i = 0; i < t->nblks; i++)
+		free(t->blks[i]);
+	free(t->blks);
+	free(t->first);
+	memset(t, 0, sizeof (*t));
+}
+
+/* insert a new block at index i */
+static mapblk_t *
+blkinsert(maptab_t *t, uint32_t i)
+{
+	mapblk_t *blk;
+
+	if (t->nblks == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 64;
+		t->blks = vh_realloc(t->blks, t->alloc * sizeof (mapblk_t *));
+		t->first = vh_realloc(t->first, t->alloc * sizeof (uint64_t));
+	}
+	memmove(t->blks + i + 1, t->blks + i,
+	    (t->nblks - i) * sizeof (mapblk_t *));
+	memmove(t->first + i + 1, t->first + i,
+	    (t->nblks - i) * sizeof (uint64_t));
+	blk = vh_malloc(sizeof (mapblk_t));
+	blk->count = 0;
+	t->blks[i] = blk;
+	t->nblks++;
+	return blk;
+}
+
+/*
+ * Find where an entry from addr to end belongs: block b, before entry i.
+ * Returns 1 if it overlaps an entry of the table.
+ */
+static int
+mapfind(const maptab_t *t, uint64_t addr, uint64_t end, uint32_t *bp,
+    uint32_t *ip)
+{
+	const mapblk_t *blk;
+	const mapent_t *next;
+	uint32_t lo, hi, mid, b;
+
+	*bp = *ip = 0;
+	if (t->nblks == 0)
+		return 0;
+
+	/* the last block starting at or before addr, or the first */
+	for (lo = 0, hi = t->nblks; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (t->first[mid] <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*bp = b = lo > 0 ? lo - 1 : 0;
+	blk = t->blks[b];
+
+	/* the first entry starting after addr, and the one before it */
+	for (lo = 0, hi = blk->count; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (blk->ents[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*ip = lo;
+	if (lo > 0 && blk->ents[lo - 1].end >= addr)
+		return 1;
+	next = lo < blk->count ? &blk->ents[lo] :
+	    b + 1 < t->nblks ? &t->blks[b + 1]->ents[0] : NULL;
+	return next != NULL && next->addr <= end;
+}
+
+/* return 1 if an entry from addr to end, inclusive, overlaps the table */
+int
+maptab_overlaps(const maptab_t *t, uint64_t addr, uint64_t end)
+{
+	uint32_t b, i;
+
+	return mapfind(t, addr, end, &b, &i);
+}
+
+/*
+ * Add an entry, older than all added before, unless it overlaps one of
+ * them. Returns 1 if it was added.
+ */
+int
+maptab_add(maptab_t *t, uint64_t addr, uint64_t size, const char *name,
+    size_t len)
+{
+	mapblk_t *blk, *split;
+	uint64_t end;
+	uint32_t b, i;
+
+	/* the script's sums become floating point past 64 bits */
+	end = addr + size < addr ? UINT64_MAX : addr + size;
+	if (mapfind(t, addr, end, &b, &i))
+		return 0;
+	if (t->nblks == 0)
+		blkinsert(t, 0);
+	blk = t->blks[b];
+
+	if (blk->count == MT_BLOCK) {
+		split = blkinsert(t, b + 1);
+		split->count = MT_BLOCK / 2;
+		memcpy(split->ents, blk->ents + MT_BLOCK / 2,
+		    MT_BLOCK / 2 * sizeof (mapent_t));
+		t->first[b + 1] = split->ents[0].addr;
+		blk->count = MT_BLOCK / 2;
+		if (i > MT_BLOCK / 2) {
+			blk = split;
+			i -= MT_BLOCK / 2;
+		}
+	}
+	memmove(blk->ents + i + 1, blk->ents + i,
+	    (blk->count - i) * sizeof (mapent_t));
+	blk->ents[i].addr = addr;
+	blk->ents[i].end = end;
+	blk->ents[i].name = name;
+	blk->ents[i].len = len;
+	blk->count++;
+	t->first[b] = t->blks[b]->ents[0].addr;
+	t->count++;
+	return 1;
+}
+
+/* write the entries as a map, sorted by address */
+void
+maptab_write(const maptab_t *t, FILE *fp)
+{
+	const mapent_t *e;
+	uint32_t b, i;
+
+	for (b = 0; b < t->nblks; b++) {
+		for (i = 0; i < t->blks[b]->count; i++) {
+			e = &t->blks[b]->ents[i];
+			fprintf(fp, "%" PRIx64 " %" PRIx64 " %.*s\n", e->addr,
+			    e->end - e->addr, (int)e->len, e->name);
+		}
+	}
+}
+
+/*
+ * Map files
+ */
+
+/* read a hex number as Perl's hex() does: an optional "0x", and '_'s */
+static uint64_t
+perlhex(const char *p, const char *end)
+{
+	uint64_t v = 0;
+
+	if (p < end && (*p == 'x' || *p == 'X'))
+		p++;
+	else if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+		p += 2;
+	for (; p < end; p++) {
+		if (*p == '_' && p + 1 < end && isxdigit((unsigned char)p[1]))
+			continue;
+		if (!isxdigit((unsigned char)*p))
+			break;
+		v = v * 16 + (isdigit((unsigned char)*p) ? *p - '0' :
+		    tolower((unsigned char)*p) - 'a' + 10);
+	}
+	return v;
+}
+
+/* return the next whitespace separated field of p to end, as split ' ' */
+static const char *
+field(const char **p, const char *end, const char **fend)
+{
+	const char *s = *p;
+
+	while (s < end && isspace((unsigned char)*s))
+		s++;
+	*fend = s;
+	while (*fend < end && !isspace((unsigned char)**fend))
+		(*fend)++;
+	*p = *fend;
+	return s;
+}
+
+/* add a map line, without its newline; missing fields are 0 or empty */
+static void
+mapline(maptab_t *t, const char *p, const char *end)
+{
+	const char *a, *aend, *s, *send;
+
+	a = field(&p, end, &aend);
+	s = field(&p, end, &send);
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+	maptab_add(t, perlhex(a, aend), perlhex(s, send), p, end - p);
+}
+
+/* read all of fp into b */
+static int
+readall(FILE *fp, vbuf_t *b)
+{
+	char buf[65536];
+	size_t n;
+
+	while ((n = fread(buf, 1, sizeof (buf), fp)) > 0)
+		vbuf_put(b, buf, n);
+	return ferror(fp) ? -1 : 0;
+}
+
+/* add lines of buf to t, from the last, newest first */
+static void
+replay(maptab_t *t, char *buf, size_t len)
+{
+	char *p, *line, *end;
+
+	for (p = buf + len; p > buf; p = line) {
+		end = p[-1] == '\n' ? p - 1 : p;
+		for (line = end; line > buf && line[-1] != '\n'; line--)
+			;
+		mapline(t, line, end);
+	}
+}
+
+/*
+ * Map index
+ */
+
+#define TAILSZ		256		/* bytes of the log hashed for tail */
+
+typedef struct mapindex {
+	vfile_t		f;
+	const mapidx_t	*ents;
+	uint64_t	count;
+	const char	*names;
+	uint64_t	namesz;
+	uint64_t	offset;		/* of the log, read up to */
+} mapindex_t;
+
+static int
+index_path(const char *mappath, char *path, size_t pathsz)
+{
+	const char *dir = getenv("VECTOR_SYMCACHE");
+	const char *base = strrchr(mappath, '/');
+
+	if (dir == NULL || *dir == '\0')
+		return -1;
+	snprintf(path, pathsz, "%s/%s.index", dir,
+	    base != NULL ? base + 1 : mappath);
+	return 0;
+}
+
+/* hash the bytes of the log before offset */
+static uint64_t
+tailhash(FILE *fp, uint64_t offset)
+{
+	unsigned char buf[TAILSZ];
+	uint64_t h = 14695981039346656037ULL;
+	size_t n = offset < TAILSZ ? offset : TAILSZ, i;
+
+	if (fseeko(fp, offset - n, SEEK_SET) != 0 ||
+	    fread(buf, 1, n, fp) != n)
+		return 0;
+	for (i = 0; i < n; i++) {
+		h ^= buf[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+ * Map the index at path, if it is for the log id, of size bytes, open as
+ * fp. Otherwise, ix is left empty, and the log is read from the start.
+ */
+static int
+index_open(mapindex_t *ix, const char *path, const char *id, FILE *fp,
+    uint64_t size)
+{
+	char buf[64];
+	uint64_t esize, i;
+
+	memset(ix, 0, sizeof (*ix));
+	if (access(path, R_OK) != 0 ||
+	    vf_open(&ix->f, path, VF_KIND_MAPINDEX) != 0)
+		return -1;
+	if (vf_meta(&ix->f, "livemap", buf, sizeof (buf)) == NULL ||
+	    strcmp(buf, id) != 0 ||
+	    vf_meta(&ix->f, "offset", buf, sizeof (buf)) == NULL ||
+	    (ix->offset = strtoull(buf, NULL, 10)) > size ||
+	    vf_meta(&ix->f, "tail", buf, sizeof (buf)) == NULL ||
+	    strtoull(buf, NULL, 16) != tailhash(fp, ix->offset))
+		goto stale;
+	if ((ix->ents = vf_section(&ix->f, VF_MAPENTS, &esize,
+	    &ix->count)) == NULL || esize != ix->count * sizeof (mapidx_t) ||
+	    (ix->names = vf_section(&ix->f, VF_MAPNAMES, &ix->namesz,
+	    NULL)) == NULL)
+		goto bad;
+	for (i = 0; i < ix->count; i++) {
+		if (ix->ents[i].name > ix->namesz ||
+		    ix->ents[i].len > ix->namesz - ix->ents[i].name)
+			goto bad;
+	}
+	return 0;
+bad:
+	vh_warn("%s: truncated or corrupt map index", path);
+stale:
+	vf_close(&ix->f);
+	memset(ix, 0, sizeof (*ix));
+	return -1;
+}
+
+/* write a map line, and its index entry if ents is set */
+static void
+index_put(FILE *fp, vbuf_t *ents, vbuf_t *names, uint64_t addr,
+    uint64_t end, const char *name, size_t len)
+{
+	mapidx_t e;
+
+	fprintf(fp, "%" PRIx64 " %" PRIx64 " %.*s\n", addr, end - addr,
+	    (int)len, name);
+	if (ents == NULL)
+		return;
+	e.addr = addr;
+	e.end = end;
+	e.name = names->len;
+	e.len = len;
+	e.reserved = 0;
+	vbuf_put(ents, &e, sizeof (e));
+	vbuf_put(names, name, len);
+}
+
+/*
+ * Write the entries of t, and those of the index that they do not overlap,
+ * to the map at path, and as the sections of a new index to w, if set.
+ * Returns the number of entries written, or -1.
+ */
+static int64_t
+map_merge(const maptab_t *t, const mapindex_t *ix, const char *path,
+    vfwriter_t *w)
+{
+	char tmppath[4096];
+	const mapent_t *e;
+	const mapidx_t *o;
+	vbuf_t ents = { 0 }, names = { 0 };
+	uint64_t j = 0, n = 0;
+	uint32_t b = 0, i = 0;
+	FILE *fp;
+
+	snprintf(tmppath, sizeof (tmppath), "%s.tmp.%d", path, (int)getpid());
+	if ((fp = fopen(tmppath, "w")) == NULL) {
+		vh_warn("can't write %s: %s", tmppath, strerror(errno));
+		return -1;
+	}
+	for (;;) {
+		e = b < t->nblks ? &t->blks[b]->ents[i] : NULL;
+		o = j < ix->count ? &ix->ents[j] : NULL;
+		if (o != NULL && maptab_overlaps(t, o->addr, o->end)) {
+			j++;
+			continue;
+		}
+		if (e == NULL && o == NULL)
+			break;
+		if (o == NULL || (e != NULL && e->addr < o->addr)) {
+			index_put(fp, w ? &ents : NULL, &names, e->addr,
+			    e->end, e->name, e->len);
+			if (++i == t->blks[b]->count) {
+				b++;
+				i = 0;
+			}
+		} else {
+			index_put(fp, w ? &ents : NULL, &names, o->addr,
+			    o->end, ix->names + o->name, o->len);
+			j++;
+		}
+		n++;
+	}
+	if (ferror(fp) | fclose(fp) || rename(tmppath, path) != 0) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		unlink(tmppath);
+		vbuf_free(&ents);
+		vbuf_free(&names);
+		return -1;
+	}
+	if (w != NULL) {
+		*vfw_section(w, VF_MAPENTS, n) = ents;
+		*vfw_section(w, VF_MAPNAMES, 0) = names;
+	}
+	return n;
+}
+
+/*
+ * Tidy the log at path into the map at mappath, reading only the lines
+ * appended since the last run, if it was indexed. A last line without its
+ * newline is still being written, and is left for the next run.
+ */
+static int
+map_update(const char *path, const char *mappath)
+{
+	char idxpath[4096], id[64], meta[256];
+	struct stat st;
+	mapindex_t ix;
+	maptab_t t;
+	vfwriter_t vw;
+	vbuf_t b = { 0 };
+	uint64_t offset;
+	int64_t n;
+	size_t len;
+	FILE *fp;
+	int indexed;
+
+	if ((fp = fopen(path, "r")) == NULL || fstat(fileno(fp), &st) != 0) {
+		vh_warn("can't read %s: %s", path, strerror(errno));
+		if (fp != NULL)
+			fclose(fp);
+		return 1;
+	}
+	snprintf(id, sizeof (id), "%ju:%ju", (uintmax_t)st.st_dev,
+	    (uintmax_t)st.st_ino);
+	indexed = index_path(mappath, idxpath, sizeof (idxpath)) == 0;
+	if (!indexed || index_open(&ix, idxpath, id, fp, st.st_size) != 0)
+		memset(&ix, 0, sizeof (ix));
+	if (fseeko(fp, ix.offset, SEEK_SET) != 0 || readall(fp, &b) != 0) {
+		vh_warn("can't read %s: %s", path, strerror(errno));
+		vf_close(&ix.f);
+		vbuf_free(&b);
+		fclose(fp);
+		return 1;
+	}
+	for (len = b.len; len > 0 && b.buf[len - 1] != '\n'; len--)
+		;
+
+	/* nothing new, and the map is there */
+	if (len == 0 && ix.f.base != NULL && access(mappath, F_OK) == 0) {
+		vf_close(&ix.f);
+		vbuf_free(&b);
+		fclose(fp);
+		return 0;
+	}
+
+	maptab_init(&t);
+	replay(&t, (char *)b.buf, len);
+	vfw_init(&vw, VF_KIND_MAPINDEX);
+	if ((n = map_merge(&t, &ix, mappath, indexed ? &vw : NULL)) >= 0 &&
+	    indexed) {
+		offset = ix.offset + len;
+		snprintf(meta, sizeof (meta), "livemap=%s\noffset=%" PRIu64
+		    "\ntail=%016" PRIx64 "\nentries=%" PRId64 "\n", id, offset,
+		    tailhash(fp, offset), n);
+		vbuf_put(vfw_section(&vw, VF_META, 0), meta, strlen(meta));
+		if (mkdir(getenv("VECTOR_SYMCACHE"), 0755) == 0 ||
+		    errno == EEXIST)
+			vfw_write(&vw, idxpath);
+	}
+	vfw_free(&vw);
+	maptab_free(&t);
+	vf_close(&ix.f);
+	vbuf_free(&b);
+	fclose(fp);
+	return n >= 0 ? 0 : 1;
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * maptidy [-o map] [livemap]: tidy a JIT symbol log (default STDIN) into a
+ * map on STDOUT, keeping the most recent entry at each address, as
+ * perfmaptidy.pl. With -o, the map is replaced atomically, and if the
+ * symbol cache is set, only the lines appended since the last run are read.
+ */
+int
+cmd_maptidy(int argc, char **argv)
+{
+	maptab_t t;
+	vbuf_t b = { 0 };
+	const char *mappath = NULL, *path = NULL;
+	FILE *fp = stdin;
+	int c;
+
+	while ((c = getopt(argc, argv, "o:")) != -1) {
+		switch (c) {
+		case 'o':
+			mappath = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind++];
+	if (optind != argc || (mappath != NULL && path == NULL))
+		return 2;
+	if (mappath != NULL)
+		return map_update(path, mappath);
+
+	if (path != NULL && (fp = fopen(path, "r")) == NULL) {
+		vh_warn("can't read %s: %s", path, strerror(errno));
+		return 1;
+	}
+	if (readall(fp, &b) != 0) {
+		vh_warn("can't read %s: %s", path ? path : "STDIN",
+		    strerror(errno));
+		if (fp != stdin)
+			fclose(fp);
+		vbuf_free(&b);
+		return 1;
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	maptab_init(&t);
+	replay(&t, (char *)b.buf, b.len);
+	maptab_write(&t, stdout);
+	maptab_free(&t);
+	vbuf_free(&b);
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * perfmap.h - tidying of JIT symbol maps.
+ *
+ * Node's --perf_basic_prof logs each function it compiles as a line of
+ * /tmp/perf-PID.map, "START SIZE name" in hex, and never removes one, so
+ * once code is moved or collected the log holds stale entries that overlap
+ * newer ones, and perf may pick either. A tidied map keeps only the most
+ * recent entry at each address: the log is replayed from its end, newest
+ * first, and an entry is dropped if it overlaps one already kept. This is
+ * what perfmaptidy.pl does, and the output is the same: an entry covers
+ * START to START + SIZE inclusive, so entries that only touch overlap too.
+ *
+ * A maptab keeps the entries in sorted blocks of up to MT_BLOCK, with an
+ * index of the first address of each, so an overlap check is a binary search
+ * of the index and of one block, and an insert moves at most a block, where
+ * the script's array inserts move the whole table: a log of millions of
+ * lines is tidied in seconds rather than in tens of minutes.
+ *
+ * Node only ever appends to its log, so with an output map (maptidy -o), an
+ * index of the tidied map is kept in the symbol cache (see symbols.h), as
+ * the entry "<map>.index" of kind VF_KIND_MAPINDEX, named for the map file:
+ *
+ *	VF_META		livemap (device:inode), offset, tail, entries
+ *	VF_MAPENTS	mapidx_t per entry, sorted by address
+ *	VF_MAPNAMES	entry names, not terminated
+ *
+ * Each run then reads only the lines appended after offset, tidies them, and
+ * merges them into the indexed entries, dropping those that a new line
+ * overlaps. This differs from tidying the whole log only for an entry that
+ * was dropped: it stays dropped after the entry that hid it is replaced in
+ * turn, where perfmaptidy.pl would bring the older code back. tail is a hash
+ * of the bytes before offset, so that another log on the same inode, after
+ * the process exits and its PID is reused, is read from the start.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef PERFMAP_H
+#define PERFMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MT_BLOCK	128		/* entries per block */
+
+typedef struct mapent {
+	uint64_t	addr;
+	uint64_t	end;		/* inclusive, as perfmaptidy.pl */
+	const char	*name;		/* not terminated, in the caller's */
+	size_t		len;		/* buffer until written */
+} mapent_t;
+
+typedef struct mapblk {
+	uint32_t	count;
+	mapent_t	ents[MT_BLOCK];
+} mapblk_t;
+
+/* an index entry, in the symbol cache */
+typedef struct mapidx {
+	uint64_t	addr;
+	uint64_t	end;
+	uint64_t	name;		/* offset in VF_MAPNAMES */
+	uint32_t	len;
+	uint32_t	reserved;
+} mapidx_t;
+
+typedef struct maptab {
+	mapblk_t	**blks;		/* sorted, none empty */
+	uint64_t	*first;		/* first address, per block */
+	uint32_t	nblks;
+	uint32_t	alloc;
+	uint64_t	count;
+} maptab_t;
+
+void	maptab_init(maptab_t *);
+void	maptab_free(maptab_t *);
+int	maptab_add(maptab_t *, uint64_t addr, uint64_t size, const char *name,
+	    size_t len);
+int	maptab_overlaps(const maptab_t *, uint64_t addr, uint64_t end);
+void	maptab_write(const maptab_t *, FILE *);
+
+#endif /* PERFMAP_H */
@@ -13,10 +13,11 @@
 #
 # For Node.js symbols:
 # - Node processes running with --perf_basic_prof[_only_functions]
-# - The perfmaptidy.pl program in the same directory as this script.
+# - The vectorhelper program in the same directory as this script, for its
+#   maptidy command (a compiled perfmaptidy.pl).
 # 
 # A new symobl dump technique may be added to node, at which point this
-# script will need to be updated, and perfmaptidy.pl may no longer be needed.
+# script will need to be updated, and maptidy may no longer be needed.
 #
 # USAGE: . perfmaps.sh		# declares the following functions:
 #
@@ -29,13 +30,27 @@
 #     appropriate perf-map-agent version, if it doesn't already exist in the
 #     container. An optional list of PIDs can be provided, to restrict scanning
 #     to those specified (eg, listing PIDs in a container or containers. Note
-#     that the "java" process name check is still performed.)
+#     that the "java" process name check is still performed.) Up to
+#     $PM_JAVA_JOBS JVMs are dumped at once, and a JVM is skipped if its JIT
+#     code has not changed since its last dump (vectorhelper jvmstamp), so
+#     when vectord.sh refreshes the maps in the background, a task only
+#     dumps the JVMs that compiled code since.
+#
+# scan_procs(): reads the process table (vectorhelper ps), which the other
+#     functions otherwise read once, on first use, and keep for the task.
+#
+# procs_of(runtime), have_procs(runtime): print the PIDs of a runtime (java,
+#     node, python or native), or succeed if there are any, eg, to pick a
+#     flame graph palette.
+#
+# expire_java_maps(): removes the dump stamps of Java processes that have
+#     exited.
 #
 # fix_node_maps([PIDs]): find all "node" processes and ensure a symbol
 #     map is available. This can mean fixing the map permissions, and also
 #     copying maps from containers to the host. Stale entries are also
-#     cleaned up from maps (perfmaptidy.pl). An optional list of PIDs can
-#     be provided, to restrict scanning to those specified.
+#     cleaned up from maps (vectorhelper maptidy). An optional list of PIDs
+#     can be provided, to restrict scanning to those specified.
 #
 # This library was developed for Vector: http://vectoross.io/
 #
@@ -54,66 +69,90 @@ PM_CONTAINER_AWARE=1	# set to zero to disable container code
 PM_ORACLE_PMA_DIR=/usr/lib/jvm/perf-map-agent	# todo: move to -oracle
 PM_OPENJDK_PMA_DIR=/usr/lib/jvm/perf-map-agent-openjdk
 PM_HOME=${0%/*}
+PM_HELPER=$(cd $PM_HOME && pwd)/vectorhelper
 PM_UNINLINED=0
+PM_JAVA_JOBS=4		# JVMs dumped at once, each by a JVM of its own
+PM_STATE_DIR=/var/log/pcp/vector/vectord/perfmaps	# Java map stamps, locks
+PM_HELD=""		# fds of the map locks held by hold_java_maps
 
 #
-# Generic Functions
+# Process table
 #
 
-# dummy map to include an error message in the flame graph
-function _dummy_map {
-	local mapfile=$1
-	echo "000000000000 f00000000000 missing_perf_map" > $mapfile
+# The processes, from one scan of /proc by vectorhelper ps, taken on first use
+# and kept for the rest of the task: runtime, IDs, JIT flags and binary, by
+# PID. PIDs of processes started since are not listed until scan_procs is
+# called again.
+declare -A PM_RUNTIME PM_UID PM_GID PM_NSPID PM_FLAGS PM_CGROUP PM_EXE
+PM_SCANNED=0
+
+# scan_procs: read the process table, replacing any earlier scan
+function scan_procs {
+	local pid runtime uid gid nspid flags cgroup exe
+	PM_RUNTIME=() PM_UID=() PM_GID=() PM_NSPID=() PM_FLAGS=() PM_CGROUP=()
+	PM_EXE=()
+	while read pid runtime uid gid nspid flags cgroup exe; do
+		PM_RUNTIME[$pid]=$runtime
+		PM_UID[$pid]=$uid
+		PM_GID[$pid]=$gid
+		PM_NSPID[$pid]=$nspid
+		PM_FLAGS[$pid]=$flags
+		PM_CGROUP[$pid]=$cgroup
+		PM_EXE[$pid]=$exe
+	done <<< "$($PM_HELPER ps)"
+	PM_SCANNED=1
 }
 
-# takes a pid, and returns its user as a -u argument that will work with sudo
-function _pid_to_sudo_user {
-	local pid=$1
-	local user=$(ps ho user -p $pid)
-	if [[ "$user" == [0-9]* ]]; then
-		# prefix UID with '#' for use with sudo
-		user="#$user"
-	fi
-	echo $user
+# procs_of(runtime): print the PIDs of the runtime: java, node, python, native
+function procs_of {
+	local pid
+	(( PM_SCANNED )) || scan_procs
+	for pid in "${!PM_RUNTIME[@]}"; do
+		[[ "${PM_RUNTIME[$pid]}" == "$1" ]] && echo $pid
+	done
 }
 
-# takes a pid, and returns its UID
-function _pid_to_uid {
-	local pid=$1
-	local uid=$(ps ho uid -p $pid)
-	echo $uid
+# have_procs(runtime): succeed if any process is of the runtime
+function have_procs {
+	local pid
+	(( PM_SCANNED )) || scan_procs
+	for pid in "${!PM_RUNTIME[@]}"; do
+		[[ "${PM_RUNTIME[$pid]}" == "$1" ]] && return 0
+	done
+	return 1
 }
 
-# takes a pid, and returns its GID
-function _pid_to_gid {
-	local pid=$1
-	local gid=$(ps ho gid -p $pid)
-	echo $gid
+#
+# Generic Functions
+#
+
+# dummy map to include an error message in the flame graph
+function _dummy_map {
+	local mapfile=$1
+	echo "000000000000 f00000000000 missing_perf_map" > $mapfile
 }
 
-# takes a pid, and returns its namespace PID
-function _pid_to_nspid {
+# takes a pid from the process table, and returns its user as a -u argument
+# that will work with sudo
+function _pid_to_sudo_user {
 	local pid=$1
-	local nspid=$(awk '/^NSpid:/ { print $3; exit }' /proc/$pid/status)
-	[[ "$nspid" == "" ]] && nspid=$pid	# not in another namespace
-	echo $nspid
+	# prefix UID with '#' for use with sudo
+	echo "#${PM_UID[$pid]}"
 }
 
 #
 # Java
 #
 
-# return JAVA_HOME for a given pid
+# return JAVA_HOME for a given pid from the process table
 function _pid_to_java_home {
 	local pid=$1
-	# fetch java home by parsing java's /proc/$pid/exe symlink destination.
-	# could also use stat %N, but it adds quotes.
-	set -- $(ls -l /proc/$pid/exe)
-	if [[ "${11}" != "${11%%/jre/bin/java}" ]] 	
-	then 
-		echo ${11%%/jre/bin/java}
-	else 
-		echo ${11%%/bin/java}
+	# from java's /proc/$pid/exe symlink destination
+	local exe=${PM_EXE[$pid]}
+	if [[ "$exe" != "${exe%%/jre/bin/java}" ]]; then
+		echo ${exe%%/jre/bin/java}
+	else
+		echo ${exe%%/bin/java}
 	fi
 }
 
@@ -151,7 +190,7 @@ function _host_java_map {
 	if (( no_pma )); then
 		_dummy_map $mapfile
 		echo >&2 "WARNING: perfmaplib no perf-map-agent for PID $pid ($java_home)"
-		return
+		return 1
 	fi
 
 	local java_home=$(_pid_to_java_home $pid)
@@ -170,7 +209,7 @@ function _host_java_map {
 function _container_java_map {
 	local pid=$1
 	local nspid=$2	# optional,
-	[[ "$nspid" == "" ]] && nspid=$(_pid_to_nspid $pid)
+	[[ "$nspid" == "" ]] && nspid=${PM_NSPID[$pid]}
 	local nsroot=/proc/$pid/root
 
 	local mapfile=/tmp/perf-$pid.map
@@ -213,7 +252,7 @@ function _container_java_map {
 	if (( no_pma )); then
 		_dummy_map $mapfile
 		echo >&2 "WARNING: perfmaplib no perf-map-agent for PID $pid NSPID $nspid ($java_home)"
-		return
+		return 1
 	fi
 
 	if (( need_copy )); then
@@ -227,8 +266,8 @@ function _container_java_map {
 	# run as java user to avoid "well-known file is not secure" error.
 	# execute perf-map-agent from within the container.
 	local java_home=$(_pid_to_java_home $pid)
-	local uid=$(_pid_to_uid $pid)
-	local gid=$(_pid_to_uid $pid)
+	local uid=${PM_UID[$pid]}
+	local gid=${PM_GID[$pid]}
 	local opts=""
 	(( PM_UNINLINED )) && opts="unfoldall"
 	nsenter -t $pid -m -p -u -r  -S $uid -G $gid sh -c '
@@ -243,6 +282,43 @@ function _container_java_map {
 	[ -e $mapfile ] && chown root:root $mapfile
 }
 
+# dump the map of one JVM, unless its JIT code is unchanged since its last
+# dump. The stamp of a dump is written once the map is, and a JVM is dumped
+# by one caller at a time: a task and vectord.sh may both be dumping maps.
+function _java_map {
+	local pid=$1
+	local mapfile=/tmp/perf-$pid.map
+	local stampfile=$PM_STATE_DIR/$pid.stamp
+
+	exec 8> $PM_STATE_DIR/$pid.lock
+	flock 8
+	# the stamp is empty if the JVM has no hsperfdata: always dump it
+	local stamp=$($PM_HELPER jvmstamp $pid 2>/dev/null)
+	[[ "$stamp" != "" ]] && stamp="$stamp uninlined=$PM_UNINLINED"
+	if [[ "$stamp" != "" && -s $mapfile && -e $stampfile ]] &&
+	    [[ "$(< $stampfile)" == "$stamp" ]]; then
+		return
+	fi
+	rm -f $stampfile
+
+	local status
+	if (( PM_CONTAINER_AWARE )); then
+		# check the namespace pid to determine if a pid is in a
+		# container
+		local nspid=${PM_NSPID[$pid]}
+		if (( nspid == pid )); then
+			_host_java_map $pid
+		else
+			_container_java_map $pid $nspid
+		fi
+	else
+		# not container aware approach
+		_host_java_map $pid
+	fi
+	status=$?
+	(( status == 0 )) && [[ "$stamp" != "" ]] && echo "$stamp" > $stampfile
+}
+
 # dump_java_maps([container]): finds all processes named "java" and dumps their
 # maps. If the processes are in containers, then copy the maps to the host. If a
 # list of PIDs is provided, only dump "java" maps from those PIDs.
@@ -250,30 +326,64 @@ function dump_java_maps {
 	local filter_pids	# effectively resets it between runs
 	for p in $*; do filter_pids[$p]=1; done
 
+	[ ! -d $PM_STATE_DIR ] && mkdir -p $PM_STATE_DIR
+	(( PM_SCANNED )) || scan_procs
+
+	# each JVM is dumped in the background, up to $PM_JAVA_JOBS at once. A
+	# subshell, so that wait -n is not woken by the caller's jobs.
+	(
 	# do all processes named "java" (use jps instead?)
 	local pid
-	for pid in $(pgrep -x java); do
+	for pid in $(procs_of java); do
 		# filter on pids, if provided
 		if (( ${#filter_pids[@]} )); then
 			(( ! filter_pids[pid] )) && continue
 		fi
 
-		if (( PM_CONTAINER_AWARE )); then
-			# check the namespace pid to determine if a pid is in a
-			# container
-			local nspid=$(_pid_to_nspid $pid)
-			if (( nspid == pid )); then
-				_host_java_map $pid
-			else
-				_container_java_map $pid $nspid
-			fi
-		else
-			# not container aware approach
-			_host_java_map $pid
-		fi
+		while (( $(jobs -rp | wc -l) >= PM_JAVA_JOBS )); do
+			wait -n
+		done
+		_java_map $pid &
+	done
+	wait
+	)
+}
+
+# remove the Java map stamps of processes that have exited
+function expire_java_maps {
+	local f pid
+	for f in $PM_STATE_DIR/*.stamp; do
+		[ -e "$f" ] || continue
+		pid=${f##*/}
+		pid=${pid%.stamp}
+		[ -e /proc/$pid ] && continue
+		rm -f $f $PM_STATE_DIR/$pid.lock
 	done
 }
 
+# hold_java_maps: take the map lock of each JVM shared, until
+# release_java_maps, so that no map is dumped while the caller reads them. A
+# JVM rewrites its map in place, so a task decoding while another task or the
+# vectord.sh refresh dumps it would read a missing or partial map. Don't dump
+# maps while holding them.
+function hold_java_maps {
+	local pid fd
+	[ ! -d $PM_STATE_DIR ] && mkdir -p $PM_STATE_DIR
+	for pid in $(procs_of java); do
+		exec {fd}>> $PM_STATE_DIR/$pid.lock
+		flock -s $fd
+		PM_HELD="$PM_HELD $fd"
+	done
+}
+
+function release_java_maps {
+	local fd
+	for fd in $PM_HELD; do
+		exec {fd}>&-
+	done
+	PM_HELD=""
+}
+
 # with uninlining of Java symbols
 function dump_java_maps_uninlined {
 	PM_UNINLINED=1
@@ -291,8 +401,7 @@ function _host_node_map {
 	local mapfile=/tmp/perf-$pid.map
 	local livemapfile=/tmp/perf-$pid.livemap
 
-	local args=$(ps ho args $pid)
-	if [[ "$args" == *perf-basic-prof* || "$args" == *perf_basic_prof* ]]; then
+	if [[ "${PM_FLAGS[$pid]}" == *perfmap* ]]; then
 		# node is using the --perf_basic_prof[_only_functions] live
 		# symbol log.
 
@@ -304,7 +413,9 @@ function _host_node_map {
 			mv $mapfile $livemapfile
 		fi
 
-		./perfmaptidy.pl < $livemapfile > $mapfile
+		# only the lines appended since the last run are read, and
+		# the map is replaced atomically, while perf may be reading it
+		$PM_HELPER maptidy -o $mapfile $livemapfile
 		# new map file should be owned by root, as needed by perf
 	else
 		# node may one day support on-demand map dumps, in which case,
@@ -320,21 +431,20 @@ function _host_node_map {
 function _container_node_map {
 	local pid=$1
 	local nspid=$2	# optional,
-	[[ "$nspid" == "" ]] && nspid=$(_pid_to_nspid $pid)
+	[[ "$nspid" == "" ]] && nspid=${PM_NSPID[$pid]}
 	local mapfile=/tmp/perf-$pid.map
 	local nsmapfile=/tmp/perf-$nspid.map
 	local nsroot=/proc/$pid/root
 
-	local args=$(ps ho args $pid)
-	if [[ "$args" == *perf-basic-prof* || "$args" == *perf_basic_prof* ]]; then
+	if [[ "${PM_FLAGS[$pid]}" == *perfmap* ]]; then
 		# node is using the --perf_basic_prof[_only_functions] live
 		# symbol log.
 
 		if [ -e ${nsroot}$nsmapfile ]; then
-			./perfmaptidy.pl < ${nsroot}$nsmapfile > $mapfile
+			$PM_HELPER maptidy -o $mapfile ${nsroot}$nsmapfile
 		# if the /proc/PID/root approach stops working, use:
 		# if nsenter -t $pid -m [ -e $nsmapfile ]; then
-		# 	nsenter -t $pid -m cat $nsmapfile | ./perfmaptidy.pl > $mapfile
+		# 	nsenter -t $pid -m cat $nsmapfile | ./vectorhelper maptidy > $mapfile
 		else
 			_dummy_map $mapfile
 		fi
@@ -356,9 +466,8 @@ function fix_node_maps {
 	local filter_pids	# effectively resets it between runs
 	for p in $*; do filter_pids[$p]=1; done
 
-	cd $PM_HOME
-
-	for pid in $(pgrep -x node); do
+	(( PM_SCANNED )) || scan_procs
+	for pid in $(procs_of node); do
 		# filter on pids, if provided
 		if (( ${#filter_pids[@]} )); then
 			(( ! filter_pids[pid] )) && continue
@@ -367,7 +476,7 @@ function fix_node_maps {
 		if (( PM_CONTAINER_AWARE )); then
 			# check the namespace pid to determine if a pid is in a
 			# container
-			local nspid=$(_pid_to_nspid $pid)
+			local nspid=${PM_NSPID[$pid]}
 			if (( nspid == pid )); then
 				_host_node_map $pid
 			else
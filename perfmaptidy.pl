@@ -15,6 +15,9 @@
 # file to be a .livemap file, and then recreate the .map file using
 # perfmaptidy.pl (the new .livemap file should continue being written to).
 #
+# Vector uses "vectorhelper maptidy", a compiled version with the same output,
+# as replaying a large map here is quadratic.
+#
 # Copyright 2017 Netflix, Inc.
 # Licensed under the Apache License, Version 2.0 (the "License")
 
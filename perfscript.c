@@ -0,0 +1,518 @@
+/*
+ * perfscript.c - fold "perf script" output into stacks, natively.
+ *
+ * This follows the rules of BINFlameGraph/stackcollapse-perf.pl, so that
+ * flame graphs look the same: frames are tidied the same way, [unknown]
+ * frames use the module name, inlined frames are split, and the first event
+ * type seen is used unless another is specified. Annotations (-a) are as
+ * for stackcollapse-perf.pl --all.
+ *
+ * Unlike stackcollapse-perf.pl, the sample time, CPU, PID and TID are kept,
+ * so that samples can also be written to a sample store (samplestore.h) for
+ * later time range queries.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vectorhelper.h"
+#include "stacktab.h"
+#include "samplestore.h"
+#include "perfscript.h"
+
+#define FUNCMAX		4096
+
+/*
+ * cgroups: samples are tagged with the cgroup of their process, read from
+ * /proc when the profile is processed. The unified (v2) path is preferred,
+ * then the v1 perf_event hierarchy.
+ */
+uint32_t
+ps_cgroup(psparser_t *ps, int32_t pid)
+{
+	char path[64], *line = NULL, *cg = NULL, *p;
+	size_t linesz = 0;
+	uint32_t i, mask, id;
+	FILE *fp;
+
+	if (pid <= 0)
+		return 0;
+	if (ps->cgcount * 2 >= ps->cgsize) {
+		int32_t *opid = ps->cgpid;
+		uint32_t *oid = ps->cgid, osize = ps->cgsize;
+
+		ps->cgsize = osize ? osize * 2 : 1024;
+		ps->cgpid = vh_calloc(ps->cgsize, sizeof (int32_t));
+		ps->cgid = vh_calloc(ps->cgsize, sizeof (uint32_t));
+		mask = ps->cgsize - 1;
+		for (i = 0; i < osize; i++) {
+			if (opid[i] == 0)
+				continue;
+			id = opid[i] & mask;
+			while (ps->cgpid[id])
+				id = (id + 1) & mask;
+			ps->cgpid[id] = opid[i];
+			ps->cgid[id] = oid[i];
+		}
+		free(opid);
+		free(oid);
+	}
+	mask = ps->cgsize - 1;
+	for (i = pid & mask; ps->cgpid[i]; i = (i + 1) & mask) {
+		if (ps->cgpid[i] == pid)
+			return ps->cgid[i];
+	}
+
+	snprintf(path, sizeof (path), "/proc/%d/cgroup", pid);
+	if ((fp = fopen(path, "r")) != NULL) {
+		while (getline(&line, &linesz, fp) != -1) {
+			line[strcspn(line, "\n")] = '\0';
+			if (strncmp(line, "0::", 3) == 0) {
+				free(cg);
+				cg = vh_strdup(line + 3);
+				break;
+			}
+			if ((p = strchr(line, ':')) != NULL &&
+			    strncmp(p + 1, "perf_event:", 11) == 0)
+				cg = vh_strdup(p + 12);
+		}
+		fclose(fp);
+		free(line);
+	}
+	ps->cgpid[i] = pid;
+	ps->cgid[i] = cg ? ssw_cgroup(ps->store, cg) : 0;
+	ps->cgcount++;
+	free(cg);
+	return ps->cgid[i];
+}
+
+static void
+addframe(psparser_t *ps, const char *func, size_t len)
+{
+	if (ps->nframes == ps->alloc) {
+		ps->alloc = ps->alloc ? ps->alloc * 2 : 256;
+		ps->frames = vh_realloc(ps->frames, ps->alloc * sizeof (uint32_t));
+	}
+	ps->frames[ps->nframes++] = strtab_intern(&ps->st->frames, func, len);
+}
+
+/* finish the current sample: build the stack root first, and record it */
+void
+ps_end(psparser_t *ps)
+{
+	uint32_t *ids, depth = 0, g, i, end;
+
+	if (!ps->active)
+		return;
+	ps->active = 0;
+
+	/* lines are leaf first, but frames within a line are in order */
+	ids = stacktab_scratch(ps->st, ps->nframes + 1);
+	ids[depth++] = ps->pname;
+	end = ps->nframes;
+	for (g = ps->ngroups; g > 0; g--) {
+		for (i = ps->groups[g - 1]; i < end; i++)
+			ids[depth++] = ps->frames[i];
+		end = ps->groups[g - 1];
+	}
+	ps->sample.stack = stacktab_intern(ps->st, ids, depth);
+	stacktab_add(ps->st, ps->sample.stack, ps->col, ps->sample.weight);
+	if (ps->store != NULL) {
+		ps->sample.cgroup = ps_cgroup(ps,
+		    ps->sample.pid > 0 ? ps->sample.pid : ps->sample.tid);
+		ssw_add(ps->store, &ps->sample);
+	}
+}
+
+/*
+ * Parse an event record header, eg:
+ *	java 12688 [002] 6544038.708352: cpu-clock:
+ *	V8 WorkerThread 24636/25607 [000] 94564.109216: 10101010 cycles:
+ * The process name may contain spaces, and is followed by the PID/TID, or
+ * just the TID. Returns 0 if this starts a sample to be kept.
+ */
+static int
+parseheader(psparser_t *ps, char *line)
+{
+	char *p, *q, *tok, *event = NULL, *comm_end = NULL;
+	long pid = -1, tid = -1;
+	sample_t *s = &ps->sample;
+	size_t len;
+
+	/* find the first " digits[/digits] " after the process name */
+	for (p = line + 1; *p != '\0'; p++) {
+		if (!isspace((unsigned char)*p))
+			continue;
+		for (q = p; isspace((unsigned char)*q); q++)
+			;
+		if (!isdigit((unsigned char)*q))
+			continue;
+		tid = strtol(q, &q, 10);
+		while (*q == '/')
+			q++;
+		if (isdigit((unsigned char)*q)) {
+			pid = tid;
+			tid = strtol(q, &q, 10);
+		}
+		if (isspace((unsigned char)*q)) {
+			comm_end = p;
+			p = q;
+			break;
+		}
+		pid = tid = -1;
+	}
+	if (comm_end == NULL) {
+		vh_warn("Unrecognized line: %s", line);
+		return -1;
+	}
+
+	memset(s, 0, sizeof (*s));
+	s->pid = pid;
+	s->tid = tid;
+	s->cpu = -1;
+	s->weight = 1;
+	for (tok = strtok(p, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+		len = strlen(tok);
+		if (tok[0] == '[' && tok[len - 1] == ']') {
+			s->cpu = atoi(tok + 1);
+		} else if (isdigit((unsigned char)tok[0]) && tok[len - 1] == ':' &&
+		    strchr(tok, '.') != NULL) {
+			/* seconds.fraction: */
+			s->time = strtoull(tok, &q, 10) * 1000000000ULL;
+			if (*q == '.') {
+				uint64_t frac = 0, scale = 1000000000ULL;
+
+				for (q++; isdigit((unsigned char)*q); q++) {
+					scale /= 10;
+					frac += (*q - '0') * scale;
+				}
+				s->time += frac;
+			}
+		}
+		event = tok;
+	}
+	/* the event is the last token, if it ends with a colon */
+	if (event != NULL) {
+		len = strlen(event);
+		if (len > 1 && event[len - 1] == ':' && !(isdigit(
+		    (unsigned char)event[0]) && strchr(event, '.'))) {
+			event[len - 1] = '\0';
+			if (ps->event[0] == '\0') {
+				snprintf(ps->event, sizeof (ps->event), "%s", event);
+				ps->defaulted = 1;
+			} else if (strcmp(event, ps->event) != 0) {
+				if (ps->defaulted && !ps->warned) {
+					vh_warn("Filtering for events of type: %s",
+					    ps->event);
+					ps->warned = 1;
+				}
+				return -1;
+			}
+		}
+	}
+
+	ps_begin(ps, line, comm_end - line);
+	return 0;
+}
+
+/* begin a sample of ps->sample, with the process name as its root frame */
+void
+ps_begin(psparser_t *ps, const char *comm, size_t len)
+{
+	char buf[FUNCMAX];
+	size_t i;
+
+	/* spaces become underscores */
+	if (len >= sizeof (buf))
+		len = sizeof (buf) - 1;
+	for (i = 0; i < len; i++)
+		buf[i] = comm[i] == ' ' ? '_' : comm[i];
+	buf[len] = '\0';
+	ps->pname = strtab_intern(&ps->st->frames, buf, len);
+	ps->java = strcmp(buf, "java") == 0;
+	ps->nframes = ps->ngroups = 0;
+	ps->active = 1;
+}
+
+/*
+ * Tidy a function name into buf, as stackcollapse-perf.pl does.
+ */
+static size_t
+tidyfunc(psparser_t *ps, const char *func, size_t len, const char *mod,
+    int inlined, char *buf)
+{
+	const char *base, *p, *q;
+	size_t n = 0, i;
+	int unknown;
+
+	if (len >= FUNCMAX - 8)
+		len = FUNCMAX - 8;
+	unknown = len == 9 && memcmp(func, "[unknown]", 9) == 0;
+	if (unknown) {
+		/* use the module name instead, if known */
+		if (strcmp(mod, "[unknown]") != 0) {
+			base = strrchr(mod, '/');
+			base = base ? base + 1 : mod;
+		} else {
+			base = "unknown";
+		}
+		n = snprintf(buf, FUNCMAX - 8, "[%s]", base);
+	} else {
+		memcpy(buf, func, len);
+		n = len;
+		buf[n] = '\0';
+	}
+
+	/* tidy generic */
+	for (i = 0; i < n; i++) {
+		if (buf[i] == ';')
+			buf[i] = ':';
+	}
+	/* unless a Go method name, drop everything after the first paren */
+	p = strstr(buf, ".(");
+	if (p == NULL || (q = strstr(p + 2, ").")) == NULL) {
+		for (p = buf; (p = strchr(p, '(')) != NULL; p++) {
+			if (strncmp(p, "(anonymous namespace)", 21) != 0) {
+				n = p - buf;
+				buf[n] = '\0';
+				break;
+			}
+		}
+	}
+	for (i = 0, p = buf; *p; p++) {
+		if (*p != '"' && *p != '\'')
+			buf[i++] = *p;
+	}
+	buf[n = i] = '\0';
+
+	/* tidy java */
+	if (ps->java && buf[0] == 'L' && strchr(buf, '/') != NULL) {
+		memmove(buf, buf + 1, n);
+		n--;
+	}
+
+	/* annotations */
+	if (inlined) {
+		n += sprintf(buf + n, "_[i]");
+	} else if (ps->annotate && (mod[0] == '[' ||
+	    ((i = strlen(mod)) >= 7 && strcmp(mod + i - 7, "vmlinux") == 0)) &&
+	    strstr(mod, "unknown") == NULL) {
+		n += sprintf(buf + n, "_[k]");
+	} else if (ps->annotate && (p = strstr(mod, "/tmp/perf-")) != NULL &&
+	    isdigit((unsigned char)p[10])) {
+		for (q = p + 10; isdigit((unsigned char)*q); q++)
+			;
+		if (strncmp(q, ".map", 4) == 0)
+			n += sprintf(buf + n, "_[j]");
+	}
+	return n;
+}
+
+/*
+ * Parse a stack line, eg:
+ *	ffffffff8103ce3b native_safe_halt+0x6 ([kernel.kallsyms])
+ */
+static void
+parseframe(psparser_t *ps, char *line)
+{
+	char *pc, *func, *funcend, *mod, *modend, *p, *q;
+
+	for (pc = line; isspace((unsigned char)*pc); pc++)
+		;
+	for (p = pc; isalnum((unsigned char)*p) || *p == '_'; p++)
+		;
+	if (p == pc)
+		goto bad;
+	for (func = p; isspace((unsigned char)*func); func++)
+		;
+
+	/* the module is the last " (nonspace)" group */
+	mod = modend = NULL;
+	for (p = line + strlen(line) - 1; p > func; p--) {
+		if (p[0] != '(' || p[-1] != ' ')
+			continue;
+		for (q = p + 1; *q && !isspace((unsigned char)*q); q++)
+			;
+		while (q > p + 1 && q[-1] != ')')
+			q--;
+		if (q > p + 1 && q[-1] == ')') {
+			mod = p + 1;
+			modend = q - 1;
+			break;
+		}
+	}
+	if (mod == NULL || p - 1 <= func)
+		goto bad;
+	funcend = p - 1;
+	*modend = '\0';
+	*funcend = '\0';
+
+	/* strip symbol offsets, eg, "+0x1c" */
+	if ((p = strrchr(func, '+')) != NULL && p[1] == '0' && p[2] == 'x' &&
+	    p[3] != '\0' && strspn(p + 3, "0123456789abcdef") == strlen(p + 3))
+		*p = '\0';
+	if (func[0] == '(')
+		return;			/* process names */
+	ps_frame(ps, func, mod);
+	return;
+bad:
+	vh_warn("Unrecognized line: %s", line);
+}
+
+/*
+ * Add a frame of the current sample, leaf first. func may be several frames
+ * joined by "->", with the inlined frames after the first.
+ */
+void
+ps_frame(psparser_t *ps, char *func, const char *mod)
+{
+	char buf[FUNCMAX], *p, *arrow;
+	size_t n;
+	int inlined = 0;
+
+	if (ps->ngroups == ps->groupalloc) {
+		ps->groupalloc *= 2;
+		ps->groups = vh_realloc(ps->groups,
+		    ps->groupalloc * sizeof (uint32_t));
+	}
+	ps->groups[ps->ngroups++] = ps->nframes;
+	for (p = func; p != NULL; p = arrow) {
+		if ((arrow = strstr(p, "->")) != NULL) {
+			*arrow = '\0';
+			arrow += 2;
+		}
+		n = tidyfunc(ps, p, strlen(p), mod, inlined++, buf);
+		addframe(ps, buf, n);
+	}
+}
+
+/*
+ * Name one frame outside of a sample, for decoders that aggregate stacks
+ * before naming them: returns its frame IDs, in order, in *ids.
+ */
+uint32_t
+ps_name(psparser_t *ps, char *func, const char *mod, int java,
+    const uint32_t **ids)
+{
+	ps->java = java;
+	ps->nframes = ps->ngroups = 0;
+	ps_frame(ps, func, mod);
+	*ids = ps->frames;
+	return ps->nframes;
+}
+
+void
+ps_init(psparser_t *ps, stacktab_t *st, sswriter_t *store)
+{
+	memset(ps, 0, sizeof (*ps));
+	ps->st = st;
+	ps->store = store;
+	ps->alloc = ps->groupalloc = 256;
+	ps->frames = vh_malloc(ps->alloc * sizeof (uint32_t));
+	ps->groups = vh_malloc(ps->groupalloc * sizeof (uint32_t));
+}
+
+void
+ps_free(psparser_t *ps)
+{
+	free(ps->frames);
+	free(ps->groups);
+	free(ps->cgpid);
+	free(ps->cgid);
+}
+
+/* parse "perf script" output from fp */
+void
+ps_read(psparser_t *ps, FILE *fp)
+{
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &linesz, fp)) != -1) {
+		if (line[0] == '#')
+			continue;
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0) {
+			ps_end(ps);
+		} else if (!isspace((unsigned char)line[0])) {
+			ps_end(ps);
+			parseheader(ps, line);
+		} else if (ps->active) {
+			parseframe(ps, line);
+		}
+	}
+	ps_end(ps);
+	free(line);
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * collapse [-a] [-e event] [-k clock] [-s store]: fold "perf script" output
+ * on STDIN into a folded profile on STDOUT, and optionally write a sample
+ * store. perf script does not print the sample clock, so -k mono says that
+ * it was recorded with perf record -k mono, for epoch time ranges.
+ */
+int
+cmd_collapse(int argc, char **argv)
+{
+	stacktab_t st;
+	sswriter_t store;
+	psparser_t ps;
+	const char *storepath = NULL, *event = NULL;
+	int annotate = 0, monotonic = 0, c, status = 0;
+
+	while ((c = getopt(argc, argv, "ae:k:s:")) != -1) {
+		switch (c) {
+		case 'a':
+			annotate = 1;
+			break;
+		case 'e':
+			event = optarg;
+			break;
+		case 'k':
+			if (strcmp(optarg, "mono") != 0 &&
+			    strcmp(optarg, "monotonic") != 0)
+				return 2;
+			monotonic = 1;
+			break;
+		case 's':
+			storepath = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc)
+		return 2;
+
+	stacktab_init(&st, 1);
+	ssw_init(&store, &st);
+	store.monotonic = monotonic;
+	ps_init(&ps, &st, storepath ? &store : NULL);
+	ps.annotate = annotate;
+	if (event != NULL)
+		snprintf(ps.event, sizeof (ps.event), "%s", event);
+
+	ps_read(&ps, stdin);
+	stacktab_write_folded(&st, stdout, 0);
+	if (storepath != NULL) {
+		snprintf(store.event, sizeof (store.event), "%s", ps.event);
+		status = ssw_write(&store, storepath) == 0 ? 0 : 1;
+	}
+
+	ps_free(&ps);
+	ssw_free(&store);
+	stacktab_free(&st);
+	return status;
+}
@@ -0,0 +1,61 @@
+/*
+ * perfscript.h - fold perf samples into stacks, as stackcollapse-perf.pl does.
+ *
+ * A psparser builds one sample at a time, from "perf script" output (the
+ * collapse command) or from perf.data decoded natively (perfdata.c): begin
+ * the sample with its process name, add its frames leaf first, and end it to
+ * add it to the stack table, and optionally to a sample store.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef PERFSCRIPT_H
+#define PERFSCRIPT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "stacktab.h"
+#include "samplestore.h"
+
+typedef struct psparser {
+	stacktab_t	*st;
+	sswriter_t	*store;		/* optional */
+	int		annotate;
+	char		event[64];	/* event filter, or first seen */
+	int		defaulted;
+	int		warned;
+
+	/* current sample */
+	int		active;
+	int		java;
+	int		col;		/* weight column */
+	sample_t	sample;
+	uint32_t	pname;
+	uint32_t	*frames;	/* frame IDs, in input (leaf) order */
+	uint32_t	*groups;	/* start of each line's frames */
+	uint32_t	nframes;
+	uint32_t	ngroups;
+	uint32_t	alloc;
+	uint32_t	groupalloc;
+
+	/* pid -> cgroup ID cache, for the store */
+	int32_t		*cgpid;
+	uint32_t	*cgid;
+	uint32_t	cgsize;
+	uint32_t	cgcount;
+} psparser_t;
+
+void	ps_init(psparser_t *, stacktab_t *, sswriter_t *);
+void	ps_free(psparser_t *);
+void	ps_read(psparser_t *, FILE *);
+
+/* set ps->sample, then begin; func may be modified by ps_frame */
+void	ps_begin(psparser_t *, const char *comm, size_t len);
+void	ps_frame(psparser_t *, char *func, const char *mod);
+void	ps_end(psparser_t *);
+uint32_t ps_name(psparser_t *, char *func, const char *mod, int java,
+	    const uint32_t **ids);
+uint32_t ps_cgroup(psparser_t *, int32_t pid);
+
+#endif /* PERFSCRIPT_H */
@@ -0,0 +1,356 @@
+/*
+ * procs.c - a process table, from one scan of /proc.
+ *
+ * See procs.h. A process is read from its stat, status and cgroup files,
+ * its exe link, and for runtimes only, its command line. A process that
+ * exits during the scan is skipped.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vectorhelper.h"
+#include "procs.h"
+
+#define PF_KTHREAD	0x00200000	/* kernel thread, in stat flags */
+
+static const char *runtime_names[] = {
+	[PROC_NATIVE] = "native",
+	[PROC_JAVA] = "java",
+	[PROC_NODE] = "node",
+	[PROC_PYTHON] = "python",
+};
+
+void
+proctab_init(proctab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+}
+
+void
+proctab_free(proctab_t *t)
+{
+	uint32_t i;
+
+	for (i = 0; i < t->count; i++) {
+		free(t->procs[i].cgroup);
+		free(t->procs[i].exe);
+	}
+	free(t->procs);
+	memset(t, 0, sizeof (*t));
+}
+
+const char *
+proc_runtime_name(int runtime)
+{
+	return runtime_names[runtime];
+}
+
+/* read a /proc file of the process, terminated; returns the length or -1 */
+static ssize_t
+readproc(int pid, const char *file, char *buf, size_t size)
+{
+	char path[64];
+	ssize_t n, len = 0;
+	int fd;
+
+	snprintf(path, sizeof (path), "/proc/%d/%s", pid, file);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	while ((size_t)len < size - 1 &&
+	    (n = read(fd, buf + len, size - 1 - len)) > 0)
+		len += n;
+	close(fd);
+	buf[len] = '\0';
+	return len;
+}
+
+/* the runtime that a process or binary name is */
+static int
+runtime(const char *name)
+{
+	const char *p;
+
+	if (strcmp(name, "java") == 0)
+		return PROC_JAVA;
+	if (strcmp(name, "node") == 0 || strcmp(name, "nodejs") == 0)
+		return PROC_NODE;
+	if (strncmp(name, "python", 6) == 0) {
+		for (p = name + 6; isdigit((unsigned char)*p) || *p == '.'; p++)
+			;
+		if (*p == '\0')
+			return PROC_PYTHON;
+	}
+	return PROC_NATIVE;
+}
+
+/* the JIT symbol flags of a runtime, from its command line */
+static int
+jitflags(int pid, int rt)
+{
+	char buf[8192], *arg, *end;
+	ssize_t len;
+	int flags = 0, xopt = 0;
+
+	if ((len = readproc(pid, "cmdline", buf, sizeof (buf))) <= 0)
+		return 0;
+	end = buf + len;
+	for (arg = buf; arg < end; arg += strlen(arg) + 1) {
+		if (rt == PROC_NODE) {
+			/* node accepts - and _ alike in option names */
+			if (strncmp(arg, "--perf_basic_prof", 17) == 0 ||
+			    strncmp(arg, "--perf-basic-prof", 17) == 0)
+				flags |= PROC_PERFMAP;
+			else if (strncmp(arg, "--perf_prof", 11) == 0 ||
+			    strncmp(arg, "--perf-prof", 11) == 0)
+				flags |= PROC_JITDUMP;
+		} else if (rt == PROC_PYTHON) {
+			/* -X perf, -Xperf, and the same for perf_jit */
+			if (strncmp(arg, "-X", 2) == 0 && arg[2] != '\0')
+				arg += 2;
+			else if (strcmp(arg, "-X") == 0) {
+				xopt = 1;
+				continue;
+			} else if (!xopt)
+				continue;
+			xopt = 0;
+			if (strcmp(arg, "perf") == 0)
+				flags |= PROC_PERFMAP;
+			else if (strcmp(arg, "perf_jit") == 0)
+				flags |= PROC_JITDUMP;
+		}
+	}
+	return flags;
+}
+
+/*
+ * The cgroups of a process: its perf_event cgroup (v1), and its unified
+ * cgroup (v2), either NULL if it has none. The caller frees both.
+ */
+int
+proc_cgroups(int pid, char **perf_event, char **unified)
+{
+	char buf[8192], *line, *next, *ctl, *path;
+
+	*perf_event = *unified = NULL;
+	if (readproc(pid, "cgroup", buf, sizeof (buf)) < 0)
+		return -1;
+	for (line = buf; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		/* hierarchy-ID:controller-list:cgroup-path */
+		if ((ctl = strchr(line, ':')) == NULL ||
+		    (path = strchr(ctl + 1, ':')) == NULL)
+			continue;
+		*path++ = '\0';
+		*ctl++ = '\0';
+		if (strcmp(line, "0") == 0 && *ctl == '\0' && *unified == NULL)
+			*unified = vh_strdup(path);
+		for (; ctl != NULL && *perf_event == NULL;
+		    ctl = strchr(ctl, ',')) {
+			if (*ctl == ',')
+				ctl++;
+			if (strncmp(ctl, "perf_event", 10) == 0 &&
+			    (ctl[10] == '\0' || ctl[10] == ','))
+				*perf_event = vh_strdup(path);
+		}
+	}
+	return 0;
+}
+
+/* read a process into p; returns -1 for kernel threads, or if it exited */
+static int
+procread(procinfo_t *p, int pid)
+{
+	char buf[4096], exe[4096], *s, *e, *line, *v2 = NULL;
+	const char *base;
+	unsigned long flags;
+	ssize_t len;
+	int i;
+
+	memset(p, 0, sizeof (*p));
+	p->pid = p->nspid = pid;
+
+	/* pid (comm) state ppid pgrp session tty_nr tpgid flags ... */
+	if (readproc(pid, "stat", buf, sizeof (buf)) <= 0 ||
+	    (s = strchr(buf, '(')) == NULL || (e = strrchr(buf, ')')) == NULL)
+		return -1;
+	len = e - s - 1;
+	if (len >= (ssize_t)sizeof (p->comm))
+		len = sizeof (p->comm) - 1;
+	memcpy(p->comm, s + 1, len);
+	p->comm[len] = '\0';
+	for (i = 0; i < 7 && e != NULL; i++)
+		e = strchr(e + 1, ' ');
+	if (e == NULL)
+		return -1;
+	flags = strtoul(e + 1, NULL, 10);
+	if (flags & PF_KTHREAD)
+		return -1;
+
+	if (readproc(pid, "status", buf, sizeof (buf)) <= 0)
+		return -1;
+	for (line = buf; line != NULL && *line != '\0'; line = s) {
+		if ((s = strchr(line, '\n')) != NULL)
+			*s++ = '\0';
+		/* real, effective, saved and filesystem IDs */
+		if (strncmp(line, "Uid:", 4) == 0)
+			sscanf(line + 4, "%*u %u", &p->uid);
+		else if (strncmp(line, "Gid:", 4) == 0)
+			sscanf(line + 4, "%*u %u", &p->gid);
+		else if (strncmp(line, "NSpid:", 6) == 0 &&
+		    (e = strrchr(line, '\t')) != NULL)
+			p->nspid = atoi(e + 1);
+	}
+
+	snprintf(buf, sizeof (buf), "/proc/%d/exe", pid);
+	if ((len = readlink(buf, exe, sizeof (exe) - 1)) > 0) {
+		exe[len] = '\0';
+		p->exe = vh_strdup(exe);
+	}
+	p->runtime = runtime(p->comm);
+	if (p->runtime == PROC_NATIVE && p->exe != NULL) {
+		base = strrchr(p->exe, '/');
+		p->runtime = runtime(base != NULL ? base + 1 : p->exe);
+	}
+	if (p->runtime != PROC_NATIVE)
+		p->flags = jitflags(pid, p->runtime);
+	/* the hierarchy that perf record --cgroup filters on */
+	if (proc_cgroups(pid, &p->cgroup, &v2) == 0 && p->cgroup == NULL)
+		p->cgroup = v2;
+	else
+		free(v2);
+	return 0;
+}
+
+/* the start time of a process, in clock ticks since boot */
+int
+proc_starttime(int pid, uint64_t *start)
+{
+	char buf[1024], *p;
+	int i;
+
+	/* after the command, which may have spaces: start is the 22nd field */
+	if (readproc(pid, "stat", buf, sizeof (buf)) <= 0 ||
+	    (p = strrchr(buf, ')')) == NULL)
+		return -1;
+	for (i = 2; i < 22 && p != NULL; i++)
+		p = strchr(p + 1, ' ');
+	if (p == NULL)
+		return -1;
+	*start = strtoull(p + 1, NULL, 10);
+	return 0;
+}
+
+static int
+pidcmp(const void *a, const void *b)
+{
+	const procinfo_t *x = a, *y = b;
+
+	return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+/* scan all processes into an empty t */
+int
+proctab_scan(proctab_t *t)
+{
+	struct dirent *de;
+	char *end;
+	DIR *dir;
+	long pid;
+
+	if ((dir = opendir("/proc")) == NULL) {
+		vh_warn("can't read /proc: %s", strerror(errno));
+		return -1;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		pid = strtol(de->d_name, &end, 10);
+		if (*end != '\0' || pid <= 0)
+			continue;
+		if (t->count == t->alloc) {
+			t->alloc = t->alloc ? t->alloc * 2 : 256;
+			t->procs = vh_realloc(t->procs,
+			    t->alloc * sizeof (procinfo_t));
+		}
+		if (procread(&t->procs[t->count], pid) == 0)
+			t->count++;
+	}
+	closedir(dir);
+	qsort(t->procs, t->count, sizeof (procinfo_t), pidcmp);
+	return 0;
+}
+
+const procinfo_t *
+proctab_find(const proctab_t *t, int pid)
+{
+	procinfo_t key;
+
+	key.pid = pid;
+	return bsearch(&key, t->procs, t->count, sizeof (procinfo_t), pidcmp);
+}
+
+/*
+ * ps [-r runtime] [pid ...]: print the process table, or the listed
+ * processes, of the given runtime, one per line:
+ *
+ *	pid runtime uid gid nspid flags cgroup exe
+ *
+ * where flags is perfmap and/or jitdump, comma separated, and a field that
+ * is not known is "-". exe is last, as it may have spaces.
+ */
+int
+cmd_ps(int argc, char **argv)
+{
+	const procinfo_t *p;
+	const char *rt = NULL;
+	proctab_t t;
+	uint32_t i;
+	int c, j, status = 0;
+
+	while ((c = getopt(argc, argv, "r:")) != -1) {
+		switch (c) {
+		case 'r':
+			rt = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+
+	proctab_init(&t);
+	if (proctab_scan(&t) != 0)
+		status = 1;
+	for (i = 0; i < t.count; i++) {
+		p = &t.procs[i];
+		if (rt != NULL &&
+		    strcmp(rt, proc_runtime_name(p->runtime)) != 0)
+			continue;
+		if (optind < argc) {
+			for (j = optind; j < argc; j++) {
+				if (atoi(argv[j]) == p->pid)
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+		printf("%d %s %u %u %d %s %s %s\n", p->pid,
+		    proc_runtime_name(p->runtime), p->uid, p->gid, p->nspid,
+		    p->flags == (PROC_PERFMAP | PROC_JITDUMP) ?
+		    "perfmap,jitdump" : p->flags == PROC_PERFMAP ? "perfmap" :
+		    p->flags == PROC_JITDUMP ? "jitdump" : "-",
+		    p->cgroup != NULL && *p->cgroup != '\0' ? p->cgroup : "-",
+		    p->exe != NULL ? p->exe : "-");
+	}
+	proctab_free(&t);
+	return status;
+}
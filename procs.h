@@ -0,0 +1,70 @@
+/*
+ * procs.h - a process table, from one scan of /proc.
+ *
+ * The task scripts need to know which processes are JIT runtimes, and for
+ * each, its user, its PID in its own namespace, its cgroup and its binary:
+ * to dump or fix its symbol map, and to pick a flame graph palette. A
+ * proctab collects all of these in a single pass over /proc, rather than a
+ * pgrep, and then a ps or awk per process. Each process is classified by
+ * its name (as pgrep -x matches it) or that of its binary:
+ *
+ *	java	a JVM, comm or binary "java"
+ *	node	Node.js, "node" or "nodejs"
+ *	python	CPython, "python" followed by a version, if any
+ *	native	anything else
+ *
+ * along with flags for the JIT symbols that a runtime's options enable:
+ * PROC_PERFMAP for a /tmp/perf-PID.map log (node --perf_basic_prof,
+ * python -X perf), PROC_JITDUMP for a jitdump file (node --perf-prof,
+ * python -X perf_jit). Kernel threads are not listed.
+ *
+ * "vectorhelper ps" prints the table, which perfmaplib.sh reads once and
+ * keeps for the rest of a task.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef PROCS_H
+#define PROCS_H
+
+#include <stdint.h>
+
+enum {
+	PROC_NATIVE = 0,
+	PROC_JAVA,
+	PROC_NODE,
+	PROC_PYTHON,
+};
+
+/* flags */
+#define PROC_PERFMAP	0x1		/* logs a perf map */
+#define PROC_JITDUMP	0x2		/* writes a jitdump */
+
+typedef struct procinfo {
+	int		pid;
+	int		nspid;		/* in its own PID namespace */
+	uint32_t	uid;		/* effective */
+	uint32_t	gid;
+	int		runtime;
+	int		flags;
+	char		*cgroup;	/* perf_event (v1), else unified (v2) */
+	char		*exe;		/* binary, or NULL */
+	char		comm[16];
+} procinfo_t;
+
+typedef struct proctab {
+	procinfo_t	*procs;		/* sorted by PID */
+	uint32_t	count;
+	uint32_t	alloc;
+} proctab_t;
+
+void	proctab_init(proctab_t *);
+void	proctab_free(proctab_t *);
+int	proctab_scan(proctab_t *);
+const procinfo_t *proctab_find(const proctab_t *, int pid);
+const char *proc_runtime_name(int runtime);
+int	proc_cgroups(int pid, char **perf_event, char **unified);
+int	proc_starttime(int pid, uint64_t *start);
+
+#endif /* PROCS_H */
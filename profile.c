@@ -0,0 +1,396 @@
+/*
+ * profile.c - compact binary format for aggregated profiles.
+ *
+ * See profile.h for the layout.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vectorhelper.h"
+#include "profile.h"
+
+static const char *suffix[PF_NKINDS] = { "", "_[k]", "_[i]", "_[j]" };
+
+/* return the kind of an annotated frame name, and the length without it */
+static uint32_t
+framekind(const char *name, size_t *len)
+{
+	uint32_t k;
+
+	for (k = PF_PLAIN + 1; k < PF_NKINDS; k++) {
+		if (*len > 4 && memcmp(name + *len - 4, suffix[k], 4) == 0) {
+			*len -= 4;
+			return k;
+		}
+	}
+	return PF_PLAIN;
+}
+
+/*
+ * Writing
+ */
+
+/* write all weight columns of the table; columns names them, eg, "samples" */
+int
+pf_write(const stacktab_t *st, const char *columns, const char *path)
+{
+	vfwriter_t vw;
+	vbuf_t *b;
+	strtab_t names;
+	pf_frame_t fr;
+	const char *name;
+	size_t len;
+	uint32_t i;
+	char buf[512];
+	int c, n, status;
+
+	strtab_init(&names);
+	vfw_init(&vw, VF_KIND_PROFILE);
+	b = vfw_section(&vw, VF_META, 0);
+	n = snprintf(buf, sizeof (buf), "columns=%s\nstacks=%u\n", columns,
+	    st->count);
+	vbuf_put(b, buf, n);
+
+	b = vfw_section(&vw, VF_FRAMES, st->frames.count);
+	for (i = 0; i < st->frames.count; i++) {
+		name = strtab_str(&st->frames, i);
+		len = st->frames.len[i];
+		fr.kind = framekind(name, &len);
+		fr.name = strtab_intern(&names, name, len);
+		vbuf_put(b, &fr, sizeof (fr));
+	}
+	vf_put_strings(vfw_section(&vw, VF_STRINGS, names.count), &names);
+	vf_put_stacks(vfw_section(&vw, VF_STACKS, st->count), st);
+	for (c = 0; c < st->ncols; c++) {
+		b = vfw_section(&vw, VF_COL_WEIGHT, st->count);
+		for (i = 0; i < st->count; i++)
+			vbuf_varint(b, st->weight[c][i]);
+	}
+
+	status = vfw_write(&vw, path);
+	vfw_free(&vw);
+	strtab_free(&names);
+	return status;
+}
+
+/*
+ * Reading
+ */
+
+/* return 1 if the file is a profile, rather than folded text */
+int
+pf_isprofile(const char *path)
+{
+	vf_header_t hdr;
+	FILE *fp;
+	int is = 0;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+	if (fread(&hdr, sizeof (hdr), 1, fp) == 1 &&
+	    memcmp(hdr.magic, VF_MAGIC, sizeof (hdr.magic)) == 0 &&
+	    hdr.kind == VF_KIND_PROFILE)
+		is = 1;
+	fclose(fp);
+	return is;
+}
+
+int
+pf_open(profile_t *pf, const char *path)
+{
+	const void *p;
+	uint64_t size, count;
+	uint32_t i;
+
+	memset(pf, 0, sizeof (*pf));
+	if (vf_open(&pf->f, path, VF_KIND_PROFILE) != 0)
+		return -1;
+	if (vf_get_strings(&pf->f, VF_STRINGS, &pf->names) != 0 ||
+	    vf_get_stacks(&pf->f, &pf->stacks) != 0)
+		goto bad;
+	if ((p = vf_section(&pf->f, VF_FRAMES, &size, &count)) == NULL ||
+	    size != count * sizeof (pf_frame_t))
+		goto bad;
+	pf->frames = p;
+	pf->nframes = count;
+	for (i = 0; i < pf->nframes; i++) {
+		if (pf->frames[i].name >= pf->names.count ||
+		    pf->frames[i].kind >= PF_NKINDS)
+			goto bad;
+	}
+	while (vf_nsection(&pf->f, VF_COL_WEIGHT, pf->ncols, NULL,
+	    &count) != NULL) {
+		if (count != pf->stacks.count)
+			goto bad;
+		pf->ncols++;
+	}
+	if (vf_meta(&pf->f, "columns", pf->columns,
+	    sizeof (pf->columns)) == NULL)
+		pf->columns[0] = '\0';
+	return 0;
+
+bad:
+	vh_warn("%s: truncated or corrupt profile", path);
+	pf_close(pf);
+	return -1;
+}
+
+void
+pf_close(profile_t *pf)
+{
+	vf_close(&pf->f);
+	memset(pf, 0, sizeof (*pf));
+}
+
+/* return the number of the named column, or -1 */
+int
+pf_colnum(const profile_t *pf, const char *name)
+{
+	const char *p = pf->columns, *end;
+	size_t len = strlen(name);
+	int col;
+
+	for (col = 0; col < pf->ncols && *p != '\0'; col++) {
+		if ((end = strchr(p, ',')) == NULL)
+			end = p + strlen(p);
+		if ((size_t)(end - p) == len && memcmp(p, name, len) == 0)
+			return col;
+		if (*end == '\0')
+			break;
+		p = end + 1;
+	}
+	return -1;
+}
+
+/* decode a weight column into w[stack ID], returning -1 if corrupt */
+int
+pf_weights(const profile_t *pf, int col, uint64_t *w)
+{
+	const unsigned char *p, *end;
+	uint64_t size;
+	uint32_t i;
+
+	if ((p = vf_nsection(&pf->f, VF_COL_WEIGHT, col, &size, NULL)) == NULL)
+		return -1;
+	for (end = p + size, i = 0; i < pf->stacks.count; i++) {
+		if ((p = varint(p, end, &w[i])) == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+void
+pf_write_stack(const profile_t *pf, FILE *fp, uint32_t id)
+{
+	static uint32_t *frames;
+	static uint32_t max;
+	const pf_frame_t *fr;
+	int depth, i;
+
+	depth = vf_stack(&pf->stacks, id, frames, max);
+	if (depth > (int)max) {
+		max = depth * 2;
+		frames = vh_realloc(frames, max * sizeof (uint32_t));
+		depth = vf_stack(&pf->stacks, id, frames, max);
+	}
+	if (depth < 0) {
+		fputs("[corrupt stack]", fp);
+		return;
+	}
+	for (i = 0; i < depth; i++) {
+		if (i)
+			putc(';', fp);
+		if (frames[i] >= pf->nframes) {
+			fputs("[bad frame]", fp);
+			continue;
+		}
+		fr = &pf->frames[frames[i]];
+		fputs(vf_string(&pf->names, fr->name), fp);
+		fputs(suffix[fr->kind], fp);
+	}
+}
+
+/*
+ * Add a profile to a stack table, as stacktab_read_folded() does for text.
+ * Frames are interned once each, rather than once per stack. Columns are
+ * read in order into the table's columns from col, up to its column count.
+ */
+int
+pf_read(stacktab_t *st, const char *path, int col)
+{
+	profile_t pf;
+	uint64_t *w[ST_MAXCOLS] = { NULL };
+	uint32_t *map = NULL, *frames, id, sid, i;
+	char *name = NULL;
+	size_t len, namesz = 0;
+	int c, ncols, depth, status = -1;
+	const pf_frame_t *fr;
+
+	if (pf_open(&pf, path) != 0)
+		return -1;
+	ncols = pf.ncols < st->ncols - col ? pf.ncols : st->ncols - col;
+	for (c = 0; c < ncols; c++) {
+		w[c] = vh_malloc(pf.stacks.count * sizeof (uint64_t) + 1);
+		if (pf_weights(&pf, c, w[c]) != 0)
+			goto done;
+	}
+	map = vh_malloc(pf.nframes * sizeof (uint32_t) + 1);
+	for (i = 0; i < pf.nframes; i++)
+		map[i] = ST_NONE;
+
+	for (id = 0; id < pf.stacks.count; id++) {
+		frames = stacktab_scratch(st, 256);
+		depth = vf_stack(&pf.stacks, id, frames, st->scratchsz);
+		if (depth > (int)st->scratchsz) {
+			frames = stacktab_scratch(st, depth);
+			depth = vf_stack(&pf.stacks, id, frames, depth);
+		}
+		if (depth < 0)
+			goto done;
+		for (i = 0; i < (uint32_t)depth; i++) {
+			if (frames[i] >= pf.nframes)
+				goto done;
+			if (map[frames[i]] == ST_NONE) {
+				fr = &pf.frames[frames[i]];
+				len = snprintf(name, namesz, "%s%s",
+				    vf_string(&pf.names, fr->name),
+				    suffix[fr->kind]);
+				if (len >= namesz) {
+					namesz = len + 1;
+					name = vh_realloc(name, namesz);
+					snprintf(name, namesz, "%s%s",
+					    vf_string(&pf.names, fr->name),
+					    suffix[fr->kind]);
+				}
+				map[frames[i]] = strtab_intern(&st->frames,
+				    name, len);
+			}
+			frames[i] = map[frames[i]];
+		}
+		sid = stacktab_intern(st, frames, depth);
+		for (c = 0; c < ncols; c++)
+			stacktab_add(st, sid, col + c, w[c][id]);
+	}
+	status = 0;
+
+done:
+	if (status != 0)
+		vh_warn("%s: truncated or corrupt profile", path);
+	for (c = 0; c < ncols; c++)
+		free(w[c]);
+	free(map);
+	free(name);
+	pf_close(&pf);
+	return status;
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * pack [-c column] -o profile [folded ...]: convert folded profiles (or
+ * STDIN) to a profile, merging identical stacks.
+ */
+int
+cmd_pack(int argc, char **argv)
+{
+	stacktab_t st;
+	FILE *fp;
+	const char *out = NULL, *column = "samples";
+	int c, i, status = 0;
+
+	while ((c = getopt(argc, argv, "c:o:")) != -1) {
+		switch (c) {
+		case 'c':
+			column = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (out == NULL || strchr(column, ',') != NULL)
+		return 2;
+
+	stacktab_init(&st, 1);
+	if (optind == argc)
+		stacktab_read_folded(&st, stdin, 0);
+	for (i = optind; i < argc; i++) {
+		if ((fp = fopen(argv[i], "r")) == NULL) {
+			vh_warn("can't read %s: %s", argv[i], strerror(errno));
+			status = 1;
+			continue;
+		}
+		stacktab_read_folded(&st, fp, 0);
+		fclose(fp);
+	}
+	if (pf_write(&st, column, out) != 0)
+		status = 1;
+	stacktab_free(&st);
+	return status;
+}
+
+/*
+ * unpack [-c column] profile: print a profile as folded text, with the
+ * weights of the named column (default the first).
+ */
+int
+cmd_unpack(int argc, char **argv)
+{
+	profile_t pf;
+	uint64_t *w;
+	const char *column = NULL;
+	uint32_t id;
+	int c, col = 0;
+
+	while ((c = getopt(argc, argv, "c:")) != -1) {
+		switch (c) {
+		case 'c':
+			column = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc - 1)
+		return 2;
+
+	if (pf_open(&pf, argv[optind]) != 0)
+		return 1;
+	if (column != NULL && (col = pf_colnum(&pf, column)) < 0) {
+		vh_warn("%s: no column %s (have %s)", argv[optind], column,
+		    pf.columns);
+		pf_close(&pf);
+		return 1;
+	}
+	if (col >= pf.ncols) {
+		pf_close(&pf);
+		return 0;
+	}
+	w = vh_malloc(pf.stacks.count * sizeof (uint64_t) + 1);
+	if (pf_weights(&pf, col, w) != 0) {
+		vh_warn("%s: truncated or corrupt profile", argv[optind]);
+		free(w);
+		pf_close(&pf);
+		return 1;
+	}
+	for (id = 0; id < pf.stacks.count; id++) {
+		if (w[id] == 0)
+			continue;
+		pf_write_stack(&pf, stdout, id);
+		printf(" %" PRIu64 "\n", w[id]);
+	}
+	free(w);
+	pf_close(&pf);
+	return 0;
+}
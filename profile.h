@@ -0,0 +1,65 @@
+/*
+ * profile.h - compact binary format for aggregated profiles.
+ *
+ * A profile holds what a folded text profile does, one entry per unique
+ * stack with its counts, but each frame name is stored once. It is a vfile
+ * (see vfile.h) of kind VF_KIND_PROFILE:
+ *
+ *	VF_META		columns (comma separated column names), stacks
+ *	VF_STRINGS	frame names, without annotations
+ *	VF_FRAMES	pf_frame_t per frame ID
+ *	VF_STACKS	stacks of frame IDs, root first
+ *	VF_COL_WEIGHT	one section per column: a varint per stack ID
+ *
+ * The stackcollapse-perf.pl --all annotations (_[k], _[i] and _[j]) are
+ * kept as the frame kind, so that "read" and "read_[k]" share a name.
+ * Folded text is converted to and from this format with the pack and unpack
+ * commands, so that the BINFlameGraph tools can still be used.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "stacktab.h"
+#include "vfile.h"
+
+/* frame kinds */
+enum {
+	PF_PLAIN = 0,
+	PF_KERNEL,		/* _[k] */
+	PF_INLINED,		/* _[i] */
+	PF_JIT,			/* _[j] */
+	PF_NKINDS
+};
+
+typedef struct pf_frame {
+	uint32_t	name;		/* string ID */
+	uint32_t	kind;
+} pf_frame_t;
+
+/* reading: the file is mapped, and frames and stacks are used in place */
+typedef struct profile {
+	vfile_t		f;
+	vf_strings_t	names;
+	const pf_frame_t *frames;
+	uint32_t	nframes;
+	vf_stacks_t	stacks;
+	int		ncols;
+	char		columns[256];	/* comma separated column names */
+} profile_t;
+
+int	pf_write(const stacktab_t *, const char *columns, const char *path);
+int	pf_isprofile(const char *path);
+int	pf_open(profile_t *, const char *path);
+void	pf_close(profile_t *);
+int	pf_colnum(const profile_t *, const char *name);
+int	pf_weights(const profile_t *, int col, uint64_t *);
+void	pf_write_stack(const profile_t *, FILE *, uint32_t);
+int	pf_read(stacktab_t *, const char *path, int col);
+
+#endif /* PROFILE_H */
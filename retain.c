@@ -0,0 +1,331 @@
+/*
+ * retain.c - disk budget for task output files.
+ *
+ * Each task leaves its output in a directory under /var/log/pcp/vector:
+ * perf.data, sample stores, profiles, and so on. These are kept for later
+ * queries and debugging, but must not fill the file system. The retain
+ * command enforces a budget for each task directory, and then for all of
+ * them, by removing the least recently used files first. Files of a task
+ * that is still running are never removed.
+ *
+ * Usage is written to a stats file, which the PMDA exports as the
+ * vector.retention metrics:
+ *
+ *	budget task_bytes total_bytes
+ *	task name bytes files evicted
+ *
+ * where evicted is the number of files removed since the stats file was
+ * created.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+
+#define BUSY_SECS	60		/* files this recently written are busy */
+
+typedef struct taskdir {
+	char		*name;
+	uint64_t	bytes;
+	uint32_t	files;
+	uint64_t	evicted;
+} taskdir_t;
+
+typedef struct artifact {
+	char		*path;
+	taskdir_t	*dir;
+	uint64_t	bytes;		/* allocated on disk */
+	time_t		used;		/* last access or modification */
+	int		busy;
+} artifact_t;
+
+typedef struct retainer {
+	taskdir_t	*dirs;
+	uint32_t	ndirs;
+	artifact_t	*files;
+	uint32_t	nfiles;
+	uint32_t	filesalloc;
+} retainer_t;
+
+/* files that are not task output */
+static int
+ignored(const char *name)
+{
+	static const char *suffixes[] = { ".status", ".lock", ".stats" };
+	size_t len = strlen(name), slen;
+	unsigned int i;
+
+	if (name[0] == '.')
+		return 1;
+	for (i = 0; i < sizeof (suffixes) / sizeof (suffixes[0]); i++) {
+		slen = strlen(suffixes[i]);
+		if (len > slen && strcmp(name + len - slen, suffixes[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Task output files are named with the PID of the task script, eg,
+ * perf.data.1234 or perf.data.1234.zst, and the side files of a shared
+ * capture follow it with their own suffix, eg, perf.data.1234.views. The
+ * PID is the third component of perf.* names, and the last of others, eg,
+ * out.lat_us.1234. Return 1 if that PID is running.
+ */
+static int
+inuse(const char *name)
+{
+	char buf[256], *p;
+	size_t len;
+	long pid;
+
+	snprintf(buf, sizeof (buf), "%s", name);
+	len = strlen(buf);
+	if (len > 4 && strcmp(buf + len - 4, ".zst") == 0)
+		buf[len - 4] = '\0';
+	if (strncmp(buf, "perf.", 5) == 0)
+		p = strchr(buf + 5, '.');
+	else
+		p = strrchr(buf, '.');
+	if (p == NULL || p[1] < '0' || p[1] > '9')
+		return 0;
+	pid = strtol(p + 1, &p, 10);
+	if ((*p != '\0' && *p != '.') || pid <= 0 || pid > INT32_MAX)
+		return 0;
+	return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+}
+
+static void
+scantask(retainer_t *r, const char *root, taskdir_t *td, time_t now)
+{
+	char path[4096];
+	struct dirent *de;
+	struct stat st;
+	artifact_t *a;
+	DIR *dir;
+
+	snprintf(path, sizeof (path), "%s/%s", root, td->name);
+	if ((dir = opendir(path)) == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (ignored(de->d_name))
+			continue;
+		snprintf(path, sizeof (path), "%s/%s/%s", root, td->name,
+		    de->d_name);
+		if (lstat(path, &st) != 0)
+			continue;
+		if (S_ISLNK(st.st_mode)) {
+			/* eg, a sample store link, once the store is removed */
+			if (stat(path, &st) != 0 && errno == ENOENT)
+				unlink(path);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode))
+			continue;
+
+		if (r->nfiles == r->filesalloc) {
+			r->filesalloc = r->filesalloc ? r->filesalloc * 2 : 256;
+			r->files = vh_realloc(r->files,
+			    r->filesalloc * sizeof (artifact_t));
+		}
+		a = &r->files[r->nfiles++];
+		a->path = vh_strdup(path);
+		a->dir = td;
+		a->bytes = (uint64_t)st.st_blocks * 512;
+		a->used = st.st_atime > st.st_mtime ? st.st_atime : st.st_mtime;
+		a->busy = inuse(de->d_name) || now - st.st_mtime < BUSY_SECS;
+		td->bytes += a->bytes;
+		td->files++;
+	}
+	closedir(dir);
+}
+
+static void
+scanroot(retainer_t *r, const char *root)
+{
+	char path[4096];
+	struct dirent *de;
+	struct stat st;
+	time_t now = time(NULL);
+	DIR *dir;
+	uint32_t i;
+
+	if ((dir = opendir(root)) == NULL) {
+		vh_warn("can't read %s: %s", root, strerror(errno));
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof (path), "%s/%s", root, de->d_name);
+		if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+			continue;
+		r->dirs = vh_realloc(r->dirs,
+		    (r->ndirs + 1) * sizeof (taskdir_t));
+		memset(&r->dirs[r->ndirs], 0, sizeof (taskdir_t));
+		r->dirs[r->ndirs++].name = vh_strdup(de->d_name);
+	}
+	closedir(dir);
+	/* the dirs array is now fixed, so artifacts can point into it */
+	for (i = 0; i < r->ndirs; i++)
+		scantask(r, root, &r->dirs[i], now);
+}
+
+static int
+lrucmp(const void *a, const void *b)
+{
+	const artifact_t *x = a, *y = b;
+
+	if (x->used != y->used)
+		return x->used < y->used ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+static void
+evict(artifact_t *a, uint64_t *total)
+{
+	if (unlink(a->path) != 0 && errno != ENOENT) {
+		vh_warn("can't remove %s: %s", a->path, strerror(errno));
+		a->busy = 1;
+		return;
+	}
+	a->dir->bytes -= a->bytes;
+	a->dir->files--;
+	a->dir->evicted++;
+	*total -= a->bytes;
+	a->bytes = 0;
+	a->busy = 1;		/* don't evict again */
+}
+
+/* carry the evicted counts over from the previous stats file */
+static void
+readstats(retainer_t *r, const char *path)
+{
+	char line[512], name[256];
+	uint64_t bytes, evicted;
+	uint32_t files, i;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "task %255s %" SCNu64 " %" SCNu32 " %" SCNu64,
+		    name, &bytes, &files, &evicted) != 4)
+			continue;
+		for (i = 0; i < r->ndirs; i++) {
+			if (strcmp(r->dirs[i].name, name) == 0)
+				r->dirs[i].evicted += evicted;
+		}
+	}
+	fclose(fp);
+}
+
+static int
+writestats(const retainer_t *r, const char *path, uint64_t taskbudget,
+    uint64_t budget)
+{
+	char tmppath[4096];
+	const taskdir_t *td;
+	uint32_t i;
+	FILE *fp;
+
+	snprintf(tmppath, sizeof (tmppath), "%s.tmp", path);
+	if ((fp = fopen(tmppath, "w")) == NULL) {
+		vh_warn("can't write %s: %s", tmppath, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "budget %" PRIu64 " %" PRIu64 "\n", taskbudget, budget);
+	for (i = 0; i < r->ndirs; i++) {
+		td = &r->dirs[i];
+		fprintf(fp, "task %s %" PRIu64 " %" PRIu32 " %" PRIu64 "\n",
+		    td->name, td->bytes, td->files, td->evicted);
+	}
+	if (ferror(fp) | fclose(fp) || rename(tmppath, path) != 0) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		unlink(tmppath);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * retain [-t task_mb] [-g total_mb] [-s statsfile] root: remove the least
+ * recently used task output files under root, until each task directory is
+ * within the task budget, and all are within the total budget. A budget of
+ * zero is unlimited.
+ */
+int
+cmd_retain(int argc, char **argv)
+{
+	retainer_t r;
+	const char *statspath = NULL;
+	uint64_t taskbudget = 0, budget = 0, total = 0;
+	uint32_t i;
+	int c, status = 0;
+
+	while ((c = getopt(argc, argv, "t:g:s:")) != -1) {
+		switch (c) {
+		case 't':
+			taskbudget = strtoull(optarg, NULL, 10) << 20;
+			break;
+		case 'g':
+			budget = strtoull(optarg, NULL, 10) << 20;
+			break;
+		case 's':
+			statspath = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc - 1)
+		return 2;
+
+	memset(&r, 0, sizeof (r));
+	scanroot(&r, argv[optind]);
+	qsort(r.files, r.nfiles, sizeof (artifact_t), lrucmp);
+	for (i = 0; i < r.nfiles; i++)
+		total += r.files[i].bytes;
+
+	if (taskbudget) {
+		for (i = 0; i < r.nfiles; i++) {
+			if (!r.files[i].busy && r.files[i].dir->bytes > taskbudget)
+				evict(&r.files[i], &total);
+		}
+	}
+	if (budget) {
+		for (i = 0; i < r.nfiles && total > budget; i++) {
+			if (!r.files[i].busy)
+				evict(&r.files[i], &total);
+		}
+	}
+
+	if (statspath != NULL) {
+		readstats(&r, statspath);
+		if (writestats(&r, statspath, taskbudget, budget) != 0)
+			status = 1;
+	}
+
+	for (i = 0; i < r.nfiles; i++)
+		free(r.files[i].path);
+	free(r.files);
+	for (i = 0; i < r.ndirs; i++)
+		free(r.dirs[i].name);
+	free(r.dirs);
+	return status;
+}
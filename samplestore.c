@@ -0,0 +1,463 @@
+/*
+ * samplestore.c - columnar store of profile samples, with a time index.
+ *
+ * See samplestore.h for the layout.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "vectorhelper.h"
+#include "samplestore.h"
+
+#define NSEC_PER_SEC	1000000000ULL
+
+/*
+ * Writing
+ */
+
+void
+ssw_init(sswriter_t *w, stacktab_t *st)
+{
+	memset(w, 0, sizeof (*w));
+	w->st = st;
+	strtab_init(&w->cgroups);
+	strtab_intern(&w->cgroups, "", 0);
+}
+
+void
+ssw_free(sswriter_t *w)
+{
+	strtab_free(&w->cgroups);
+	free(w->samples);
+	memset(w, 0, sizeof (*w));
+}
+
+void
+ssw_add(sswriter_t *w, const sample_t *s)
+{
+	if (w->count == w->alloc) {
+		w->alloc = w->alloc ? w->alloc * 2 : 65536;
+		w->samples = vh_realloc(w->samples, w->alloc * sizeof (sample_t));
+	}
+	w->samples[w->count++] = *s;
+}
+
+uint32_t
+ssw_cgroup(sswriter_t *w, const char *path)
+{
+	return strtab_intern(&w->cgroups, path, strlen(path));
+}
+
+/* offset from CLOCK_MONOTONIC, the sample clock of perf record -k mono, to
+ * the epoch */
+static int64_t
+realtime_offset(void)
+{
+	struct timespec mono, real;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	return ((int64_t)real.tv_sec - mono.tv_sec) * (int64_t)NSEC_PER_SEC +
+	    real.tv_nsec - mono.tv_nsec;
+}
+
+int
+ssw_write(sswriter_t *w, const char *path)
+{
+	vfwriter_t vw;
+	vbuf_t *meta, *index, *col[SS_NCOLS];
+	ss_index_t ix;
+	const sample_t *s;
+	uint64_t i, start = 0, end = 0, ptime = 0;
+	uint32_t pstack = 0;
+	char buf[512];
+	int c, n, status;
+
+	for (i = 0; i < w->count; i++) {
+		s = &w->samples[i];
+		if (i == 0 || s->time < start)
+			start = s->time;
+		if (s->time > end)
+			end = s->time;
+	}
+
+	vfw_init(&vw, VF_KIND_SAMPLES);
+	meta = vfw_section(&vw, VF_META, 0);
+	n = snprintf(buf, sizeof (buf), "start=%" PRIu64 "\nend=%" PRIu64
+	    "\nclock=%s\nrealtime=%" PRId64 "\nsamples=%" PRIu64
+	    "\nevent=%s\n", start, end, w->monotonic ? "monotonic" : "unknown",
+	    realtime_offset(), w->count, w->event);
+	vbuf_put(meta, buf, n);
+	vf_put_strings(vfw_section(&vw, VF_STRINGS, w->st->frames.count),
+	    &w->st->frames);
+	vf_put_stacks(vfw_section(&vw, VF_STACKS, w->st->count), w->st);
+	vf_put_strings(vfw_section(&vw, VF_CGROUPS, w->cgroups.count),
+	    &w->cgroups);
+	index = vfw_section(&vw, VF_INDEX,
+	    (w->count + SS_BLOCK - 1) / SS_BLOCK);
+	for (c = 0; c < SS_NCOLS; c++)
+		col[c] = vfw_section(&vw, VF_COL_TIME + c, w->count);
+
+	for (i = 0; i < w->count; i++) {
+		s = &w->samples[i];
+		if (i % SS_BLOCK == 0) {
+			if (i > 0)
+				vbuf_put(index, &ix, sizeof (ix));
+			memset(&ix, 0, sizeof (ix));
+			ix.first = i;
+			ix.tmin = ix.tmax = s->time;
+			for (c = 0; c < SS_NCOLS; c++)
+				ix.off[c] = col[c]->len;
+			ptime = 0;
+			pstack = 0;
+		}
+		ix.nsamples++;
+		if (s->time < ix.tmin)
+			ix.tmin = s->time;
+		if (s->time > ix.tmax)
+			ix.tmax = s->time;
+		vbuf_varint(col[0], zigzag((int64_t)(s->time - ptime)));
+		vbuf_varint(col[1], zigzag((int64_t)s->stack - pstack));
+		vbuf_varint(col[2], (uint32_t)(s->pid + 1));
+		vbuf_varint(col[3], (uint32_t)(s->tid + 1));
+		vbuf_varint(col[4], (uint32_t)(s->cpu + 1));
+		vbuf_varint(col[5], s->cgroup);
+		vbuf_varint(col[6], s->weight);
+		ptime = s->time;
+		pstack = s->stack;
+	}
+	if (w->count > 0)
+		vbuf_put(index, &ix, sizeof (ix));
+
+	status = vfw_write(&vw, path);
+	vfw_free(&vw);
+	return status;
+}
+
+/*
+ * Reading
+ */
+
+int
+ssr_open(ssreader_t *r, const char *path)
+{
+	uint64_t size, count, v;
+	char buf[64];
+	int c;
+
+	memset(r, 0, sizeof (*r));
+	if (vf_open(&r->f, path, VF_KIND_SAMPLES) != 0)
+		return -1;
+	if (vf_get_strings(&r->f, VF_STRINGS, &r->frames) != 0 ||
+	    vf_get_stacks(&r->f, &r->stacks) != 0 ||
+	    vf_get_strings(&r->f, VF_CGROUPS, &r->cgroups) != 0 ||
+	    (r->index = vf_section(&r->f, VF_INDEX, &size, &count)) == NULL ||
+	    size != count * sizeof (ss_index_t))
+		goto bad;
+	r->nblocks = count;
+	for (c = 0; c < SS_NCOLS; c++) {
+		r->col[c] = vf_section(&r->f, VF_COL_TIME + c, &size, NULL);
+		if (r->col[c] == NULL)
+			goto bad;
+		r->colend[c] = r->col[c] + size;
+	}
+	for (v = 0; v < r->nblocks; v++) {
+		for (c = 0; c < SS_NCOLS; c++) {
+			if (r->index[v].off[c] > (uint64_t)(r->colend[c] - r->col[c]))
+				goto bad;
+		}
+	}
+	if (vf_meta(&r->f, "start", buf, sizeof (buf)))
+		r->start = strtoull(buf, NULL, 10);
+	if (vf_meta(&r->f, "end", buf, sizeof (buf)))
+		r->end = strtoull(buf, NULL, 10);
+	if (vf_meta(&r->f, "realtime", buf, sizeof (buf)))
+		r->realtime = strtoll(buf, NULL, 10);
+	if (vf_meta(&r->f, "clock", buf, sizeof (buf)))
+		r->monotonic = strcmp(buf, "monotonic") == 0;
+	return 0;
+
+bad:
+	vh_warn("%s: corrupt sample store", path);
+	vf_close(&r->f);
+	return -1;
+}
+
+void
+ssr_close(ssreader_t *r)
+{
+	vf_close(&r->f);
+}
+
+void
+ssr_filter_init(ss_filter_t *flt)
+{
+	memset(flt, 0, sizeof (*flt));
+	flt->t1 = UINT64_MAX;
+	flt->cpu = flt->pid = flt->tid = -1;
+}
+
+static int
+parsesecs(const char *s, const char *end, double *secs)
+{
+	char buf[64], *p;
+	size_t len = end - s;
+
+	if (len == 0 || len >= sizeof (buf))
+		return -1;
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	*secs = strtod(buf, &p);
+	return (*p != '\0' || *secs < 0) ? -1 : 0;
+}
+
+/*
+ * Set the filter time range from "t0-t1", in seconds. Times less than
+ * 1000000000 are offsets from the first sample, and larger times are
+ * seconds since the epoch, if the samples were timed with CLOCK_MONOTONIC.
+ * Either end may be omitted, eg, "10-".
+ */
+int
+ssr_range(const ssreader_t *r, const char *range, ss_filter_t *flt)
+{
+	const char *dash = strchr(range, '-');
+	double t[2];
+	uint64_t ns[2];
+	int i;
+
+	if (dash == NULL)
+		return -1;
+	t[0] = t[1] = -1;
+	if (dash > range && parsesecs(range, dash, &t[0]) != 0)
+		return -1;
+	if (dash[1] && parsesecs(dash + 1, dash + strlen(dash), &t[1]) != 0)
+		return -1;
+	for (i = 0; i < 2; i++) {
+		if (t[i] >= 1000000000.0 && !r->monotonic) {
+			vh_warn("epoch times need samples timed with "
+			    "CLOCK_MONOTONIC (perf record -k mono)");
+			return -1;
+		}
+		if (t[i] < 0)
+			ns[i] = i ? UINT64_MAX : 0;
+		else if (t[i] >= 1000000000.0)
+			ns[i] = (uint64_t)(t[i] * NSEC_PER_SEC) - r->realtime;
+		else
+			ns[i] = r->start + (uint64_t)(t[i] * NSEC_PER_SEC);
+	}
+	if (ns[1] < ns[0])
+		return -1;
+	flt->t0 = ns[0];
+	flt->t1 = ns[1];
+	return 0;
+}
+
+/*
+ * Call func for each sample that matches the filter, decoding only the
+ * blocks that overlap the time range. Returns the number of matching
+ * samples, or -1 if the store is corrupt or func returns non-zero.
+ */
+int64_t
+ssr_scan(const ssreader_t *r, const ss_filter_t *flt,
+    int (*func)(const sample_t *, void *), void *arg)
+{
+	const ss_index_t *ix;
+	const unsigned char *p[SS_NCOLS];
+	unsigned char *cgmatch = NULL;
+	uint64_t b, i, v[SS_NCOLS];
+	int64_t matched = 0;
+	sample_t s;
+	int c;
+
+	if (flt->cgroup != NULL) {
+		cgmatch = vh_calloc(r->cgroups.count, 1);
+		for (i = 0; i < r->cgroups.count; i++) {
+			cgmatch[i] = strstr(vf_string(&r->cgroups, i),
+			    flt->cgroup) != NULL;
+		}
+	}
+
+	for (b = 0; b < r->nblocks; b++) {
+		ix = &r->index[b];
+		if (ix->tmax < flt->t0 || ix->tmin > flt->t1)
+			continue;
+		for (c = 0; c < SS_NCOLS; c++)
+			p[c] = r->col[c] + ix->off[c];
+		memset(&s, 0, sizeof (s));
+		for (i = 0; i < ix->nsamples; i++) {
+			for (c = 0; c < SS_NCOLS; c++) {
+				p[c] = varint(p[c], r->colend[c], &v[c]);
+				if (p[c] == NULL) {
+					matched = -1;
+					goto done;
+				}
+			}
+			s.time += unzigzag(v[0]);
+			s.stack += unzigzag(v[1]);
+			s.pid = (int32_t)v[2] - 1;
+			s.tid = (int32_t)v[3] - 1;
+			s.cpu = (int32_t)v[4] - 1;
+			s.cgroup = v[5];
+			s.weight = v[6];
+
+			if (s.time < flt->t0 || s.time > flt->t1)
+				continue;
+			if ((flt->cpu >= 0 && s.cpu != flt->cpu) ||
+			    (flt->pid >= 0 && s.pid != flt->pid) ||
+			    (flt->tid >= 0 && s.tid != flt->tid) ||
+			    (flt->noidle && s.tid == 0))
+				continue;
+			if (cgmatch && (s.cgroup >= r->cgroups.count ||
+			    !cgmatch[s.cgroup]))
+				continue;
+			if (s.stack >= r->stacks.count) {
+				matched = -1;
+				goto done;
+			}
+			matched++;
+			if (func(&s, arg) != 0) {
+				matched = -1;
+				goto done;
+			}
+		}
+	}
+done:
+	free(cgmatch);
+	return matched;
+}
+
+void
+ssr_write_stack(const ssreader_t *r, FILE *fp, uint32_t id)
+{
+	static uint32_t *frames;
+	static uint32_t max;
+	int depth, i;
+
+	depth = vf_stack(&r->stacks, id, frames, max);
+	if (depth > (int)max) {
+		max = depth * 2;
+		frames = vh_realloc(frames, max * sizeof (uint32_t));
+		depth = vf_stack(&r->stacks, id, frames, max);
+	}
+	if (depth < 0) {
+		fputs("[corrupt stack]", fp);
+		return;
+	}
+	for (i = 0; i < depth; i++) {
+		if (i)
+			putc(';', fp);
+		fputs(vf_string(&r->frames, frames[i]), fp);
+	}
+}
+
+/*
+ * Commands
+ */
+
+static int
+sumweight(const sample_t *s, void *arg)
+{
+	uint64_t *weights = arg;
+
+	weights[s->stack] += s->weight;
+	return 0;
+}
+
+/* print the sample time as ms from the start, and ms within that second */
+static int
+printoffset(const sample_t *s, void *arg)
+{
+	const ssreader_t *r = arg;
+	uint64_t t = s->time - r->start;
+
+	printf("%.3f %.3f\n", t / 1e6, (t % 1000000000) / 1e6);
+	return 0;
+}
+
+/*
+ * query [-oI] [-r t0-t1] [-C cpu] [-p pid] [-t tid] [-g cgroup] store: print
+ * the folded profile of the matching samples, or with -o, the time offsets
+ * of each sample for a subsecond offset heat map. -I skips idle samples.
+ */
+int
+cmd_query(int argc, char **argv)
+{
+	ssreader_t r;
+	ss_filter_t flt;
+	uint64_t *weights;
+	const char *range = NULL;
+	uint32_t id;
+	int c, offsets = 0;
+
+	ssr_filter_init(&flt);
+	while ((c = getopt(argc, argv, "oIr:C:p:t:g:")) != -1) {
+		switch (c) {
+		case 'o':
+			offsets = 1;
+			break;
+		case 'I':
+			flt.noidle = 1;
+			break;
+		case 'r':
+			range = optarg;
+			break;
+		case 'C':
+			flt.cpu = atoi(optarg);
+			break;
+		case 'p':
+			flt.pid = atoi(optarg);
+			break;
+		case 't':
+			flt.tid = atoi(optarg);
+			break;
+		case 'g':
+			flt.cgroup = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc - 1)
+		return 2;
+
+	if (ssr_open(&r, argv[optind]) != 0)
+		return 1;
+	if (range != NULL && ssr_range(&r, range, &flt) != 0) {
+		vh_warn("bad time range: %s", range);
+		ssr_close(&r);
+		return 2;
+	}
+	if (offsets) {
+		if (ssr_scan(&r, &flt, printoffset, &r) < 0) {
+			vh_warn("%s: corrupt sample store", argv[optind]);
+			ssr_close(&r);
+			return 1;
+		}
+		ssr_close(&r);
+		return 0;
+	}
+	weights = vh_calloc(r.stacks.count, sizeof (uint64_t));
+	if (ssr_scan(&r, &flt, sumweight, weights) < 0) {
+		vh_warn("%s: corrupt sample store", argv[optind]);
+		free(weights);
+		ssr_close(&r);
+		return 1;
+	}
+	for (id = 0; id < r.stacks.count; id++) {
+		if (weights[id] == 0)
+			continue;
+		ssr_write_stack(&r, stdout, id);
+		printf(" %" PRIu64 "\n", weights[id]);
+	}
+	free(weights);
+	ssr_close(&r);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * samplestore.h - columnar store of profile samples, with a time index.
+ *
+ * A sample store keeps every sample of a capture, so that any time range,
+ * CPU, PID, TID or cgroup can be turned into a flame graph later without
+ * profiling again. It is a vfile (see vfile.h) of kind VF_KIND_SAMPLES:
+ *
+ *	VF_META		start (ns, first sample), end, clock ("monotonic" if
+ *			the sample clock is CLOCK_MONOTONIC, as with perf
+ *			record -k mono, else "unknown"), realtime (ns offset
+ *			from CLOCK_MONOTONIC to the epoch), samples, event
+ *	VF_STRINGS	frame names
+ *	VF_STACKS	interned stacks
+ *	VF_CGROUPS	cgroup paths; ID 0 is "" (unknown)
+ *	VF_INDEX	ss_index_t per block of SS_BLOCK samples
+ *	VF_COL_*	one varint column per sample field
+ *
+ * Samples are stored in blocks of SS_BLOCK. Within a block, the time and
+ * stack ID columns are zigzag deltas from the previous sample, restarting
+ * at each block so that a query only decodes the blocks in its time range.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef SAMPLESTORE_H
+#define SAMPLESTORE_H
+
+#include <stdint.h>
+#include "stacktab.h"
+#include "vfile.h"
+
+#define SS_BLOCK	4096		/* samples per index entry */
+#define SS_NCOLS	7		/* VF_COL_TIME .. VF_COL_WEIGHT */
+
+typedef struct sample {
+	uint64_t	time;		/* ns, sample clock */
+	uint64_t	weight;		/* 1 for a sample, or eg, a period */
+	uint32_t	stack;		/* stack ID */
+	int32_t		pid;		/* -1 if unknown */
+	int32_t		tid;
+	int32_t		cpu;		/* -1 if unknown */
+	uint32_t	cgroup;		/* cgroup string ID, 0 if unknown */
+} sample_t;
+
+typedef struct ss_index {
+	uint64_t	tmin;		/* time range of the block */
+	uint64_t	tmax;
+	uint64_t	first;		/* first sample number */
+	uint32_t	nsamples;
+	uint32_t	reserved;
+	uint64_t	off[SS_NCOLS];	/* block start in each column */
+} ss_index_t;
+
+/* writing: samples refer to stacks and cgroups in the caller's tables */
+typedef struct sswriter {
+	stacktab_t	*st;
+	strtab_t	cgroups;
+	sample_t	*samples;
+	uint64_t	count;
+	uint64_t	alloc;
+	int		monotonic;	/* sample times are CLOCK_MONOTONIC */
+	char		event[64];
+} sswriter_t;
+
+void	ssw_init(sswriter_t *, stacktab_t *);
+void	ssw_add(sswriter_t *, const sample_t *);
+uint32_t ssw_cgroup(sswriter_t *, const char *);
+int	ssw_write(sswriter_t *, const char *path);
+void	ssw_free(sswriter_t *);
+
+/* querying */
+typedef struct ss_filter {
+	uint64_t	t0;		/* time range, ns, sample clock */
+	uint64_t	t1;
+	int32_t		cpu;		/* -1 for any ... */
+	int32_t		pid;
+	int32_t		tid;
+	const char	*cgroup;	/* substring of the cgroup path */
+	int		noidle;		/* skip samples of the idle task, tid 0 */
+} ss_filter_t;
+
+typedef struct ssreader {
+	vfile_t		f;
+	vf_strings_t	frames;
+	vf_stacks_t	stacks;
+	vf_strings_t	cgroups;
+	const ss_index_t *index;
+	uint64_t	nblocks;
+	const unsigned char *col[SS_NCOLS];
+	const unsigned char *colend[SS_NCOLS];
+	uint64_t	start;		/* first sample time */
+	uint64_t	end;		/* last sample time */
+	int64_t		realtime;	/* epoch - sample clock, ns */
+	int		monotonic;	/* realtime applies to the samples */
+} ssreader_t;
+
+int	ssr_open(ssreader_t *, const char *path);
+void	ssr_close(ssreader_t *);
+void	ssr_filter_init(ss_filter_t *);
+int	ssr_range(const ssreader_t *, const char *, ss_filter_t *);
+int64_t	ssr_scan(const ssreader_t *, const ss_filter_t *,
+	    int (*)(const sample_t *, void *), void *);
+void	ssr_write_stack(const ssreader_t *, FILE *, uint32_t);
+
+#endif /* SAMPLESTORE_H */
@@ -0,0 +1,665 @@
+/*
+ * stacktab.c - interned stack table for aggregated profiles.
+ *
+ * See stacktab.h. Both tables use open addressing with linear probing, and
+ * are grown to keep the load factor under one half.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vectorhelper.h"
+#include "stacktab.h"
+#include "profile.h"
+
+#define HASHINIT	1024
+
+/* FNV-1a */
+static uint64_t
+hashbytes(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t h = 14695981039346656037ULL;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+ * Strings
+ */
+
+void
+strtab_init(strtab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+	t->hashsz = HASHINIT;
+	t->hash = vh_calloc(t->hashsz, sizeof (uint32_t));
+}
+
+void
+strtab_free(strtab_t *t)
+{
+	free(t->pool);
+	free(t->off);
+	free(t->len);
+	free(t->hash);
+	memset(t, 0, sizeof (*t));
+}
+
+static void
+strtab_rehash(strtab_t *t)
+{
+	uint32_t i, id, mask;
+
+	free(t->hash);
+	t->hashsz *= 2;
+	t->hash = vh_calloc(t->hashsz, sizeof (uint32_t));
+	mask = t->hashsz - 1;
+	for (id = 0; id < t->count; id++) {
+		i = hashbytes(t->pool + t->off[id], t->len[id]) & mask;
+		while (t->hash[i])
+			i = (i + 1) & mask;
+		t->hash[i] = id + 1;
+	}
+}
+
+/* return the hash slot for the string: either its entry, or empty */
+static uint32_t
+strtab_slot(const strtab_t *t, const char *s, size_t len)
+{
+	uint32_t i, id, mask = t->hashsz - 1;
+
+	i = hashbytes(s, len) & mask;
+	while (t->hash[i]) {
+		id = t->hash[i] - 1;
+		if (t->len[id] == len && memcmp(t->pool + t->off[id], s, len) == 0)
+			break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+uint32_t
+strtab_lookup(const strtab_t *t, const char *s, size_t len)
+{
+	uint32_t i = strtab_slot(t, s, len);
+
+	return t->hash[i] ? t->hash[i] - 1 : ST_NONE;
+}
+
+uint32_t
+strtab_intern(strtab_t *t, const char *s, size_t len)
+{
+	uint32_t i, id;
+
+	i = strtab_slot(t, s, len);
+	if (t->hash[i])
+		return t->hash[i] - 1;
+
+	if (t->count == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 1024;
+		t->off = vh_realloc(t->off, t->alloc * sizeof (uint32_t));
+		t->len = vh_realloc(t->len, t->alloc * sizeof (uint32_t));
+	}
+	while (t->poollen + len + 1 > t->poolsz) {
+		t->poolsz = t->poolsz ? t->poolsz * 2 : 65536;
+		t->pool = vh_realloc(t->pool, t->poolsz);
+	}
+	id = t->count++;
+	t->off[id] = t->poollen;
+	t->len[id] = len;
+	memcpy(t->pool + t->poollen, s, len);
+	t->pool[t->poollen + len] = '\0';
+	t->poollen += len + 1;
+	t->hash[i] = id + 1;
+
+	if (t->count * 2 > t->hashsz)
+		strtab_rehash(t);
+	return id;
+}
+
+/*
+ * Stacks
+ */
+
+void
+stacktab_init(stacktab_t *st, int ncols)
+{
+	memset(st, 0, sizeof (*st));
+	strtab_init(&st->frames);
+	st->ncols = ncols < 1 ? 1 : ncols > ST_MAXCOLS ? ST_MAXCOLS : ncols;
+	st->hashsz = HASHINIT;
+	st->hash = vh_calloc(st->hashsz, sizeof (uint32_t));
+}
+
+void
+stacktab_free(stacktab_t *st)
+{
+	int c;
+
+	strtab_free(&st->frames);
+	free(st->ids);
+	free(st->stkoff);
+	free(st->stklen);
+	for (c = 0; c < ST_MAXCOLS; c++)
+		free(st->weight[c]);
+	free(st->hash);
+	free(st->scratch);
+	memset(st, 0, sizeof (*st));
+}
+
+/* return a frame ID buffer of at least n entries, valid until next call */
+uint32_t *
+stacktab_scratch(stacktab_t *st, uint32_t n)
+{
+	if (n > st->scratchsz) {
+		st->scratchsz = n < 256 ? 256 : n * 2;
+		st->scratch = vh_realloc(st->scratch,
+		    st->scratchsz * sizeof (uint32_t));
+	}
+	return st->scratch;
+}
+
+static void
+stacktab_rehash(stacktab_t *st)
+{
+	uint32_t i, id, mask;
+
+	free(st->hash);
+	st->hashsz *= 2;
+	st->hash = vh_calloc(st->hashsz, sizeof (uint32_t));
+	mask = st->hashsz - 1;
+	for (id = 0; id < st->count; id++) {
+		i = hashbytes(st->ids + st->stkoff[id],
+		    st->stklen[id] * sizeof (uint32_t)) & mask;
+		while (st->hash[i])
+			i = (i + 1) & mask;
+		st->hash[i] = id + 1;
+	}
+}
+
+uint32_t
+stacktab_intern(stacktab_t *st, const uint32_t *frames, uint32_t depth)
+{
+	size_t bytes = depth * sizeof (uint32_t);
+	uint32_t i, id, mask = st->hashsz - 1;
+	int c;
+
+	i = hashbytes(frames, bytes) & mask;
+	while (st->hash[i]) {
+		id = st->hash[i] - 1;
+		if (st->stklen[id] == depth &&
+		    memcmp(st->ids + st->stkoff[id], frames, bytes) == 0)
+			return id;
+		i = (i + 1) & mask;
+	}
+
+	if (st->count == st->alloc) {
+		st->alloc = st->alloc ? st->alloc * 2 : 1024;
+		st->stkoff = vh_realloc(st->stkoff, st->alloc * sizeof (uint32_t));
+		st->stklen = vh_realloc(st->stklen, st->alloc * sizeof (uint32_t));
+		for (c = 0; c < st->ncols; c++) {
+			st->weight[c] = vh_realloc(st->weight[c],
+			    st->alloc * sizeof (uint64_t));
+		}
+	}
+	while (st->nids + depth > st->idsalloc) {
+		st->idsalloc = st->idsalloc ? st->idsalloc * 2 : 16384;
+		st->ids = vh_realloc(st->ids, st->idsalloc * sizeof (uint32_t));
+	}
+	id = st->count++;
+	st->stkoff[id] = st->nids;
+	st->stklen[id] = depth;
+	memcpy(st->ids + st->nids, frames, bytes);
+	st->nids += depth;
+	for (c = 0; c < st->ncols; c++)
+		st->weight[c][id] = 0;
+	st->hash[i] = id + 1;
+
+	if (st->count * 2 > st->hashsz)
+		stacktab_rehash(st);
+	return id;
+}
+
+/*
+ * Parse a folded line, "frame;frame;frame count", interning its frames and
+ * stack. The line is modified. Fractional counts are rounded. Returns 0 on
+ * success, or -1 for a line without a stack and count.
+ */
+int
+stacktab_parse(stacktab_t *st, char *line, uint32_t *idp, uint64_t *wp)
+{
+	char *end, *sp, *frame, *next;
+	uint32_t depth = 0, *ids;
+	double w;
+
+	end = line + strlen(line);
+	while (end > line && (end[-1] == '\n' || end[-1] == ' ' ||
+	    end[-1] == '\t' || end[-1] == '\r'))
+		*--end = '\0';
+	for (sp = end; sp > line && sp[-1] != ' ' && sp[-1] != '\t'; sp--)
+		;
+	if (sp == line || sp == end)
+		return -1;
+	w = strtod(sp, &next);
+	if (*next != '\0' || w < 0)
+		return -1;
+	*--sp = '\0';
+	if (sp == line)
+		return -1;
+
+	for (frame = line; frame != NULL; frame = next) {
+		if ((next = strchr(frame, ';')) != NULL)
+			*next++ = '\0';
+		ids = stacktab_scratch(st, depth + 1);
+		ids[depth++] = strtab_intern(&st->frames, frame, strlen(frame));
+	}
+	*idp = stacktab_intern(st, st->scratch, depth);
+	*wp = (uint64_t)(w + 0.5);
+	return 0;
+}
+
+/* read a folded file into the given weight column */
+int
+stacktab_read_folded(stacktab_t *st, FILE *fp, int col)
+{
+	char *line = NULL;
+	size_t linesz = 0;
+	uint32_t id;
+	uint64_t w;
+	int bad = 0;
+
+	while (getline(&line, &linesz, fp) != -1) {
+		if (stacktab_parse(st, line, &id, &w) == 0)
+			stacktab_add(st, id, col, w);
+		else
+			bad++;
+	}
+	free(line);
+	return bad;
+}
+
+void
+stacktab_write_stack(const stacktab_t *st, FILE *fp, uint32_t id)
+{
+	const uint32_t *frames;
+	uint32_t depth, i;
+
+	frames = stacktab_frames(st, id, &depth);
+	for (i = 0; i < depth; i++) {
+		if (i)
+			putc(';', fp);
+		fputs(strtab_str(&st->frames, frames[i]), fp);
+	}
+}
+
+/* write stacks with a non-zero weight in the column as folded lines */
+void
+stacktab_write_folded(const stacktab_t *st, FILE *fp, int col)
+{
+	uint32_t id;
+
+	for (id = 0; id < st->count; id++) {
+		if (st->weight[col][id] == 0)
+			continue;
+		stacktab_write_stack(st, fp, id);
+		fprintf(fp, " %llu\n", (unsigned long long)st->weight[col][id]);
+	}
+}
+
+/*
+ * Write two columns as differential folded lines, "stack w0 w1", as
+ * difffolded.pl does. With normalize, w0 is scaled so that the column totals
+ * match.
+ */
+void
+stacktab_write_diff(const stacktab_t *st, FILE *fp, int c0, int c1,
+    int normalize)
+{
+	uint64_t t0 = stacktab_total(st, c0), t1 = stacktab_total(st, c1), w0;
+	uint32_t id;
+
+	for (id = 0; id < st->count; id++) {
+		w0 = st->weight[c0][id];
+		if (w0 == 0 && st->weight[c1][id] == 0)
+			continue;
+		if (normalize && t0 != t1 && t0 != 0)
+			w0 = (uint64_t)((double)w0 * t1 / t0);
+		stacktab_write_stack(st, fp, id);
+		fprintf(fp, " %llu %llu\n", (unsigned long long)w0,
+		    (unsigned long long)st->weight[c1][id]);
+	}
+}
+
+/*
+ * Add all stacks and weights of src to dst, mapping frame IDs once. If idmap
+ * is not NULL, it is set to the dst stack ID of each src stack.
+ */
+void
+stacktab_merge(stacktab_t *dst, const stacktab_t *src, uint32_t *idmap)
+{
+	const uint32_t *frames;
+	uint32_t *map, *ids, depth, id, i, did;
+	int c, ncols = dst->ncols < src->ncols ? dst->ncols : src->ncols;
+
+	map = vh_malloc((src->frames.count + 1) * sizeof (uint32_t));
+	for (i = 0; i < src->frames.count; i++)
+		map[i] = ST_NONE;
+
+	for (id = 0; id < src->count; id++) {
+		frames = stacktab_frames(src, id, &depth);
+		ids = stacktab_scratch(dst, depth);
+		for (i = 0; i < depth; i++) {
+			if (map[frames[i]] == ST_NONE) {
+				map[frames[i]] = strtab_intern(&dst->frames,
+				    strtab_str(&src->frames, frames[i]),
+				    src->frames.len[frames[i]]);
+			}
+			ids[i] = map[frames[i]];
+		}
+		did = stacktab_intern(dst, ids, depth);
+		for (c = 0; c < ncols; c++)
+			stacktab_add(dst, did, c, src->weight[c][id]);
+		if (idmap != NULL)
+			idmap[id] = did;
+	}
+	free(map);
+}
+
+uint64_t
+stacktab_total(const stacktab_t *st, int col)
+{
+	uint64_t total = 0;
+	uint32_t id;
+
+	for (id = 0; id < st->count; id++)
+		total += st->weight[col][id];
+	return total;
+}
+
+typedef struct {
+	uint64_t	w;
+	uint32_t	id;
+} rank_t;
+
+static int
+rankcmp(const void *a, const void *b)
+{
+	const rank_t *ra = a, *rb = b;
+
+	if (ra->w != rb->w)
+		return ra->w < rb->w ? 1 : -1;
+	return ra->id < rb->id ? -1 : ra->id > rb->id;
+}
+
+/*
+ * Bound the table to about maxstacks stacks. The heaviest stacks are kept,
+ * and the rest are truncated to their root frame (usually the process name),
+ * so that totals and the root level of a flame graph are preserved.
+ */
+void
+stacktab_prune(stacktab_t *st, uint32_t maxstacks)
+{
+	stacktab_t pruned;
+	const uint32_t *frames;
+	uint32_t depth, id, nid, i;
+	rank_t *rank;
+	int c;
+
+	if (maxstacks == 0 || st->count <= maxstacks)
+		return;
+
+	rank = vh_malloc(st->count * sizeof (rank_t));
+	for (id = 0; id < st->count; id++) {
+		rank[id].id = id;
+		rank[id].w = 0;
+		for (c = 0; c < st->ncols; c++)
+			rank[id].w += st->weight[c][id];
+	}
+	qsort(rank, st->count, sizeof (rank_t), rankcmp);
+
+	stacktab_init(&pruned, st->ncols);
+	for (i = 0; i < st->count; i++) {
+		id = rank[i].id;
+		frames = stacktab_frames(st, id, &depth);
+		if (i >= maxstacks && depth > 1)
+			depth = 1;
+		nid = stacktab_intern(&pruned, frames, depth);
+		for (c = 0; c < st->ncols; c++)
+			stacktab_add(&pruned, nid, c, st->weight[c][id]);
+	}
+	free(rank);
+
+	/* frame IDs are shared, so keep the original string table */
+	strtab_free(&pruned.frames);
+	pruned.frames = st->frames;
+	memset(&st->frames, 0, sizeof (st->frames));
+	stacktab_free(st);
+	*st = pruned;
+}
+
+/*
+ * Truncate each stack after its last frame with at least minfrac of the
+ * total weight (of all columns): the frames that flamegraph.pl --minwidth
+ * would omit. Their weight is left with the frame above, so totals and the
+ * width of every remaining frame are preserved. Frames are nodes of a tree,
+ * interned as (parent node, frame ID) pairs in a second table.
+ */
+void
+stacktab_trim(stacktab_t *st, double minfrac)
+{
+	stacktab_t trimmed, tree;
+	const uint32_t *frames;
+	uint32_t pair[2], depth, id, nid, i;
+	uint64_t w, total = 0, min;
+	int c;
+
+	for (c = 0; c < st->ncols; c++)
+		total += stacktab_total(st, c);
+	min = total * minfrac;
+	if (min == 0)
+		return;
+
+	/* the weight of each node: its stacks, and their descendants */
+	stacktab_init(&tree, 1);
+	for (id = 0; id < st->count; id++) {
+		frames = stacktab_frames(st, id, &depth);
+		for (w = 0, c = 0; c < st->ncols; c++)
+			w += st->weight[c][id];
+		pair[0] = ST_NONE;
+		for (i = 0; i < depth; i++) {
+			pair[1] = frames[i];
+			pair[0] = stacktab_intern(&tree, pair, 2);
+			stacktab_add(&tree, pair[0], 0, w);
+		}
+	}
+
+	stacktab_init(&trimmed, st->ncols);
+	for (id = 0; id < st->count; id++) {
+		frames = stacktab_frames(st, id, &depth);
+		pair[0] = ST_NONE;
+		for (i = 0; i < depth; i++) {
+			pair[1] = frames[i];
+			pair[0] = stacktab_intern(&tree, pair, 2);
+			if (i > 0 && tree.weight[0][pair[0]] < min)
+				break;
+		}
+		nid = stacktab_intern(&trimmed, frames, i);
+		for (c = 0; c < st->ncols; c++)
+			stacktab_add(&trimmed, nid, c, st->weight[c][id]);
+	}
+	stacktab_free(&tree);
+
+	strtab_free(&trimmed.frames);
+	trimmed.frames = st->frames;
+	memset(&st->frames, 0, sizeof (st->frames));
+	stacktab_free(st);
+	*st = trimmed;
+}
+
+/*
+ * Replace hex numbers in frame names with "0x...", as difffolded.pl -s does,
+ * so that stacks that differ only by addresses are joined.
+ */
+void
+stacktab_striphex(stacktab_t *st)
+{
+	stacktab_t out;
+	const uint32_t *frames;
+	const char *name, *p;
+	uint32_t *map, *ids, depth, id, i, did;
+	char *buf = NULL;
+	size_t bufsz = 0, n;
+	int c;
+
+	stacktab_init(&out, st->ncols);
+	map = vh_malloc((st->frames.count + 1) * sizeof (uint32_t));
+	for (i = 0; i < st->frames.count; i++) {
+		name = strtab_str(&st->frames, i);
+		if (bufsz < st->frames.len[i] + 1) {
+			bufsz = st->frames.len[i] + 1;
+			buf = vh_realloc(buf, bufsz);
+		}
+		for (p = name, n = 0; *p != '\0'; ) {
+			if (p[0] == '0' && p[1] == 'x' && isxdigit((unsigned char)p[2])) {
+				for (p += 2; isxdigit((unsigned char)*p); p++)
+					;
+				memcpy(buf + n, "0x...", 5);
+				n += 5;
+				continue;
+			}
+			buf[n++] = *p++;
+		}
+		map[i] = strtab_intern(&out.frames, buf, n);
+	}
+
+	for (id = 0; id < st->count; id++) {
+		frames = stacktab_frames(st, id, &depth);
+		ids = stacktab_scratch(&out, depth);
+		for (i = 0; i < depth; i++)
+			ids[i] = map[frames[i]];
+		did = stacktab_intern(&out, ids, depth);
+		for (c = 0; c < st->ncols; c++)
+			stacktab_add(&out, did, c, st->weight[c][id]);
+	}
+	free(map);
+	free(buf);
+	stacktab_free(st);
+	*st = out;
+}
+
+/* read a folded text or binary profile into the given weight column */
+static int
+readprofile(stacktab_t *st, const char *path, int col)
+{
+	FILE *fp;
+
+	if (pf_isprofile(path))
+		return pf_read(st, path, col);
+	if ((fp = fopen(path, "r")) == NULL) {
+		vh_warn("can't read %s: %s", path, strerror(errno));
+		return -1;
+	}
+	stacktab_read_folded(st, fp, col);
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * diff [-ns] before after: join two folded text or binary profiles by stack,
+ * and write differential folded lines, "stack before after", for
+ * flamegraph.pl, as difffolded.pl does. -n scales the before counts to the
+ * after total, and -s replaces hex numbers in frame names with "0x...".
+ */
+int
+cmd_diff(int argc, char **argv)
+{
+	stacktab_t st;
+	int normalize = 0, strip = 0, c, status = 0;
+
+	while ((c = getopt(argc, argv, "ns")) != -1) {
+		switch (c) {
+		case 'n':
+			normalize = 1;
+			break;
+		case 's':
+			strip = 1;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc - 2)
+		return 2;
+
+	/* stacks are interned once, so the join is by stack ID */
+	stacktab_init(&st, 2);
+	if (readprofile(&st, argv[optind], 0) != 0 ||
+	    readprofile(&st, argv[optind + 1], 1) != 0)
+		status = 1;
+	if (status == 0) {
+		if (strip)
+			stacktab_striphex(&st);
+		stacktab_write_diff(&st, stdout, 0, 1, normalize);
+	}
+	stacktab_free(&st);
+	return status;
+}
+
+/*
+ * merge [-m maxstacks] [-o profile] [file ...]: merge folded text or binary
+ * profiles (or STDIN), summing the counts of identical stacks, and
+ * optionally bounding the output size. The output is folded text, or a
+ * profile with -o.
+ */
+int
+cmd_merge(int argc, char **argv)
+{
+	stacktab_t st;
+	const char *out = NULL;
+	uint32_t maxstacks = 0;
+	int c, i, status = 0;
+
+	while ((c = getopt(argc, argv, "m:o:")) != -1) {
+		switch (c) {
+		case 'm':
+			maxstacks = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+
+	stacktab_init(&st, 1);
+	if (optind == argc)
+		stacktab_read_folded(&st, stdin, 0);
+	for (i = optind; i < argc; i++) {
+		if (readprofile(&st, argv[i], 0) != 0)
+			status = 1;
+	}
+	stacktab_prune(&st, maxstacks);
+	if (out != NULL) {
+		if (pf_write(&st, "samples", out) != 0)
+			status = 1;
+	} else {
+		stacktab_write_folded(&st, stdout, 0);
+	}
+	stacktab_free(&st);
+	return status;
+}
@@ -0,0 +1,96 @@
+/*
+ * stacktab.h - interned stack table for aggregated profiles.
+ *
+ * Frame names are interned once in a string table, and each unique stack is
+ * interned as a sequence of frame IDs (root first). A stack is identified by
+ * its stack ID, and has one or more weight columns, eg, a sample count, or
+ * cycles and instructions. Merging tables and joining profiles is done by
+ * stack ID, rather than by comparing strings.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef STACKTAB_H
+#define STACKTAB_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ST_MAXCOLS	4		/* weight columns per stack */
+#define ST_NONE		UINT32_MAX	/* invalid frame or stack ID */
+
+typedef struct strtab {
+	char		*pool;		/* NUL terminated strings */
+	size_t		poollen;
+	size_t		poolsz;
+	uint32_t	*off;		/* string ID -> pool offset */
+	uint32_t	*len;		/* string ID -> length */
+	uint32_t	count;
+	uint32_t	alloc;
+	uint32_t	*hash;		/* open addressed, ID + 1, 0 == empty */
+	uint32_t	hashsz;
+} strtab_t;
+
+typedef struct stacktab {
+	strtab_t	frames;		/* interned frame names */
+	uint32_t	*ids;		/* frame IDs of all stacks */
+	size_t		nids;
+	size_t		idsalloc;
+	uint32_t	*stkoff;	/* stack ID -> offset in ids */
+	uint32_t	*stklen;	/* stack ID -> depth */
+	uint64_t	*weight[ST_MAXCOLS];
+	int		ncols;
+	uint32_t	count;
+	uint32_t	alloc;
+	uint32_t	*hash;		/* open addressed, ID + 1, 0 == empty */
+	uint32_t	hashsz;
+	uint32_t	*scratch;	/* frame ID buffer for parsing */
+	uint32_t	scratchsz;
+} stacktab_t;
+
+/*
+ * Strings returned by strtab_str() point into the pool, and are only valid
+ * until the next string is interned.
+ */
+void		strtab_init(strtab_t *);
+void		strtab_free(strtab_t *);
+uint32_t	strtab_intern(strtab_t *, const char *, size_t);
+uint32_t	strtab_lookup(const strtab_t *, const char *, size_t);
+
+static inline const char *
+strtab_str(const strtab_t *t, uint32_t id)
+{
+	return t->pool + t->off[id];
+}
+
+void		stacktab_init(stacktab_t *, int ncols);
+void		stacktab_free(stacktab_t *);
+uint32_t	stacktab_intern(stacktab_t *, const uint32_t *, uint32_t);
+uint32_t	*stacktab_scratch(stacktab_t *, uint32_t);
+int		stacktab_parse(stacktab_t *, char *, uint32_t *, uint64_t *);
+int		stacktab_read_folded(stacktab_t *, FILE *, int col);
+void		stacktab_write_stack(const stacktab_t *, FILE *, uint32_t);
+void		stacktab_write_folded(const stacktab_t *, FILE *, int col);
+void		stacktab_write_diff(const stacktab_t *, FILE *, int c0, int c1,
+		    int normalize);
+void		stacktab_merge(stacktab_t *, const stacktab_t *, uint32_t *);
+void		stacktab_prune(stacktab_t *, uint32_t maxstacks);
+void		stacktab_trim(stacktab_t *, double minfrac);
+void		stacktab_striphex(stacktab_t *);
+uint64_t	stacktab_total(const stacktab_t *, int col);
+
+static inline void
+stacktab_add(stacktab_t *st, uint32_t id, int col, uint64_t w)
+{
+	st->weight[col][id] += w;
+}
+
+static inline const uint32_t *
+stacktab_frames(const stacktab_t *st, uint32_t id, uint32_t *depth)
+{
+	*depth = st->stklen[id];
+	return st->ids + st->stkoff[id];
+}
+
+#endif /* STACKTAB_H */
@@ -0,0 +1,214 @@
+#!/bin/bash
+#
+# subsecondheatmap - a Vector pcp pmda for generating a subsecond offset
+#		     heat map of CPU samples, for finding periodic activity.
+#
+# USAGE: subsecondheatmap [seconds] [stream]
+#	 subsecondheatmap range=t0-t1 [cpu=N] [pid=N] [tid=N] [cgroup=path]
+#
+# CPU stacks are sampled as with cpuflamegraph, and every sample is kept in a
+# sample store. The heat map has one column per second of the capture, and
+# the row is the offset within that second: so a 100 ms stall every second
+# shows as a horizontal band, and a GC pause as a vertical one. The color is
+# the sample count. Hover over a box to see its second and offset range.
+#
+# range=t0-t1 then renders a flame graph for just the samples of a selected
+# region, from the same sample store, without profiling again. t0 and t1 are
+# seconds from the start of the capture: eg, the box at second 12, offset
+# 300-320ms to the box at second 14, offset 100-120ms is range=12.3-14.12.
+#
+# stream stores the samples while the capture runs, rather than writing
+# perf.data and reading it back afterwards, so the heat map is ready sooner.
+#
+# Unless streamed, the capture is shared with cpuflamegraph,
+# uninlinedcpuflamegraph and pnamecpuflamegraph, when their runs overlap
+# (see shared_capture in vectorlib.sh): one sample store is written for the
+# CPU flame graph and the heat map, from one capture.
+#
+# The $PCP_CONTAINER_NAME environment variable will be read, and if it is
+# not NULL, the heat map will be generated for the container name it
+# identifies only.
+#
+# Check and adjust the environment settings below.
+#
+# REQUIREMENTS: The libraries perfmaplib.sh and vectorlib.sh. See those
+# files for their own requirements.
+#
+# DEBUG: STDERR includes timestamped debug messages, and command errors. It
+# is redirected to the pmda vector log (/var/log/pcp/pmcd/vector.log).
+#
+# SEE ALSO: http://vectoross.io http://pcp.io
+#
+# Copyright 2017 Netflix, Inc.
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+# host
+export TZ=US/Pacific
+TS=$(date +%Y-%m-%d_%T)
+PATH=/bin:/usr/bin:$PATH
+HOSTNAME=$(uname -n)
+
+# pcp pmda paths
+METRIC=subsecondheatmap
+PMDA_DIR=${0%/*}
+WEBSITE_DIR=/usr/share/pcp/webapps/$METRIC
+WORKING_DIR=/var/log/pcp/vector/$METRIC
+FG_DIR=/var/lib/pcp/pmdas/vector/BINFlameGraph
+HM_DIR=/var/lib/pcp/pmdas/vector/BINHeatMap
+OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
+OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
+OUT_FOLDED=$WORKING_DIR/perf.folded.$$
+OUT_SAMPLES=$WORKING_DIR/perf.samples.$$
+OUT_OFFSETS=$WORKING_DIR/perf.offsets.$$
+PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
+
+# libraries
+. $PMDA_DIR/vectorlib.sh
+. $PMDA_DIR/perfmaplib.sh
+
+# s3
+# S3BUCKET="s3://"
+
+# perf settings
+parseargs "$@"
+SECS=${ARG_SECS:-60}		# default to 60 seconds if not sepcified
+HERTZ=49
+ROW_MS=20			# heat map row height, in milliseconds
+PERF_SCRIPT_OPTS="-F comm,pid,tid,cpu,time,event,ip,sym,dso"
+
+#
+# Ensure output directories exist
+#
+[ ! -d "$WORKING_DIR" ] && mkdir -p $WORKING_DIR
+[ ! -d "$WEBSITE_DIR" ] && mkdir -p $WEBSITE_DIR
+[ -d "$WEBSITE_DIR" -a -e "$OUT_SVG" ] && rm $OUT_SVG
+[ -d "$FG_DIR" ] || errorexit "Flame graph software missing"
+[ -d "$HM_DIR" ] || errorexit "Heat map software missing"
+
+# terminator for new log group:
+echo >&2
+
+debugtime "$0 start, container=$PCP_CONTAINER_NAME"
+
+# decide upon a palette
+if have_procs node; then
+	color=js
+else
+	color=java
+fi
+
+#
+# Range query: flame graph of a selected region of the last heat map
+#
+if [[ "$OPT_range" != "" ]]; then
+	statusmsg "Querying samples"
+	range_query > $OUT_FOLDED.range
+	egrep -v 'cpu_idle|cpuidle_enter' $OUT_FOLDED.range > $OUT_FOLDED
+	rm $OUT_FOLDED.range
+	fgtitle="CPU Flame Graph (no idle): $HOSTNAME, range $OPT_range"
+	statusmsg "Flame Graph generation"
+	$FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" < $OUT_FOLDED > $OUT_SVG
+	keep_profile
+	statusmsg "DONE"
+	exit 0
+fi
+
+statusmsg "Profiling for $SECS seconds"
+
+#
+# Container filter
+#
+if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
+	#
+	# Set $cgroupfilter for perf record, and $tasklist of container PIDs.
+	#
+	# $PCP_CONTAINER_NAME is a Docker container name, or a container ID,
+	# resolved by vectorhelper under cgroup v1 or v2 (see vectorlib.sh).
+	#
+	container_resolve $PCP_CONTAINER_NAME
+	cgroupfilter="-e cpu-clock --cgroup=$cgroup"
+	hmtitle="Subsecond Offset Heat Map: $PCP_CONTAINER_NAME, $TS"
+else
+	cgroupfilter=""
+	tasklist=""
+	hmtitle="Subsecond Offset Heat Map: $HOSTNAME, $TS"
+fi
+
+# store every sample, for perf_capture and perf_fold. The folded output is
+# not needed. perf_capture times samples with CLOCK_MONOTONIC.
+function foldstacks {
+	$VECTOR_HELPER collapse -a -k mono -s $OUT_SAMPLES > /dev/null
+}
+function decodestacks {
+	$VECTOR_HELPER decode -a -s $OUT_SAMPLES $PERF_DATA > /dev/null
+}
+shared=0
+(( SHARED_CAPTURE && NATIVE_DECODE && ! OPT_stream )) && shared=1
+
+# when streaming, samples are symbolized as they arrive, so collect maps first
+if (( OPT_stream )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+	statusmsg "Profiling for $SECS seconds"
+fi
+
+#
+# Profile
+#
+if (( shared )); then
+	shared_capture subsecond -F $HERTZ -a $cgroupfilter -g
+else
+	perf_capture -F $HERTZ -a $cgroupfilter -g
+fi
+s=0
+# update status message
+while (( s < SECS )); do
+	sleep 5
+	kill -0 $bgpid > /dev/null 2>&1 || break
+	(( s += 5 ))
+	statusmsg "Profiling for $SECS seconds ($s/$SECS)" 2>/dev/null
+done
+if (( shared )); then
+	shared_wait
+else
+	wait
+fi
+
+# lower our priority before heat map generation, to reduce CPU contention:
+renice -n 19 -p $$ &>/dev/null
+
+# prepare symbol maps, for range queries
+if (( ! OPT_stream && ! shared )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps $tasklist
+	fix_node_maps $tasklist
+fi
+
+# store every sample, then plot sample times. Idle samples are excluded, as
+# idle CPUs would otherwise fill the heat map.
+statusmsg "Processing profile"
+if (( shared )); then
+	# maps are collected for, and stacks decoded with, the other views
+	shared_fold subsecond $OUT_SAMPLES
+else
+	perf_fold
+	rm -f $OUT_FOLDED
+fi
+[ -e $OUT_SAMPLES ] || errorexit "No samples captured"
+ln -sf ${OUT_SAMPLES##*/} $WORKING_DIR/${METRIC}.${PCP_CONTEXT}.samples
+$VECTOR_HELPER query -o -I $OUT_SAMPLES > $OUT_OFFSETS
+statusmsg "Heat Map generation"
+$HM_DIR/trace2heatmap.pl --unitstime=ms --unitslatency=ms --minlat=0 --maxlat=1000 \
+    --steplat=$ROW_MS --title="$hmtitle" $OUT_OFFSETS > $OUT_SVG
+rm $OUT_OFFSETS
+
+# send to s3
+# statusmsg "s3 archive"
+# s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
+
+statusmsg "Usage: $(rusage)"
+statusmsg "DONE"
+
+# $PERF_DATA (unless streamed) and $OUT_SAMPLES left behind for range queries
+# and custom reports
@@ -0,0 +1,855 @@
+/*
+ * symbols.c - symbol tables for resolving sampled addresses.
+ *
+ * See symbols.h. ELF objects are read with mmap, and only 64-bit objects
+ * of the host byte order are supported, as for the profiled host. Symbol
+ * cache entries are written as other vfiles are, to a temporary file that
+ * is renamed into place, so concurrent helpers never see a partial entry.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "symbols.h"
+#include "vfile.h"
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ELFDATA_HOST	ELFDATA2LSB
+#else
+#define ELFDATA_HOST	ELFDATA2MSB
+#endif
+
+/* from libstdc++, so C++ names read as they do in perf script */
+extern char *__cxa_demangle(const char *, char *, size_t *, int *);
+
+/*
+ * Symbol tables
+ */
+
+void
+symtab_init(symtab_t *t)
+{
+	memset(t, 0, sizeof (*t));
+	strtab_init(&t->names);
+}
+
+void
+symtab_free(symtab_t *t)
+{
+	if (t->mapped)
+		vf_close(&t->f);
+	else
+		free(t->syms);
+	strtab_free(&t->names);
+	memset(t, 0, sizeof (*t));
+}
+
+void
+symtab_add(symtab_t *t, uint64_t addr, uint64_t size, const char *name,
+    size_t len, uint32_t mod)
+{
+	sym_t *s;
+
+	if (t->count == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 1024;
+		t->syms = vh_realloc(t->syms, t->alloc * sizeof (sym_t));
+	}
+	s = &t->syms[t->count];
+	s->addr = addr;
+	s->size = size > UINT32_MAX ? 0 : size;
+	s->name = strtab_intern(&t->names, name, len);
+	s->mod = mod;
+	s->reserved = t->count++;	/* insertion order, until finished */
+}
+
+static int
+symcmp(const void *a, const void *b)
+{
+	const sym_t *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x->reserved < y->reserved ? -1 : x->reserved > y->reserved;
+}
+
+/* sort, keeping the last symbol added at each address */
+void
+symtab_finish(symtab_t *t)
+{
+	uint32_t i, n = 0;
+
+	qsort(t->syms, t->count, sizeof (sym_t), symcmp);
+	for (i = 0; i < t->count; i++) {
+		if (n > 0 && t->syms[n - 1].addr == t->syms[i].addr)
+			n--;
+		t->syms[n] = t->syms[i];
+		t->syms[n++].reserved = 0;
+	}
+	t->count = n;
+}
+
+const sym_t *
+symtab_lookup(const symtab_t *t, uint64_t addr)
+{
+	uint32_t lo = 0, hi = t->count, mid;
+	const sym_t *s;
+
+	/* find the last symbol starting at or before addr */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+	s = &t->syms[lo - 1];
+	if (s->size != 0 && addr - s->addr >= s->size)
+		return NULL;
+	return s;
+}
+
+/*
+ * ELF objects
+ */
+
+static void
+elf_addsym(symtab_t *t, const char *name, uint64_t addr, uint64_t size)
+{
+	char *dm = NULL;
+	int status;
+
+	if (name[0] == '_' && name[1] == 'Z')
+		dm = __cxa_demangle(name, NULL, NULL, &status);
+	if (dm != NULL) {
+		symtab_add(t, addr, size, dm, strlen(dm), ST_NONE);
+		free(dm);
+	} else {
+		symtab_add(t, addr, size, name, strlen(name), ST_NONE);
+	}
+}
+
+/* read symbols and segments from an ELF image of size bytes */
+static int
+elf_parse(elfobj_t *eo, const unsigned char *base, size_t size)
+{
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)base;
+	const Elf64_Phdr *ph;
+	const Elf64_Shdr *sh, *strsh;
+	const Elf64_Sym *sym;
+	const char *strs;
+	uint64_t i, j, nsyms;
+
+	if (size < sizeof (*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    eh->e_ident[EI_DATA] != ELFDATA_HOST)
+		return -1;
+	if (eh->e_phoff > size || eh->e_phentsize != sizeof (*ph) ||
+	    eh->e_phnum > (size - eh->e_phoff) / sizeof (*ph) ||
+	    eh->e_shoff > size || (eh->e_shnum && eh->e_shentsize !=
+	    sizeof (*sh)) || eh->e_shnum > (size - eh->e_shoff) / sizeof (*sh))
+		return -1;
+
+	ph = (const Elf64_Phdr *)(base + eh->e_phoff);
+	eo->segs = vh_malloc(eh->e_phnum * sizeof (elfseg_t) + 1);
+	for (i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_type != PT_LOAD)
+			continue;
+		eo->segs[eo->nsegs].offset = ph[i].p_offset;
+		eo->segs[eo->nsegs].vaddr = ph[i].p_vaddr;
+		eo->segs[eo->nsegs++].filesz = ph[i].p_filesz;
+	}
+
+	sh = (const Elf64_Shdr *)(base + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type != SHT_SYMTAB && sh[i].sh_type != SHT_DYNSYM)
+			continue;
+		if (sh[i].sh_link >= eh->e_shnum || sh[i].sh_offset > size ||
+		    sh[i].sh_size > size - sh[i].sh_offset)
+			continue;
+		strsh = &sh[sh[i].sh_link];
+		if (strsh->sh_offset > size || strsh->sh_size == 0 ||
+		    strsh->sh_size > size - strsh->sh_offset)
+			continue;
+		strs = (const char *)base + strsh->sh_offset;
+		if (strs[strsh->sh_size - 1] != '\0')
+			continue;
+		sym = (const Elf64_Sym *)(base + sh[i].sh_offset);
+		nsyms = sh[i].sh_size / sizeof (*sym);
+		for (j = 0; j < nsyms; j++) {
+			if ((ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC &&
+			    ELF64_ST_TYPE(sym[j].st_info) != STT_GNU_IFUNC) ||
+			    sym[j].st_shndx == SHN_UNDEF ||
+			    sym[j].st_value == 0 ||
+			    sym[j].st_name >= strsh->sh_size)
+				continue;
+			elf_addsym(&eo->syms, strs + sym[j].st_name,
+			    sym[j].st_value, sym[j].st_size);
+		}
+	}
+	symtab_finish(&eo->syms);
+	return 0;
+}
+
+/* the hex GNU build ID of an ELF image, from its notes, or "" if none */
+static void
+elf_buildid(const unsigned char *base, size_t size, char *hex)
+{
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)base;
+	const Elf64_Phdr *ph;
+	const Elf64_Nhdr *nh;
+	const unsigned char *p, *end, *desc;
+	uint32_t i, j;
+
+	hex[0] = '\0';
+	if (size < sizeof (*eh) || eh->e_phoff > size ||
+	    eh->e_phentsize != sizeof (*ph) ||
+	    eh->e_phnum > (size - eh->e_phoff) / sizeof (*ph))
+		return;
+	ph = (const Elf64_Phdr *)(base + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_type != PT_NOTE || ph[i].p_offset > size ||
+		    ph[i].p_filesz > size - ph[i].p_offset)
+			continue;
+		p = base + ph[i].p_offset;
+		end = p + ph[i].p_filesz;
+		while ((size_t)(end - p) >= sizeof (*nh)) {
+			nh = (const Elf64_Nhdr *)p;
+			desc = p + sizeof (*nh) + ((nh->n_namesz + 3) & ~3U);
+			if (desc > end || nh->n_descsz > (size_t)(end - desc))
+				break;
+			if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 &&
+			    memcmp(p + sizeof (*nh), "GNU", 4) == 0 &&
+			    nh->n_descsz > 0 && nh->n_descsz <= 20) {
+				for (j = 0; j < nh->n_descsz; j++)
+					sprintf(hex + j * 2, "%02x", desc[j]);
+				return;
+			}
+			p = desc + ((nh->n_descsz + 3) & ~3U);
+		}
+	}
+}
+
+/*
+ * Symbol cache
+ */
+
+static int
+cache_path(const char *buildid, char *path, size_t pathsz)
+{
+	const char *dir = getenv("VECTOR_SYMCACHE");
+
+	if (dir == NULL || *dir == '\0' || buildid[0] == '\0')
+		return -1;
+	snprintf(path, pathsz, "%s/%s", dir, buildid);
+	return 0;
+}
+
+/* map a cache entry into an empty symtab */
+static int
+cache_open(symtab_t *t, const char *path)
+{
+	const void *syms;
+	uint64_t size, count;
+
+	if (access(path, R_OK) != 0 ||
+	    vf_open(&t->f, path, VF_KIND_SYMBOLS) != 0)
+		return -1;
+	if (vf_get_strings(&t->f, VF_STRINGS, &t->fnames) != 0 ||
+	    (syms = vf_section(&t->f, VF_SYMS, &size, &count)) == NULL ||
+	    size != count * sizeof (sym_t) || count > UINT32_MAX) {
+		vh_warn("%s: truncated or corrupt symbol cache entry", path);
+		vf_close(&t->f);
+		return -1;
+	}
+	/* names are bounds checked by vf_string(), so syms are used as is */
+	t->syms = (sym_t *)syms;
+	t->count = count;
+	t->mapped = 1;
+	return 0;
+}
+
+static void
+cache_write(const symtab_t *t, const elfseg_t *segs, uint32_t nsegs,
+    const char *meta, const char *path)
+{
+	vfwriter_t vw;
+
+	if (mkdir(getenv("VECTOR_SYMCACHE"), 0755) != 0 && errno != EEXIST)
+		return;
+	vfw_init(&vw, VF_KIND_SYMBOLS);
+	vbuf_put(vfw_section(&vw, VF_META, 0), meta, strlen(meta));
+	vf_put_strings(vfw_section(&vw, VF_STRINGS, t->names.count),
+	    &t->names);
+	vbuf_put(vfw_section(&vw, VF_SYMS, t->count), t->syms,
+	    t->count * sizeof (sym_t));
+	vbuf_put(vfw_section(&vw, VF_SEGMENTS, nsegs), segs,
+	    nsegs * sizeof (elfseg_t));
+	vfw_write(&vw, path);
+	vfw_free(&vw);
+}
+
+/* map the cached symbols of a build ID, if any */
+static int
+cache_load(elfobj_t *eo, const char *buildid)
+{
+	char path[4096];
+	const void *segs;
+	uint64_t size, count;
+
+	if (cache_path(buildid, path, sizeof (path)) != 0 ||
+	    cache_open(&eo->syms, path) != 0)
+		return -1;
+	if ((segs = vf_section(&eo->syms.f, VF_SEGMENTS, &size,
+	    &count)) == NULL || size != count * sizeof (elfseg_t)) {
+		vh_warn("%s: truncated or corrupt symbol cache entry", path);
+		symtab_free(&eo->syms);
+		symtab_init(&eo->syms);
+		return -1;
+	}
+	eo->segs = vh_malloc(size + 1);
+	memcpy(eo->segs, segs, size);
+	eo->nsegs = count;
+	return 0;
+}
+
+static void
+cache_save(const elfobj_t *eo, const char *buildid)
+{
+	char path[4096], meta[128];
+
+	if (cache_path(buildid, path, sizeof (path)) != 0)
+		return;
+	snprintf(meta, sizeof (meta), "buildid=%s\nsymbols=%u\n", buildid,
+	    eo->syms.count);
+	cache_write(&eo->syms, eo->segs, eo->nsegs, meta, path);
+}
+
+/* map the regular file at path, read only, or return NULL */
+static unsigned char *
+elf_map(const char *path, size_t *sizep)
+{
+	struct stat st;
+	void *base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+	*sizep = st.st_size;
+	return base;
+}
+
+/*
+ * Load the symbols of the ELF object at path. If buildid is not NULL, it is
+ * the expected build ID: its cache entry is used without reading the file,
+ * and a file with another build ID is not loaded, eg, a host library of the
+ * same path as one in a container.
+ */
+int
+elf_load(elfobj_t *eo, const char *path, const char *buildid)
+{
+	char id[SYM_BUILDIDLEN];
+	unsigned char *base;
+	size_t size;
+	int status;
+
+	memset(eo, 0, sizeof (*eo));
+	symtab_init(&eo->syms);
+	if (buildid != NULL && cache_load(eo, buildid) == 0)
+		return 0;
+	if ((base = elf_map(path, &size)) == NULL)
+		return -1;
+	elf_buildid(base, size, id);
+	if (buildid != NULL && buildid[0] != '\0' && id[0] != '\0' &&
+	    strcmp(buildid, id) != 0) {
+		status = -1;
+	} else if (cache_load(eo, id) == 0) {
+		status = 0;
+	} else {
+		status = elf_parse(eo, base, size);
+		if (status == 0)
+			cache_save(eo, id);
+	}
+	munmap(base, size);
+	return status;
+}
+
+/*
+ * Inlined calls
+ */
+
+/* map the cached inlined calls of a build ID, if any, into an empty t */
+static int
+inl_cache_load(inltab_t *t, const char *buildid)
+{
+	char name[SYM_BUILDIDLEN + 16], path[4096];
+	const void *inls;
+	const inl_t *p;
+	uint64_t size, count, i;
+
+	snprintf(name, sizeof (name), "%s.inlines", buildid);
+	if (buildid[0] == '\0' || cache_path(name, path, sizeof (path)) != 0 ||
+	    access(path, R_OK) != 0 ||
+	    vf_open(&t->f, path, VF_KIND_INLINES) != 0)
+		return -1;
+	if (vf_get_strings(&t->f, VF_STRINGS, &t->fnames) != 0 ||
+	    (inls = vf_section(&t->f, VF_INLINES, &size, &count)) == NULL ||
+	    size != count * sizeof (inl_t) || count > UINT32_MAX) {
+		vh_warn("%s: truncated or corrupt symbol cache entry", path);
+		vf_close(&t->f);
+		return -1;
+	}
+	/* lookups follow parents, which always come first */
+	for (i = 0; i < count; i++) {
+		p = &((const inl_t *)inls)[i];
+		if (p->parent != ST_NONE && p->parent >= i) {
+			vh_warn("%s: corrupt symbol cache entry", path);
+			vf_close(&t->f);
+			return -1;
+		}
+	}
+	t->inls = (inl_t *)inls;
+	t->count = count;
+	t->mapped = 1;
+	return 0;
+}
+
+static void
+inl_cache_save(const inltab_t *t, const char *buildid)
+{
+	char name[SYM_BUILDIDLEN + 16], path[4096], meta[128];
+	vfwriter_t vw;
+
+	snprintf(name, sizeof (name), "%s.inlines", buildid);
+	if (buildid[0] == '\0' || cache_path(name, path, sizeof (path)) != 0)
+		return;
+	if (mkdir(getenv("VECTOR_SYMCACHE"), 0755) != 0 && errno != EEXIST)
+		return;
+	snprintf(meta, sizeof (meta), "buildid=%s\ninlines=%u\n", buildid,
+	    t->count);
+	vfw_init(&vw, VF_KIND_INLINES);
+	vbuf_put(vfw_section(&vw, VF_META, 0), meta, strlen(meta));
+	vf_put_strings(vfw_section(&vw, VF_STRINGS, t->names.count),
+	    &t->names);
+	vbuf_put(vfw_section(&vw, VF_INLINES, t->count), t->inls,
+	    t->count * sizeof (inl_t));
+	vfw_write(&vw, path);
+	vfw_free(&vw);
+}
+
+/* the separate debug file of a build ID, mapped, or NULL */
+static unsigned char *
+debug_map(const char *id, size_t *sizep)
+{
+	char path[128];
+
+	if (id[0] == '\0')
+		return NULL;
+	snprintf(path, sizeof (path), "/usr/lib/debug/.build-id/%.2s/%s.debug",
+	    id, id + 2);
+	return elf_map(path, sizep);
+}
+
+/*
+ * Load the inlined calls of the ELF object at path, as elf_load() loads its
+ * symbols. Stripped objects are read from their debug file, by build ID,
+ * in /usr/lib/debug/.build-id. An object without DWARF has an empty table,
+ * which is cached too, so it is not looked for again.
+ */
+int
+elf_load_inlines(inltab_t *t, const char *path, const char *buildid)
+{
+	char id[SYM_BUILDIDLEN];
+	unsigned char *base, *dbase;
+	size_t size, dsize;
+	int status = 0;
+
+	inltab_init(t);
+	if (buildid != NULL && inl_cache_load(t, buildid) == 0)
+		return 0;
+	if ((base = elf_map(path, &size)) == NULL)
+		return -1;
+	elf_buildid(base, size, id);
+	if (buildid != NULL && buildid[0] != '\0' && id[0] != '\0' &&
+	    strcmp(buildid, id) != 0) {
+		status = -1;
+	} else if (inl_cache_load(t, id) != 0) {
+		if (dwarf_inlines(t, base, size) != 0 &&
+		    (dbase = debug_map(id, &dsize)) != NULL) {
+			dwarf_inlines(t, dbase, dsize);
+			munmap(dbase, dsize);
+		}
+		inl_cache_save(t, id);
+	}
+	munmap(base, size);
+	return status;
+}
+
+/*
+ * Source lines
+ */
+
+/* map the cached line table of a build ID, if any, into an empty t */
+static int
+line_cache_load(linetab_t *t, const char *buildid)
+{
+	char name[SYM_BUILDIDLEN + 16], path[4096];
+	const void *rows;
+	uint64_t size, count;
+
+	snprintf(name, sizeof (name), "%s.lines", buildid);
+	if (buildid[0] == '\0' || cache_path(name, path, sizeof (path)) != 0 ||
+	    access(path, R_OK) != 0 ||
+	    vf_open(&t->f, path, VF_KIND_LINES) != 0)
+		return -1;
+	if (vf_get_strings(&t->f, VF_STRINGS, &t->ffiles) != 0 ||
+	    (rows = vf_section(&t->f, VF_LINES, &size, &count)) == NULL ||
+	    size != count * sizeof (line_t) || count > UINT32_MAX) {
+		vh_warn("%s: truncated or corrupt symbol cache entry", path);
+		vf_close(&t->f);
+		return -1;
+	}
+	t->rows = (line_t *)rows;
+	t->count = count;
+	t->mapped = 1;
+	return 0;
+}
+
+static void
+line_cache_save(const linetab_t *t, const char *buildid)
+{
+	char name[SYM_BUILDIDLEN + 16], path[4096], meta[128];
+	vfwriter_t vw;
+
+	snprintf(name, sizeof (name), "%s.lines", buildid);
+	if (buildid[0] == '\0' || cache_path(name, path, sizeof (path)) != 0)
+		return;
+	if (mkdir(getenv("VECTOR_SYMCACHE"), 0755) != 0 && errno != EEXIST)
+		return;
+	snprintf(meta, sizeof (meta), "buildid=%s\nlines=%u\n", buildid,
+	    t->count);
+	vfw_init(&vw, VF_KIND_LINES);
+	vbuf_put(vfw_section(&vw, VF_META, 0), meta, strlen(meta));
+	vf_put_strings(vfw_section(&vw, VF_STRINGS, t->files.count),
+	    &t->files);
+	vbuf_put(vfw_section(&vw, VF_LINES, t->count), t->rows,
+	    t->count * sizeof (line_t));
+	vfw_write(&vw, path);
+	vfw_free(&vw);
+}
+
+/* load the line table of the ELF object at path, as elf_load_inlines() */
+int
+elf_load_lines(linetab_t *t, const char *path, const char *buildid)
+{
+	char id[SYM_BUILDIDLEN];
+	unsigned char *base, *dbase;
+	size_t size, dsize;
+	int status = 0;
+
+	linetab_init(t);
+	if (buildid != NULL && line_cache_load(t, buildid) == 0)
+		return 0;
+	if ((base = elf_map(path, &size)) == NULL)
+		return -1;
+	elf_buildid(base, size, id);
+	if (buildid != NULL && buildid[0] != '\0' && id[0] != '\0' &&
+	    strcmp(buildid, id) != 0) {
+		status = -1;
+	} else if (line_cache_load(t, id) != 0) {
+		if (dwarf_lines(t, base, size) != 0 &&
+		    (dbase = debug_map(id, &dsize)) != NULL) {
+			dwarf_lines(t, dbase, dsize);
+			munmap(dbase, dsize);
+		}
+		line_cache_save(t, id);
+	}
+	munmap(base, size);
+	return status;
+}
+
+/*
+ * The vDSO is the same for all processes on the host, so the helper's own
+ * copy is used, as perf does.
+ */
+int
+elf_load_vdso(elfobj_t *eo)
+{
+	const Elf64_Ehdr *eh;
+	const Elf64_Shdr *sh;
+	size_t size;
+	int i;
+
+	memset(eo, 0, sizeof (*eo));
+	symtab_init(&eo->syms);
+	if ((eh = (const Elf64_Ehdr *)getauxval(AT_SYSINFO_EHDR)) == NULL)
+		return -1;
+	/* the image ends with its section headers, or the last section */
+	size = eh->e_shoff + (size_t)eh->e_shnum * eh->e_shentsize;
+	sh = (const Elf64_Shdr *)((const char *)eh + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type != SHT_NOBITS &&
+		    sh[i].sh_offset + sh[i].sh_size > size)
+			size = sh[i].sh_offset + sh[i].sh_size;
+	}
+	return elf_parse(eo, (const unsigned char *)eh, size);
+}
+
+void
+elf_free(elfobj_t *eo)
+{
+	symtab_free(&eo->syms);
+	free(eo->segs);
+	memset(eo, 0, sizeof (*eo));
+}
+
+/* translate a file offset to a symbol address */
+uint64_t
+elf_vaddr(const elfobj_t *eo, uint64_t offset)
+{
+	uint32_t i;
+
+	for (i = 0; i < eo->nsegs; i++) {
+		if (offset >= eo->segs[i].offset &&
+		    offset - eo->segs[i].offset < eo->segs[i].filesz)
+			return eo->segs[i].vaddr + offset - eo->segs[i].offset;
+	}
+	return offset;
+}
+
+/*
+ * Kernel and JIT symbols
+ */
+
+/*
+ * Read text symbols from kallsyms. Module symbols have mod set to their
+ * "[module]" name, and the others ST_NONE. Returns -1 if addresses are
+ * hidden (kernel.kptr_restrict).
+ */
+int
+kallsyms_load(symtab_t *t, const char *path)
+{
+	char *line = NULL, *p, *name, *mod;
+	size_t linesz = 0, len;
+	uint64_t addr;
+	uint32_t modid;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	while (getline(&line, &linesz, fp) != -1) {
+		addr = strtoull(line, &p, 16);
+		if (addr == 0 || *p != ' ' || strchr("tTwW", p[1]) == NULL ||
+		    p[2] != ' ')
+			continue;
+		name = p + 3;
+		len = strcspn(name, "\t\n");
+		modid = ST_NONE;
+		mod = name[len] == '\t' ? strchr(name + len, '[') : NULL;
+		if (mod != NULL)
+			modid = strtab_intern(&t->names, mod,
+			    strcspn(mod, "\n"));
+		symtab_add(t, addr, 0, name, len, modid);
+	}
+	free(line);
+	fclose(fp);
+	symtab_finish(t);
+	return t->count ? 0 : -1;
+}
+
+/*
+ * The kernel index is valid for one boot and set of loaded modules: the boot
+ * ID, and a hash of the module names and load addresses.
+ */
+static int
+kallsyms_key(char *key, size_t keysz)
+{
+	char *line = NULL, boot[64], name[256];
+	unsigned long long addr;
+	size_t linesz = 0, i;
+	uint64_t h = 14695981039346656037ULL;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/sys/kernel/random/boot_id", "r")) == NULL)
+		return -1;
+	if (fgets(boot, sizeof (boot), fp) == NULL) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	boot[strcspn(boot, "\n")] = '\0';
+	if ((fp = fopen("/proc/modules", "r")) != NULL) {
+		/* name size refcount deps state address: skip the refcount */
+		while (getline(&line, &linesz, fp) != -1) {
+			if (sscanf(line, "%255s %*s %*s %*s %*s %llx", name,
+			    &addr) != 2)
+				continue;
+			for (i = 0; name[i] != '\0'; i++) {
+				h ^= (unsigned char)name[i];
+				h *= 1099511628211ULL;
+			}
+			h ^= addr;
+			h *= 1099511628211ULL;
+		}
+		free(line);
+		fclose(fp);
+	}
+	snprintf(key, keysz, "%s-%016" PRIx64, boot, h);
+	return 0;
+}
+
+/*
+ * Load kernel symbols from the cached index in the symbol cache, rebuilding
+ * it from kallsyms if modules were loaded or unloaded since, or after a
+ * reboot. Returns -1 if kernel addresses are hidden.
+ */
+int
+kallsyms_index(symtab_t *t)
+{
+	char path[4096], key[128], buf[128], meta[256];
+
+	if (kallsyms_key(key, sizeof (key)) != 0 ||
+	    cache_path("kallsyms", path, sizeof (path)) != 0)
+		return kallsyms_load(t, "/proc/kallsyms");
+	if (cache_open(t, path) == 0) {
+		if (vf_meta(&t->f, "key", buf, sizeof (buf)) != NULL &&
+		    strcmp(buf, key) == 0)
+			return t->count ? 0 : -1;
+		symtab_free(t);
+		symtab_init(t);
+	}
+	if (kallsyms_load(t, "/proc/kallsyms") != 0)
+		return -1;
+	snprintf(meta, sizeof (meta), "key=%s\nsymbols=%u\n", key, t->count);
+	cache_write(t, NULL, 0, meta, path);
+	return 0;
+}
+
+/* return 1 if a symbol of this name is in the table */
+int
+symtab_hasname(const symtab_t *t, const char *name)
+{
+	uint32_t i;
+
+	if (!t->mapped)
+		return strtab_lookup(&t->names, name, strlen(name)) != ST_NONE;
+	for (i = 0; i < t->fnames.count; i++) {
+		if (strcmp(vf_string(&t->fnames, i), name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* read a perf map: "START SIZE name" per line, in hex */
+int
+perfmap_load(symtab_t *t, const char *path)
+{
+	char *line = NULL, *p;
+	size_t linesz = 0;
+	uint64_t addr, size;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	while (getline(&line, &linesz, fp) != -1) {
+		addr = strtoull(line, &p, 16);
+		if (*p != ' ')
+			continue;
+		size = strtoull(p + 1, &p, 16);
+		if (*p != ' ')
+			continue;
+		p++;
+		symtab_add(t, addr, size, p, strcspn(p, "\n"), ST_NONE);
+	}
+	free(line);
+	fclose(fp);
+	symtab_finish(t);
+	return 0;
+}
+
+/*
+ * Return 1 if kallsyms has all of the named text symbols, by name only, for
+ * when addresses are hidden (kernel.kptr_restrict) and there is no index.
+ */
+static int
+kallsyms_hasnames(const char *path, char **names, int n)
+{
+	char *line = NULL, *p, *name;
+	unsigned char *found;
+	size_t linesz = 0, len;
+	int i, nfound = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+	found = vh_calloc(n, 1);
+	while (nfound < n && getline(&line, &linesz, fp) != -1) {
+		strtoull(line, &p, 16);
+		if (*p != ' ' || strchr("tTwW", p[1]) == NULL || p[2] != ' ')
+			continue;
+		name = p + 3;
+		len = strcspn(name, "\t\n");
+		for (i = 0; i < n; i++) {
+			if (!found[i] && strncmp(names[i], name, len) == 0 &&
+			    names[i][len] == '\0') {
+				found[i] = 1;
+				nfound++;
+			}
+		}
+	}
+	free(found);
+	free(line);
+	fclose(fp);
+	return nfound == n;
+}
+
+/*
+ * Commands
+ */
+
+/*
+ * ksym name ...: exit 0 if the running kernel has all of the named text
+ * symbols, eg, "ksym bpf_get_stackid" for BPF stack support, using the
+ * cached kernel index, or the names in kallsyms if addresses are hidden.
+ */
+int
+cmd_ksym(int argc, char **argv)
+{
+	symtab_t t;
+	int i, status = 0;
+
+	if (argc < 2)
+		return 2;
+	symtab_init(&t);
+	if (kallsyms_index(&t) != 0) {
+		symtab_free(&t);
+		return kallsyms_hasnames("/proc/kallsyms", argv + 1, argc - 1) ? 0 : 1;
+	}
+	for (i = 1; i < argc && status == 0; i++) {
+		if (!symtab_hasname(&t, argv[i]))
+			status = 1;
+	}
+	symtab_free(&t);
+	return status;
+}
@@ -0,0 +1,110 @@
+/*
+ * symbols.h - symbol tables for resolving sampled addresses.
+ *
+ * A symtab is a sorted array of symbol start addresses, so a lookup is a
+ * binary search. Tables are loaded from ELF objects (.symtab and .dynsym,
+ * with C++ names demangled), from /proc/kallsyms for the kernel, and from
+ * /tmp/perf-PID.map files for JIT compiled code.
+ *
+ * ELF symbol tables are cached on disk by build ID, when $VECTOR_SYMCACHE
+ * names a directory: each entry is a vfile (see vfile.h) of kind
+ * VF_KIND_SYMBOLS, named by the hex build ID:
+ *
+ *	VF_META		buildid, symbols
+ *	VF_STRINGS	symbol names
+ *	VF_SYMS		sym_t per symbol, sorted by address
+ *	VF_SEGMENTS	elfseg_t per loadable segment
+ *
+ * A cached table is mapped and searched in place, so a binary seen before,
+ * on the host or in any container, is not read or sorted again. The kernel's
+ * symbols are cached the same way, as the entry "kallsyms", which is rebuilt
+ * after a reboot or when modules are loaded or unloaded, and so are the
+ * inlined calls and line table of an object, if asked for (see dwarf.h).
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dwarf.h"
+#include "stacktab.h"
+#include "vfile.h"
+
+#define SYM_BUILDIDLEN	41		/* hex, up to 20 bytes */
+
+typedef struct sym {
+	uint64_t	addr;
+	uint32_t	size;		/* 0: up to the next symbol */
+	uint32_t	name;		/* string ID */
+	uint32_t	mod;		/* module string ID, kernel */
+	uint32_t	reserved;
+} sym_t;
+
+typedef struct symtab {
+	sym_t		*syms;		/* sorted by address, once finished */
+	uint32_t	count;
+	uint32_t	alloc;
+	strtab_t	names;
+
+	/* or, mapped from a symbol cache entry, read only */
+	int		mapped;
+	vfile_t		f;
+	vf_strings_t	fnames;
+} symtab_t;
+
+/* an ELF object: its symbols, and loadable segments for file offsets */
+typedef struct elfseg {
+	uint64_t	offset;
+	uint64_t	vaddr;
+	uint64_t	filesz;
+} elfseg_t;
+
+typedef struct elfobj {
+	symtab_t	syms;
+	elfseg_t	*segs;
+	uint32_t	nsegs;
+} elfobj_t;
+
+void	symtab_init(symtab_t *);
+void	symtab_free(symtab_t *);
+void	symtab_add(symtab_t *, uint64_t addr, uint64_t size, const char *name,
+	    size_t len, uint32_t mod);
+void	symtab_finish(symtab_t *);
+const sym_t *symtab_lookup(const symtab_t *, uint64_t addr);
+
+static inline const char *
+sym_name(const symtab_t *t, const sym_t *s)
+{
+	if (t->mapped)
+		return vf_string(&t->fnames, s->name);
+	return strtab_str(&t->names, s->name);
+}
+
+/* the module of a kernel symbol, eg, "[ext4]", or NULL for the kernel */
+static inline const char *
+sym_mod(const symtab_t *t, const sym_t *s)
+{
+	if (s->mod == ST_NONE)
+		return NULL;
+	if (t->mapped)
+		return vf_string(&t->fnames, s->mod);
+	return strtab_str(&t->names, s->mod);
+}
+
+int	elf_load(elfobj_t *, const char *path, const char *buildid);
+int	elf_load_vdso(elfobj_t *);
+int	elf_load_inlines(inltab_t *, const char *path, const char *buildid);
+int	elf_load_lines(linetab_t *, const char *path, const char *buildid);
+void	elf_free(elfobj_t *);
+uint64_t elf_vaddr(const elfobj_t *, uint64_t offset);
+
+int	kallsyms_load(symtab_t *, const char *path);
+int	kallsyms_index(symtab_t *);
+int	symtab_hasname(const symtab_t *, const char *name);
+int	perfmap_load(symtab_t *, const char *path);
+
+#endif /* SYMBOLS_H */
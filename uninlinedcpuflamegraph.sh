@@ -3,7 +3,18 @@
 # uninlinedcpuflamegraph - a Vector pcp pmda for generating a CPU flame graph
 #			   with uninlined symbols.
 #
-# USAGE: uninlinedcpuflamegraph [seconds]
+# USAGE: uninlinedcpuflamegraph [seconds] [stream]
+#
+# stream decodes the capture while it runs, rather than writing perf.data and
+# reading it back afterwards, so the flame graph is ready sooner.
+#
+# Java methods are uninlined from their symbol maps, and when perf.data is
+# decoded natively, the inlined calls of native code are expanded from DWARF
+# debug information (if installed) as frames with an "_[i]" suffix.
+#
+# Unless streamed, the capture is shared with cpuflamegraph and
+# pnamecpuflamegraph, when their runs overlap (see shared_capture in
+# vectorlib.sh): the views are decoded together, from one capture.
 #
 # The $PCP_CONTAINER_NAME environment variable will be read, and if it is
 # not NULL, a CPU flame graph will be generated for the container name it
@@ -38,7 +49,6 @@ OUT_SVG=$WEBSITE_DIR/${METRIC}.${PCP_CONTEXT}.svg
 OUT_STATUS=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.status
 OUT_FOLDED=$WORKING_DIR/perf.folded.$$
 PERF_DATA=$WORKING_DIR/perf.data.$$	# adding $$ avoids a clash of concurrent runs
-CGROUPFS=/sys/fs/cgroup
 
 # libraries
 . $PMDA_DIR/vectorlib.sh
@@ -48,7 +58,8 @@ CGROUPFS=/sys/fs/cgroup
 # S3BUCKET="s3://"
 
 # perf settings
-SECS=${1:-60}		# default to 60 seconds if not sepcified
+parseargs "$@"
+SECS=${ARG_SECS:-60}		# default to 60 seconds if not sepcified
 HERTZ=49
 
 #
@@ -72,18 +83,11 @@ if [[ "$PCP_CONTAINER_NAME" != "" ]]; then
 	#
 	# Set $cgroupfilter for perf record, and $tasklist of container PIDs.
 	#
-	# The code below assumes that $PCP_CONTAINER_NAME is a Docker container
-	# name, and so uses the docker command and cgroup v1 paths in
-	# /sys/fs/cgroup. This code will need modifications for different
-	# container software, and for cgroup v2.
+	# $PCP_CONTAINER_NAME is a Docker container name, or a container ID,
+	# resolved by vectorhelper under cgroup v1 or v2 (see vectorlib.sh).
 	#
-	UUID=$(docker inspect --format='{{ .Id }}' $PCP_CONTAINER_NAME)
-	[[ "$UUID" == "" ]] && errorexit "Container not found"
-	pid=$(docker inspect --format='{{ .State.Pid }}' $UUID)
-	cgroup=$(awk -F: '$2 == "perf_event" { print $3; exit }' /proc/$pid/cgroup)
-	[ ! -e $CGROUPFS/perf_event/$cgroup ] && errorexit "Container cgroup not found"
+	container_resolve $PCP_CONTAINER_NAME
 	cgroupfilter="-e cpu-clock --cgroup=$cgroup"
-	tasklist=$(cat $CGROUPFS/perf_event/$cgroup/tasks)
 	fgtitle="Uninlined CPU Flame Graph (no idle): $PCP_CONTAINER_NAME, $TS"
 else
 	cgroupfilter=""
@@ -91,29 +95,61 @@ else
 	fgtitle="Uninlined CPU Flame Graph (no idle): $HOSTNAME, $TS"
 fi
 
+# fold perf script output, for perf_capture and perf_fold
+function foldstacks {
+	$FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter'
+}
+shared=0
+(( SHARED_CAPTURE && NATIVE_DECODE && ! OPT_stream )) && shared=1
+
+# fold $PERF_DATA natively, for perf_fold
+function decodestacks {
+	$VECTOR_HELPER decode -a -i -m $DECODE_MINPCT $PERF_DATA | \
+	    egrep -v 'cpu_idle|cpuidle_enter'
+}
+
+# when streaming, samples are symbolized as they arrive, so collect maps first
+if (( OPT_stream )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps_uninlined $tasklist
+	fix_node_maps $tasklist
+	statusmsg "Profiling for $SECS seconds"
+fi
+
 #
 # Profile
 #
-perf record -o $PERF_DATA -F $HERTZ -a $cgroupfilter -g sleep $SECS >/dev/null &
+if (( shared )); then
+	shared_capture uninlined -F $HERTZ -a $cgroupfilter -g
+else
+	perf_capture -F $HERTZ -a $cgroupfilter -g
+fi
 s=0
 # update status message
 while (( s < SECS )); do
 	sleep 5
+	kill -0 $bgpid > /dev/null 2>&1 || break
 	(( s += 5 ))
 	statusmsg "Profiling for $SECS seconds ($s/$SECS)" 2>/dev/null
 done
-wait
+if (( shared )); then
+	shared_wait
+else
+	wait
+fi
 
 # lower our priority before flame graph generation, to reduce CPU contention:
 renice -n 19 -p $$ &>/dev/null
 
 # prepare symbol maps
-statusmsg "Collecting symbol maps"
-dump_java_maps_uninlined $tasklist
-fix_node_maps $tasklist
+if (( ! OPT_stream && ! shared )); then
+	statusmsg "Collecting symbol maps"
+	dump_java_maps_uninlined $tasklist
+	fix_node_maps $tasklist
+fi
 
 # decide upon a palette
-if pgrep -x node >/dev/null; then
+if have_procs node; then
 	color=js
 else
 	color=java
@@ -121,17 +157,26 @@ fi
 
 # generate flame graph and stash it away with the folded profile on s3
 statusmsg "Processing profile"
-timeout 20 perf script -i $PERF_DATA | $FG_DIR/stackcollapse-perf.pl --all | egrep -v 'cpu_idle|cpuidle_enter' > $OUT_FOLDED
+if (( shared )); then
+	shared_fold uninlined $OUT_FOLDED.shared
+	egrep -v 'cpu_idle|cpuidle_enter' $OUT_FOLDED.shared > $OUT_FOLDED
+	rm $OUT_FOLDED.shared
+else
+	perf_fold
+fi
 statusmsg "Flame Graph generation"
 $FG_DIR/flamegraph.pl --minwidth=0.5 --color=$color --hash --title="$fgtitle" < $OUT_FOLDED > $OUT_SVG
 
+# keep the profile in the compact binary format
+keep_profile
+
 # send to s3
 # statusmsg "s3 archive"
 # s3cp $OUT_SVG $S3BUCKET/${METRIC}-$TS.svg >/dev/null &
-# s3cp $OUT_FOLDED $S3BUCKET/${METRIC}-$TS.folded >/dev/null &
+# s3cp ${OUT_FOLDED/perf.folded/perf.profile} $S3BUCKET/${METRIC}-$TS.profile >/dev/null &
 
 statusmsg "Usage: $(rusage)"
 statusmsg "DONE"
 
-# $PERF_DATA file left behind for debug or custom reports
-# XXX add code that cleans up all output files except the most recent 10
+# $PERF_DATA file left behind for debug or custom reports, unless streamed
+# (retention in vectord.sh compresses it, and removes old output)
@@ -7,6 +7,7 @@
  * Licensed under the Apache License, Version 2.0 (the "License")
  */
 
+#include <ctype.h>
 #include <pcp/pmapi.h>
 #include <pcp/impl.h>
 #include <pcp/pmda.h>
@@ -14,6 +15,8 @@
 
 #define WORKING_DIR "/var/log/pcp/vector"
 #define VECTOR_DIR "/var/lib/pcp/pmdas/vector"
+#define RETENTION_STATS WORKING_DIR "/vectord/retention.stats"
+#define RESOLVER_STATS WORKING_DIR "/vectord/resolver.stats"
 
 /*
  * Vector PMDA
@@ -66,6 +69,50 @@
  *     request, provided it does not begin with the previous keywords.
  *
  * A task must finish with either "DONE" or "ERROR" with optional argument.
+ *
+ * Retention Metrics
+ * -----------------
+ *
+ * Task output is kept in WORKING_DIR/<task>, within a disk budget enforced
+ * by vectord.sh (see retain.c). Its usage is read from RETENTION_STATS. The
+ * instances are the tasks, and "continuous" for the continuous profile.
+ *
+ * vector.retention.bytes
+ *	Disk space used by the retained output of each task.
+ * vector.retention.files
+ *	Number of retained output files of each task.
+ * vector.retention.evicted
+ *	Output files of each task removed to stay within the budget.
+ * vector.retention.total
+ *	Disk space used by all retained task output.
+ * vector.retention.taskbudget
+ *	Disk budget for each task's output, or zero for unlimited.
+ * vector.retention.budget
+ *	Disk budget for all task output, or zero for unlimited.
+ *
+ * Resolver Metrics
+ * ----------------
+ *
+ * Tasks that expand native frames into their inlined calls (vectorhelper
+ * decode -i) add their symbol resolution totals to RESOLVER_STATS. These
+ * are counters since the file was created.
+ *
+ * vector.resolver.frames
+ *	Native frames resolved.
+ * vector.resolver.hits
+ *	Native frames resolved to a symbol.
+ * vector.resolver.inlined
+ *	Native frames expanded into inlined calls.
+ * vector.resolver.time
+ *	Time spent decoding and resolving stacks.
+ *
+ * Task Arguments
+ * --------------
+ *
+ * The store value is passed to the task as its arguments: an optional
+ * duration in seconds, followed by optional name[=value] options, eg,
+ * "60 mode=bpf hz=997". Options are interpreted by the task scripts (see
+ * parseargs in vectorlib.sh), and unknown options are ignored.
  */
 
 enum {
@@ -80,10 +127,33 @@ enum {
 	VECTOR_TASK_CSWFLAMEGRAPH,
 	VECTOR_TASK_OFFCPUFLAMEGRAPH,
 	VECTOR_TASK_OFFWAKEFLAMEGRAPH,
+	VECTOR_TASK_SUBSECONDHEATMAP,
 
 	VECTOR_TASK_METRIC_COUNT
 };
 
+enum {
+	VECTOR_RETENTION_BYTES = 0,
+	VECTOR_RETENTION_FILES,
+	VECTOR_RETENTION_EVICTED,
+	VECTOR_RETENTION_TOTAL,
+	VECTOR_RETENTION_TASKBUDGET,
+	VECTOR_RETENTION_BUDGET,
+};
+
+enum {
+	VECTOR_RESOLVER_FRAMES = 0,
+	VECTOR_RESOLVER_HITS,
+	VECTOR_RESOLVER_INLINED,
+	VECTOR_RESOLVER_TIME,
+
+	VECTOR_RESOLVER_METRIC_COUNT
+};
+
+/* instance domains */
+#define TASK_INDOM	0
+#define TASK_CONTINUOUS	VECTOR_TASK_METRIC_COUNT	/* extra instance */
+
 char *tasknames[] = {
 	"cpuflamegraph",
 	"disklatencyheatmap",
@@ -95,7 +165,8 @@ char *tasknames[] = {
 	"ipcflamegraph",
 	"cswflamegraph",
 	"offcpuflamegraph",
-	"offwakeflamegraph"
+	"offwakeflamegraph",
+	"subsecondheatmap"
 };
 
 static pmdaMetric metrictab[] = {
@@ -143,8 +214,71 @@ static pmdaMetric metrictab[] = {
 		{ PMDA_PMID(0, VECTOR_TASK_OFFWAKEFLAMEGRAPH), PM_TYPE_STRING,
 		  PM_INDOM_NULL, PM_SEM_DISCRETE,
 		  PMDA_PMUNITS(0, 0, 0, 0, 0, 0) } },
+	{ NULL,
+		{ PMDA_PMID(0, VECTOR_TASK_SUBSECONDHEATMAP), PM_TYPE_STRING,
+		  PM_INDOM_NULL, PM_SEM_DISCRETE,
+		  PMDA_PMUNITS(0, 0, 0, 0, 0, 0) } },
+	{ NULL,
+		{ PMDA_PMID(1, VECTOR_RETENTION_BYTES), PM_TYPE_U64,
+		  TASK_INDOM, PM_SEM_INSTANT,
+		  PMDA_PMUNITS(1, 0, 0, PM_SPACE_BYTE, 0, 0) } },
+	{ NULL,
+		{ PMDA_PMID(1, VECTOR_RETENTION_FILES), PM_TYPE_U32,
+		  TASK_INDOM, PM_SEM_INSTANT,
+		  PMDA_PMUNITS(0, 0, 1, 0, 0, PM_COUNT_ONE) } },
+	{ NULL,
+		{ PMDA_PMID(1, VECTOR_RETENTION_EVICTED), PM_TYPE_U64,
+		  TASK_INDOM, PM_SEM_COUNTER,
+		  PMDA_PMUNITS(0, 0, 1, 0, 0, PM_COUNT_ONE) } },
+	{ NULL,
+		{ PMDA_PMID(1, VECTOR_RETENTION_TOTAL), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_INSTANT,
+		  PMDA_PMUNITS(1, 0, 0, PM_SPACE_BYTE, 0, 0) } },
+	{ NULL,
+		{ PMDA_PMID(1, VECTOR_RETENTION_TASKBUDGET), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_DISCRETE,
+		  PMDA_PMUNITS(1, 0, 0, PM_SPACE_BYTE, 0, 0) } },
+	{ NULL,
+		{ PMDA_PMID(1, VECTOR_RETENTION_BUDGET), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_DISCRETE,
+		  PMDA_PMUNITS(1, 0, 0, PM_SPACE_BYTE, 0, 0) } },
+	{ NULL,
+		{ PMDA_PMID(2, VECTOR_RESOLVER_FRAMES), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_COUNTER,
+		  PMDA_PMUNITS(0, 0, 1, 0, 0, PM_COUNT_ONE) } },
+	{ NULL,
+		{ PMDA_PMID(2, VECTOR_RESOLVER_HITS), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_COUNTER,
+		  PMDA_PMUNITS(0, 0, 1, 0, 0, PM_COUNT_ONE) } },
+	{ NULL,
+		{ PMDA_PMID(2, VECTOR_RESOLVER_INLINED), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_COUNTER,
+		  PMDA_PMUNITS(0, 0, 1, 0, 0, PM_COUNT_ONE) } },
+	{ NULL,
+		{ PMDA_PMID(2, VECTOR_RESOLVER_TIME), PM_TYPE_U64,
+		  PM_INDOM_NULL, PM_SEM_COUNTER,
+		  PMDA_PMUNITS(0, 1, 0, 0, PM_TIME_USEC, 0) } },
 };
 
+static pmdaInstid task_instances[VECTOR_TASK_METRIC_COUNT + 1];
+
+static pmdaIndom indomtab[] = {
+	{ TASK_INDOM, VECTOR_TASK_METRIC_COUNT + 1, task_instances },
+};
+
+/* retention usage, per task instance, from RETENTION_STATS */
+static struct retention {
+	__uint64_t	bytes;
+	__uint32_t	files;
+	__uint64_t	evicted;
+} retention[VECTOR_TASK_METRIC_COUNT + 1];
+static __uint64_t	retention_total;
+static __uint64_t	retention_taskbudget;
+static __uint64_t	retention_budget;
+
+/* resolver totals, from RESOLVER_STATS */
+static __uint64_t	resolver[VECTOR_RESOLVER_METRIC_COUNT];
+
 static char	*username;
 static char	mypath[MAXPATHLEN];
 #define CONTAINER_NAME_MAX	256
@@ -211,19 +345,23 @@ rmstatus(const char *metric, int ctx)
 	unlink(statuspath);
 }
 
-// input validation, as some is passed to system()
+/*
+ * Input validation, as some is passed to system(). Task arguments are
+ * words of alphanumerics and a few punctuation characters that are not
+ * special to the shell.
+ */
 int
 badinput(char *str)
 {
 	char *c = str;
 	while (c && *c != '\0') {
-		if (*c < '0' || *c > '9')
+		if (!isalnum((unsigned char)*c) && strchr(" =.,:_-/", *c) == NULL)
 			return 1;
 		c++;
 	}
 	return 0;
 }
-	
+
 
 /*
  * vector_fetchCallBack() schedules tasks.
@@ -235,9 +373,9 @@ vector_store(pmResult *result, pmdaExt *pmda)
 	__pmID_int *idp = (__pmID_int *)&vsp->pmid;
 	pmAtomValue av;
 	static char statusmsg[256];
-	char cmd[256];
+	char cmd[512];
 	char ctxstr[64];
-	char *status, *secs, *metricname;
+	char *status, *args, *metricname;
 	int ctx;
 
 	if (idp->cluster != 0)
@@ -263,14 +401,15 @@ vector_store(pmResult *result, pmdaExt *pmda)
 	case VECTOR_TASK_CSWFLAMEGRAPH:
 	case VECTOR_TASK_OFFCPUFLAMEGRAPH:
 	case VECTOR_TASK_OFFWAKEFLAMEGRAPH:
+	case VECTOR_TASK_SUBSECONDHEATMAP:
 		metricname = tasknames[idp->item];
 
-		// fetch optional seconds argument
-		secs = "";
+		// fetch optional seconds and options arguments
+		args = "";
 		if (pmExtractValue(vsp->valfmt, &vsp->vlist[0],
 		    PM_TYPE_STRING, &av, PM_TYPE_STRING) >= 0) {
-			secs = av.cp;
-			if (badinput(secs))
+			args = av.cp;
+			if (badinput(args) || strlen(args) > 256)
 				return PM_ERR_BADSTORE;
 		}
 
@@ -282,7 +421,7 @@ vector_store(pmResult *result, pmdaExt *pmda)
 		}
 
 		// application and kernel stacks via perf and flamegraph
-		sprintf(cmd, VECTOR_DIR "/%s.sh %s &", metricname, secs);
+		snprintf(cmd, sizeof(cmd), VECTOR_DIR "/%s.sh %s &", metricname, args);
 		if (system(cmd) != 0) {
 			fprintf(stderr, "system failed: %s\n",
 			    pmErrStr(- oserror()));
@@ -290,6 +429,15 @@ vector_store(pmResult *result, pmdaExt *pmda)
 		break;
 
 	case VECTOR_TASK_DISKLATENCYHEATMAP:
+		// fetch optional seconds argument
+		args = "";
+		if (pmExtractValue(vsp->valfmt, &vsp->vlist[0],
+		    PM_TYPE_STRING, &av, PM_TYPE_STRING) >= 0) {
+			args = av.cp;
+			if (badinput(args) || strlen(args) > 256)
+				return PM_ERR_BADSTORE;
+		}
+
 		// if already busy, return try again
 		if (hasstatus("disklatencyheatmap", ctx)) {
 			status = getstatus("disklatencyheatmap", statusmsg, sizeof (statusmsg), ctx);
@@ -297,8 +445,9 @@ vector_store(pmResult *result, pmdaExt *pmda)
 				return PM_ERR_AGAIN;
 		}
 
-		// disk I/O latency heat map 
-		if (system(VECTOR_DIR "/heatmap.sh &") != 0) {
+		// disk I/O latency heat map, sharing diskioflamegraph's trace
+		snprintf(cmd, sizeof(cmd), VECTOR_DIR "/heatmap.sh %s &", args);
+		if (system(cmd) != 0) {
 			fprintf(stderr, "system failed: %s\n",
 			    pmErrStr(- oserror()));
 		}
@@ -326,6 +475,132 @@ vector_store(pmResult *result, pmdaExt *pmda)
 	return 0;
 }
 
+/*
+ * Read the retention stats file written by vectord.sh. Task directories
+ * that are not instances, eg, HEATMAP, only count toward the total.
+ */
+static void
+vector_refresh_retention(void)
+{
+	char line[512], name[256];
+	unsigned long long bytes, evicted, taskbudget, budget;
+	unsigned int files;
+	FILE *fp;
+	int i;
+
+	memset(retention, 0, sizeof (retention));
+	retention_total = retention_taskbudget = retention_budget = 0;
+	if ((fp = fopen(RETENTION_STATS, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "budget %llu %llu", &taskbudget, &budget) == 2) {
+			retention_taskbudget = taskbudget;
+			retention_budget = budget;
+			continue;
+		}
+		if (sscanf(line, "task %255s %llu %u %llu", name, &bytes, &files,
+		    &evicted) != 4)
+			continue;
+		retention_total += bytes;
+		for (i = 0; i <= TASK_CONTINUOUS; i++) {
+			if (strcmp(task_instances[i].i_name, name) == 0) {
+				retention[i].bytes = bytes;
+				retention[i].files = files;
+				retention[i].evicted = evicted;
+				break;
+			}
+		}
+	}
+	fclose(fp);
+}
+
+/*
+ * Read the resolver stats file written by vectorhelper decode, as "name
+ * value" lines in the order of the resolver metrics.
+ */
+static void
+vector_refresh_resolver(void)
+{
+	static char *names[VECTOR_RESOLVER_METRIC_COUNT] = {
+		"frames", "hits", "inlined", "time"
+	};
+	char line[256], name[64];
+	unsigned long long value;
+	FILE *fp;
+	int i;
+
+	memset(resolver, 0, sizeof (resolver));
+	if ((fp = fopen(RESOLVER_STATS, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "%63s %llu", name, &value) != 2)
+			continue;
+		for (i = 0; i < VECTOR_RESOLVER_METRIC_COUNT; i++) {
+			if (strcmp(names[i], name) == 0)
+				resolver[i] = value;
+		}
+	}
+	fclose(fp);
+}
+
+/*
+ * vector_fetch() refreshes the retention and resolver stats once per fetch,
+ * if needed.
+ */
+static int
+vector_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
+{
+	__pmID_int *idp;
+	int i, stale_retention = 0, stale_resolver = 0;
+
+	for (i = 0; i < numpmid; i++) {
+		idp = (__pmID_int *)&pmidlist[i];
+		if (idp->cluster == 1)
+			stale_retention = 1;
+		else if (idp->cluster == 2)
+			stale_resolver = 1;
+	}
+	if (stale_retention)
+		vector_refresh_retention();
+	if (stale_resolver)
+		vector_refresh_resolver();
+	return pmdaFetch(numpmid, pmidlist, resp, pmda);
+}
+
+/*
+ * vector_retention_fetch() returns the retention metrics.
+ */
+static int
+vector_retention_fetch(unsigned int item, unsigned int inst, pmAtomValue *atom)
+{
+	switch (item) {
+	case VECTOR_RETENTION_BYTES:
+	case VECTOR_RETENTION_FILES:
+	case VECTOR_RETENTION_EVICTED:
+		if (inst > TASK_CONTINUOUS)
+			return PM_ERR_INST;
+		if (item == VECTOR_RETENTION_BYTES)
+			atom->ull = retention[inst].bytes;
+		else if (item == VECTOR_RETENTION_FILES)
+			atom->ul = retention[inst].files;
+		else
+			atom->ull = retention[inst].evicted;
+		break;
+	case VECTOR_RETENTION_TOTAL:
+		atom->ull = retention_total;
+		break;
+	case VECTOR_RETENTION_TASKBUDGET:
+		atom->ull = retention_taskbudget;
+		break;
+	case VECTOR_RETENTION_BUDGET:
+		atom->ull = retention_budget;
+		break;
+	default:
+		return PM_ERR_PMID;
+	}
+	return PMDA_FETCH_STATIC;
+}
+
 /*
  * vector_fetchCallBack() returns the status of tasks.
  */
@@ -337,6 +612,14 @@ vector_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	char *metricname;
 	int ctx;
 
+	if (idp->cluster == 1)
+		return vector_retention_fetch(idp->item, inst, atom);
+	if (idp->cluster == 2) {
+		if (idp->item >= VECTOR_RESOLVER_METRIC_COUNT)
+			return PM_ERR_PMID;
+		atom->ull = resolver[idp->item];
+		return PMDA_FETCH_STATIC;
+	}
 	if (idp->cluster != 0)
 		return PM_ERR_PMID;
 	else if (inst != PM_IN_NULL)
@@ -357,6 +640,7 @@ vector_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	case VECTOR_TASK_CSWFLAMEGRAPH:
 	case VECTOR_TASK_OFFCPUFLAMEGRAPH:
 	case VECTOR_TASK_OFFWAKEFLAMEGRAPH:
+	case VECTOR_TASK_SUBSECONDHEATMAP:
 		metricname = tasknames[idp->item];
 		if (hasstatus(metricname, ctx)) {
 			atom->cp = getstatus(metricname, statusmsg, sizeof (statusmsg), ctx);
@@ -411,12 +695,29 @@ vector_attribute(int ctx, int attr, const char *value, int len, pmdaExt *pmda)
 	return 0;
 }
 
+/*
+ * Start the background service, vectord.sh, which exits when this process
+ * does: the pmda daemon, or pmcd for the DSO.
+ */
+static void
+vectord_start(void)
+{
+	char cmd[256];
+
+	snprintf(cmd, sizeof(cmd), VECTOR_DIR "/vectord.sh %d &", getpid());
+	if (system(cmd) != 0)
+		fprintf(stderr, "starting vectord failed: %s\n",
+		    pmErrStr(- oserror()));
+}
+
 /*
  * Initialise the agent (both daemon and DSO).
  */
 void
 vector_init(pmdaInterface *dp)
 {
+	int i;
+
 	if (isDSO) {
 		int sep = __pmPathSeparator();
 		snprintf(mypath, sizeof(mypath), "%s%c" "vector" "%c" "help",
@@ -431,9 +732,20 @@ vector_init(pmdaInterface *dp)
 	dp->comm.flags |= PDU_FLAG_CONTAINER;
 	dp->version.six.attribute = vector_attribute;
 	dp->version.six.store = vector_store;
+	dp->version.six.fetch = vector_fetch;
 	pmdaSetFetchCallBack(dp, vector_fetchCallBack);
-	pmdaInit(dp, NULL, 0,
+
+	for (i = 0; i < VECTOR_TASK_METRIC_COUNT; i++) {
+		task_instances[i].i_inst = i;
+		task_instances[i].i_name = tasknames[i];
+	}
+	task_instances[TASK_CONTINUOUS].i_inst = TASK_CONTINUOUS;
+	task_instances[TASK_CONTINUOUS].i_name = "continuous";
+
+	pmdaInit(dp, indomtab, sizeof(indomtab) / sizeof(indomtab[0]),
 	    metrictab, sizeof(metrictab) / sizeof(metrictab[0]));
+
+	vectord_start();
 }
 
 /*
@@ -467,6 +779,7 @@ int main(int argc, char **argv)
 		    pmErrStr(- oserror()));
 
 	pmdaOpenLog(&desc);
+
 	vector_init(&desc);
 	pmdaConnect(&desc);
 	pmdaMain(&desc);
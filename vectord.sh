@@ -0,0 +1,199 @@
+#!/bin/bash
+#
+# vectord - background service for the Vector pcp pmda
+#
+# USAGE: vectord.sh pmda_pid
+#
+# This is started by the pmda, and runs until the pmda process exits: the
+# pmda daemon, or pmcd if the pmda is installed as a DSO. It does periodic
+# work on behalf of the task scripts, so that results can be ready before a
+# task is requested:
+#
+# Continuous profiling: when enabled (CONTINUOUS=1), a low frequency CPU
+# profile of the whole host is captured every minute and aggregated into a
+# ring of per-minute binary profiles in $CONT_DIR. Each profile is bounded
+# to $CONT_MAXSTACKS stacks, and only the most recent $CONT_MINUTES are
+# kept. A cpuflamegraph request with the "last=N" option then renders the
+# last N minutes immediately, instead of profiling for another minute.
+#
+# Java symbol maps: when enabled (JAVA_MAPS=1), or while continuous profiling
+# is, the perf maps of all JVMs are refreshed every minute, several at once,
+# skipping the JVMs that have compiled no code since their last dump (see
+# dump_java_maps in perfmaplib.sh). Tasks then find the maps current at the
+# end of a capture, and dump only the JVMs that changed since, instead of
+# attaching to every JVM in turn. This is off by default, as it attaches to
+# JVMs when no one is profiling.
+#
+# Retention: task output in /var/log/pcp/vector is kept within a disk budget
+# per task ($RETAIN_TASK_MB) and in total ($RETAIN_TOTAL_MB), by removing the
+# least recently used files first. Retained perf.data and folded text files
+# are compressed with zstd, at low CPU and I/O priority. Usage is written to
+# $RETAIN_STATS, and exported by the pmda as the vector.retention metrics.
+#
+# Check and adjust the environment settings below.
+#
+# REQUIREMENTS: The libraries vectorlib.sh and perfmaplib.sh, perf or bcc/BPF, and vectorhelper.
+# zstd is optional, for compression.
+#
+# DEBUG: STDERR includes timestamped debug messages, and command errors. It
+# is redirected to the pmda vector log (/var/log/pcp/pmcd/vector.log).
+#
+# SEE ALSO: http://vectoross.io http://pcp.io
+#
+# Copyright 2017 Netflix, Inc.
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+# host
+PATH=/bin:/usr/bin:$PATH
+
+# pcp pmda paths
+PMDA_PID=$1
+PMDA_DIR=${0%/*}
+WORKING_DIR=/var/log/pcp/vector/vectord
+FG_DIR=/var/lib/pcp/pmdas/vector/BINFlameGraph
+BCC_DIR=/usr/share/bcc/tools
+CONT_DIR=/var/log/pcp/vector/continuous
+LOCKFILE=$WORKING_DIR/vectord.lock
+RETAIN_ROOT=/var/log/pcp/vector
+RETAIN_STATS=$WORKING_DIR/retention.stats
+
+# libraries
+. $PMDA_DIR/vectorlib.sh
+. $PMDA_DIR/perfmaplib.sh
+
+# continuous profiling settings
+CONTINUOUS=0		# set to one to enable always-on CPU profiling
+CONT_HERTZ=19		# sampling frequency; keep this low
+CONT_MINUTES=60		# retention: number of per-minute profiles kept
+CONT_MAXSTACKS=20000	# bound on unique stacks in each per-minute profile
+
+# Java symbol map settings
+JAVA_MAPS=0		# set to one to refresh Java maps between tasks
+PM_JAVA_JOBS=4		# JVMs dumped at once
+
+# retention settings
+RETAIN_TASK_MB=1024	# disk budget for each task's output, in Mbytes
+RETAIN_TOTAL_MB=4096	# disk budget for all task output, in Mbytes
+COMPRESS=1		# set to zero to keep perf.data and folded text as is
+
+[[ "$PMDA_PID" == "" ]] && { echo >&2 "USAGE: $0 pmda_pid"; exit 1; }
+[ ! -d "$WORKING_DIR" ] && mkdir -p $WORKING_DIR
+
+# only one instance, eg, if the pmda is restarted quickly
+exec 9> $LOCKFILE
+flock -n 9 || exit 0
+
+# this is background work: stay out of the way of the workload
+renice -n 19 -p $$ &>/dev/null
+
+#
+# Continuous profiling
+#
+
+# capture one minute of stacks into the ring, as $CONT_DIR/<epoch>.profile.
+# this uses whatever JIT symbol maps exist when the stacks are symbolized.
+function continuous_minute {
+	local start=$1
+	local out=$CONT_DIR/$start.profile
+
+	if (( CONT_BPF )); then
+		# stacks are counted in kernel context, and copied once
+		${BCC_DIR}/profile -af -F $CONT_HERTZ 60 > $out.tmp 2>/dev/null
+	else
+		# streamed through a pipe as it is captured: no perf.data
+		perf record -o - -F $CONT_HERTZ -a -g sleep 60 2>/dev/null | \
+		    perf script -i - 2>/dev/null | $FG_DIR/stackcollapse-perf.pl --all > $out.tmp
+	fi
+	# bound the size of each minute, so the ring has bounded size. merge
+	# writes to a temporary file and renames it into place.
+	$VECTOR_HELPER merge -m $CONT_MAXSTACKS -o $out $out.tmp
+	rm -f $out.tmp
+}
+
+# remove the oldest per-minute profiles beyond the retention
+function continuous_expire {
+	ls -1 $CONT_DIR/*.profile 2>/dev/null | sort | head -n -$CONT_MINUTES | \
+	    xargs -r rm -f
+}
+
+if (( CONTINUOUS )); then
+	[ ! -d "$CONT_DIR" ] && mkdir -p $CONT_DIR
+	CONT_BPF=0
+	if $VECTOR_HELPER ksym bpf_get_stackid 2>/dev/null &&
+	    [ -e $BCC_DIR/profile ]; then
+		CONT_BPF=1
+	fi
+	debugtime "$0 continuous profiling at $CONT_HERTZ Hertz, bpf=$CONT_BPF"
+fi
+
+#
+# Java symbol maps
+#
+
+function java_maps_refresh {
+	expire_java_maps
+	scan_procs
+	dump_java_maps
+}
+
+#
+# Retention
+#
+
+# compress output of finished tasks. Task output files are named with the
+# PID of the task script, as perf.data.<pid> or perf.folded.<pid>, and may have
+# a further suffix, eg, perf.data.<pid>.views; they are skipped while it runs,
+# as are files modified in the last minute, the lock files of a shared
+# capture, and the continuous profile's work files.
+function retain_compress {
+	local f
+	(( COMPRESS )) && type zstd > /dev/null 2>&1 || return
+	for f in $(find $RETAIN_ROOT -mindepth 2 -maxdepth 2 -type f -mmin +1 \
+	    \( -name 'perf.data.*' -o -name 'perf.folded.*' \) ! -name '*.zst' \
+	    ! -name '*.lock' ! -path "$CONT_DIR/*"); do
+		[[ "${f##*/}" =~ ^perf\.[a-z]+\.([0-9]+)(\.|$) ]] &&
+		    kill -0 ${BASH_REMATCH[1]} 2>/dev/null && continue
+		ionice -c 3 nice -n 19 zstd -q --rm $f
+	done
+}
+
+function retain_run {
+	retain_compress
+	$VECTOR_HELPER retain -t $RETAIN_TASK_MB -g $RETAIN_TOTAL_MB \
+	    -s $RETAIN_STATS $RETAIN_ROOT
+}
+
+#
+# Main loop, at the start of each minute
+#
+trap 'kill $(jobs -p) 2>/dev/null' EXIT
+debugtime "$0 start, pmda pid $PMDA_PID"
+retain_pid=""
+javamaps_pid=""
+
+while kill -0 $PMDA_PID 2>/dev/null; do
+	now=$(date +%s)
+	sleep $(( 60 - now % 60 ))
+
+	if (( CONTINUOUS )); then
+		continuous_minute $(( (now / 60 + 1) * 60 )) &
+		continuous_expire
+	fi
+	# rebuild the kernel symbol index here rather than in a task, after
+	# modules are loaded or unloaded; otherwise this only checks it
+	$VECTOR_HELPER ksym _stext 2>/dev/null
+	# one refresh at a time, as a JVM may take seconds to dump
+	# (this attaches to every JVM, so only when asked, or when continuous
+	# profiles are to be symbolized with current maps)
+	if (( JAVA_MAPS || CONTINUOUS )) && ! kill -0 $javamaps_pid 2>/dev/null; then
+		java_maps_refresh &
+		javamaps_pid=$!
+	fi
+	# one retention pass at a time, as compression may be slow
+	if ! kill -0 $retain_pid 2>/dev/null; then
+		retain_run &
+		retain_pid=$!
+	fi
+done
+
+debugtime "$0 exit, pmda pid $PMDA_PID gone"
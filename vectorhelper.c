@@ -0,0 +1,159 @@
+/*
+ * vectorhelper - native helper commands for the Vector PMDA task scripts.
+ *
+ * USAGE: vectorhelper command [options] [args]
+ *
+ * The task scripts run in the background and process profiles with shell,
+ * awk and Perl. vectorhelper provides compiled versions of the steps that
+ * are too slow that way on large systems. Each command is a filter or small
+ * utility, invoked by the scripts; run with no arguments for the list.
+ *
+ * SEE ALSO: http://vectoross.io
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vectorhelper.h"
+
+static struct command {
+	const char	*name;
+	int		(*func)(int, char **);
+	const char	*args;
+	const char	*desc;
+} commands[] = {
+	{ "collapse", cmd_collapse,
+	    "[-a] [-e event] [-k mono] [-s store] < perf-script",
+	    "fold perf script output, and optionally write a sample store" },
+	{ "container", cmd_container, "name",
+	    "print the cgroup, cgroup ID and PIDs of a container" },
+	{ "decode", cmd_decode,
+	    "[-ailn] [-b latencies [-w file]] [-c dir] [-e event ...] [-I file] "
+	    "[-j threads] [-L lines] [-m pct] [-P file] [-s store] [-t totals] "
+	    "perf.data",
+	    "fold a perf.data file on several threads, as collapse does" },
+	{ "diff", cmd_diff, "[-ns] before after",
+	    "join two profiles into differential folded output" },
+	{ "jvmstamp", cmd_jvmstamp, "pid",
+	    "print a stamp of a JVM's JIT code, which changes when it does" },
+	{ "ksym", cmd_ksym, "name ...",
+	    "exit 0 if the kernel has all of the named functions" },
+	{ "maptidy", cmd_maptidy, "[-o map] [livemap]",
+	    "tidy a JIT symbol log into a perf map, as perfmaptidy.pl" },
+	{ "merge", cmd_merge, "[-m maxstacks] [-o profile] [file ...]",
+	    "merge profiles, summing counts of identical stacks" },
+	{ "pack", cmd_pack, "[-c column] -o profile [folded ...]",
+	    "convert folded text to a binary profile" },
+	{ "ps", cmd_ps, "[-r runtime] [pid ...]",
+	    "list processes with their runtime, IDs, cgroup and binary" },
+	{ "query", cmd_query,
+	    "[-oI] [-r t0-t1] [-C cpu] [-p pid] [-t tid] [-g cgroup] store",
+	    "print the folded profile of matching samples in a store" },
+	{ "retain", cmd_retain, "[-t task_mb] [-g total_mb] [-s statsfile] root",
+	    "remove least recently used task output beyond the disk budget" },
+	{ "unpack", cmd_unpack, "[-c column] profile",
+	    "convert a binary profile to folded text" },
+};
+
+#define NCOMMANDS	(sizeof (commands) / sizeof (commands[0]))
+
+void
+vh_warn(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "vectorhelper: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+static void
+nomem(void)
+{
+	vh_warn("out of memory");
+	exit(1);
+}
+
+void *
+vh_malloc(size_t sz)
+{
+	void *p;
+
+	if ((p = malloc(sz ? sz : 1)) == NULL)
+		nomem();
+	return p;
+}
+
+void *
+vh_calloc(size_t n, size_t sz)
+{
+	void *p;
+
+	if ((p = calloc(n ? n : 1, sz ? sz : 1)) == NULL)
+		nomem();
+	return p;
+}
+
+void *
+vh_realloc(void *p, size_t sz)
+{
+	if ((p = realloc(p, sz ? sz : 1)) == NULL)
+		nomem();
+	return p;
+}
+
+char *
+vh_strdup(const char *s)
+{
+	char *p;
+
+	if ((p = strdup(s)) == NULL)
+		nomem();
+	return p;
+}
+
+static void
+usage(void)
+{
+	unsigned int i;
+
+	fprintf(stderr, "USAGE: vectorhelper command [options] [args]\n\n");
+	for (i = 0; i < NCOMMANDS; i++) {
+		fprintf(stderr, "  %s %s\n\t%s\n", commands[i].name,
+		    commands[i].args, commands[i].desc);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int i;
+	int status;
+
+	if (argc < 2) {
+		usage();
+		exit(2);
+	}
+	for (i = 0; i < NCOMMANDS; i++) {
+		if (strcmp(argv[1], commands[i].name) != 0)
+			continue;
+		/* commands parse their own options, from argv[1] */
+		status = commands[i].func(argc - 1, argv + 1);
+		if (status == 2) {
+			fprintf(stderr, "USAGE: vectorhelper %s %s\n",
+			    commands[i].name, commands[i].args);
+		}
+		if (fflush(stdout) != 0 && status == 0)
+			status = 1;
+		exit(status);
+	}
+	vh_warn("unknown command: %s", argv[1]);
+	usage();
+	exit(2);
+}
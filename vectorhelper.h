@@ -0,0 +1,39 @@
+/*
+ * vectorhelper.h - shared declarations for the vectorhelper commands.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef VECTORHELPER_H
+#define VECTORHELPER_H
+
+#include <stddef.h>
+
+/* allocation either succeeds, or the helper exits with an error */
+void	*vh_malloc(size_t);
+void	*vh_calloc(size_t, size_t);
+void	*vh_realloc(void *, size_t);
+char	*vh_strdup(const char *);
+
+void	vh_warn(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * Commands, see the usage table in vectorhelper.c. Each returns the exit
+ * status for the helper.
+ */
+int	cmd_collapse(int, char **);
+int	cmd_container(int, char **);
+int	cmd_decode(int, char **);
+int	cmd_diff(int, char **);
+int	cmd_jvmstamp(int, char **);
+int	cmd_ksym(int, char **);
+int	cmd_maptidy(int, char **);
+int	cmd_merge(int, char **);
+int	cmd_pack(int, char **);
+int	cmd_ps(int, char **);
+int	cmd_query(int, char **);
+int	cmd_retain(int, char **);
+int	cmd_unpack(int, char **);
+
+#endif /* VECTORHELPER_H */
@@ -12,6 +12,26 @@
 # environment
 DEBUG_MSG=1	# set to zero to disable debug messages (pmda log via STDERR)
 STATUS_MSG=1	# set to zero to disable status messages (pmda request status)
+VECTOR_HELPER=${PMDA_DIR:-/var/lib/pcp/pmdas/vector}/vectorhelper
+NATIVE_DECODE=1	# set to zero to read perf.data with perf script instead
+# decoded stacks are trimmed to frames of at least this percent of samples,
+# before they are symbolized: flamegraph.pl --minwidth=0.5 omits frames under
+# about 0.04% (of 1180 pixels), and this allows for idle stacks removed later
+DECODE_MINPCT=0.005
+# ELF symbol tables, cached by build ID for vectorhelper decode, indexes of
+# tidied JIT maps for maptidy, and resolved containers. It is kept within the
+# disk budget like a task directory (see vectord.sh).
+export VECTOR_SYMCACHE=/var/log/pcp/vector/symcache
+# decode -i (and -I) adds its frame and time totals here, for the
+# vector.resolver metrics; other decodes do not
+export VECTOR_RESOLVER_STATS=/var/log/pcp/vector/vectord/resolver.stats
+# cpuflamegraph, uninlinedcpuflamegraph, pnamecpuflamegraph and
+# subsecondheatmap share one capture when their requests overlap, as do
+# diskioflamegraph and disklatencyheatmap (see shared_capture): set to zero
+# for each to capture on its own. The capture keys are kept in a dot
+# directory, which retention skips, as it is not task output.
+SHARED_CAPTURE=1
+SHARED_DIR=/var/log/pcp/vector/.shared
 
 #
 # Functions
@@ -50,3 +70,275 @@ function errorexit {
 	fi
 	exit 1
 }
+
+# Parse task arguments: an optional number of seconds, followed by optional
+# name[=value] options. Seconds are set in $ARG_SECS, and each option is set
+# as $OPT_name (value defaults to 1). Names must be lowercase alphabetic.
+# Seconds must be a whole number, as they are used in arithmetic.
+function parseargs {
+	local arg name
+	for arg in "$@"; do
+		case "$arg" in
+		[0-9]*)
+			if [[ ! "$arg" =~ ^[0-9]+$ ]]; then
+				# the status file's directory may be new
+				mkdir -p ${OUT_STATUS%/*}
+				errorexit "Bad seconds: $arg"
+			fi
+			ARG_SECS=$arg ;;
+		*)
+			name=${arg%%=*}
+			if [[ ! "$name" =~ ^[a-z]+$ ]]; then
+				debugtime "ignoring bad option: $arg"
+				continue
+			fi
+			if [[ "$arg" == *=* ]]; then
+				eval "OPT_$name=\${arg#*=}"
+			else
+				eval "OPT_$name=1"
+			fi
+			;;
+		esac
+	done
+}
+
+# Resolve a container name or ID, and set $UUID, $cgroup (for perf record
+# --cgroup, under cgroup v1 or v2), $cgroupid (the cgroup ID that BPF
+# programs see, or 0), $cgroupids (it and the IDs of the cgroups below it)
+# and $tasklist (its PIDs). This reads the container runtime's state files
+# and /proc, not the docker command, and the result is cached in
+# $VECTOR_SYMCACHE until the container restarts.
+function container_resolve {
+	local key value
+	UUID="" cgroup="" cgroupid=0 cgroupids="" tasklist=""
+	while read key value; do
+		case $key in
+		id)		UUID=$value ;;
+		cgroup)		cgroup=$value ;;
+		cgroupid)	cgroupid=$value ;;
+		cgroupids)	cgroupids=$value ;;
+		pids)		tasklist=$value ;;
+		esac
+	done <<< "$($VECTOR_HELPER container "$1")"
+	[[ "$UUID" == "" ]] && errorexit "Container not found"
+}
+
+# Set $cgroupfilter to the bpfstacks.py options that count the events of
+# only the container that container_resolve found, in kernel context: by
+# its $cgroupids, if it has a unified (v2) cgroup and the kernel has
+# bpf_get_current_cgroup_id() (Linux 4.18), or else by its $tasklist.
+function container_bpffilter {
+	if [[ "$cgroupids" != "" ]] &&
+	    $VECTOR_HELPER ksym bpf_get_current_cgroup_id 2>/dev/null; then
+		cgroupfilter="-c ${cgroupids// /,}"
+	elif [[ "$tasklist" != "" ]]; then
+		cgroupfilter="-p ${tasklist// /,}"
+	else
+		errorexit "Container has no processes"
+	fi
+}
+
+# Start perf record in the background for $SECS seconds, with the given perf
+# record options, and set $bgpid. The capture is written to $PERF_DATA for
+# perf_fold to read afterwards. With the stream option, perf record writes
+# to a pipe instead, which perf script and the task's foldstacks function
+# read while the capture runs: no perf.data is written, and $OUT_FOLDED is
+# complete seconds after the capture ends. As samples are then symbolized as
+# they arrive, JIT symbol maps must be collected before the capture, as for
+# bpf mode. $PERF_SCRIPT_OPTS are extra perf script options, eg, -F fields.
+# Samples are timed with CLOCK_MONOTONIC (-k mono), as jitdump loads are, so
+# that JIT frames are resolved with the code loaded at the time of a sample.
+function perf_capture {
+	if (( OPT_stream )); then
+		perf record -k mono -o - "$@" sleep $SECS | \
+		    timeout $(( SECS + 20 )) perf script $PERF_SCRIPT_OPTS -i - | \
+		    foldstacks > $OUT_FOLDED &
+	else
+		perf record -k mono -o $PERF_DATA "$@" sleep $SECS >/dev/null &
+	fi
+	bgpid=$!
+}
+
+# Fold the perf_capture output in $PERF_DATA into $OUT_FOLDED, unless it was
+# streamed. Tasks that define a decodestacks function have $PERF_DATA decoded
+# by vectorhelper, on several CPUs; the others, or all with NATIVE_DECODE=0,
+# use perf script and the task's foldstacks function. No Java map is dumped
+# meanwhile (see hold_java_maps in perfmaplib.sh).
+function perf_fold {
+	(( OPT_stream )) && return
+	hold_java_maps
+	if (( NATIVE_DECODE )) && [[ $(type -t decodestacks) == function ]]; then
+		decodestacks > $OUT_FOLDED
+	else
+		timeout 20 perf script $PERF_SCRIPT_OPTS -i $PERF_DATA | foldstacks > $OUT_FOLDED
+	fi
+	release_java_maps
+}
+
+# Start the capture of perf_capture for the named view (eg, cpu, uninlined,
+# pname or subsecond), or join one that is running: the CPU flame graph and
+# subsecond heat map tasks sample the same way, as do the block I/O tasks,
+# so a task that starts while another's capture with the same perf record
+# options is running, and is to run for at least $SECS seconds in all,
+# decodes that one instead of sampling again. This sets $PERF_DATA (another
+# task's, if joined) and $bgpid, which shared_wait waits for.
+function shared_capture {
+	local view=$1 key pid data secs end; shift
+	key=$(echo "$*" | md5sum)
+	key=$SHARED_DIR/${key%% *}
+	[ -d $SHARED_DIR ] || mkdir -p $SHARED_DIR
+	exec 8>$key.lock
+	flock 8
+	if [ -e $key ] && read pid data secs end < $key && (( secs >= SECS &&
+	    end > $(date +%s) )) && kill -0 $pid 2>/dev/null; then
+		debugtime "joining capture $data ($pid)"
+		statusmsg "Profiling for $SECS seconds (joined a running capture)"
+		PERF_DATA=$data
+		bgpid=$pid
+	else
+		perf_capture "$@" 8>&-	# perf must not hold the lock
+		echo "$bgpid $PERF_DATA $SECS $(( $(date +%s) + SECS ))" > $key
+	fi
+	echo $view >> $PERF_DATA.views
+	exec 8>&-
+}
+
+# Wait for the shared_capture to end, which may not be a child of this task
+function shared_wait {
+	wait $bgpid 2>/dev/null
+	while kill -0 $bgpid 2>/dev/null; do
+		sleep 1
+	done
+}
+
+# Decode the named view of the shared_capture to the file given, and for
+# the cpu view, its sample store to the second file given. The subsecond
+# view is the sample store alone. The first of the tasks that shared the
+# capture decodes all of their views in one pass, from the same stacks
+# (vectorhelper decode -I -P -s), with the Java symbol maps dumped uninlined
+# if one is the uninlined view, and the others find theirs written, as
+# $PERF_DATA.<view>, with a link to the store for each that needs one.
+function shared_fold {
+	local view=$1 views out=/dev/null opts=""
+	exec 8>$PERF_DATA.lock
+	flock 8
+	if [ ! -e $PERF_DATA.$view ]; then
+		if [ -e $PERF_DATA.decoded ]; then
+			views=$view	# joined as the capture ended
+		else
+			views="$(sort -u $PERF_DATA.views) $view"
+		fi
+		statusmsg "Collecting symbol maps"
+		if [[ $views == *uninlined* ]]; then
+			dump_java_maps_uninlined $tasklist
+			opts="$opts -I $PERF_DATA.uninlined"
+		else
+			dump_java_maps $tasklist
+		fi
+		fix_node_maps $tasklist
+		[[ $views == *pname* ]] && opts="$opts -P $PERF_DATA.pname"
+		if [[ $views == *cpu* || $views == *subsecond* ]]; then
+			opts="$opts -s $PERF_DATA.samples"
+		else
+			opts="$opts -m $DECODE_MINPCT"
+		fi
+		[[ $views == *cpu* ]] && out=$PERF_DATA.cpu
+		statusmsg "Processing profile"
+		debugtime "decoding views:" $views
+		hold_java_maps
+		$VECTOR_HELPER decode -a $opts $PERF_DATA > $out
+		release_java_maps
+		if [ -e $PERF_DATA.samples ]; then
+			[[ $views == *cpu* ]] &&
+			    ln -f $PERF_DATA.samples $PERF_DATA.cpu.samples
+			[[ $views == *subsecond* ]] &&
+			    ln -f $PERF_DATA.samples $PERF_DATA.subsecond
+			rm $PERF_DATA.samples
+		fi
+		touch $PERF_DATA.decoded
+	fi
+	mv $PERF_DATA.$view $2
+	[[ $view == cpu ]] && mv $PERF_DATA.cpu.samples $3
+	exec 8>&-
+}
+
+# Record block I/O for diskioflamegraph and disklatencyheatmap, as one
+# shared_capture: issues with their stacks, and completions, which are
+# matched to them by vectorhelper decode -b to time each I/O. The given
+# cgroup, if any, filters issues; completions are traced host-wide, as they
+# run in whichever task the interrupt lands on.
+function blkio_capture {
+	local capture=perf_capture cgroup=$2
+	(( SHARED_CAPTURE )) && capture="shared_capture $1"
+	$capture -e block:block_rq_issue ${cgroup:+--cgroup=$cgroup} \
+	    -e block:block_rq_complete -a -g
+}
+
+# Decode the blkio_capture into the given files: the issue stacks by I/O
+# count and by I/O time, and the latencies, for trace2heatmap.pl. The first
+# task that shared it decodes it for all, once, and symbol maps are only
+# collected if one of them is to draw stacks.
+function blkio_fold {
+	exec 8>$PERF_DATA.lock
+	flock 8
+	if [ ! -e $PERF_DATA.decoded ]; then
+		if [[ "$(sort -u $PERF_DATA.views 2>/dev/null)" != heatmap ]]; then
+			statusmsg "Collecting symbol maps"
+			dump_java_maps $tasklist
+			fix_node_maps $tasklist
+		fi
+		statusmsg "Processing trace"
+		hold_java_maps
+		$VECTOR_HELPER decode -a -b $PERF_DATA.lat -w $PERF_DATA.time \
+		    $PERF_DATA > $PERF_DATA.count
+		release_java_maps
+		touch $PERF_DATA.decoded
+	fi
+	exec 8>&-
+	cp $PERF_DATA.count $1
+	cp $PERF_DATA.time $2
+	cp $PERF_DATA.lat $3
+}
+
+# Write folded stacks for the range=t0-t1 option from the most recent sample
+# store of this task, also filtered by the cpu=, pid=, tid= and cgroup=
+# options. Times are seconds from the start of the capture, or epoch seconds.
+function range_query {
+	local store=$WORKING_DIR/${METRIC}.${PCP_CONTEXT}.samples
+	local filter=""
+	[ -e "$store" ] || store=$(ls -1t $WORKING_DIR/perf.samples.* 2>/dev/null | head -1)
+	[[ "$store" == "" ]] && errorexit "No stored samples (run the task without range= first)"
+	[[ "$OPT_range" =~ ^[0-9.]*-[0-9.]*$ ]] || errorexit "Bad range option: $OPT_range"
+	[[ "$OPT_cpu" =~ ^[0-9]+$ ]] && filter="$filter -C $OPT_cpu"
+	[[ "$OPT_pid" =~ ^[0-9]+$ ]] && filter="$filter -p $OPT_pid"
+	[[ "$OPT_tid" =~ ^[0-9]+$ ]] && filter="$filter -t $OPT_tid"
+	[[ "$OPT_cgroup" != "" ]] && filter="$filter -g $OPT_cgroup"
+	debugtime "querying $store range=$OPT_range$filter"
+	$VECTOR_HELPER query -r $OPT_range $filter $store
+}
+
+# Print the profile of an earlier run of this task, for the compare= option:
+# the PID of the run, as in perf.profile.<pid>, or "last" for the most recent.
+function compare_profile {
+	local prof
+	if [[ "$OPT_compare" == last ]]; then
+		prof=$(ls -1t $WORKING_DIR/perf.profile.* 2>/dev/null | head -1)
+	elif [[ "$OPT_compare" =~ ^[0-9]+$ ]]; then
+		prof=$WORKING_DIR/perf.profile.$OPT_compare
+	else
+		errorexit "Bad compare option: $OPT_compare"
+	fi
+	[ -e "$prof" ] || errorexit "No profile to compare with: $OPT_compare"
+	echo $prof
+}
+
+# Replace the folded profile in $OUT_FOLDED with a binary profile, named
+# perf.profile.$$ in the same directory. It is a fraction of the size, and
+# is read directly by vectorhelper merge; "vectorhelper unpack" converts it
+# back to folded text for the BINFlameGraph tools. The optional argument
+# names the count column (default "samples").
+function keep_profile {
+	local out=${OUT_FOLDED/perf.folded/perf.profile}
+	[ -s "$OUT_FOLDED" ] || return
+	$VECTOR_HELPER pack -c ${1:-samples} -o $out $OUT_FOLDED && rm $OUT_FOLDED
+}
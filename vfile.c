@@ -0,0 +1,376 @@
+/*
+ * vfile.c - container for the helper's binary files.
+ *
+ * See vfile.h for the layout.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vectorhelper.h"
+#include "vfile.h"
+
+#define ALIGN8(x)	(((x) + 7) & ~(uint64_t)7)
+
+/*
+ * Buffers
+ */
+
+void
+vbuf_put(vbuf_t *b, const void *p, size_t len)
+{
+	if (len == 0)
+		return;
+	if (b->len + len > b->size) {
+		while (b->len + len > b->size)
+			b->size = b->size ? b->size * 2 : 4096;
+		b->buf = vh_realloc(b->buf, b->size);
+	}
+	memcpy(b->buf + b->len, p, len);
+	b->len += len;
+}
+
+void
+vbuf_varint(vbuf_t *b, uint64_t v)
+{
+	unsigned char tmp[10];
+	int n = 0;
+
+	while (v >= 0x80) {
+		tmp[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	tmp[n++] = v;
+	vbuf_put(b, tmp, n);
+}
+
+void
+vbuf_free(vbuf_t *b)
+{
+	free(b->buf);
+	memset(b, 0, sizeof (*b));
+}
+
+/*
+ * Writing
+ */
+
+void
+vfw_init(vfwriter_t *w, uint32_t kind)
+{
+	memset(w, 0, sizeof (*w));
+	w->kind = kind;
+}
+
+vbuf_t *
+vfw_section(vfwriter_t *w, uint32_t type, uint64_t count)
+{
+	int i = w->nsections;
+
+	if (i == VF_MAXSECTIONS) {
+		vh_warn("too many file sections");
+		exit(1);
+	}
+	w->nsections++;
+	w->sec[i].type = type;
+	w->sec[i].count = count;
+	return &w->data[i];
+}
+
+void
+vfw_free(vfwriter_t *w)
+{
+	int i;
+
+	for (i = 0; i < w->nsections; i++)
+		vbuf_free(&w->data[i]);
+	w->nsections = 0;
+}
+
+int
+vfw_write(vfwriter_t *w, const char *path)
+{
+	static const char pad[8];
+	vf_header_t hdr;
+	char tmppath[4096];
+	uint64_t off;
+	FILE *fp;
+	int i;
+
+	memset(&hdr, 0, sizeof (hdr));
+	memcpy(hdr.magic, VF_MAGIC, sizeof (hdr.magic));
+	hdr.version = VF_VERSION;
+	hdr.kind = w->kind;
+	hdr.nsections = w->nsections;
+
+	off = ALIGN8(sizeof (hdr) + w->nsections * sizeof (vf_section_t));
+	for (i = 0; i < w->nsections; i++) {
+		w->sec[i].offset = off;
+		w->sec[i].size = w->data[i].len;
+		off = ALIGN8(off + w->data[i].len);
+	}
+
+	snprintf(tmppath, sizeof (tmppath), "%s.tmp.%d", path, (int)getpid());
+	if ((fp = fopen(tmppath, "w")) == NULL) {
+		vh_warn("can't write %s: %s", tmppath, strerror(errno));
+		return -1;
+	}
+	fwrite(&hdr, sizeof (hdr), 1, fp);
+	fwrite(w->sec, sizeof (vf_section_t), w->nsections, fp);
+	off = sizeof (hdr) + w->nsections * sizeof (vf_section_t);
+	fwrite(pad, ALIGN8(off) - off, 1, fp);
+	for (i = 0; i < w->nsections; i++) {
+		if (w->data[i].len > 0)
+			fwrite(w->data[i].buf, w->data[i].len, 1, fp);
+		off = w->data[i].len;
+		fwrite(pad, ALIGN8(off) - off, 1, fp);
+	}
+	if (ferror(fp) | fclose(fp) || rename(tmppath, path) != 0) {
+		vh_warn("can't write %s: %s", path, strerror(errno));
+		unlink(tmppath);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Reading
+ */
+
+int
+vf_open(vfile_t *f, const char *path, uint32_t kind)
+{
+	struct stat st;
+	void *base;
+	uint64_t dirsz;
+	uint32_t i;
+	int fd;
+
+	memset(f, 0, sizeof (*f));
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		vh_warn("can't read %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof (vf_header_t)) {
+		vh_warn("%s: not a vector helper file", path);
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		vh_warn("can't map %s: %s", path, strerror(errno));
+		return -1;
+	}
+	f->base = base;
+	f->size = st.st_size;
+	f->hdr = base;
+	f->sec = (const vf_section_t *)(f->hdr + 1);
+
+	dirsz = sizeof (vf_header_t) +
+	    (uint64_t)f->hdr->nsections * sizeof (vf_section_t);
+	if (memcmp(f->hdr->magic, VF_MAGIC, sizeof (f->hdr->magic)) != 0 ||
+	    f->hdr->version != VF_VERSION || f->hdr->kind != kind ||
+	    f->hdr->nsections > VF_MAXSECTIONS || dirsz > f->size) {
+		vh_warn("%s: not a vector helper file of the expected kind",
+		    path);
+		vf_close(f);
+		return -1;
+	}
+	for (i = 0; i < f->hdr->nsections; i++) {
+		if (f->sec[i].offset % 8 != 0 || f->sec[i].offset > f->size ||
+		    f->sec[i].size > f->size - f->sec[i].offset) {
+			vh_warn("%s: truncated or corrupt", path);
+			vf_close(f);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void
+vf_close(vfile_t *f)
+{
+	if (f->base != NULL)
+		munmap((void *)f->base, f->size);
+	memset(f, 0, sizeof (*f));
+}
+
+/* return the first section of the type, or NULL */
+const void *
+vf_section(const vfile_t *f, uint32_t type, uint64_t *size, uint64_t *count)
+{
+	return vf_nsection(f, type, 0, size, count);
+}
+
+/* return the nth (from 0) section of the type, or NULL */
+const void *
+vf_nsection(const vfile_t *f, uint32_t type, int n, uint64_t *size,
+    uint64_t *count)
+{
+	uint32_t i;
+
+	for (i = 0; i < f->hdr->nsections; i++) {
+		if (f->sec[i].type != type || n-- > 0)
+			continue;
+		if (size != NULL)
+			*size = f->sec[i].size;
+		if (count != NULL)
+			*count = f->sec[i].count;
+		return f->base + f->sec[i].offset;
+	}
+	return NULL;
+}
+
+/* copy the value of a VF_META key into buf, returning buf or NULL */
+char *
+vf_meta(const vfile_t *f, const char *key, char *buf, size_t bufsz)
+{
+	const char *p, *end, *eol;
+	size_t keylen = strlen(key), len;
+	uint64_t size;
+
+	if ((p = vf_section(f, VF_META, &size, NULL)) == NULL)
+		return NULL;
+	for (end = p + size; p < end; p = eol + 1) {
+		if ((eol = memchr(p, '\n', end - p)) == NULL)
+			eol = end;
+		if (eol - p > (ptrdiff_t)keylen && p[keylen] == '=' &&
+		    memcmp(p, key, keylen) == 0) {
+			len = eol - p - keylen - 1;
+			if (len >= bufsz)
+				len = bufsz - 1;
+			memcpy(buf, p + keylen + 1, len);
+			buf[len] = '\0';
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * String tables
+ */
+
+void
+vf_put_strings(vbuf_t *b, const strtab_t *t)
+{
+	uint32_t count = t->count;
+
+	vbuf_put(b, &count, sizeof (count));
+	vbuf_put(b, t->off, count * sizeof (uint32_t));
+	vbuf_put(b, t->pool, t->poollen);
+}
+
+int
+vf_get_strings(const vfile_t *f, uint32_t type, vf_strings_t *s)
+{
+	const unsigned char *p;
+	uint64_t size, hdrsz;
+	uint32_t i;
+
+	memset(s, 0, sizeof (*s));
+	if ((p = vf_section(f, type, &size, NULL)) == NULL)
+		return -1;
+	if (size < sizeof (uint32_t))
+		return -1;
+	memcpy(&s->count, p, sizeof (uint32_t));
+	hdrsz = sizeof (uint32_t) + (uint64_t)s->count * sizeof (uint32_t);
+	if (hdrsz > size)
+		return -1;
+	s->off = (const uint32_t *)(p + sizeof (uint32_t));
+	s->pool = (const char *)p + hdrsz;
+	s->poolsz = size - hdrsz;
+	/* strings must be terminated within the pool */
+	if (s->count && s->pool[s->poolsz - 1] != '\0')
+		return -1;
+	for (i = 0; i < s->count; i++) {
+		if (s->off[i] >= s->poolsz)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Stack tables
+ */
+
+void
+vf_put_stacks(vbuf_t *b, const stacktab_t *st)
+{
+	const uint32_t *frames;
+	uint32_t count = st->count, depth, id, i, off;
+	vbuf_t data = { 0 };
+
+	vbuf_put(b, &count, sizeof (count));
+	for (id = 0; id < count; id++) {
+		off = data.len;
+		vbuf_put(b, &off, sizeof (off));
+		frames = stacktab_frames(st, id, &depth);
+		vbuf_varint(&data, depth);
+		for (i = 0; i < depth; i++)
+			vbuf_varint(&data, frames[i]);
+	}
+	off = data.len;
+	vbuf_put(b, &off, sizeof (off));
+	vbuf_put(b, data.buf, data.len);
+	vbuf_free(&data);
+}
+
+int
+vf_get_stacks(const vfile_t *f, vf_stacks_t *s)
+{
+	const unsigned char *p;
+	uint64_t size, hdrsz;
+
+	memset(s, 0, sizeof (*s));
+	if ((p = vf_section(f, VF_STACKS, &size, NULL)) == NULL)
+		return -1;
+	if (size < sizeof (uint32_t))
+		return -1;
+	memcpy(&s->count, p, sizeof (uint32_t));
+	hdrsz = sizeof (uint32_t) + ((uint64_t)s->count + 1) * sizeof (uint32_t);
+	if (hdrsz > size)
+		return -1;
+	s->off = (const uint32_t *)(p + sizeof (uint32_t));
+	s->data = p + hdrsz;
+	s->datasz = size - hdrsz;
+	if (s->off[s->count] > s->datasz)
+		return -1;
+	return 0;
+}
+
+/*
+ * Decode a stack into frames, up to max. Returns the depth of the stack,
+ * which may be more than max, or -1 if it is corrupt.
+ */
+int
+vf_stack(const vf_stacks_t *s, uint32_t id, uint32_t *frames, uint32_t max)
+{
+	const unsigned char *p, *end;
+	uint64_t depth, v;
+	uint32_t i;
+
+	if (id >= s->count || s->off[id] > s->off[id + 1] ||
+	    s->off[id + 1] > s->datasz)
+		return -1;
+	p = s->data + s->off[id];
+	end = s->data + s->off[id + 1];
+	if ((p = varint(p, end, &depth)) == NULL || depth > INT32_MAX)
+		return -1;
+	for (i = 0; i < depth; i++) {
+		if ((p = varint(p, end, &v)) == NULL)
+			return -1;
+		if (i < max)
+			frames[i] = v;
+	}
+	return depth;
+}
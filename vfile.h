@@ -0,0 +1,195 @@
+/*
+ * vfile.h - container for the helper's binary files.
+ *
+ * A vfile is a header, a section directory, and then the sections, each
+ * starting on an 8 byte boundary so that arrays can be used in place from a
+ * read-only mmap(2) of the file. Integers are in host byte order, as these
+ * files are written and read on the same host.
+ *
+ *	vf_header_t
+ *	vf_section_t[nsections]
+ *	section data ...
+ *
+ * Variable length integers (varints) are LEB128: 7 bits per byte, least
+ * significant group first, with the high bit set on all but the last byte.
+ * Signed deltas are zigzag encoded first.
+ *
+ * Copyright 2017 Netflix, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+#ifndef VFILE_H
+#define VFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "stacktab.h"
+
+#define VF_MAGIC	"VECTORVF"
+#define VF_VERSION	1
+#define VF_MAXSECTIONS	32
+
+/* file kinds */
+enum {
+	VF_KIND_SAMPLES = 1,	/* per-sample store, see samplestore.h */
+	VF_KIND_PROFILE,	/* aggregated profile, see profile.h */
+	VF_KIND_SYMBOLS,	/* symbol cache entry, see symbols.h */
+	VF_KIND_INLINES,	/* inlined calls cache entry, see dwarf.h */
+	VF_KIND_LINES,		/* line table cache entry, see dwarf.h */
+	VF_KIND_MAPINDEX,	/* tidied JIT map index, see perfmap.h */
+	VF_KIND_CONTAINER,	/* resolved container, see containers.h */
+};
+
+/* section types */
+enum {
+	VF_META = 1,		/* text, "key=value" lines */
+	VF_STRINGS,		/* frame names, see below */
+	VF_STACKS,		/* stacks of frame IDs, see below */
+	VF_CGROUPS,		/* cgroup paths, as VF_STRINGS */
+	VF_INDEX,		/* samples: block index */
+	VF_COL_TIME,		/* samples: columns ... */
+	VF_COL_STACK,
+	VF_COL_PID,
+	VF_COL_TID,
+	VF_COL_CPU,
+	VF_COL_CGROUP,
+	VF_COL_WEIGHT,
+	VF_FRAMES,		/* profiles: frame table */
+	VF_SYMS,		/* symbols: sym_t array, sorted by address */
+	VF_SEGMENTS,		/* symbols: elfseg_t array */
+	VF_INLINES,		/* inlines: inl_t array, sorted by address */
+	VF_LINES,		/* lines: line_t array, sorted by address */
+	VF_MAPENTS,		/* map index: mapidx_t array, sorted */
+	VF_MAPNAMES,		/* map index: entry names */
+};
+
+typedef struct vf_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	kind;
+	uint32_t	nsections;
+	uint32_t	reserved;
+} vf_header_t;
+
+typedef struct vf_section {
+	uint32_t	type;
+	uint32_t	reserved;
+	uint64_t	count;		/* entries, meaning depends on type */
+	uint64_t	offset;		/* from the start of the file */
+	uint64_t	size;		/* in bytes */
+} vf_section_t;
+
+/*
+ * Growable byte buffer, for building sections.
+ */
+typedef struct vbuf {
+	unsigned char	*buf;
+	size_t		len;
+	size_t		size;
+} vbuf_t;
+
+void	vbuf_put(vbuf_t *, const void *, size_t);
+void	vbuf_varint(vbuf_t *, uint64_t);
+void	vbuf_free(vbuf_t *);
+
+static inline uint64_t
+zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t
+unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* decode a varint, returning the next byte, or NULL if truncated */
+static inline const unsigned char *
+varint(const unsigned char *p, const unsigned char *end, uint64_t *vp)
+{
+	uint64_t v = 0;
+	int shift = 0;
+
+	while (p < end && shift < 64) {
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			*vp = v;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+/*
+ * Writing: sections are built in memory, then written with vfw_write(),
+ * which writes a temporary file and renames it into place.
+ */
+typedef struct vfwriter {
+	uint32_t	kind;
+	int		nsections;
+	vf_section_t	sec[VF_MAXSECTIONS];
+	vbuf_t		data[VF_MAXSECTIONS];
+} vfwriter_t;
+
+void	vfw_init(vfwriter_t *, uint32_t kind);
+vbuf_t	*vfw_section(vfwriter_t *, uint32_t type, uint64_t count);
+int	vfw_write(vfwriter_t *, const char *path);
+void	vfw_free(vfwriter_t *);
+
+/*
+ * Reading: the file is mapped read-only, and sections are used in place.
+ */
+typedef struct vfile {
+	const unsigned char	*base;
+	size_t			size;
+	const vf_header_t	*hdr;
+	const vf_section_t	*sec;
+} vfile_t;
+
+int	vf_open(vfile_t *, const char *path, uint32_t kind);
+void	vf_close(vfile_t *);
+const void *vf_section(const vfile_t *, uint32_t type, uint64_t *size,
+	    uint64_t *count);
+const void *vf_nsection(const vfile_t *, uint32_t type, int n, uint64_t *size,
+	    uint64_t *count);
+char	*vf_meta(const vfile_t *, const char *key, char *buf, size_t bufsz);
+
+/*
+ * String table sections: uint32_t count, uint32_t offsets[count], then the
+ * NUL terminated strings.
+ */
+typedef struct vf_strings {
+	uint32_t	count;
+	const uint32_t	*off;
+	const char	*pool;
+	size_t		poolsz;
+} vf_strings_t;
+
+void	vf_put_strings(vbuf_t *, const strtab_t *);
+int	vf_get_strings(const vfile_t *, uint32_t type, vf_strings_t *);
+
+static inline const char *
+vf_string(const vf_strings_t *s, uint32_t id)
+{
+	return id < s->count ? s->pool + s->off[id] : "[bad string]";
+}
+
+/*
+ * Stack table sections: uint32_t count, uint32_t offsets[count + 1], then
+ * for each stack a varint depth and varint frame IDs, root first.
+ */
+typedef struct vf_stacks {
+	uint32_t		count;
+	const uint32_t		*off;
+	const unsigned char	*data;
+	size_t			datasz;
+} vf_stacks_t;
+
+void	vf_put_stacks(vbuf_t *, const stacktab_t *);
+int	vf_get_stacks(const vfile_t *, vf_stacks_t *);
+int	vf_stack(const vf_stacks_t *, uint32_t id, uint32_t *frames,
+	    uint32_t max);
+
+#endif /* VFILE_H */